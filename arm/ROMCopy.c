@@ -9,86 +9,182 @@
  *  This is based on the ROMCopy.c file from CodeWarrior for Coldfire 4.0
  */
 
+#include <stdint.h>
 #include "ROMCopy.h"
 
 /* imported data */
-extern RomInfo __S_romp[];		/* linker defined symbol */
+extern InitInfo __S_init[];		/* linker defined symbol */
 
 /*
  *	Routine to copy a single section from ROM to RAM ...
+ *
+ *	The destination is brought to a word boundary with byte copies, then
+ *	the body moves in bursts of four words. When the source is not word
+ *	aligned along with the destination, it is read as aligned words that
+ *	are shifted together (little endian), so every access in the body is
+ *	a full word whatever the alignment. The last 0-3 bytes go one at a
+ *	time.
  */
-void __copy_rom_section(unsigned long dst, unsigned long src, unsigned long size)
+BOOT_FAST void __copy_rom_section(unsigned long dst, unsigned long src, unsigned long size)
 {
-	unsigned long len = size;
-
-	const int size_int = sizeof(int);
-	const int mask_int = sizeof(int)-1;
-
-	const int size_short = sizeof(short);
-	const int mask_short = sizeof(short)-1;
-
-	const int size_char = sizeof(char);
+	unsigned char *d = (unsigned char *)dst;
+	const unsigned char *s = (const unsigned char *)src;
+	uint32_t *dw;
 
 	if( dst == src || size == 0)
 	{
 		return;
 	}
 
+	while( ((unsigned long)d & 3) && size > 0)
+	{
+		*d++ = *s++;
+		size--;
+	}
 
-	while( len > 0)
+	dw = (uint32_t *)d;
+	if( ((unsigned long)s & 3) == 0)
 	{
+		const uint32_t *sw = (const uint32_t *)s;
 
-		if( !(src & mask_int) && !(dst & mask_int) && len >= size_int)
+		while( size >= 16)
 		{
-			*((int *)dst)  = *((int*)src);
-			dst += size_int;
-			src += size_int;
-			len -= size_int;
+			uint32_t w0 = sw[0], w1 = sw[1], w2 = sw[2], w3 = sw[3];
+
+			dw[0] = w0;
+			dw[1] = w1;
+			dw[2] = w2;
+			dw[3] = w3;
+			sw += 4;
+			dw += 4;
+			size -= 16;
 		}
-		else if( !(src & mask_short) && !(dst & mask_short) && len >= size_short)
+		while( size >= 4)
 		{
-			*((short *)dst)  = *((short*)src);
-			dst += size_short;
-			src += size_short;
-			len -= size_short;
+			*dw++ = *sw++;
+			size -= 4;
 		}
-		else
+		s = (const unsigned char *)sw;
+	}
+	else if( size >= 4)
+	{
+		unsigned int shift = ((unsigned long)s & 3) * 8;
+		const uint32_t *sw = (const uint32_t *)((unsigned long)s & ~3UL);
+		uint32_t lo = *sw++, w0, w1, w2, w3;
+
+		while( size >= 16)
+		{
+			w0 = sw[0];
+			w1 = sw[1];
+			w2 = sw[2];
+			w3 = sw[3];
+			dw[0] = (lo >> shift) | (w0 << (32 - shift));
+			dw[1] = (w0 >> shift) | (w1 << (32 - shift));
+			dw[2] = (w1 >> shift) | (w2 << (32 - shift));
+			dw[3] = (w2 >> shift) | (w3 << (32 - shift));
+			lo = w3;
+			sw += 4;
+			dw += 4;
+			size -= 16;
+		}
+		while( size >= 4)
 		{
-			*((char *)dst)  = *((char*)src);
-			dst += size_char;
-			src += size_char;
-			len -= size_char;
+			w0 = *sw++;
+			*dw++ = (lo >> shift) | (w0 << (32 - shift));
+			lo = w0;
+			size -= 4;
 		}
+		s = (const unsigned char *)sw - 4 + shift / 8;
+	}
+
+	d = (unsigned char *)dw;
+	while( size > 0)
+	{
+		*d++ = *s++;
+		size--;
 	}
 }
 
 /*
- *	Routine that copies all sections the user marked as ROM into
- *	their target RAM addresses ...
+ *	Routine to fill a single RAM section with a repeated word ...
  *
- *	__S_romp is defined in the linker command file
- *  It is a table of RomInfo
- *	structures.  The final entry in the table has all-zero
- *	fields.
+ *	"pattern" is the word as it lies at a word boundary, so a section
+ *	that starts or ends mid-word gets the matching bytes of it. The body
+ *	is stored four words at a time.
  */
-void __copy_rom_sections_to_ram(void)
+BOOT_FAST void __fill_ram_section(unsigned long dst, unsigned long pattern, unsigned long size)
 {
+	unsigned char *d = (unsigned char *)dst;
+	uint32_t w = pattern;
+	uint32_t *dw;
 
-	int				index;
+	while( ((unsigned long)d & 3) && size > 0)
+	{
+		*d = (unsigned char)(w >> ((unsigned long)d & 3) * 8);
+		d++;
+		size--;
+	}
 
-	if (__S_romp == 0L) return;
+	dw = (uint32_t *)d;
+	while( size >= 16)
+	{
+		dw[0] = w;
+		dw[1] = w;
+		dw[2] = w;
+		dw[3] = w;
+		dw += 4;
+		size -= 16;
+	}
+	while( size >= 4)
+	{
+		*dw++ = w;
+		size -= 4;
+	}
+
+	d = (unsigned char *)dw;
+	while( size > 0)
+	{
+		*d++ = (unsigned char)w;
+		w >>= 8;
+		size--;
+	}
+}
+
+/*
+ *	Routine that sets up all RAM sections before main() runs ...
+ *
+ *	__S_init is defined in the linker command file
+ *  It is a table of InitInfo
+ *	structures, in the order the sections are to be set up: copies of
+ *	initialized data from ROM, cleared .bss and pattern fills. The final
+ *	entry in the table has Kind INIT_END. A new RAM section only needs an
+ *	entry there. The stack this code runs on is painted only up to
+ *	INIT_STACK_RESERVE bytes below the current frame.
+ */
+BOOT_FAST void __init_ram_sections(void)
+{
+	const InitInfo	*p;
 
 	/*
-	 *	Go through the entire table, copying sections from ROM to RAM.
+	 *	Go through the entire table, setting up each section.
 	 */
-	for (index = 0;
-		 __S_romp[index].Source != 0 ||
-		 __S_romp[index].Target != 0 ||
-		 __S_romp[index].Size != 0;
-		 ++index)
+	for (p = __S_init; p->Kind != INIT_END; ++p)
 	{
-		__copy_rom_section( __S_romp[index].Target,
-							__S_romp[index].Source,
-							__S_romp[index].Size );
+		if (p->Kind == INIT_COPY)
+			__copy_rom_section( p->Target, p->Source, p->Size );
+		else if (p->Kind == INIT_ZERO)
+			__fill_ram_section( p->Target, 0, p->Size );
+		else if (p->Kind == INIT_FILL)
+			__fill_ram_section( p->Target, p->Source, p->Size );
+		else if (p->Kind == INIT_STACK)
+		{
+			unsigned long live = (unsigned long)__builtin_frame_address(0) - INIT_STACK_RESERVE;
+			unsigned long end = p->Target + p->Size;
+
+			if (end > live)
+				end = live;
+			if (end > p->Target)
+				__fill_ram_section( p->Target, p->Source, end - p->Target );
+		}
 	}
 }
@@ -13,17 +13,34 @@
 #ifndef __ROMCOPY_H__
 #define __ROMCOPY_H__
 
-/* format of the ROM table info entry ... */
-typedef struct RomInfo {
+/* Startup code is optimized even in -O0 debug builds, since it runs on
+   every reset, including those after a fault */
+#define BOOT_FAST	__attribute__((optimize("O2", "no-tree-loop-distribute-patterns")))
+
+/* kinds of init table entry ... */
+#define INIT_END	0		/* terminates the table */
+#define INIT_COPY	1		/* copy Size bytes from ROM at Source */
+#define INIT_ZERO	2		/* clear Size bytes */
+#define INIT_FILL	3		/* repeat the word in Source over Size bytes */
+#define INIT_STACK	4		/* as INIT_FILL, but stop below the live stack */
+
+/* Bytes below the startup stack pointer that INIT_STACK leaves alone,
+   for the frames of the init routines themselves */
+#define INIT_STACK_RESERVE	64
+
+/* format of the init table entry ... */
+typedef struct InitInfo {
+	unsigned long	Kind;
 	unsigned long	Source;
 	unsigned long	Target;
 	unsigned long 	Size;
-} RomInfo;
+} InitInfo;
 
 
 /* exported routines */
 
 extern void __copy_rom_section(unsigned long dst, unsigned long src, unsigned long size);
-extern void __copy_rom_sections_to_ram(void);
+extern void __fill_ram_section(unsigned long dst, unsigned long pattern, unsigned long size);
+extern void __init_ram_sections(void);
 extern void __flush_cache(unsigned long dst, unsigned long size);
 #endif
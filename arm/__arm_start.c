@@ -1,44 +1,63 @@
 
 #include <stdint.h>
 #include <string.h>
+#include "boottimes.h"
+#include "kinetis_sysinit.h"
+#include "MK12D5.h"
+
+#define DEMCR_TRCENA_MASK		0x01000000u
+#define DWT_CTRL_CYCCNTENA_MASK	0x00000001u
 
 extern int main(void);
 extern void __init_registers();
-extern void __copy_rom_sections_to_ram(void);
-extern char __S_romp[];
+extern void __init_ram_sections(void);
+extern void fault_init(void);
 extern uint32_t _end_heap_magic[];
 extern uint32_t _end_stack_magic[];
 extern uint32_t _guard_magic[];
 
+BootTimes boot_times;
 
-static void zero_fill_bss(void)
-{
-	extern char __START_BSS[];
-	extern char __END_BSS[];
-    extern char __START_BSS2[];
-    extern char __END_BSS2[];
-
-	memset(__START_BSS, 0, (__END_BSS - __START_BSS));
-	memset(__START_BSS2, 0, (__END_BSS2 - __START_BSS2));
-}
+// Stamps until boot_times is set up. Not on the stack: __init_registers
+// moves sp and returns without restoring r7, so no local of
+// __thumb_startup can be used after it. .noinit, so RAM setup leaves it
+static uint32_t boot_stamp[BOOT_PHASES] __attribute__ ((section(".noinit")));
 
 void __thumb_startup(void)
 {
+    // Time the phases below as early as possible; boot_times itself is
+    // only written once RAM is set up
+    DEMCR |= DEMCR_TRCENA_MASK;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA_MASK;
+
     // Setup registers
     __init_registers();
+    boot_stamp[BOOT_REGISTERS] = DWT_CYCCNT;
 
-    // setup hardware
+    // setup hardware: full speed clock and flash prefetch, so the RAM
+    // setup below runs fast too
     //wdt_disable();
+    __init_hardware();
+    boot_stamp[BOOT_HARDWARE] = DWT_CYCCNT;
 
-    //	zero-fill the .bss section
-    zero_fill_bss();
-
-    // Initialize initialized data
-    if (__S_romp != 0L)
-        __copy_rom_sections_to_ram();
+    //	copy initialized data, zero-fill .bss and paint free RAM, as
+    //	listed in __S_init. .noinit is not listed, so crash_buffer
+    //	survives resets
+    __init_ram_sections();
+    boot_stamp[BOOT_RAM] = DWT_CYCCNT;
 
     _end_heap_magic[0] = (uint32_t)_guard_magic;
     _end_stack_magic[0] = (uint32_t)_guard_magic;
+    boot_stamp[BOOT_GUARDS] = DWT_CYCCNT;
+
+    // Catch faults with state capture instead of Default_Handler
+    fault_init();
+    boot_stamp[BOOT_FAULT_INIT] = DWT_CYCCNT;
+
+    memcpy(boot_times.stamp, boot_stamp, sizeof(boot_times.stamp));
+    boot_times.clock_hz = CORE_CLOCK_HZ;
+    boot_times.magic = BOOT_TIMES_MAGIC;
 
     //	call main
     main();
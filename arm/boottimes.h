@@ -0,0 +1,42 @@
+/*
+ *	boottimes.h		-	Durations of the startup phases.
+ *
+ *  __thumb_startup starts the DWT cycle counter first thing and stamps
+ *  the end of each phase. The stamps are kept in .noinit until RAM is
+ *  set up, then stored in boot_times, where a debugger, any RAM dump or
+ *  a crash dump finds them. Every reset goes through the same path,
+ *  including the one crash_save() forces after a fault.
+ *
+ *  bare_core carries the block into cores as an NT_BARE_BOOT_TIMES note
+ *  with owner "BARE", the bytes as they are in target memory, and
+ *  bare_core boot reports on it.
+ */
+
+#ifndef __BOOTTIMES_H__
+#define __BOOTTIMES_H__
+
+#include <stdint.h>
+
+#define BOOT_TIMES_MAGIC	0x31544f42	/* "BOT1", once the stamps are in */
+
+#define NT_BARE_BOOT_TIMES	1
+
+/* Phases, in the order they run */
+enum {
+	BOOT_REGISTERS,		/* __init_registers() */
+	BOOT_HARDWARE,		/* __init_hardware(): clocks and flash */
+	BOOT_RAM,			/* __init_ram_sections(): copy, zero and fill */
+	BOOT_GUARDS,		/* heap and stack guard magic */
+	BOOT_FAULT_INIT,	/* fault_init(), up to the call of main() */
+	BOOT_PHASES
+};
+
+typedef struct BootTimes {
+	uint32_t	magic;				/* BOOT_TIMES_MAGIC */
+	uint32_t	clock_hz;			/* CORE_CLOCK_HZ when main() was entered */
+	uint32_t	stamp[BOOT_PHASES];	/* DWT_CYCCNT at the end of each phase,
+									   counted from the reset vector */
+} BootTimes;
+
+extern BootTimes boot_times;
+#endif
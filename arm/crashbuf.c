@@ -0,0 +1,151 @@
+/*
+ *	crashbuf.c		-	Reset-surviving crash buffer.
+ *
+ *  Capturing is cheap: the handler puts the fault record and, as deltas
+ *  against what startup left there, at most CRASH_RAM_SIZE bytes of stack
+ *  and the painted heap and free RAM into the buffer, marks it valid and
+ *  resets, so the device is back up within a millisecond. Sending the
+ *  dump is deferred to the next boot, where crash_upload_poll() feeds it
+ *  to crash_transport_write() without ever blocking.
+ */
+
+#include <string.h>
+#include "crashbuf.h"
+#include "crc.h"
+#include "ROMCopy.h"
+#include "MK12D5.h"
+
+/* imported data */
+extern InitInfo __S_init[];		/* linker defined symbols */
+extern uint32_t _crash_magic[];	/* linker defined symbol */
+extern uint32_t _end_heap_magic[];	/* linker defined symbol */
+extern uint32_t _end_stack_magic[];	/* linker defined symbol */
+
+/* Not zeroed or copied at startup, so it keeps its contents across resets */
+CrashBuffer crash_buffer __attribute__ ((section(".noinit")));
+
+/* Upload progress; starts over after every reset */
+static uint32_t crash_sent;
+
+/* Bytes of stream[] that crash_append() may fill; it drops whatever goes
+   past them and sets crash_full */
+static uint32_t crash_limit;
+static int crash_full;
+
+static void crash_append(const void *buf, uint32_t len)
+{
+	if (crash_full || len > crash_limit - crash_buffer.size) {
+		crash_full = 1;
+		return;
+	}
+	memcpy(crash_buffer.stream + crash_buffer.size, buf, len);
+	crash_buffer.size += len;
+}
+
+/*
+ *	Adds a delta of each INIT_FILL range in __S_init, the painted heap and
+ *	free RAM, so that bare_core stack can tell how much of them the fleet
+ *	uses. Ranges that were never touched cost little more than a record.
+ *	One whose delta does not fit in the room left, short of the fault
+ *	record and the end, is taken back out whole: bare_core stack only reads
+ *	ranges that are in a core in full.
+ */
+static void crash_save_painted(void)
+{
+	const InitInfo *p;
+	DumpStats stats;
+	uint32_t size;
+
+	crash_limit = sizeof(crash_buffer.stream) - 2 * sizeof(DumpRecord) -
+				  sizeof(FaultRecord);
+	for (p = __S_init; p->Kind != INIT_END; p++) {
+		if (p->Kind != INIT_FILL || p->Size == 0)
+			continue;
+		size = crash_buffer.size;
+		stats = crash_buffer.stats;
+		dump_region_delta(p->Target, p->Size);
+		if (crash_full) {
+			crash_buffer.size = size;
+			crash_buffer.stats = stats;
+			crash_full = 0;
+		}
+	}
+	crash_limit = sizeof(crash_buffer.stream);
+}
+
+/*
+ *	Saves "rec", the whole stack with the guard words on either side, the
+ *	boot times of the run that faulted and the painted heap and free RAM,
+ *	then resets. All go as deltas, so only the chunks that differ from
+ *	startup are sent; unused stack is still painted and drops out, and the
+ *	host sees how deep the stack had ever been. The fault record goes
+ *	last, so that its cycles cover the handler from "start", the DWT count
+ *	on entry, up to it. The magic is written last, so that a half-written
+ *	buffer is never uploaded.
+ */
+void crash_save(FaultRecord *rec, uint32_t start)
+{
+	uint32_t bottom = (uint32_t)_end_heap_magic;
+	uint32_t len = (uint32_t)_end_stack_magic + 4 - bottom;
+
+	if (len > CRASH_RAM_SIZE)
+		len = CRASH_RAM_SIZE;
+
+	crash_buffer.magic = 0;
+	crash_buffer.size = 0;
+	memset(&crash_buffer.stats, 0, sizeof(crash_buffer.stats));
+	crash_limit = sizeof(crash_buffer.stream);
+	crash_full = 0;
+	crc_init();
+	dump_begin(crash_append, &crash_buffer.stats);
+	dump_region_delta(bottom, len);
+	dump_region_delta((uint32_t)&boot_times, sizeof(boot_times));
+	crash_save_painted();
+	rec->cycles = DWT_CYCCNT - start;
+	dump_fault(rec);
+	dump_end();
+	crash_buffer.magic = (uint32_t)_crash_magic;
+
+	SCB_AIRCR = SCB_AIRCR_VECTKEY(0x5FA) | SCB_AIRCR_SYSRESETREQ_MASK;
+	while (1)
+		;
+}
+
+/*
+ *	Returns non-zero while a dump from before the last reset waits to be
+ *	uploaded.
+ */
+int crash_pending(void)
+{
+	return crash_buffer.magic == (uint32_t)_crash_magic &&
+		   crash_buffer.size <= sizeof(crash_buffer.stream);
+}
+
+/*
+ *	Sends as much of a pending dump as the transport accepts right now.
+ *	The buffer is invalidated once all of it has gone out.
+ */
+void crash_upload_poll(void)
+{
+	if (!crash_pending())
+		return;
+
+	crash_sent += crash_transport_write(crash_buffer.stream + crash_sent,
+										crash_buffer.size - crash_sent);
+	if (crash_sent >= crash_buffer.size) {
+		crash_buffer.magic = 0;
+		crash_sent = 0;
+	}
+}
+
+/*
+ *	Default transport, for boards without one: accepts nothing, so the dump
+ *	stays pending for a debugger to pick up. Returns the number of bytes
+ *	taken, and must not block.
+ */
+__attribute__((weak)) uint32_t crash_transport_write(const void *buf, uint32_t len)
+{
+	(void)buf;
+	(void)len;
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ *	crashbuf.h		-	Reset-surviving crash buffer.
+ *
+ *  The fault handler writes the captured state, the stack and the painted
+ *  heap and free RAM, as deltas against startup, into the .noinit section
+ *  as a dump stream (see dumpstream.h), which has no entry in the startup
+ *  init table, and resets right away.
+ *  After the reset, crash_upload_poll() sends the stream out a piece at a
+ *  time from the idle loop.
+ */
+
+#ifndef __CRASHBUF_H__
+#define __CRASHBUF_H__
+
+#include <stdint.h>
+#include "fault.h"
+#include "dumpstream.h"
+#include "boottimes.h"
+
+/* Build with DUMP_SWO=1 to send dumps out the SWO pin (dumpswo.h) instead
+   of UART0 (dumpuart.h); the one chosen provides crash_transport_write() */
+#ifndef DUMP_SWO
+#define DUMP_SWO 0
+#endif
+
+#define CRASH_RAM_SIZE	(0x800 + 8)	/* __stack_size in MK12DX256_app.ld and
+								   the guard words either side */
+
+/* Bytes a delta of "n" bytes adds to a plain region in the worst case: the
+   CRC, the bitmap and a literal token for each run of changed chunks */
+#define CRASH_DELTA_CHUNKS(n)	(((n) + DUMP_CHUNK_SIZE - 1) / DUMP_CHUNK_SIZE)
+#define CRASH_DELTA_EXTRA(n)	(4 + (CRASH_DELTA_CHUNKS(n) + 7) / 8 + \
+								 CRASH_DELTA_CHUNKS(n))
+
+/* Room for the deltas of the painted heap and free RAM. These have no
+   worst case that fits in RAM; a range whose delta does not fit is left
+   out of the dump */
+#define CRASH_PAINTED_ROOM	1024
+
+/* Worst case stream: five records (begin, stack, boot times, fault, end),
+   the build-id, the fault, and an incompressible stack and boot times,
+   every chunk of them changed, then the painted ranges */
+#define CRASH_STREAM_SIZE	(5 * sizeof(DumpRecord) + DUMP_BUILD_ID_MAX + \
+							 sizeof(FaultRecord) + \
+							 CRASH_RAM_SIZE + CRASH_RAM_SIZE / DUMP_LITERAL_MAX + 1 + \
+							 CRASH_DELTA_EXTRA(CRASH_RAM_SIZE) + \
+							 sizeof(BootTimes) + 1 + \
+							 CRASH_DELTA_EXTRA(sizeof(BootTimes)) + \
+							 CRASH_PAINTED_ROOM)
+
+typedef struct CrashBuffer {
+	uint32_t	magic;			/* _crash_magic while a dump is pending */
+	uint32_t	size;			/* Bytes used in stream[] */
+	DumpStats	stats;			/* How well the stack compressed */
+	uint8_t		stream[CRASH_STREAM_SIZE];
+} CrashBuffer;
+
+extern CrashBuffer crash_buffer;
+
+/* exported routines */
+
+extern void crash_save(FaultRecord *rec, uint32_t start);
+extern int crash_pending(void);
+extern void crash_upload_poll(void);
+extern uint32_t crash_transport_write(const void *buf, uint32_t len);
+#endif
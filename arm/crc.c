@@ -0,0 +1,67 @@
+/*
+ *	crc.c		-	CRC-32 on the CRC module.
+ *
+ *  Words go to the 32-bit data register, with the module transposing
+ *  bits and bytes so that a little endian word counts as its four bytes
+ *  in memory order; unaligned heads and tails go through the byte lane.
+ */
+
+#include "crc.h"
+#include "MK12D5.h"
+
+#define CRC32_POLY		0x04C11DB7u
+#define CRC32_SEED		0xFFFFFFFFu
+#define CRC_BITS_AND_BYTES	2	/* TOT and TOTR transposition */
+
+/*
+ *	Clocks the module and selects CRC-32.
+ */
+void crc_init(void)
+{
+	SIM_SCGC6 |= SIM_SCGC6_CRC_MASK;
+	CRC_CTRL = CRC_CTRL_TCRC_MASK | CRC_CTRL_FXOR_MASK |
+			   CRC_CTRL_TOT(CRC_BITS_AND_BYTES) | CRC_CTRL_TOTR(CRC_BITS_AND_BYTES);
+	CRC_GPOLY = CRC32_POLY;
+}
+
+/*
+ *	Starts a new checksum.
+ */
+void crc_start(void)
+{
+	CRC_CTRL |= CRC_CTRL_WAS_MASK;
+	CRC_DATA = CRC32_SEED;
+	CRC_CTRL &= ~CRC_CTRL_WAS_MASK;
+}
+
+void crc_feed(const void *buf, uint32_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+
+	for (; len && ((uint32_t)p & 3); len--)
+		CRC_DATALL = *p++;
+	for (; len >= 4; len -= 4, p += 4)
+		CRC_DATA = *(const uint32_t *)p;
+	for (; len; len--)
+		CRC_DATALL = *p++;
+}
+
+/*
+ *	Feeds "len" bytes of the word "pattern" repeated, starting with its
+ *	low byte.
+ */
+void crc_feed_fill(uint32_t pattern, uint32_t len)
+{
+	for (; len >= 4; len -= 4)
+		CRC_DATA = pattern;
+	for (; len; len--, pattern >>= 8)
+		CRC_DATALL = (uint8_t)pattern;
+}
+
+/*
+ *	Returns the checksum of everything fed since crc_start().
+ */
+uint32_t crc_result(void)
+{
+	return CRC_DATA;
+}
@@ -0,0 +1,21 @@
+/*
+ *	crc.h		-	CRC-32 on the CRC module.
+ *
+ *  The module is set up for the common CRC-32 (polynomial 0x04C11DB7,
+ *  reflected, seed and final XOR 0xFFFFFFFF), so its results match
+ *  crc32() from zlib on the host.
+ */
+
+#ifndef __CRC_H__
+#define __CRC_H__
+
+#include <stdint.h>
+
+/* exported routines */
+
+extern void crc_init(void);
+extern void crc_start(void);
+extern void crc_feed(const void *buf, uint32_t len);
+extern void crc_feed_fill(uint32_t pattern, uint32_t len);
+extern uint32_t crc_result(void);
+#endif
@@ -0,0 +1,23 @@
+/*
+ *	dumpframe.h		-	Framing of a dump on a serial line, shared with
+ *						the host.
+ *
+ *  Each frame is
+ *
+ *	0xa5 0x5a seq len payload[len] crc[4]
+ *
+ *  where seq counts frames modulo 256, len is 1 to DUMP_FRAME_PAYLOAD_MAX
+ *  and crc is the CRC-32 of seq, len and the payload, little endian. The
+ *  payloads of consecutive frames concatenate to a dump stream (see
+ *  dumpstream.h); a gap in seq means frames were lost.
+ */
+
+#ifndef __DUMPFRAME_H__
+#define __DUMPFRAME_H__
+
+#define DUMP_FRAME_SYNC0		0xa5
+#define DUMP_FRAME_SYNC1		0x5a
+#define DUMP_FRAME_HEADER		4		/* Sync, seq and len */
+#define DUMP_FRAME_OVERHEAD		8		/* Header and CRC */
+#define DUMP_FRAME_PAYLOAD_MAX	128
+#endif
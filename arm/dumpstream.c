@@ -0,0 +1,283 @@
+/*
+ *	dumpstream.c	-	Compressing dump writer.
+ *
+ *  Regions are compressed straight from memory into the write callback:
+ *  literals are sent from where they lie and run tokens are built in a
+ *  few bytes on the stack, so the compressor needs no buffer of its own
+ *  whatever the size of the region. Every byte either extends a run or
+ *  joins a literal, so the output is never more than 1/128 larger than
+ *  the input.
+ */
+
+#include <string.h>
+#include "dumpstream.h"
+#include "crc.h"
+#include "ROMCopy.h"
+#include "MK12D5.h"
+
+/* imported data */
+extern InitInfo __S_init[];		/* linker defined symbols */
+extern const uint8_t __build_id_start[], __build_id_end[];
+
+static dump_write_fn	dump_write;
+static DumpStats		*dump_stats;
+
+static void emit(const void *buf, uint32_t len)
+{
+	dump_write(buf, len);
+	if (dump_stats)
+		dump_stats->out += len;
+}
+
+static void emit_record(uint32_t type, uint32_t addr, uint32_t size)
+{
+	DumpRecord rec;
+
+	rec.magic = DUMP_MAGIC;
+	rec.type = type;
+	rec.addr = addr;
+	rec.size = size;
+	emit(&rec, sizeof(rec));
+}
+
+static void emit_literal(const uint8_t *p, uint32_t len)
+{
+	uint8_t tok = DUMP_TOK_LITERAL | (len - 1);
+
+	emit(&tok, 1);
+	emit(p, len);
+}
+
+static void emit_run(uint8_t kind, uint32_t count, const uint8_t *pattern,
+					 uint32_t len)
+{
+	uint8_t tok[6];
+
+	tok[0] = kind | (count >> 8);
+	tok[1] = count & 0xff;
+	memcpy(&tok[2], pattern, len);
+	emit(tok, 2 + len);
+}
+
+/*
+ *	Returns the length in bytes of the run starting at p, or 0 if none
+ *	starts there, and sets *kind to the token that encodes it. Word runs
+ *	are only looked for at word aligned addresses.
+ */
+static uint32_t run_at(const uint8_t *p, uint32_t left, uint8_t *kind)
+{
+	uint32_t n, max;
+
+	if (((uint32_t)p & 3) == 0 && left >= 4 * DUMP_WORDS_MIN) {
+		const uint32_t *w = (const uint32_t *)p;
+
+		max = left / 4;
+		if (max > DUMP_RUN_MAX + DUMP_WORDS_MIN)
+			max = DUMP_RUN_MAX + DUMP_WORDS_MIN;
+		for (n = 1; n < max && w[n] == w[0]; n++)
+			;
+		if (n >= DUMP_WORDS_MIN) {
+			*kind = DUMP_TOK_WORDS;
+			return 4 * n;
+		}
+	}
+
+	max = left;
+	if (max > DUMP_RUN_MAX + DUMP_BYTES_MIN)
+		max = DUMP_RUN_MAX + DUMP_BYTES_MIN;
+	for (n = 1; n < max && p[n] == p[0]; n++)
+		;
+	if (n >= DUMP_BYTES_MIN) {
+		*kind = DUMP_TOK_BYTES;
+		return n;
+	}
+	return 0;
+}
+
+/*
+ *	Returns the length of the build-id in the GNU note that the linker
+ *	put between __build_id_start and __build_id_end, and sets *id to it,
+ *	or returns 0 if there is none that fits in a dump.
+ */
+static uint32_t build_id(const uint8_t **id)
+{
+	const uint8_t *note = __build_id_start;
+	uint32_t namesz, descsz;
+
+	if (__build_id_end - note < 12)
+		return 0;
+	memcpy(&namesz, note, 4);
+	memcpy(&descsz, note + 4, 4);
+	*id = note + 12 + ((namesz + 3) & ~3);
+	if (descsz > DUMP_BUILD_ID_MAX || *id + descsz > __build_id_end)
+		return 0;
+	return descsz;
+}
+
+/*
+ *	Starts a dump that goes to "write". If "stats" is not NULL, the sizes
+ *	and cycles of the dump are added to it.
+ */
+void dump_begin(dump_write_fn write, DumpStats *stats)
+{
+	const uint8_t *id;
+	uint32_t len = build_id(&id);
+
+	dump_write = write;
+	dump_stats = stats;
+	emit_record(DUMP_REC_BEGIN, 0, len);
+	if (len)
+		emit(id, len);
+}
+
+void dump_fault(const FaultRecord *rec)
+{
+	emit_record(DUMP_REC_FAULT, 0, sizeof(*rec));
+	emit(rec, sizeof(*rec));
+}
+
+/*
+ *	Emits the tokens for the "size" bytes at "p".
+ */
+static void compress_block(const uint8_t *p, uint32_t size)
+{
+	uint32_t i = 0, lit = 0, n;
+	uint8_t kind;
+
+	while (i < size) {
+		n = run_at(p + i, size - i, &kind);
+		if (n == 0) {
+			i++;
+			if (++lit == DUMP_LITERAL_MAX) {
+				emit_literal(p + i - lit, lit);
+				lit = 0;
+			}
+			continue;
+		}
+		if (lit) {
+			emit_literal(p + i - lit, lit);
+			lit = 0;
+		}
+		if (kind == DUMP_TOK_WORDS)
+			emit_run(kind, n / 4 - DUMP_WORDS_MIN, p + i, 4);
+		else
+			emit_run(kind, n - DUMP_BYTES_MIN, p + i, 1);
+		i += n;
+	}
+	if (lit)
+		emit_literal(p + i - lit, lit);
+}
+
+/*
+ *	Compresses the "size" bytes at "addr" into the dump.
+ */
+void dump_region(uint32_t addr, uint32_t size)
+{
+	uint32_t start = DWT_CYCCNT;
+
+	emit_record(DUMP_REC_REGION, addr, size);
+	compress_block((const uint8_t *)addr, size);
+
+	if (dump_stats) {
+		dump_stats->in += size;
+		dump_stats->cycles += DWT_CYCCNT - start;
+	}
+}
+
+/*
+ *	Feeds the startup contents of the "len" bytes at "addr" to the CRC
+ *	module, as __S_init sets them up: the ROM image for copies, the
+ *	pattern for fills and zeros everywhere else.
+ */
+static void crc_feed_baseline(uint32_t addr, uint32_t len)
+{
+	const InitInfo *p, *hit;
+	uint32_t n, shift;
+
+	while (len) {
+		hit = 0;
+		n = len;
+		for (p = __S_init; p->Kind != INIT_END; p++) {
+			if (addr >= p->Target && addr - p->Target < p->Size) {
+				hit = p;
+				if (n > p->Target + p->Size - addr)
+					n = p->Target + p->Size - addr;
+				break;
+			}
+			if (p->Target > addr && p->Target - addr < n)
+				n = p->Target - addr;
+		}
+		if (hit && hit->Kind == INIT_COPY)
+			crc_feed((const void *)(hit->Source + (addr - hit->Target)), n);
+		else if (hit && (hit->Kind == INIT_FILL || hit->Kind == INIT_STACK)) {
+			shift = (addr & 3) * 8;
+			crc_feed_fill(shift ? hit->Source >> shift | hit->Source << (32 - shift) : hit->Source, n);
+		} else
+			crc_feed_fill(0, n);
+		addr += n;
+		len -= n;
+	}
+}
+
+/*
+ *	Sends the "size" bytes at "addr" as a delta against their startup
+ *	contents. Chunks are compared by their CRC on the CRC module: the CPU
+ *	still reads both copies to feed it, but no copy of the baseline has to
+ *	be kept in RAM, and only the chunks that changed are compressed into
+ *	the dump. crc_init() must have been called.
+ */
+void dump_region_delta(uint32_t addr, uint32_t size)
+{
+	static uint8_t changed[DUMP_DELTA_MAX_CHUNKS / 8];
+	uint32_t chunks = (size + DUMP_CHUNK_SIZE - 1) / DUMP_CHUNK_SIZE;
+	uint32_t start = DWT_CYCCNT;
+	uint32_t i, off, len, crc, run;
+
+	if (chunks > DUMP_DELTA_MAX_CHUNKS) {
+		dump_region(addr, size);
+		return;
+	}
+
+	memset(changed, 0, sizeof(changed));
+	for (i = 0; i < chunks; i++) {
+		off = i * DUMP_CHUNK_SIZE;
+		len = size - off < DUMP_CHUNK_SIZE ? size - off : DUMP_CHUNK_SIZE;
+		crc_start();
+		crc_feed((const void *)(addr + off), len);
+		crc = crc_result();
+		crc_start();
+		crc_feed_baseline(addr + off, len);
+		if (crc != crc_result())
+			changed[i / 8] |= 1 << (i % 8);
+	}
+	crc_start();
+	crc_feed((const void *)addr, size);
+	crc = crc_result();
+
+	emit_record(DUMP_REC_DELTA, addr, size);
+	emit(&crc, sizeof(crc));
+	emit(changed, (chunks + 7) / 8);
+
+	/* Neighbouring changed chunks are compressed as one block */
+	for (i = 0; i < chunks; i += run) {
+		for (run = 0; i + run < chunks && (changed[(i + run) / 8] & 1 << ((i + run) % 8)); run++)
+			;
+		if (run == 0) {
+			run = 1;
+			continue;
+		}
+		off = i * DUMP_CHUNK_SIZE;
+		len = run * DUMP_CHUNK_SIZE;
+		compress_block((const uint8_t *)(addr + off), size - off < len ? size - off : len);
+	}
+
+	if (dump_stats) {
+		dump_stats->in += size;
+		dump_stats->cycles += DWT_CYCCNT - start;
+	}
+}
+
+void dump_end(void)
+{
+	emit_record(DUMP_REC_END, 0, 0);
+}
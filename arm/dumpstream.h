@@ -0,0 +1,88 @@
+/*
+ *	dumpstream.h	-	Wire format of a dump, shared with the host.
+ *
+ *  A dump is a sequence of records, each a DumpRecord header followed by
+ *  its payload, from a DUMP_REC_BEGIN record to a DUMP_REC_END record:
+ *
+ *	DUMP_REC_BEGIN	payload is the GNU build-id of the firmware, "size"
+ *					bytes as they are, none if it was linked without
+ *	DUMP_REC_FAULT	payload is a FaultRecord, as in fault.h
+ *	DUMP_REC_REGION	payload is "size" bytes at "addr", compressed with
+ *					the tokens below
+ *	DUMP_REC_DELTA	"size" bytes at "addr" as changes to their baseline:
+ *					the CRC-32 of the whole region, a bitmap with one
+ *					bit per DUMP_CHUNK_SIZE chunk (LSB first, set if
+ *					the chunk differs), then the differing chunks back
+ *					to back, compressed with the tokens below
+ *
+ *  The baseline of a delta is what startup leaves in RAM, as listed in
+ *  __S_init: the ROM image for copied ranges, the pattern for filled
+ *  ones, zeros everywhere else.
+ *
+ *  All fields are little endian. Tokens, by their first byte c:
+ *
+ *	0x00-0x7f	c + 1 literal bytes follow
+ *	0x80-0xbf	lo, b: byte b repeated ((c & 0x3f) << 8 | lo) + 4 times
+ *	0xc0-0xff	lo, w[4]: the 4 bytes w repeated ((c & 0x3f) << 8 | lo) + 2
+ *				times
+ *
+ *  Zeroed .bss, the 0xDEADBEEF guard fill and unused stack collapse into
+ *  word runs, so a mostly idle RAM image shrinks to a small fraction of
+ *  its size.
+ */
+
+#ifndef __DUMPSTREAM_H__
+#define __DUMPSTREAM_H__
+
+#include <stdint.h>
+#include "fault.h"
+
+#define DUMP_MAGIC		0x504d5544	/* "DUMP" */
+
+#define DUMP_REC_END	0
+#define DUMP_REC_FAULT	1
+#define DUMP_REC_REGION	2
+#define DUMP_REC_DELTA	3
+#define DUMP_REC_BEGIN	4			/* Lets a receiver find the next dump */
+
+#define DUMP_BUILD_ID_MAX		32		/* Longer build-ids are not sent */
+
+#define DUMP_CHUNK_SIZE			256
+#define DUMP_DELTA_MAX_CHUNKS	256		/* Larger regions are sent whole */
+
+#define DUMP_TOK_LITERAL	0x00
+#define DUMP_TOK_BYTES		0x80
+#define DUMP_TOK_WORDS		0xc0
+#define DUMP_TOK_KIND		0xc0
+
+#define DUMP_LITERAL_MAX	128
+#define DUMP_BYTES_MIN		4
+#define DUMP_WORDS_MIN		2
+#define DUMP_RUN_MAX		0x3fff	/* Largest biased run count */
+
+/* Header of every record */
+typedef struct DumpRecord {
+	uint32_t	magic;			/* DUMP_MAGIC */
+	uint32_t	type;			/* DUMP_REC_* */
+	uint32_t	addr;			/* Target address of the region */
+	uint32_t	size;			/* Payload bytes once decoded */
+} DumpRecord;
+
+/* Receives the encoded stream; may block until the bytes are taken */
+typedef void (*dump_write_fn)(const void *buf, uint32_t len);
+
+/* Running totals for a dump, to judge the compressor on the target */
+typedef struct DumpStats {
+	uint32_t	in;				/* Region bytes read */
+	uint32_t	out;			/* Stream bytes written */
+	uint32_t	cycles;			/* DWT cycles spent compressing */
+} DumpStats;
+
+/* exported routines */
+
+extern void dump_begin(dump_write_fn write, DumpStats *stats);
+extern void dump_fault(const FaultRecord *rec);
+extern void dump_region(uint32_t addr, uint32_t size);
+extern void dump_region_delta(uint32_t addr, uint32_t size);
+extern void dump_end(void);
+#endif
@@ -0,0 +1,90 @@
+/*
+ *	dumpswo.c		-	Dump transport on the SWO trace pin.
+ *
+ *  Every write to a stimulus port becomes one ITM packet with a single
+ *  byte of header, so words are written whole and only unaligned heads
+ *  and tails go out a byte at a time. The ITM FIFO's ready flag is all
+ *  the flow control SWO has, so a write stops as soon as the FIFO is
+ *  full and the caller tries again later, like dump_uart_write(). When
+ *  no probe has enabled the port, nothing is taken and the dump stays
+ *  pending.
+ */
+
+#include "dumpswo.h"
+#include "crashbuf.h"
+#include "MK12D5.h"
+
+#define DEMCR_TRCENA_MASK		0x01000000u
+
+#define ITM_LAR_UNLOCK			0xC5ACCE55u
+#define ITM_TCR_ITMENA_MASK		0x00000001u
+#define ITM_TCR_SYNCENA_MASK	0x00000004u
+#define ITM_TCR_TRACEBUSID(x)	((uint32_t)(x) << 16)
+#define ITM_STIM_FIFOREADY_MASK	0x00000001u
+
+#define TPIU_SPPR_NRZ			2			/* SWO with UART encoding */
+#define TPIU_FFCR_TRIGIN_MASK	0x00000100u	/* Formatter off */
+
+#define STIM32	ITM_STIM_WRITE_REG(ITM_BASE_PTR, DUMP_SWO_PORT)
+#define STIM8	(*(volatile uint8_t *)&STIM32)
+#define STIM_READY	(ITM_STIM_READ_REG(ITM_BASE_PTR, DUMP_SWO_PORT) & ITM_STIM_FIFOREADY_MASK)
+
+/*
+ *	Sets up the TPIU for NRZ output at "swo_hz" from the "clock_hz" trace
+ *	clock and enables the stimulus port. Debug probes usually do this
+ *	themselves; it is needed when capturing without one attached. The
+ *	SWO pin is muxed by the board code.
+ */
+void dump_swo_init(uint32_t clock_hz, uint32_t swo_hz)
+{
+	DEMCR |= DEMCR_TRCENA_MASK;
+
+	TPIU_CSPSR = 1;							/* 1 bit port */
+	TPIU_SPPR = TPIU_SPPR_NRZ;
+	TPIU_ACPR = clock_hz / swo_hz - 1;
+	TPIU_FFCR = TPIU_FFCR_TRIGIN_MASK;
+
+	ITM_LAR = ITM_LAR_UNLOCK;
+	ITM_TCR = ITM_TCR_TRACEBUSID(1) | ITM_TCR_SYNCENA_MASK | ITM_TCR_ITMENA_MASK;
+	ITM_TER |= 1u << DUMP_SWO_PORT;
+}
+
+/*
+ *	Returns non-zero if writes to the port reach the trace pin.
+ */
+int dump_swo_enabled(void)
+{
+	return (DEMCR & DEMCR_TRCENA_MASK) && (ITM_TCR & ITM_TCR_ITMENA_MASK) &&
+		   (ITM_TER & (1u << DUMP_SWO_PORT));
+}
+
+/*
+ *	Writes as much of "buf" to the port as the ITM FIFO takes right now and
+ *	returns how much that was, without blocking. Nothing is taken while no
+ *	probe or dump_swo_init() has enabled the port.
+ */
+uint32_t dump_swo_write(const void *buf, uint32_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	const uint8_t *end = p + len;
+
+	if (!dump_swo_enabled())
+		return 0;
+
+	while (p < end && STIM_READY) {
+		if (((uint32_t)p & 3) == 0 && end - p >= 4) {
+			STIM32 = *(const uint32_t *)p;
+			p += 4;
+		} else
+			STIM8 = *p++;
+	}
+	return p - (const uint8_t *)buf;
+}
+
+#if DUMP_SWO
+/* Crash dumps go out over this transport */
+uint32_t crash_transport_write(const void *buf, uint32_t len)
+{
+	return dump_swo_write(buf, len);
+}
+#endif
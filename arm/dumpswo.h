@@ -0,0 +1,23 @@
+/*
+ *	dumpswo.h		-	Dump transport on the SWO trace pin.
+ *
+ *  The dump stream (see dumpstream.h) is written unframed to ITM stimulus
+ *  port DUMP_SWO_PORT, leaving the other ports to printf style tracing.
+ *  The probe captures the ITM packets, and bare_core decode -s picks the
+ *  port back out of the capture. Built with DUMP_SWO=1, dump_swo_write()
+ *  is the crash_transport_write() of crashbuf.h.
+ */
+
+#ifndef __DUMPSWO_H__
+#define __DUMPSWO_H__
+
+#include <stdint.h>
+
+#define DUMP_SWO_PORT	1
+
+/* exported routines */
+
+extern void dump_swo_init(uint32_t clock_hz, uint32_t swo_hz);
+extern int dump_swo_enabled(void);
+extern uint32_t dump_swo_write(const void *buf, uint32_t len);
+#endif
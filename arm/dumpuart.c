@@ -0,0 +1,141 @@
+/*
+ *	dumpuart.c		-	DMA driven dump transport on UART0.
+ *
+ *  A frame is handed to the DMA as soon as it is full, or, if the line
+ *  is idle, as soon as anything has been written, so a slow producer
+ *  still gets its bytes out promptly. The CRC module computes each
+ *  frame's checksum; nothing else may be using it at that moment, which
+ *  holds for dump_region_delta() as it finishes its checksums before it
+ *  writes.
+ */
+
+#include <string.h>
+#include "dumpuart.h"
+#include "dumpframe.h"
+#include "crashbuf.h"
+#include "crc.h"
+#include "MK12D5.h"
+
+#define DMAMUX_SRC_UART0_TX	3	/* DMA request source of UART0 transmit */
+
+#define FRAME_SIZE			(DUMP_FRAME_OVERHEAD + DUMP_FRAME_PAYLOAD_MAX)
+
+static uint8_t	frames[2][FRAME_SIZE];
+static int		cur;			/* Frame being filled */
+static uint32_t	fill;			/* Payload bytes in frames[cur] */
+static uint8_t	seq;
+static int		sending;		/* DMA is sending frames[!cur] */
+
+/*
+ *	Clocks UART0, the DMA and the CRC module and sets the line to "baud"
+ *	8N1 from the UART's "clock_hz" module clock. The pins are muxed by
+ *	the board code.
+ */
+void dump_uart_init(uint32_t clock_hz, uint32_t baud)
+{
+	uint32_t sbr = clock_hz / (16 * baud);
+	uint32_t brfa = (2 * clock_hz / baud) - 32 * sbr;	/* 1/32ths of sbr */
+
+	SIM_SCGC4 |= SIM_SCGC4_UART0_MASK;
+	SIM_SCGC6 |= SIM_SCGC6_DMAMUX_MASK;
+	SIM_SCGC7 |= SIM_SCGC7_DMA_MASK;
+	crc_init();
+
+	UART0_C2 = 0;
+	UART0_BDH = UART_BDH_SBR(sbr >> 8);
+	UART0_BDL = UART_BDL_SBR(sbr);
+	UART0_C4 = UART_C4_BRFA(brfa);
+	UART0_C5 = UART_C5_TDMAS_MASK;			/* TDRE requests DMA */
+	UART0_C2 = UART_C2_TE_MASK | UART_C2_TIE_MASK;
+
+	DMAMUX_CHCFG0 = 0;
+	DMAMUX_CHCFG0 = DMAMUX_CHCFG_ENBL_MASK | DMAMUX_CHCFG_SOURCE(DMAMUX_SRC_UART0_TX);
+
+	cur = 0;
+	fill = 0;
+	sending = 0;
+}
+
+/*
+ *	Completes frames[cur] and starts the DMA on it. One byte moves per
+ *	UART request, and the request is dropped when the frame is done.
+ */
+static void send_frame(void)
+{
+	uint8_t *f = frames[cur];
+	uint32_t len = DUMP_FRAME_HEADER + fill, crc;
+
+	f[0] = DUMP_FRAME_SYNC0;
+	f[1] = DUMP_FRAME_SYNC1;
+	f[2] = seq++;
+	f[3] = fill;
+	crc_start();
+	crc_feed(f + 2, 2 + fill);
+	crc = crc_result();
+	memcpy(f + len, &crc, sizeof(crc));
+	len += sizeof(crc);
+
+	DMA_CDNE = DMA_CDNE_CDNE(0);
+	DMA_TCD0_SADDR = (uint32_t)f;
+	DMA_TCD0_SOFF = 1;
+	DMA_TCD0_ATTR = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0);
+	DMA_TCD0_NBYTES_MLNO = 1;
+	DMA_TCD0_SLAST = 0;
+	DMA_TCD0_DADDR = (uint32_t)&UART0_D;
+	DMA_TCD0_DOFF = 0;
+	DMA_TCD0_CITER_ELINKNO = len;
+	DMA_TCD0_BITER_ELINKNO = len;
+	DMA_TCD0_DLASTSGA = 0;
+	DMA_TCD0_CSR = DMA_CSR_DREQ_MASK;
+	DMA_SERQ = DMA_SERQ_SERQ(0);
+
+	sending = 1;
+	cur ^= 1;
+	fill = 0;
+}
+
+/*
+ *	Notices a finished DMA transfer and sends whatever is waiting.
+ */
+void dump_uart_poll(void)
+{
+	if (sending && (DMA_TCD0_CSR & DMA_CSR_DONE_MASK))
+		sending = 0;
+	if (!sending && fill)
+		send_frame();
+}
+
+/*
+ *	Takes as much of "buf" as fits in the frame being filled and returns
+ *	how much that was, without blocking.
+ */
+uint32_t dump_uart_write(const void *buf, uint32_t len)
+{
+	uint32_t n;
+
+	dump_uart_poll();
+	n = DUMP_FRAME_PAYLOAD_MAX - fill;
+	if (n > len)
+		n = len;
+	memcpy(&frames[cur][DUMP_FRAME_HEADER + fill], buf, n);
+	fill += n;
+	dump_uart_poll();
+	return n;
+}
+
+/*
+ *	Returns non-zero while bytes are waiting or on the line.
+ */
+int dump_uart_busy(void)
+{
+	dump_uart_poll();
+	return sending || fill;
+}
+
+#if !DUMP_SWO
+/* Crash dumps go out over this transport */
+uint32_t crash_transport_write(const void *buf, uint32_t len)
+{
+	return dump_uart_write(buf, len);
+}
+#endif
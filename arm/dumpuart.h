@@ -0,0 +1,22 @@
+/*
+ *	dumpuart.h		-	DMA driven dump transport on UART0.
+ *
+ *  Bytes are packed into frames (see dumpframe.h) in one of two buffers
+ *  while eDMA channel 0 feeds the other to UART0, so the CPU only copies
+ *  and checksums; it never waits for the line. dump_uart_write() takes
+ *  what fits without blocking and serves as crash_transport_write(); the
+ *  idle loop polls dump_uart_busy() until the last frame is out.
+ */
+
+#ifndef __DUMPUART_H__
+#define __DUMPUART_H__
+
+#include <stdint.h>
+
+/* exported routines */
+
+extern void dump_uart_init(uint32_t clock_hz, uint32_t baud);
+extern uint32_t dump_uart_write(const void *buf, uint32_t len);
+extern void dump_uart_poll(void);
+extern int dump_uart_busy(void);
+#endif
@@ -1,8 +1,31 @@
 
+#include "crashbuf.h"
+#include "dumpswo.h"
+#include "dumpuart.h"
+#include "kinetis_sysinit.h"
+
+#define DUMP_UART_BAUD	115200
+#define DUMP_SWO_HZ		(CORE_CLOCK_HZ / 24)	/* Exact, for the capture */
+
 volatile int some_var = 33;
 
 int main(int argc, char *argv[])
 {
+#if DUMP_SWO
+	// send any dump left behind by a fault before the last reset out the
+	// trace pin, unless a probe has already set it up for its own rate
+	if (!dump_swo_enabled())
+		dump_swo_init(CORE_CLOCK_HZ, DUMP_SWO_HZ);
+	while (crash_pending())
+		crash_upload_poll();
+#else
+	// send any dump left behind by a fault before the last reset; the
+	// DMA moves the bytes, so real work could go on in this loop
+	dump_uart_init(CORE_CLOCK_HZ, DUMP_UART_BAUD);
+	while (crash_pending() || dump_uart_busy())
+		crash_upload_poll();
+#endif
+
 	some_var = 66;
 	return some_var;
 }
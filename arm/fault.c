@@ -0,0 +1,92 @@
+/*
+ *	fault.c		-	Capture of the processor state on a fault.
+ *
+ *  The entry stub moves the main stack pointer to a stack reserved for
+ *  the handler before it pushes anything, so a fault raised by an
+ *  overflowing main stack cannot fault again. Extracting the registers
+ *  is straight-line code; crash_save() then compresses at most
+ *  CRASH_RAM_SIZE bytes of stack, so the handler as a whole is bounded by
+ *  that size, not by what went wrong. fault_record.cycles holds the DWT
+ *  cycles from fault_capture() until the record is written, after the
+ *  stack, to check the whole handler against the watchdog window.
+ */
+
+#include "fault.h"
+#include "crashbuf.h"
+#include "MK12D5.h"
+
+#define DEMCR_TRCENA_MASK		0x01000000u
+#define DWT_CTRL_CYCCNTENA_MASK	0x00000001u
+
+#define EXC_RETURN_PSP			0x4u	/* Frame is on the process stack */
+
+#define FAULT_STACK_SIZE		1024	/* fault_capture() and crash_save() */
+
+#define STR_(x)					#x
+#define STR(x)					STR_(x)
+
+FaultRecord fault_record;
+
+/* What the handler runs on, whatever state the main stack is in */
+static uint64_t fault_stack[FAULT_STACK_SIZE / 8] __attribute__((used));
+
+/*
+ *	Enables the cycle counter used to time the capture, if startup has
+ *	not already, and gives MemManage, BusFault and UsageFault their own
+ *	handlers instead of escalating to HardFault.
+ */
+void fault_init(void)
+{
+	DEMCR |= DEMCR_TRCENA_MASK;
+	DWT_CTRL |= DWT_CTRL_CYCCNTENA_MASK;
+
+	SCB_SHCSR |= SCB_SHCSR_MEMFAULTENA_MASK |
+				 SCB_SHCSR_BUSFAULTENA_MASK |
+				 SCB_SHCSR_USGFAULTENA_MASK;
+}
+
+/*
+ *	Called from the entry stub with the exception frame, EXC_RETURN and
+ *	the pushed r4-r11. Records the state and the fault status registers,
+ *	then hands them to the crash buffer, which resets the part.
+ */
+void fault_capture(const uint32_t *stacked, uint32_t exc_return,
+				   const uint32_t *callee)
+{
+	uint32_t start = DWT_CYCCNT;
+
+	fault_extract(&fault_record, stacked, exc_return, callee);
+	fault_record.cfsr = SCB_CFSR;
+	fault_record.hfsr = SCB_HFSR;
+	fault_record.mmfar = SCB_MMFAR;
+	fault_record.bfar = SCB_BFAR;
+
+	crash_save(&fault_record, start);
+}
+
+/*
+ *	Common entry stub for all fault exceptions. Bit 2 of EXC_RETURN tells
+ *	whether the frame went to the main or the process stack. The frame is
+ *	left where the processor put it; only r4-r11 and fault_capture() go on
+ *	fault_stack.
+ */
+__attribute__((naked)) void HardFault_Handler(void)
+{
+	__asm volatile (
+	"tst    lr,#4\n\t"
+	"ite    eq\n\t"
+	"mrseq  r0,msp\n\t"
+	"mrsne  r0,psp\n\t"
+	"mov    r1,lr\n\t"
+	"movw   r3,#:lower16:fault_stack+" STR(FAULT_STACK_SIZE) "\n\t"
+	"movt   r3,#:upper16:fault_stack+" STR(FAULT_STACK_SIZE) "\n\t"
+	"msr    msp,r3\n\t"
+	"push   {r4-r11}\n\t"
+	"mov    r2,sp\n\t"
+	"b      fault_capture\n\t"
+	);
+}
+
+void MemManage_Handler(void) __attribute__((alias("HardFault_Handler")));
+void BusFault_Handler(void) __attribute__((alias("HardFault_Handler")));
+void UsageFault_Handler(void) __attribute__((alias("HardFault_Handler")));
@@ -0,0 +1,53 @@
+/*
+ *	fault.h		-	Capture of the processor state on a fault.
+ *
+ *  HardFault, MemManage, BusFault and UsageFault all enter through one
+ *  stub that finds the stacked exception frame (on MSP or PSP, as told by
+ *  EXC_RETURN), moves to a stack of its own, pushes r4-r11 there and
+ *  hands both to fault_capture(). The result is a FaultRecord whose
+ *  register block has the layout of arm_regs in elfcore.h, so the host
+ *  can use it as the Frame of a core.
+ *
+ *  bare_core carries the rest of the record, exc_return to cycles, into
+ *  cores as an NT_BARE_FAULT note with owner "BARE", the bytes as they
+ *  are in the dump, and bare_core bucket groups crashes by it.
+ */
+
+#ifndef __FAULT_H__
+#define __FAULT_H__
+
+#include <stdint.h>
+
+#define NT_BARE_FAULT		2
+
+/* Register block, same layout as arm_regs in elfcore.h */
+typedef struct FaultRegs {
+	uint32_t	uregs[18];		/* r0-r15, xpsr, orig_r0 */
+} FaultRegs;
+
+/* Everything captured on a fault */
+typedef struct FaultRecord {
+	FaultRegs	regs;
+	uint32_t	exc_return;		/* lr on exception entry */
+	uint32_t	cfsr;			/* Configurable Fault Status */
+	uint32_t	hfsr;			/* HardFault Status */
+	uint32_t	mmfar;			/* MemManage Fault Address */
+	uint32_t	bfar;			/* BusFault Address */
+	uint32_t	cycles;			/* DWT cycles spent in the handler */
+} FaultRecord;
+
+extern FaultRecord fault_record;
+
+/* exported routines */
+
+extern void fault_init(void);
+extern void fault_extract(FaultRecord *rec, const uint32_t *stacked,
+						  uint32_t exc_return, const uint32_t *callee);
+extern void fault_capture(const uint32_t *stacked, uint32_t exc_return,
+						  const uint32_t *callee);
+
+extern void HardFault_Handler(void);
+extern void MemManage_Handler(void);
+extern void BusFault_Handler(void);
+extern void UsageFault_Handler(void);
+#endif
@@ -0,0 +1,56 @@
+/*
+ *	faultextract.c	-	Registers of a fault from its exception frame.
+ *
+ *  Kept apart from fault.c, which needs the core peripherals and the
+ *  Thumb entry stub, so that the host can build this file as it is and
+ *  test it with synthetic frames.
+ */
+
+#include "fault.h"
+
+#define EXC_RETURN_BASIC_FRAME	0x10u	/* No floating point state stacked */
+#define XPSR_STACK_ALIGN		0x200u	/* Frame was padded to 8 bytes */
+
+/*
+ *	Fills "rec" from the exception frame at "stacked" and the r4-r11 block
+ *	at "callee". The stack pointer before the exception is worked out from
+ *	the size of the frame, with or without s0-s15 and fpscr, and the
+ *	padding word the processor adds to align it to 8 bytes.
+ */
+void fault_extract(FaultRecord *rec, const uint32_t *stacked,
+				   uint32_t exc_return, const uint32_t *callee)
+{
+	uint32_t *r = rec->regs.uregs;
+	uint32_t sp;
+
+	/* Hardware stacked r0-r3, r12, lr, pc, xpsr */
+	r[0] = stacked[0];
+	r[1] = stacked[1];
+	r[2] = stacked[2];
+	r[3] = stacked[3];
+	r[12] = stacked[4];
+	r[14] = stacked[5];
+	r[15] = stacked[6];
+	r[16] = stacked[7];
+
+	/* Pushed by the entry stub */
+	r[4] = callee[0];
+	r[5] = callee[1];
+	r[6] = callee[2];
+	r[7] = callee[3];
+	r[8] = callee[4];
+	r[9] = callee[5];
+	r[10] = callee[6];
+	r[11] = callee[7];
+
+	/* sp as it was before the exception */
+	sp = (uint32_t)(uintptr_t)stacked + 8 * 4;
+	if (!(exc_return & EXC_RETURN_BASIC_FRAME))
+		sp += 18 * 4;		/* s0-s15, fpscr, reserved */
+	if (stacked[7] & XPSR_STACK_ALIGN)
+		sp += 4;
+	r[13] = sp;
+	r[17] = stacked[0];
+
+	rec->exc_return = exc_return;
+}
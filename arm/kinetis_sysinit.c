@@ -5,6 +5,8 @@
  */
 
 #include "kinetis_sysinit.h"
+#include "fault.h"
+#include "MK12D5.h"
 #include <stdint.h>
 
 
@@ -40,6 +42,38 @@ void Default_Handler()
 
 
 
+/**
+ **===========================================================================
+ **  Early hardware setup
+ **===========================================================================
+ */
+void __init_hardware(void)
+{
+#if BOOT_FAST_CLOCK
+	/* Flash prefetch, single entry buffer and cache on for both banks,
+	   for the ROM copy that follows as much as for code */
+	FMC_PFB0CR |= FMC_PFB0CR_B0SEBE_MASK | FMC_PFB0CR_B0IPE_MASK |
+				  FMC_PFB0CR_B0DPE_MASK | FMC_PFB0CR_B0ICE_MASK |
+				  FMC_PFB0CR_B0DCE_MASK;
+	FMC_PFB1CR |= FMC_PFB1CR_B1SEBE_MASK | FMC_PFB1CR_B1IPE_MASK |
+				  FMC_PFB1CR_B1DPE_MASK | FMC_PFB1CR_B1ICE_MASK |
+				  FMC_PFB1CR_B1DCE_MASK;
+
+	/* Core and bus at full speed, flash at half, which keeps it under
+	   its 25 MHz limit. The dividers go first so no clock is ever over
+	   its limit */
+	SIM_CLKDIV1 = SIM_CLKDIV1_OUTDIV1(0) | SIM_CLKDIV1_OUTDIV2(0) |
+				  SIM_CLKDIV1_OUTDIV4(1);
+
+	/* Still FEI: DCO mid range, fine tuned for a 32.768 kHz reference */
+	MCG_C4 = (MCG_C4 & ~(MCG_C4_DMX32_MASK | MCG_C4_DRST_DRS_MASK)) |
+			 MCG_C4_DMX32_MASK | MCG_C4_DRST_DRS(1);
+	while ((MCG_C4 & MCG_C4_DRST_DRS_MASK) != MCG_C4_DRST_DRS(1))
+		;
+#endif
+}
+
+
 /* Vector table for FB200 */
 
 /* The Interrupt Vector Table */
@@ -48,10 +82,10 @@ void (* const InterruptVector[])() __attribute__ ((section(".vectortable"))) = {
     (void(*)(void)) &_end_stack,   // 0
     __thumb_startup,    // 1 Reset
     Default_Handler,    // 2 NMI
-    Default_Handler,  // 3 Hard fault
-    Default_Handler,    // 4 MemManage
-    Default_Handler,    // 5 Bus Fault
-    Default_Handler,    // 6 Usage Fault
+    HardFault_Handler,  // 3 Hard fault
+    MemManage_Handler,  // 4 MemManage
+    BusFault_Handler,   // 5 Bus Fault
+    UsageFault_Handler, // 6 Usage Fault
     0,                  // 7 - 10 Reserved
     0,
     0,
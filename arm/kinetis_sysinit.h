@@ -11,6 +11,21 @@
 extern "C" {
 #endif
 
+/* Build with BOOT_FAST_CLOCK=0 to leave the clocks at their reset
+   defaults until main() */
+#ifndef BOOT_FAST_CLOCK
+#define BOOT_FAST_CLOCK 1
+#endif
+
+/* Core and system clock once __init_hardware() has run: the FLL at 1464
+   or, by default, 640 times the 32.768 kHz slow internal reference.
+   UART0 and UART1 run from it too */
+#if BOOT_FAST_CLOCK
+#define CORE_CLOCK_HZ	47972352
+#else
+#define CORE_CLOCK_HZ	20971520
+#endif
+
 /*
 ** ===================================================================
 **     Method      :  Default_Handler
@@ -21,6 +36,17 @@ extern "C" {
 */
 void Default_Handler();
 
+/*
+** ===================================================================
+**     Method      :  __init_hardware
+**
+**     Description :
+**         Early clock and flash setup, called by __thumb_startup
+**         before RAM is initialized. Touches no RAM variables.
+** ===================================================================
+*/
+void __init_hardware(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,279 @@
+/*
+ * backtrace.c
+ *
+ *  bare_core backtrace: symbolized backtraces of cores, without a
+ *  debugger.
+ *
+ *  The firmware's unwind tables are decoded once (see unwind.c), its
+ *  symbols come from the cached index (see symindex.c), and every core
+ *  is then unwound from the registers of its prstatus through the stack
+ *  it carries.
+ *
+ *  Both are cached under the GNU build-id of the firmware, which every
+ *  core carries, so once a build has been seen with -f its cores are
+ *  traced without its ELF image, and a directory may mix cores of many
+ *  builds.
+ */
+
+#include "bare_core.h"
+#include "cache.h"
+#include "corefile.h"
+#include "firmware.h"
+#include "symindex.h"
+#include "unwind.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FRAMES  64
+
+/* The artifacts of one firmware build, or NULL ones if it is not at hand */
+typedef struct build {
+    char      key[CACHE_KEY_MAX];
+    SymIndex *syms;
+    Unwinder *uw;
+} build;
+
+typedef struct trace {
+    const Firmware *fw;         /* From -f, or NULL */
+    char            fw_key[CACHE_KEY_MAX];
+    build          *builds;
+    int             num_builds;
+    int             one_line;
+    int             cores, failed, unknown;
+    int             stops[UNWIND_DEPTH + 1];
+} trace;
+
+
+/* Returns the build that wrote "cf": the one its build-id names, or the
+ * firmware given if it has none. Each build is opened once, from the
+ * firmware given if it is that build and else from the cache. Returns NULL
+ * if the build cannot be had, saying why the first time.
+ */
+static const build *find_build(trace *t, const CoreFile *cf, const char *fn)
+{
+    const uint8_t *id;
+    build         *b;
+    char           key[CACHE_KEY_MAX];
+    size_t         len;
+    int            i;
+
+    id = CoreFileBuildId(cf, &len);
+    if (id == NULL || CacheKeyFromBuildId(id, len, key) < 0) {
+        if (!t->fw) {
+            fprintf(stderr, "%s: no build-id, its firmware must be given "
+                    "with -f\n", fn);
+            return NULL;
+        }
+        strcpy(key, t->fw_key);
+    }
+    for (i = 0; i < t->num_builds; i++) {
+        if (strcmp(t->builds[i].key, key) == 0)
+            return t->builds[i].uw ? &t->builds[i] : NULL;
+    }
+
+    if ((b = realloc(t->builds, (t->num_builds + 1) * sizeof(build))) == NULL)
+        return NULL;
+    t->builds = b;
+    b = &t->builds[t->num_builds++];
+    strcpy(b->key, key);
+    if (t->fw && strcmp(key, t->fw_key) == 0) {
+        b->uw   = UnwinderOpen(t->fw);
+        b->syms = b->uw ? SymIndexOpen(t->fw) : NULL;
+    } else {
+        b->uw   = UnwinderOpenCached(key);
+        b->syms = b->uw ? SymIndexOpenCached(key) : NULL;
+    }
+    if (b->syms)
+        return b;
+
+    if (t->fw && strcmp(key, t->fw_key) == 0)
+        fprintf(stderr, "%s: %s\n", fn,
+                errno == ENOENT ? "firmware has no unwind tables"
+                                : strerror(errno));
+    else if (t->fw)
+        fprintf(stderr, "%s: build %s is not the firmware given (%s) and "
+                "is not cached\n", fn, key, t->fw_key);
+    else
+        fprintf(stderr, "%s: build %s is not cached; run once with -f and "
+                "its firmware\n", fn, key);
+    UnwinderDestroy(b->uw);
+    b->uw   = NULL;
+    b->syms = NULL;
+    return NULL;
+}
+
+
+/* Prints "pc" as function+offset, or as the bare address if it is in no
+ * function. Return addresses are looked up 2 bytes back, in the call.
+ */
+static void print_pc(const build *b, const UnwindFrame *f, int caller)
+{
+    uint32_t    off;
+    const char *fn = SymIndexLookup(b->syms, (f->pc & ~1u) - (caller ? 2 : 0),
+                                    &off);
+
+    if (fn == NULL)
+        printf("0x%08x", f->pc & ~1u);
+    else
+        printf("%s+0x%x", fn, off + (caller ? 2 : 0));
+}
+
+
+static void add_core(trace *t, const char *fn)
+{
+    UnwindFrame  frames[MAX_FRAMES];
+    UnwindStop   stop;
+    CoreFile    *cf;
+    const build *b;
+    uint32_t     regs[18];
+    int          n, i;
+
+    if ((cf = CoreFileOpen(fn)) == NULL || CoreFileRegisters(cf, regs) < 0) {
+        fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+        CoreFileClose(cf);
+        t->failed++;
+        return;
+    }
+    if ((b = find_build(t, cf, fn)) == NULL) {
+        CoreFileClose(cf);
+        t->unknown++;
+        return;
+    }
+    n = Unwind(b->uw, cf, regs, frames, MAX_FRAMES, &stop);
+    t->cores++;
+    t->stops[stop]++;
+    printf("%s:", fn);
+    for (i = 0; i < n; i++) {
+        int caller = i > 0 && !(frames[i].flags & UNWIND_EXCEPTION);
+        if (t->one_line) {
+            printf(i ? " < " : " ");
+        } else {
+            printf("\n  #%-2d 0x%08x sp 0x%08x ", i, frames[i].pc & ~1u,
+                   frames[i].sp);
+            if (frames[i].flags & UNWIND_EXCEPTION)
+                printf("<exception> ");
+        }
+        print_pc(b, &frames[i], caller);
+    }
+    if (t->one_line)
+        printf(stop == UNWIND_END ? "\n" : " (%s)\n", UnwindStopName(stop));
+    else
+        printf("\n  (%s)\n", UnwindStopName(stop));
+    CoreFileClose(cf);
+}
+
+
+/* Reads every *.core in "dir".
+ */
+static int add_dir(trace *t, const char *dir)
+{
+    DIR           *d;
+    struct dirent *e;
+    char           path[4096];
+
+    if ((d = opendir(dir)) == NULL)
+        return -1;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len <= 5 || strcmp(e->d_name + len - 5, ".core") != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        add_core(t, path);
+    }
+    closedir(d);
+    return 0;
+}
+
+
+static void backtrace_usage(void)
+{
+    fprintf(stderr,
+            "usage: bare_core backtrace [-f firmware] [-1] (core | dir)...\n"
+            "\n"
+            "Prints the call stack of each of the cores given and every\n"
+            "*.core in the directories given, unwound by the firmware's\n"
+            "ARM exception index tables, with each frame's pc as\n"
+            "function+offset. -1 prints each core's functions on one line,\n"
+            "innermost first. How many cores were read, how fast and why\n"
+            "their unwinds ended goes to standard error.\n"
+            "\n"
+            "The tables and symbols of each build are cached by its GNU\n"
+            "build-id in $BARE_CORE_CACHE, else $XDG_CACHE_HOME/bare_core\n"
+            "or ~/.cache/bare_core, so -f is only needed the first time a\n"
+            "build is seen, or for cores without a build-id.\n");
+}
+
+
+int backtrace_main(int argc, char *argv[])
+{
+    trace           t;
+    Firmware       *fw = NULL;
+    const char     *firmware = NULL;
+    struct stat     st;
+    struct timespec t0, t1;
+    double          secs;
+    int             opt, i;
+
+    memset(&t, 0, sizeof(t));
+    while ((opt = getopt(argc, argv, "f:1")) != -1) {
+        switch (opt) {
+        case 'f':
+            firmware = optarg;
+            break;
+        case '1':
+            t.one_line = 1;
+            break;
+        default:
+            backtrace_usage();
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        backtrace_usage();
+        return 2;
+    }
+    if (firmware) {
+        if ((fw = FirmwareOpen(firmware)) == NULL) {
+            perror(firmware);
+            return 1;
+        }
+        t.fw = fw;
+        CacheKey(fw, t.fw_key);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = optind; i < argc; i++) {
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (add_dir(&t, argv[i]) < 0)
+                perror(argv[i]);
+        } else {
+            add_core(&t, argv[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    fprintf(stderr, "%d cores of %d builds, %d unreadable, %d of unknown "
+            "builds", t.cores, t.num_builds, t.failed, t.unknown);
+    if (secs > 0)
+        fprintf(stderr, " in %.3f s, %.0f cores/s", secs, t.cores / secs);
+    fprintf(stderr, "\n");
+    for (i = 0; i <= UNWIND_DEPTH; i++) {
+        if (t.stops[i])
+            fprintf(stderr, "  %6d %s\n", t.stops[i], UnwindStopName(i));
+    }
+
+    for (i = 0; i < t.num_builds; i++) {
+        SymIndexClose(t.builds[i].syms);
+        UnwinderDestroy(t.builds[i].uw);
+    }
+    free(t.builds);
+    FirmwareClose(fw);
+    return t.cores ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+/*
+ * bare_core.c
+ *
+ *  Host tool for turning bare metal dumps into core files:
+ *
+ *      bare_core <command> [options...]
+ */
+
+#include "bare_core.h"
+#include <stdio.h>
+#include <string.h>
+
+
+static const struct command {
+    const char *name;
+    int       (*main)(int argc, char *argv[]);
+    const char *help;
+} commands[] = {
+    { "convert",   convert_main,   "convert raw RAM dumps into core files" },
+    { "decode",    decode_main,    "decode dumps received over a serial line" },
+    { "boot",      boot_main,      "report boot phase times across cores" },
+    { "stack",     stack_main,     "report stack and RAM high-water marks" },
+    { "backtrace", backtrace_main, "print the call stacks of cores" },
+    { "symbolize", symbolize_main, "name the symbols at target addresses" },
+    { "bucket",    bucket_main,    "group cores by crash signature" },
+};
+
+
+static void usage(void)
+{
+    size_t i;
+
+    fprintf(stderr, "usage: bare_core <command> [options...]\n\n");
+    for (i = 0; i < sizeof(commands)/sizeof(commands[0]); i++)
+        fprintf(stderr, "    %-10s %s\n", commands[i].name, commands[i].help);
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t i;
+
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+    for (i = 0; i < sizeof(commands)/sizeof(commands[0]); i++) {
+        if (strcmp(argv[1], commands[i].name) == 0)
+            return commands[i].main(argc - 1, argv + 1);
+    }
+    usage();
+    return 2;
+}
@@ -0,0 +1,18 @@
+/*
+ * bare_core.h
+ *
+ *  Subcommands of the bare_core host tool.
+ */
+
+#ifndef _BARE_CORE_H
+#define _BARE_CORE_H
+
+int backtrace_main(int argc, char *argv[]);
+int boot_main(int argc, char *argv[]);
+int bucket_main(int argc, char *argv[]);
+int convert_main(int argc, char *argv[]);
+int decode_main(int argc, char *argv[]);
+int stack_main(int argc, char *argv[]);
+int symbolize_main(int argc, char *argv[]);
+
+#endif /* _BARE_CORE_H */
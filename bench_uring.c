@@ -0,0 +1,168 @@
+/*
+ * bench_uring.c
+ *
+ * Measures how many cores per second a CoreRing writes at queue depths 1,
+ * 8 and 64, against CreateElfCoreDump() one core after the other. Each
+ * depth writes the same batch of cores into a fresh directory, keeping up
+ * to "depth" cores in flight the way convert -q does, and checks that
+ * every core came out whole.
+ *
+ *   ./bench_uring [cores] [KB per core]
+ */
+
+#include "elfcore.h"
+#include <libelf/libelf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void core_name(char *fn, size_t size, const char *dir, int n)
+{
+    snprintf(fn, size, "%s/core.%d", dir, n);
+}
+
+
+/* Returns the number of cores in "dir" that are not "size" bytes long,
+ * and removes them all.
+ */
+static int check_and_remove(const char *dir, int cores, uint64_t size)
+{
+    char fn[256];
+    struct stat st;
+    int bad = 0, n;
+
+    for (n = 0; n < cores; n++) {
+        core_name(fn, sizeof(fn), dir, n);
+        if (stat(fn, &st) < 0 || (uint64_t)st.st_size != size)
+            bad++;
+        unlink(fn);
+    }
+    return bad;
+}
+
+
+/* Writes "cores" cores of "dump" one after the other.
+ */
+static int run_sync(const char *dir, int cores, const CoreDump *dump)
+{
+    char fn[256];
+    int n;
+
+    for (n = 0; n < cores; n++) {
+        core_name(fn, sizeof(fn), dir, n);
+        if (CreateElfCoreDump(fn, dump, NULL) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+/* Writes "cores" cores of "dump" through a ring of "depth", with up to
+ * "depth" cores in flight.
+ */
+static int run_ring(const char *dir, int cores, const CoreDump *dump,
+                    unsigned depth, int *async)
+{
+    CoreRing *ring = CoreRingCreate(depth);
+    char      fn[256];
+    unsigned  inflight = 0;
+    void     *tag;
+    int       n, rc, failed = 0;
+
+    if (!ring)
+        return -1;
+    *async = CoreRingIsAsync(ring);
+    for (n = 0; n < cores; n++) {
+        while (inflight >= depth && CoreRingReap(ring, &tag, &rc, 1)) {
+            failed |= rc;
+            inflight--;
+        }
+        core_name(fn, sizeof(fn), dir, n);
+        if (CoreRingSubmit(ring, fn, dump, NULL) < 0)
+            failed = -1;
+        else
+            inflight++;
+    }
+    while (inflight && CoreRingReap(ring, &tag, &rc, 1)) {
+        failed |= rc;
+        inflight--;
+    }
+    CoreRingDestroy(ring);
+    return failed;
+}
+
+
+static void report(const char *what, int cores, size_t ram_size,
+                   double seconds)
+{
+    printf("  %-10s %8.0f cores/s  %8.1f MB/s\n", what, cores / seconds,
+           (double)ram_size * cores / seconds / 1e6);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const unsigned depths[] = { 1, 8, 64 };
+    int       cores    = argc > 1 ? atoi(argv[1]) : 512;
+    size_t    ram_size = (argc > 2 ? atoi(argv[2]) : 64) * (size_t)1024;
+    char      dir[] = "/tmp/bench_uring.XXXXXX";
+    uint8_t  *ram;
+    Frame     frame;
+    uint64_t  size;
+    double    start;
+    unsigned  i;
+    int       async = 0, failed = 0;
+
+    if (cores <= 0 || ram_size == 0 || (ram = malloc(ram_size)) == NULL ||
+        mkdtemp(dir) == NULL) {
+        fprintf(stderr, "usage: %s [cores] [KB per core]\n", argv[0]);
+        return 1;
+    }
+    memset(ram, 0xde, ram_size);
+    memset(&frame, 0, sizeof(frame));
+    {
+        CoreRegion region = {
+            .addr = 0x1fffc000, .size = ram_size, .flags = PF_R|PF_W,
+            .buf = ram, .fd = -1, .offset = 0, .priority = 0
+        };
+        CoreDump dump = {
+            .regions = &region, .num_regions = 1, .frame = &frame
+        };
+
+        size = ElfCoreSize(&dump);
+        printf("%d cores of %zu KB:\n", cores, ram_size / 1024);
+
+        start = now();
+        failed |= run_sync(dir, cores, &dump);
+        report("sync", cores, ram_size, now() - start);
+        failed |= check_and_remove(dir, cores, size);
+
+        for (i = 0; i < sizeof(depths)/sizeof(*depths); i++) {
+            char what[32];
+            snprintf(what, sizeof(what), "depth %u", depths[i]);
+            start = now();
+            failed |= run_ring(dir, cores, &dump, depths[i], &async);
+            report(what, cores, ram_size, now() - start);
+            failed |= check_and_remove(dir, cores, size);
+        }
+    }
+    if (!async)
+        printf("  (io_uring unavailable, the ring wrote synchronously)\n");
+    rmdir(dir);
+    free(ram);
+    if (failed)
+        fprintf(stderr, "some cores were not written correctly\n");
+    return failed != 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * bench_write.c
+ *
+ * Compares the system calls and throughput of the gather write in
+ * CreateElfCore() with the old way of writing a core, one c_write() for
+ * every header, note part, padding and segment. Both paths write the
+ * same bytes: the old sequence is replayed from a core that was built in
+ * memory by WriteElfCore().
+ *
+ * The program is linked with --wrap for write, writev, lseek and
+ * ftruncate, so that every system call made on the core is counted.
+ *
+ *   ./bench_write [iterations]
+ */
+
+#include "elfcore.h"
+#include <libelf/libelf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+ssize_t __real_write(int fd, const void *buf, size_t len);
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+off_t __real_lseek(int fd, off_t offset, int whence);
+int __real_ftruncate(int fd, off_t len);
+
+static unsigned long syscalls;
+
+ssize_t __wrap_write(int fd, const void *buf, size_t len)
+{
+    syscalls++;
+    return __real_write(fd, buf, len);
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    syscalls++;
+    return __real_writev(fd, iov, iovcnt);
+}
+
+off_t __wrap_lseek(int fd, off_t offset, int whence)
+{
+    syscalls++;
+    return __real_lseek(fd, offset, whence);
+}
+
+int __wrap_ftruncate(int fd, off_t len)
+{
+    syscalls++;
+    return __real_ftruncate(fd, len);
+}
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Writes "image" the way the old CreateElfCore() did: the ELF header, each
+ * program header, then the header, owner and descriptor of every note,
+ * the padding up to the first segment and each segment on its own, and
+ * finally the stray PT_NULL program header that used to trail the core.
+ */
+static int write_old(const char *fn, const uint8_t *image, size_t size)
+{
+    const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)image;
+    const Elf32_Phdr *phdr = (const Elf32_Phdr *)(image + ehdr->e_phoff);
+    Elf32_Phdr null_phdr;
+    size_t pos, end;
+    int fd, i, rc = 0;
+
+    if ((fd = open(fn, O_WRONLY | O_TRUNC | O_CREAT, 0644)) < 0)
+        return -1;
+
+#define PUT(p, n) \
+    do { if (c_write(fd, (p), (n)) != (ssize_t)(n)) { rc = -1; goto done; } } \
+    while (0)
+
+    PUT(image, sizeof(Elf32_Ehdr));
+    for (i = 0; i < ehdr->e_phnum; i++)
+        PUT(&phdr[i], sizeof(Elf32_Phdr));
+    pos = phdr[0].p_offset;
+    end = pos + phdr[0].p_filesz;
+    while (pos < end) {
+        const Elf32_Nhdr *nhdr = (const Elf32_Nhdr *)(image + pos);
+        size_t name = (nhdr->n_namesz + 3) & ~3u;
+        size_t desc = (nhdr->n_descsz + 3) & ~3u;
+        PUT(nhdr, sizeof(Elf32_Nhdr));
+        PUT(image + pos + sizeof(Elf32_Nhdr), name);
+        PUT(image + pos + sizeof(Elf32_Nhdr) + name, desc);
+        pos += sizeof(Elf32_Nhdr) + name + desc;
+    }
+    for (i = 1; i < ehdr->e_phnum; i++) {
+        if (phdr[i].p_offset > pos)
+            PUT(image + pos, phdr[i].p_offset - pos);
+        PUT(image + phdr[i].p_offset, phdr[i].p_filesz);
+        pos = phdr[i].p_offset + phdr[i].p_filesz;
+    }
+    if (pos < size)
+        PUT(image + pos, size - pos);
+    memset(&null_phdr, 0, sizeof(null_phdr));
+    PUT(&null_phdr, sizeof(null_phdr));
+#undef PUT
+
+done:
+    close(fd);
+    return rc;
+}
+
+
+static void report(const char *what, size_t ram_size, int iterations,
+                   unsigned long calls, double seconds)
+{
+    printf("%6zu KB  %-7s %5.1f syscalls/core  %8.1f MB/s\n",
+           ram_size / 1024, what, (double)calls / iterations,
+           (double)ram_size * iterations / seconds / 1e6);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const size_t sizes[] = { 32*1024, 256*1024, 4*1024*1024 };
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    char fn[] = "/tmp/bench_write.XXXXXX";
+    Frame frame;
+    unsigned i;
+    int fd;
+
+    if (iterations <= 0 || (fd = mkstemp(fn)) < 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    close(fd);
+    memset(&frame, 0, sizeof(frame));
+
+    for (i = 0; i < sizeof(sizes)/sizeof(*sizes); i++) {
+        size_t ram_size = sizes[i];
+        uint8_t *ram = malloc(ram_size);
+        CoreRegion region = {
+            .addr = 0x1fffc000, .size = ram_size, .flags = PF_R|PF_W,
+            .buf = ram, .fd = -1, .offset = 0, .priority = 0
+        };
+        CoreDump dump = {
+            .regions = &region, .num_regions = 1, .frame = &frame
+        };
+        CoreSink sink;
+        unsigned long calls;
+        double start;
+        int n;
+
+        /* No page of the RAM image may be left as a hole, as the old code
+         * wrote every byte.
+         */
+        if (ram)
+            memset(ram, 0xde, ram_size);
+        if (!ram || InitMemCoreSink(&sink, 0) < 0 ||
+            WriteElfCore(&sink, &dump, NULL) < 0) {
+            fprintf(stderr, "cannot build a %zu byte core\n", ram_size);
+            return 1;
+        }
+
+        syscalls = 0;
+        start = now();
+        for (n = 0; n < iterations; n++)
+            if (write_old(fn, sink.data, sink.size) < 0) {
+                perror(fn);
+                return 1;
+            }
+        calls = syscalls;
+        report("old", ram_size, iterations, calls, now() - start);
+
+        syscalls = 0;
+        start = now();
+        for (n = 0; n < iterations; n++)
+            if (CreateElfCore(fn, 0x1fffc000, ram, ram_size, &frame) < 0) {
+                perror(fn);
+                return 1;
+            }
+        calls = syscalls;
+        report("gather", ram_size, iterations, calls, now() - start);
+
+        free(sink.data);
+        free(ram);
+    }
+    unlink(fn);
+    return 0;
+}
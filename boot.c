@@ -0,0 +1,182 @@
+/*
+ * boot.c
+ *
+ *  bare_core boot: reports where boot time goes, from the boot times
+ *  notes that convert and decode put into cores (see arm/boottimes.h).
+ *
+ *  Each phase is the cycles from the end of the previous one, the first
+ *  counted from the reset vector. The summary gives the spread of every
+ *  phase across all the cores read, so that a fleet of dumps shows which
+ *  phase dominates and which one varies. Times in microseconds use the
+ *  clock recorded with each dump; phases that run before the clock is
+ *  raised come out shorter than they really were.
+ */
+
+#include "bare_core.h"
+#include "bootnote.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NUM_ROWS    (BOOT_PHASES + 1)   /* The phases, then the total       */
+
+static const char *const row_names[NUM_ROWS] = {
+    "registers", "hardware", "ram", "guards", "fault_init", "total"
+};
+
+
+typedef struct report {
+    BootTimes  *times;
+    int         num_times, capacity;
+    int         missing;        /* Cores without a boot times note          */
+    int         verbose;
+} report;
+
+
+static uint32_t row_cycles(const BootTimes *bt, int row)
+{
+    if (row == BOOT_PHASES)
+        return bt->stamp[BOOT_PHASES - 1];
+    return row ? bt->stamp[row] - bt->stamp[row - 1] : bt->stamp[0];
+}
+
+
+static void add_core(report *r, const char *fn)
+{
+    BootTimes bt;
+    int       i;
+
+    if (ReadCoreBootTimes(fn, &bt) < 0) {
+        fprintf(stderr, "%s: %s\n", fn, errno == ENOENT ? "no boot times"
+                                                        : strerror(errno));
+        r->missing++;
+        return;
+    }
+    if (r->num_times == r->capacity) {
+        BootTimes *times;
+        r->capacity = r->capacity ? 2 * r->capacity : 64;
+        if ((times = realloc(r->times, r->capacity * sizeof(BootTimes))) == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        r->times = times;
+    }
+    r->times[r->num_times++] = bt;
+    if (r->verbose) {
+        printf("%s:", fn);
+        for (i = 0; i < NUM_ROWS; i++)
+            printf(" %s %u", row_names[i], row_cycles(&bt, i));
+        printf("\n");
+    }
+}
+
+
+/* Reads every *.core in "dir".
+ */
+static int add_dir(report *r, const char *dir)
+{
+    DIR           *d;
+    struct dirent *e;
+    char           path[4096];
+
+    if ((d = opendir(dir)) == NULL)
+        return -1;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len <= 5 || strcmp(e->d_name + len - 5, ".core") != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        add_core(r, path);
+    }
+    closedir(d);
+    return 0;
+}
+
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+static void summary(const report *r)
+{
+    double *cycles = malloc((r->num_times + 1) * sizeof(double));
+    double *us     = malloc((r->num_times + 1) * sizeof(double));
+    int     n = r->num_times, row, i;
+
+    printf("%d cores with boot times, %d without\n", n, r->missing);
+    if (n == 0 || !cycles || !us) {
+        free(cycles);
+        free(us);
+        return;
+    }
+    printf("%-12s %10s %10s %10s %10s %10s\n",
+           "phase", "min", "p50", "p90", "max", "p50 us");
+    for (row = 0; row < NUM_ROWS; row++) {
+        for (i = 0; i < n; i++) {
+            cycles[i] = row_cycles(&r->times[i], row);
+            us[i]     = r->times[i].clock_hz
+                        ? cycles[i] * 1e6 / r->times[i].clock_hz : 0;
+        }
+        qsort(cycles, n, sizeof(double), cmp_double);
+        qsort(us, n, sizeof(double), cmp_double);
+        printf("%-12s %10.0f %10.0f %10.0f %10.0f %10.1f\n", row_names[row],
+               cycles[0], cycles[(n - 1) / 2], cycles[(n - 1) * 9 / 10],
+               cycles[n - 1], us[(n - 1) / 2]);
+    }
+    free(cycles);
+    free(us);
+}
+
+
+static void boot_usage(void)
+{
+    fprintf(stderr,
+            "usage: bare_core boot [-v] (core | dir)...\n"
+            "\n"
+            "Prints the cycles spent in each startup phase, as recorded by\n"
+            "the target and carried into the cores by convert and decode,\n"
+            "with their spread across all the cores given and every *.core\n"
+            "in the directories given. -v adds a line per core.\n");
+}
+
+
+int boot_main(int argc, char *argv[])
+{
+    report      r;
+    struct stat st;
+    int         opt, i;
+
+    memset(&r, 0, sizeof(r));
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        switch (opt) {
+        case 'v':
+            r.verbose = 1;
+            break;
+        default:
+            boot_usage();
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        boot_usage();
+        return 2;
+    }
+    for (i = optind; i < argc; i++) {
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (add_dir(&r, argv[i]) < 0)
+                perror(argv[i]);
+        } else {
+            add_core(&r, argv[i]);
+        }
+    }
+    summary(&r);
+    free(r.times);
+    return r.num_times ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/* Boot phase times (arm/boottimes.h) in dumps and cores.
+ *
+ * The target leaves a BootTimes block in RAM at the symbol boot_times,
+ * and crash dumps carry a copy of it. The converters look it up in the
+ * memory of each dump and add it to the core as an NT_BARE_BOOT_TIMES
+ * note, unchanged, so that reports over many cores need neither the
+ * dumps nor the firmware.
+ */
+
+#include "bootnote.h"
+#include "corefile.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+
+static uint32_t get32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Copies the sizeof(BootTimes) bytes at "addr" in "region" to "desc".
+ * Returns -1 if they are not all in the region.
+ */
+static int read_region(const CoreRegion *region, uint64_t addr,
+                       uint8_t *desc) {
+  uint64_t off = addr - region->addr;
+
+  if (addr < region->addr || off > region->size ||
+      region->size - off < sizeof(BootTimes))
+    return -1;
+  if (region->buf) {
+    memcpy(desc, region->buf + off, sizeof(BootTimes));
+    return 0;
+  }
+  if (region->fd >= 0 &&
+      pread(region->fd, desc, sizeof(BootTimes), region->offset + off) ==
+      (ssize_t)sizeof(BootTimes))
+    return 0;
+  return -1;
+}
+
+/* Fills "desc" with the target bytes of a valid BootTimes block in the
+ * memory of "dump": the one at boot_times if "fw" is given and has the
+ * symbol, otherwise the first one found by its magic in a region held in
+ * memory. Returns -1 if there is none.
+ */
+int FindBootTimes(const CoreDump *dump, const Firmware *fw, uint8_t *desc) {
+  uint64_t addr;
+  int      i;
+
+  if (fw && FirmwareSymbol(fw, "boot_times", &addr) == 0) {
+    for (i = 0; i < dump->num_regions; i++) {
+      if (read_region(&dump->regions[i], addr, desc) == 0)
+        return ParseBootTimes(desc, sizeof(BootTimes), NULL);
+    }
+    return -1;
+  }
+  for (i = 0; i < dump->num_regions; i++) {
+    const CoreRegion *r = &dump->regions[i];
+    uint64_t          off;
+    if (!r->buf || r->size < sizeof(BootTimes))
+      continue;
+    for (off = -r->addr & 3; off <= r->size - sizeof(BootTimes); off += 4) {
+      if (get32(r->buf + off) == BOOT_TIMES_MAGIC &&
+          ParseBootTimes(r->buf + off, sizeof(BootTimes), NULL) == 0) {
+        memcpy(desc, r->buf + off, sizeof(BootTimes));
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+/* Decodes the "len" target bytes at "desc" into "bt", which may be NULL.
+ * Returns -1 if they are not a complete block: wrong size or magic, or
+ * stamps that go backwards.
+ */
+int ParseBootTimes(const uint8_t *desc, size_t len, BootTimes *bt) {
+  BootTimes b;
+  int       i;
+
+  if (len != sizeof(BootTimes) || get32(desc) != BOOT_TIMES_MAGIC)
+    return -1;
+  b.magic    = BOOT_TIMES_MAGIC;
+  b.clock_hz = get32(desc + 4);
+  for (i = 0; i < BOOT_PHASES; i++) {
+    b.stamp[i] = get32(desc + 8 + 4*i);
+    if (i > 0 && b.stamp[i] < b.stamp[i - 1])
+      return -1;
+  }
+  if (bt)
+    *bt = b;
+  return 0;
+}
+
+/* Reads the NT_BARE_BOOT_TIMES note of the core file "fn". Returns -1
+ * with errno set on failure, ENOENT if the core has no such note.
+ */
+int ReadCoreBootTimes(const char *fn, BootTimes *bt) {
+  CoreFile   *cf;
+  const void *desc;
+  size_t      len;
+  int         rc = -1;
+
+  if ((cf = CoreFileOpen(fn)) == NULL)
+    return -1;
+  if (!(desc = CoreFileNote(cf, BOOT_NOTE_NAME, NT_BARE_BOOT_TIMES, &len)))
+    errno = ENOENT;
+  else if ((rc = ParseBootTimes(desc, len, bt)) < 0)
+    errno = EINVAL;
+  CoreFileClose(cf);
+  return rc;
+}
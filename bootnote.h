@@ -0,0 +1,18 @@
+/* Boot phase times (arm/boottimes.h) in dumps and cores.
+ */
+
+#ifndef _BOOTNOTE_H
+#define _BOOTNOTE_H
+
+#include "elfcore.h"
+#include "firmware.h"
+#include "arm/boottimes.h"
+
+#define BOOT_NOTE_NAME "BARE"
+
+
+int FindBootTimes(const CoreDump *dump, const Firmware *fw, uint8_t *desc);
+int ParseBootTimes(const uint8_t *desc, size_t len, BootTimes *bt);
+int ReadCoreBootTimes(const char *fn, BootTimes *bt);
+
+#endif /* _BOOTNOTE_H */
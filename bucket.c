@@ -0,0 +1,663 @@
+/*
+ * bucket.c
+ *
+ *  bare_core bucket: groups a fleet of cores by the crash they record, so
+ *  that a storm of thousands of cores reads as the handful of causes
+ *  behind it.
+ *
+ *  Each core's signature is the fault status bits set in its
+ *  NT_BARE_FAULT note (see arm/fault.h), if it has one, and the functions
+ *  of its top frames, the faulting pc first, unwound and symbolized as
+ *  by bare_core backtrace. Function names, not addresses, so that cores
+ *  of different builds with the same fault land in one bucket.
+ *
+ *  Cores are taken a chunk at a time by a pool of threads, each reading
+ *  them into a buffer of its own. A worker counts signatures in a table
+ *  of its own and merges it into the shared map of buckets when it fills
+ *  up and when the cores run out. The map is split into stripes, each
+ *  with its own lock and chains, by the top bits of the signature's hash,
+ *  so workers rarely wait for each other even when they all merge; and
+ *  as a storm is one signature over and over, a worker merges it once,
+ *  not once per core. The exemplars of a bucket are its first cores in
+ *  path order, whatever the threads, so the report does not change from
+ *  run to run.
+ */
+
+#include "bare_core.h"
+#include "cache.h"
+#include "corefile.h"
+#include "dumpdecode.h"
+#include "firmware.h"
+#include "symindex.h"
+#include "unwind.h"
+#include "arm/fault.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FRAMES   64
+#define SIG_MAX      1024       /* Bytes of a signature, longer is cut      */
+#define STRIPES      256        /* Locks of the bucket map                  */
+#define STRIPE_SHIFT 56         /* Hash bits above it pick the stripe       */
+#define LOCAL_MAX    1024       /* Signatures a worker counts before merging */
+#define CHUNK        16         /* Cores a worker takes at a time           */
+
+/* Where the status registers are in an NT_BARE_FAULT note */
+#define CFSR_OFFSET  (offsetof(FaultRecord, cfsr) - sizeof(FaultRegs))
+#define HFSR_OFFSET  (offsetof(FaultRecord, hfsr) - sizeof(FaultRegs))
+
+/* Fault status bits that tell faults apart. MMARVALID and BFARVALID only
+ * say that an address was captured, which comes with the fault.
+ */
+static const struct status_bit {
+    int         hfsr;           /* Of HFSR, else of CFSR                    */
+    uint32_t    mask;
+    const char *name;
+} status_bits[] = {
+    { 1, 1u << 1,  "VECTTBL" },     { 1, 1u << 30, "FORCED" },
+    { 1, 1u << 31, "DEBUGEVT" },    { 0, 1u << 0,  "IACCVIOL" },
+    { 0, 1u << 1,  "DACCVIOL" },    { 0, 1u << 3,  "MUNSTKERR" },
+    { 0, 1u << 4,  "MSTKERR" },     { 0, 1u << 5,  "MLSPERR" },
+    { 0, 1u << 8,  "IBUSERR" },     { 0, 1u << 9,  "PRECISERR" },
+    { 0, 1u << 10, "IMPRECISERR" }, { 0, 1u << 11, "UNSTKERR" },
+    { 0, 1u << 12, "STKERR" },      { 0, 1u << 13, "LSPERR" },
+    { 0, 1u << 16, "UNDEFINSTR" },  { 0, 1u << 17, "INVSTATE" },
+    { 0, 1u << 18, "INVPC" },       { 0, 1u << 19, "NOCP" },
+    { 0, 1u << 24, "UNALIGNED" },   { 0, 1u << 25, "DIVBYZERO" },
+};
+#define NUM_STATUS_BITS (int)(sizeof(status_bits)/sizeof(status_bits[0]))
+
+
+/* The artifacts of one firmware build, or NULL ones if it is not at hand.
+ * Cores without a build-id and no -f come under the empty key.
+ */
+typedef struct build {
+    char      key[CACHE_KEY_MAX];
+    SymIndex *syms;
+    Unwinder *uw;
+} build;
+
+/* The cores of one signature */
+typedef struct bucket {
+    struct bucket *next;        /* In its chain of the map                  */
+    uint64_t       hash;
+    char          *sig;
+    int            count;
+    int            num_ex;
+    int            ex[];        /* Lowest indexes of its cores, ascending   */
+} bucket;
+
+typedef struct stripe {
+    _Alignas(64) pthread_mutex_t lock;  /* Own cache line, not shared       */
+    bucket        **chains;
+    size_t          num_chains, num_buckets;
+} stripe;
+
+typedef struct fleet {
+    char          **cores;      /* Paths, sorted                            */
+    int             num_cores, capacity;
+    int             next;       /* First core no worker has taken           */
+    const Firmware *fw;         /* From -f, or NULL                         */
+    char            fw_key[CACHE_KEY_MAX];
+    pthread_mutex_t builds_lock;
+    build         **builds;
+    int             num_builds;
+    stripe         *map;
+    int             frames, exemplars;
+    int             done, failed, unknown;
+} fleet;
+
+typedef struct worker {
+    fleet       *f;
+    const build *last;          /* Build of the previous core               */
+    uint8_t     *buf;           /* Core being read                          */
+    size_t       capacity;
+    bucket      *local[2 * LOCAL_MAX];  /* Open addressing, half full at most */
+    int          num_local;
+    int          done, failed, unknown;
+} worker;
+
+
+static uint64_t hash_sig(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ull;     /* FNV-1a */
+
+    while (*s)
+        h = (h ^ (uint8_t)*s++) * 0x100000001b3ull;
+    return h ^ h >> 29;
+}
+
+
+/* Returns the build that wrote "cf", opened once for all threads: the one
+ * its build-id names, or the firmware given if it has none. Returns NULL
+ * if the build cannot be had, saying why the first time.
+ */
+static const build *find_build(worker *w, const CoreFile *cf, const char *fn)
+{
+    fleet         *f = w->f;
+    const uint8_t *id;
+    build         *b = NULL, **builds;
+    char           key[CACHE_KEY_MAX];
+    size_t         len;
+    int            i;
+
+    id = CoreFileBuildId(cf, &len);
+    if (id == NULL || CacheKeyFromBuildId(id, len, key) < 0)
+        strcpy(key, f->fw ? f->fw_key : "");
+    if (w->last && strcmp(w->last->key, key) == 0)
+        return w->last->uw ? w->last : NULL;
+
+    pthread_mutex_lock(&f->builds_lock);
+    for (i = 0; i < f->num_builds; i++) {
+        if (strcmp(f->builds[i]->key, key) == 0) {
+            b = f->builds[i];
+            goto found;
+        }
+    }
+    builds = realloc(f->builds, (f->num_builds + 1) * sizeof(build *));
+    if (builds != NULL)
+        f->builds = builds;
+    if (builds == NULL || (b = calloc(1, sizeof(build))) == NULL) {
+        pthread_mutex_unlock(&f->builds_lock);
+        return NULL;
+    }
+    f->builds[f->num_builds++] = b;
+    strcpy(b->key, key);
+    if (!*key) {
+        fprintf(stderr, "%s: no build-id, its firmware must be given with "
+                "-f\n", fn);
+    } else if (f->fw && strcmp(key, f->fw_key) == 0) {
+        b->uw   = UnwinderOpen(f->fw);
+        b->syms = b->uw ? SymIndexOpen(f->fw) : NULL;
+        if (!b->syms)
+            fprintf(stderr, "%s: %s\n", fn,
+                    errno == ENOENT ? "firmware has no unwind tables"
+                                    : strerror(errno));
+    } else {
+        b->uw   = UnwinderOpenCached(key);
+        b->syms = b->uw ? SymIndexOpenCached(key) : NULL;
+        if (!b->syms)
+            fprintf(stderr, "%s: build %s is not cached; run once with -f "
+                    "and its firmware\n", fn, key);
+    }
+    if (!b->syms) {
+        UnwinderDestroy(b->uw);
+        b->uw = NULL;
+    }
+
+found:
+    pthread_mutex_unlock(&f->builds_lock);
+    w->last = b;
+    return b->uw ? b : NULL;
+}
+
+
+/* Appends "s" to the signature "sig" of "*len" bytes, cutting it short at
+ * SIG_MAX.
+ */
+static void sig_add(char *sig, size_t *len, const char *s)
+{
+    size_t n = strlen(s);
+
+    if (n > SIG_MAX - 1 - *len)
+        n = SIG_MAX - 1 - *len;
+    memcpy(sig + *len, s, n);
+    *len += n;
+    sig[*len] = '\0';
+}
+
+
+/* Writes the signature of "cf" to "sig": its fault status bits in
+ * brackets, then the functions of its top frames.
+ */
+static void signature(const fleet *f, const build *b, const CoreFile *cf,
+                      const uint32_t regs[18], char sig[SIG_MAX])
+{
+    UnwindFrame    frames[MAX_FRAMES];
+    UnwindStop     stop;
+    uint32_t       addrs[MAX_FRAMES], syms[MAX_FRAMES];
+    const uint8_t *status;
+    size_t         len = 0, status_len;
+    char           addr[16];
+    int            n, i;
+
+    sig[0] = '\0';
+    status = CoreFileNote(cf, FAULT_NOTE_NAME, NT_BARE_FAULT, &status_len);
+    if (status && status_len >= HFSR_OFFSET + 4) {
+        const uint8_t *c = status + CFSR_OFFSET, *h = status + HFSR_OFFSET;
+        uint32_t cfsr = c[0] | c[1] << 8 | c[2] << 16 | (uint32_t)c[3] << 24;
+        uint32_t hfsr = h[0] | h[1] << 8 | h[2] << 16 | (uint32_t)h[3] << 24;
+        sig_add(sig, &len, "[");
+        for (i = 0; i < NUM_STATUS_BITS; i++) {
+            if ((status_bits[i].hfsr ? hfsr : cfsr) & status_bits[i].mask) {
+                sig_add(sig, &len, len > 1 ? " " : "");
+                sig_add(sig, &len, status_bits[i].name);
+            }
+        }
+        sig_add(sig, &len, "] ");
+    }
+
+    n = Unwind(b->uw, cf, regs, frames, f->frames, &stop);
+    for (i = 0; i < n; i++) {
+        /* Return addresses are looked up in the call, 2 bytes back */
+        int caller = i > 0 && !(frames[i].flags & UNWIND_EXCEPTION);
+        addrs[i] = (frames[i].pc & ~1u) - (caller ? 2 : 0);
+    }
+    SymIndexFindBatch(b->syms, addrs, n, syms);
+    for (i = 0; i < n; i++) {
+        if (i)
+            sig_add(sig, &len, " < ");
+        if (syms[i] != SYMINDEX_NONE) {
+            sig_add(sig, &len, SymIndexName(b->syms, syms[i]));
+        } else {
+            snprintf(addr, sizeof(addr), "0x%08x", frames[i].pc & ~1u);
+            sig_add(sig, &len, addr);
+        }
+    }
+    if (stop != UNWIND_END && stop != UNWIND_DEPTH) {
+        sig_add(sig, &len, " (");
+        sig_add(sig, &len, UnwindStopName(stop));
+        sig_add(sig, &len, ")");
+    }
+}
+
+
+/* Counts core "idx" in "b", keeping it as an exemplar if it is one of the
+ * "max" lowest.
+ */
+static void add_exemplar(bucket *b, int idx, int max)
+{
+    int i;
+
+    if (b->num_ex == max && (max == 0 || idx > b->ex[max - 1]))
+        return;
+    if (b->num_ex < max)
+        b->num_ex++;
+    for (i = b->num_ex - 1; i > 0 && b->ex[i - 1] > idx; i--)
+        b->ex[i] = b->ex[i - 1];
+    b->ex[i] = idx;
+}
+
+
+/* Adds the bucket "b" of a worker to the map, which takes it over unless
+ * the map has the signature already.
+ */
+static void merge(fleet *f, bucket *b)
+{
+    stripe *s = &f->map[b->hash >> STRIPE_SHIFT];
+    bucket *m;
+    size_t  i;
+    int     j;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->num_chains) {
+        for (m = s->chains[b->hash & (s->num_chains - 1)]; m; m = m->next) {
+            if (m->hash == b->hash && strcmp(m->sig, b->sig) == 0) {
+                m->count += b->count;
+                for (j = 0; j < b->num_ex; j++)
+                    add_exemplar(m, b->ex[j], f->exemplars);
+                pthread_mutex_unlock(&s->lock);
+                free(b->sig);
+                free(b);
+                return;
+            }
+        }
+    }
+    if (s->num_buckets >= s->num_chains) {
+        size_t   n = s->num_chains ? 2 * s->num_chains : 16;
+        bucket **chains = calloc(n, sizeof(bucket *));
+        if (chains == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        for (i = 0; i < s->num_chains; i++) {
+            while ((m = s->chains[i]) != NULL) {
+                s->chains[i] = m->next;
+                m->next = chains[m->hash & (n - 1)];
+                chains[m->hash & (n - 1)] = m;
+            }
+        }
+        free(s->chains);
+        s->chains     = chains;
+        s->num_chains = n;
+    }
+    b->next = s->chains[b->hash & (s->num_chains - 1)];
+    s->chains[b->hash & (s->num_chains - 1)] = b;
+    s->num_buckets++;
+    pthread_mutex_unlock(&s->lock);
+}
+
+
+/* Merges the signatures "w" has counted into the map.
+ */
+static void flush(worker *w)
+{
+    int i;
+
+    for (i = 0; i < 2 * LOCAL_MAX; i++) {
+        if (w->local[i] != NULL) {
+            merge(w->f, w->local[i]);
+            w->local[i] = NULL;
+        }
+    }
+    w->num_local = 0;
+}
+
+
+/* Counts core "idx" under the signature "sig".
+ */
+static void count(worker *w, const char *sig, int idx)
+{
+    uint64_t h = hash_sig(sig);
+    size_t   i = h & (2 * LOCAL_MAX - 1);
+    bucket  *b;
+
+    for (; (b = w->local[i]) != NULL; i = (i + 1) & (2 * LOCAL_MAX - 1)) {
+        if (b->hash == h && strcmp(b->sig, sig) == 0) {
+            b->count++;
+            add_exemplar(b, idx, w->f->exemplars);
+            return;
+        }
+    }
+    if ((b = calloc(1, sizeof(bucket) + w->f->exemplars * sizeof(int))) ==
+        NULL || (b->sig = strdup(sig)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    b->hash  = h;
+    b->count = 1;
+    add_exemplar(b, idx, w->f->exemplars);
+    w->local[i] = b;
+    if (++w->num_local == LOCAL_MAX)
+        flush(w);
+}
+
+
+static void add_core(worker *w, int idx)
+{
+    const char  *fn = w->f->cores[idx];
+    const build *b;
+    CoreFile    *cf;
+    uint32_t     regs[18];
+    char         sig[SIG_MAX];
+
+    if ((cf = CoreFileRead(fn, &w->buf, &w->capacity)) == NULL ||
+        CoreFileRegisters(cf, regs) < 0) {
+        fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+        CoreFileClose(cf);
+        w->failed++;
+        return;
+    }
+    if ((b = find_build(w, cf, fn)) == NULL) {
+        CoreFileClose(cf);
+        w->unknown++;
+        return;
+    }
+    signature(w->f, b, cf, regs, sig);
+    CoreFileClose(cf);
+    count(w, sig, idx);
+    w->done++;
+}
+
+
+static void *run_worker(void *arg)
+{
+    worker *w = arg;
+    fleet  *f = w->f;
+    int     i, end;
+
+    while ((i = __atomic_fetch_add(&f->next, CHUNK, __ATOMIC_RELAXED)) <
+           f->num_cores) {
+        end = i + CHUNK < f->num_cores ? i + CHUNK : f->num_cores;
+        for (; i < end; i++)
+            add_core(w, i);
+    }
+    flush(w);
+    free(w->buf);
+    return NULL;
+}
+
+
+static int add_path(fleet *f, const char *path)
+{
+    if (f->num_cores == f->capacity) {
+        int    c = f->capacity ? 2 * f->capacity : 1024;
+        char **p = realloc(f->cores, c * sizeof(char *));
+        if (p == NULL)
+            return -1;
+        f->cores    = p;
+        f->capacity = c;
+    }
+    if ((f->cores[f->num_cores] = strdup(path)) == NULL)
+        return -1;
+    f->num_cores++;
+    return 0;
+}
+
+
+/* Lists every *.core in "dir".
+ */
+static int add_dir(fleet *f, const char *dir)
+{
+    DIR           *d;
+    struct dirent *e;
+    char           path[4096];
+
+    if ((d = opendir(dir)) == NULL)
+        return -1;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len <= 5 || strcmp(e->d_name + len - 5, ".core") != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (add_path(f, path) < 0) {
+            closedir(d);
+            return -1;
+        }
+    }
+    closedir(d);
+    return 0;
+}
+
+
+static int cmp_path(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+/* Most cores first, then by signature.
+ */
+static int cmp_bucket(const void *a, const void *b)
+{
+    const bucket *x = *(bucket *const *)a, *y = *(bucket *const *)b;
+
+    if (x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+    return strcmp(x->sig, y->sig);
+}
+
+
+static void report(fleet *f)
+{
+    bucket **all, *b;
+    size_t   n = 0, i;
+    int      j;
+
+    for (i = 0; i < STRIPES; i++)
+        n += f->map[i].num_buckets;
+    if ((all = malloc((n + 1) * sizeof(bucket *))) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    n = 0;
+    for (i = 0; i < STRIPES; i++) {
+        for (j = 0; j < (int)f->map[i].num_chains; j++) {
+            for (b = f->map[i].chains[j]; b; b = b->next)
+                all[n++] = b;
+        }
+    }
+    qsort(all, n, sizeof(bucket *), cmp_bucket);
+    for (i = 0; i < n; i++) {
+        printf("%7d %5.1f%%  %s\n", all[i]->count,
+               100.0 * all[i]->count / f->done, all[i]->sig);
+        for (j = 0; j < all[i]->num_ex; j++)
+            printf("                %s\n", f->cores[all[i]->ex[j]]);
+    }
+    free(all);
+}
+
+
+static void bucket_usage(void)
+{
+    fprintf(stderr,
+            "usage: bare_core bucket [-f firmware] [-j threads] [-n frames]\n"
+            "                        [-e exemplars] (core | dir)...\n"
+            "\n"
+            "Groups the cores given and every *.core in the directories\n"
+            "given by their crash signature: the fault status bits set,\n"
+            "if the core has them, and the functions of the top frames\n"
+            "(-n, 5 by default), the faulting one first. Prints each\n"
+            "bucket with its share of the cores and its first -e (3 by\n"
+            "default) cores in path order, most cores first. Cores are\n"
+            "read by -j threads, one per processor by default. Symbols and\n"
+            "unwind tables are found as by bare_core backtrace.\n");
+}
+
+
+int bucket_main(int argc, char *argv[])
+{
+    fleet           f;
+    worker         *workers;
+    pthread_t      *pool;
+    Firmware       *fw = NULL;
+    const char     *firmware = NULL;
+    struct stat     st;
+    struct timespec t0, t1;
+    double          secs;
+    size_t          k;
+    int             threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int             opt, i, started;
+
+    memset(&f, 0, sizeof(f));
+    f.frames    = 5;
+    f.exemplars = 3;
+    while ((opt = getopt(argc, argv, "f:j:n:e:")) != -1) {
+        switch (opt) {
+        case 'f':
+            firmware = optarg;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'n':
+            f.frames = atoi(optarg);
+            break;
+        case 'e':
+            f.exemplars = atoi(optarg);
+            break;
+        default:
+            bucket_usage();
+            return 2;
+        }
+    }
+    if (optind >= argc || f.frames < 1 || f.frames > MAX_FRAMES ||
+        f.exemplars < 0) {
+        bucket_usage();
+        return 2;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (firmware) {
+        if ((fw = FirmwareOpen(firmware)) == NULL) {
+            perror(firmware);
+            return 1;
+        }
+        f.fw = fw;
+        CacheKey(fw, f.fw_key);
+    }
+    for (i = optind; i < argc; i++) {
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (add_dir(&f, argv[i]) < 0)
+                perror(argv[i]);
+        } else if (add_path(&f, argv[i]) < 0) {
+            perror(argv[i]);
+        }
+    }
+    qsort(f.cores, f.num_cores, sizeof(char *), cmp_path);
+
+    if ((f.map = aligned_alloc(64, STRIPES * sizeof(stripe))) == NULL ||
+        (workers = calloc(threads, sizeof(worker))) == NULL ||
+        (pool = malloc(threads * sizeof(pthread_t))) == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    memset(f.map, 0, STRIPES * sizeof(stripe));
+    for (i = 0; i < STRIPES; i++)
+        pthread_mutex_init(&f.map[i].lock, NULL);
+    pthread_mutex_init(&f.builds_lock, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (started = 0; started < threads; started++) {
+        workers[started].f = &f;
+        if (pthread_create(&pool[started], NULL, run_worker,
+                           &workers[started]))
+            break;
+    }
+    if (started == 0)
+        run_worker(&workers[0]);
+    for (i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+    for (i = 0; i < threads; i++) {
+        f.done    += workers[i].done;
+        f.failed  += workers[i].failed;
+        f.unknown += workers[i].unknown;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    report(&f);
+    for (i = 0, k = 0; i < STRIPES; i++)
+        k += f.map[i].num_buckets;
+    fprintf(stderr, "%d cores in %zu buckets, %d unreadable, %d of unknown "
+            "builds", f.done, k, f.failed, f.unknown);
+    if (secs > 0)
+        fprintf(stderr, " in %.3f s, %.0f cores/s on %d threads", secs,
+                f.num_cores / secs, started ? started : 1);
+    fprintf(stderr, "\n");
+
+    for (i = 0; i < STRIPES; i++) {
+        bucket *b;
+        for (k = 0; k < f.map[i].num_chains; k++) {
+            while ((b = f.map[i].chains[k]) != NULL) {
+                f.map[i].chains[k] = b->next;
+                free(b->sig);
+                free(b);
+            }
+        }
+        free(f.map[i].chains);
+        pthread_mutex_destroy(&f.map[i].lock);
+    }
+    for (i = 0; i < f.num_builds; i++) {
+        SymIndexClose(f.builds[i]->syms);
+        UnwinderDestroy(f.builds[i]->uw);
+        free(f.builds[i]);
+    }
+    for (i = 0; i < f.num_cores; i++)
+        free(f.cores[i]);
+    pthread_mutex_destroy(&f.builds_lock);
+    free(f.builds);
+    free(f.cores);
+    free(f.map);
+    free(workers);
+    free(pool);
+    FirmwareClose(fw);
+    return f.done ? 0 : 1;
+}
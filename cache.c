@@ -0,0 +1,161 @@
+/* On-disk cache of what bare_core derives from firmware images.
+ *
+ * Each artifact, such as the symbol index or the decoded unwind tables, is
+ * a file "<key>.<kind>" in the cache directory, where the key is the GNU
+ * build-id of the firmware. A core carries the build-id of the firmware
+ * that wrote it, so its artifacts can be found from the core alone, and
+ * nothing has to parse the ELF image again once they are cached. Images
+ * linked without a build-id are keyed by a hash of their contents.
+ *
+ * Artifacts are written whole to a temporary file and renamed into place,
+ * and read by mapping them; their formats are the business of the modules
+ * that write them, which must check what they map.
+ */
+
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* Sets "key" to the hex digits of the build-id "id". Returns -1 if it is
+ * empty or too long for a key.
+ */
+int CacheKeyFromBuildId(const uint8_t *id, size_t len,
+                        char key[CACHE_KEY_MAX]) {
+  size_t i;
+
+  if (!len || 2 * len >= CACHE_KEY_MAX)
+    return -1;
+  for (i = 0; i < len; i++)
+    sprintf(key + 2 * i, "%02x", id[i]);
+  return 0;
+}
+
+/* Sets "key" to the key of "fw".
+ */
+int CacheKey(const Firmware *fw, char key[CACHE_KEY_MAX]) {
+  const uint8_t *id;
+  size_t         len;
+
+  if ((id = FirmwareBuildId(fw, &len)) &&
+      CacheKeyFromBuildId(id, len, key) == 0)
+    return 0;
+  snprintf(key, CACHE_KEY_MAX, "hash-%016llx",
+           (unsigned long long)FirmwareHash(fw));
+  return 0;
+}
+
+/* Returns the cache directory: $BARE_CORE_CACHE, else bare_core in
+ * $XDG_CACHE_HOME or ~/.cache, or NULL if none of these is set.
+ */
+const char *CacheDir(void) {
+  static __thread char dir[4096];
+  const char *env;
+
+  if ((env = getenv("BARE_CORE_CACHE")) && *env)
+    return env;
+  if ((env = getenv("XDG_CACHE_HOME")) && *env)
+    snprintf(dir, sizeof(dir), "%s/bare_core", env);
+  else if ((env = getenv("HOME")) && *env)
+    snprintf(dir, sizeof(dir), "%s/.cache/bare_core", env);
+  else
+    return NULL;
+  return dir;
+}
+
+static int cache_path(char *path, size_t len, const char *key,
+                      const char *kind) {
+  const char *dir = CacheDir();
+
+  if (!dir || snprintf(path, len, "%s/%s.%s", dir, key, kind) >= (int)len) {
+    errno = ENOENT;
+    return -1;
+  }
+  return 0;
+}
+
+/* Maps the "kind" artifact of the build "key" and sets "size" to its
+ * size. Returns NULL with errno set if it is not cached.
+ */
+const void *CacheMap(const char *key, const char *kind, size_t *size) {
+  struct stat st;
+  char        path[4096];
+  void       *p;
+  int         fd;
+
+  if (cache_path(path, sizeof(path), key, kind) < 0 ||
+      (fd = open(path, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    errno = ENOENT;
+    return NULL;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return NULL;
+  *size = st.st_size;
+  return p;
+}
+
+void CacheUnmap(const void *p, size_t size) {
+  if (p)
+    munmap((void *)p, size);
+}
+
+/* Creates "dir" and any missing parents */
+static int make_dirs(const char *dir) {
+  char path[4096], *p;
+
+  if (snprintf(path, sizeof(path), "%s", dir) >= (int)sizeof(path))
+    return -1;
+  for (p = path + 1; *p; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      if (mkdir(path, 0777) < 0 && errno != EEXIST)
+        return -1;
+      *p = '/';
+    }
+  }
+  return mkdir(path, 0777) < 0 && errno != EEXIST ? -1 : 0;
+}
+
+/* Stores the "size" bytes at "buf" as the "kind" artifact of the build
+ * "key". Readers only ever see a whole artifact. Returns -1 with errno set
+ * on failure.
+ */
+int CacheStore(const char *key, const char *kind, const void *buf,
+               size_t size) {
+  char   path[4096], tmp[4096];
+  size_t done = 0;
+  int    fd;
+
+  if (cache_path(path, sizeof(path), key, kind) < 0 ||
+      make_dirs(CacheDir()) < 0 ||
+      snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >=
+          (int)sizeof(tmp) ||
+      (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+    return -1;
+  while (done < size) {
+    ssize_t n = write(fd, (const uint8_t *)buf + done, size - done);
+    if (n <= 0) {
+      close(fd);
+      unlink(tmp);
+      return -1;
+    }
+    done += n;
+  }
+  if (close(fd) < 0 || rename(tmp, path) < 0) {
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
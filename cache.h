@@ -0,0 +1,28 @@
+/* On-disk cache of what bare_core derives from firmware images.
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include "firmware.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+  /* A firmware build as it names its cache files: the hex of its GNU
+   * build-id, or of a hash of the image if it has none.
+   */
+  #define CACHE_KEY_MAX 129
+
+
+int CacheKey(const Firmware *fw, char key[CACHE_KEY_MAX]);
+int CacheKeyFromBuildId(const uint8_t *id, size_t len,
+                        char key[CACHE_KEY_MAX]);
+const char *CacheDir(void);
+const void *CacheMap(const char *key, const char *kind, size_t *size);
+void CacheUnmap(const void *p, size_t size);
+int CacheStore(const char *key, const char *kind, const void *buf,
+               size_t size);
+
+#endif /* _CACHE_H */
@@ -0,0 +1,597 @@
+/*
+ * convert.c
+ *
+ *  bare_core convert: turns a directory or manifest of raw RAM dumps into
+ *  core files on a pool of worker threads.
+ *
+ *  Each raw dump becomes a file backed region, copied into the core by the
+ *  kernel (or, for compressed output, streamed from the raw file), so a
+ *  worker never holds more than the core headers and a copy buffer in
+ *  memory, however large the dump. A dump that
+ *  fails to convert is reported and skipped; it does not stop the batch.
+ *
+ *  With -q, each worker instead reads its dumps into memory and writes the
+ *  cores through a CoreRing, keeping up to that many writes in flight on
+ *  io_uring. Memory per worker is then bounded by the queue depth.
+ *
+ *  "*.dump" files are compressed dump streams from the target (see
+ *  arm/dumpstream.h). They are decoded into memory first, registers and
+ *  all, and may hold any number of regions at their own addresses. Delta
+ *  regions in them are rebuilt against the firmware given with -f.
+ *
+ *  The boot times the target keeps at boot_times (arm/boottimes.h) go
+ *  into each core as a note, for bare_core boot to report on. Raw dumps
+ *  need -f to locate them; in dump streams they are also found by their
+ *  magic.
+ */
+
+#include "bare_core.h"
+#include "bootnote.h"
+#include "dumpdecode.h"
+#include "elfcore.h"
+#include "firmware.h"
+#include <libelf/libelf.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_RAM_ADDR    0x1fffc000  /* m_ram1 in MK12DX256_app.ld   */
+
+
+typedef struct job {
+    char       *in;             /* Raw dump                                 */
+    char       *out;            /* Core file                                */
+    int         stream;         /* Input is a dump stream, not a raw image  */
+    uint32_t    addr;           /* Target address of the first byte         */
+    uint64_t    bytes;          /* Size of the raw dump                     */
+    uint64_t    ns;             /* Time taken to convert it                 */
+    int         err;            /* errno of a failed conversion, or 0       */
+    uint64_t    start;          /* io_uring: when the job was started       */
+    uint8_t    *buf;            /* io_uring: contents of the dump           */
+    DumpDecoder *decoder;       /* Decoded dump stream                      */
+    CoreRegion  region;
+    CoreDump    dump;
+    Frame       frame;
+    CoreNote    notes[2];       /* Those of the dump, then its boot times   */
+    uint8_t     boot[sizeof(BootTimes)];
+} job;
+
+typedef struct batch {
+    job            *jobs;
+    int             num_jobs;
+    int             next;       /* Next job to hand out                     */
+    pthread_mutex_t lock;
+    int             compress;   /* CORE_COMPRESS_*, or 0                    */
+    unsigned        depth;      /* io_uring queue depth, or 0               */
+    Firmware       *firmware;   /* Baseline of delta dumps, or NULL         */
+} batch;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+/* Adds the boot times in the memory of "dump", if there are any, as a
+ * note kept in "j", after the one a decoded dump may have of its fault.
+ */
+static void add_boot_note(job *j, CoreDump *dump, const Firmware *fw)
+{
+    CoreNote *note = &j->notes[dump->num_notes];
+    int       i;
+
+    if (FindBootTimes(dump, fw, j->boot) < 0)
+        return;
+    for (i = 0; i < dump->num_notes; i++)
+        j->notes[i] = dump->notes[i];
+    note->name      = BOOT_NOTE_NAME;
+    note->type      = NT_BARE_BOOT_TIMES;
+    note->desc      = j->boot;
+    note->descsz    = sizeof(j->boot);
+    dump->notes     = j->notes;
+    dump->num_notes++;
+}
+
+
+/* Raw images carry no build-id of their own; theirs is that of the
+ * firmware given, if any.
+ */
+static void add_build_id(CoreDump *dump, const Firmware *fw)
+{
+    size_t len;
+
+    if (fw && (dump->build_id = FirmwareBuildId(fw, &len)) != NULL)
+        dump->build_id_size = len;
+}
+
+
+/* Converts the dump stream of "j", writing compressed if "compress" is set.
+ */
+static int convert_stream(job *j, int compress, Firmware *fw)
+{
+    DumpDecoder *d;
+    CoreDump     dump;
+    int          rc;
+
+    if ((d = DumpDecodeFile(j->in, fw ? FirmwareBaseline : NULL, fw)) == NULL)
+        return -1;
+    DumpDecoderGetCore(d, &dump);
+    add_boot_note(j, &dump, fw);
+    rc = compress ? CreateCompressedElfCore(j->out, &dump, compress, 0, NULL)
+                  : CreateElfCoreDump(j->out, &dump, NULL);
+    DumpDecoderDestroy(d);
+    return rc;
+}
+
+
+static int convert_one(job *j, int compress, Firmware *fw)
+{
+    Frame       frame;
+    struct stat st;
+    CoreRegion  region;
+    CoreDump    dump;
+    int         rc;
+
+    if (j->stream)
+        return convert_stream(j, compress, fw);
+    memset(&frame, 0, sizeof(frame));
+    memset(&region, 0, sizeof(region));
+    memset(&dump, 0, sizeof(dump));
+    if ((region.fd = open(j->in, O_RDONLY)) < 0)
+        return -1;
+    if (fstat(region.fd, &st) < 0) {
+        close(region.fd);
+        return -1;
+    }
+    region.addr      = j->addr;
+    region.size      = st.st_size;
+    region.flags     = PF_R|PF_W;
+    dump.regions     = &region;
+    dump.num_regions = 1;
+    dump.frame       = &frame;
+    add_build_id(&dump, fw);
+    add_boot_note(j, &dump, fw);
+    rc = compress ? CreateCompressedElfCore(j->out, &dump, compress, 0, NULL)
+                  : CreateElfCoreDump(j->out, &dump, NULL);
+    close(region.fd);
+    return rc;
+}
+
+
+static job *next_job(batch *b)
+{
+    job *j;
+
+    pthread_mutex_lock(&b->lock);
+    j = b->next < b->num_jobs ? &b->jobs[b->next++] : NULL;
+    pthread_mutex_unlock(&b->lock);
+    return j;
+}
+
+
+/* Reads a whole dump into memory and queues its core in "ring".
+ */
+static int submit_one(CoreRing *ring, job *j, Firmware *fw)
+{
+    struct stat st;
+    size_t      done = 0;
+    int         fd;
+
+    if ((fd = open(j->in, O_RDONLY)) < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || (j->buf = malloc(st.st_size + 1)) == NULL) {
+        close(fd);
+        return -1;
+    }
+    while (done < (size_t)st.st_size) {
+        ssize_t rc = read(fd, j->buf + done, st.st_size - done);
+        if (rc <= 0) {
+            close(fd);
+            errno = rc ? errno : EIO;
+            return -1;
+        }
+        done += rc;
+    }
+    close(fd);
+    j->bytes           = done;
+    if (j->stream) {
+        if ((j->decoder = DumpDecoderCreate()) == NULL)
+            return -1;
+        if (fw)
+            DumpDecoderSetBaseline(j->decoder, FirmwareBaseline, fw);
+        if (DumpDecoderFeed(j->decoder, j->buf, done) < 0)
+            return -1;
+        if (!DumpDecoderDone(j->decoder)) {
+            errno = EINVAL;
+            return -1;
+        }
+        DumpDecoderGetCore(j->decoder, &j->dump);
+        add_boot_note(j, &j->dump, fw);
+        return CoreRingSubmit(ring, j->out, &j->dump, j);
+    }
+    j->region.addr     = j->addr;
+    j->region.size     = done;
+    j->region.flags    = PF_R|PF_W;
+    j->region.buf      = j->buf;
+    j->region.fd       = -1;
+    j->dump.regions    = &j->region;
+    j->dump.num_regions = 1;
+    j->dump.frame      = &j->frame;
+    add_build_id(&j->dump, fw);
+    add_boot_note(j, &j->dump, fw);
+    return CoreRingSubmit(ring, j->out, &j->dump, j);
+}
+
+
+static void finish_job(job *j, int rc)
+{
+    j->ns  = now_ns() - j->start;
+    j->err = rc ? (errno ? errno : EIO) : 0;
+    free(j->buf);
+    j->buf = NULL;
+    DumpDecoderDestroy(j->decoder);
+    j->decoder = NULL;
+    if (j->err)
+        fprintf(stderr, "%s: %s\n", j->in, strerror(j->err));
+}
+
+
+static void *sync_worker(batch *b)
+{
+    for (;;) {
+        job        *j;
+        struct stat st;
+        uint64_t    start;
+
+        if ((j = next_job(b)) == NULL)
+            return NULL;
+
+        start = now_ns();
+        if (stat(j->in, &st) == 0)
+            j->bytes = st.st_size;
+        j->err = convert_one(j, b->compress, b->firmware) ? (errno ? errno : EIO) : 0;
+        j->ns  = now_ns() - start;
+        if (j->err)
+            fprintf(stderr, "%s: %s\n", j->in, strerror(j->err));
+    }
+}
+
+
+/* Keeps up to b->depth cores in flight on an io_uring CoreRing. Without a
+ * ring, the jobs are converted one at a time instead.
+ */
+static void *ring_worker(batch *b)
+{
+    CoreRing *ring = CoreRingCreate(b->depth);
+    unsigned  inflight = 0;
+    job      *j;
+    void     *tag;
+    int       rc;
+
+    if (!ring) {
+        perror("CoreRingCreate");
+        return sync_worker(b);
+    }
+    if (!CoreRingIsAsync(ring))
+        fprintf(stderr, "io_uring unavailable, writing synchronously\n");
+    while ((j = next_job(b)) != NULL) {
+        while (inflight >= b->depth && CoreRingReap(ring, &tag, &rc, 1)) {
+            finish_job((job *)tag, rc);
+            inflight--;
+        }
+        j->start = now_ns();
+        errno    = 0;
+        if (submit_one(ring, j, b->firmware) < 0)
+            finish_job(j, -1);
+        else
+            inflight++;
+        while (CoreRingReap(ring, &tag, &rc, 0)) {
+            finish_job((job *)tag, rc);
+            inflight--;
+        }
+    }
+    while (inflight && CoreRingReap(ring, &tag, &rc, 1)) {
+        finish_job((job *)tag, rc);
+        inflight--;
+    }
+    CoreRingDestroy(ring);
+    return NULL;
+}
+
+
+static void *worker(void *arg)
+{
+    batch *b = (batch *)arg;
+
+    return b->depth ? ring_worker(b) : sync_worker(b);
+}
+
+
+static int add_job(batch *b, int *capacity, const char *in, uint32_t addr,
+                   const char *out_dir, const char *suffix)
+{
+    const char *base = strrchr(in, '/') ? strrchr(in, '/') + 1 : in;
+    size_t      len  = strlen(base);
+    int         stream = len > 5 && strcmp(base + len - 5, ".dump") == 0;
+    job        *j;
+
+    if (len > 4 && strcmp(base + len - 4, ".raw") == 0)
+        len -= 4;
+    else if (stream)
+        len -= 5;
+    if (b->num_jobs == *capacity) {
+        job *jobs;
+        *capacity = *capacity ? 2 * *capacity : 64;
+        if ((jobs = realloc(b->jobs, *capacity * sizeof(job))) == NULL)
+            return -1;
+        b->jobs = jobs;
+    }
+    j = &b->jobs[b->num_jobs];
+    memset(j, 0, sizeof(*j));
+    j->in   = strdup(in);
+    j->out  = malloc(strlen(out_dir) + len + strlen(suffix) + 2);
+    j->addr = addr;
+    j->stream = stream;
+    if (!j->in || !j->out)
+        return -1;
+    sprintf(j->out, "%s/%.*s%s", out_dir, (int)len, base, suffix);
+    b->num_jobs++;
+    return 0;
+}
+
+
+/* Queues every "*.raw" and "*.dump" file in "dir".
+ */
+static int scan_dir(batch *b, int *capacity, const char *dir, uint32_t addr,
+                    const char *out_dir, const char *suffix)
+{
+    DIR           *d;
+    struct dirent *e;
+    char           path[4096];
+    int            rc = 0;
+
+    if ((d = opendir(dir)) == NULL)
+        return -1;
+    while (rc == 0 && (e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if ((len <= 4 || strcmp(e->d_name + len - 4, ".raw") != 0) &&
+            (len <= 5 || strcmp(e->d_name + len - 5, ".dump") != 0))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        rc = add_job(b, capacity, path, addr, out_dir, suffix);
+    }
+    closedir(d);
+    return rc;
+}
+
+
+/* Queues the dumps listed in "manifest", one "path [address]" per line.
+ * Blank lines and lines starting with '#' are ignored.
+ */
+static int read_manifest(batch *b, int *capacity, const char *manifest,
+                         uint32_t addr, const char *out_dir,
+                         const char *suffix)
+{
+    FILE *f;
+    char  line[4096];
+    int   rc = 0;
+
+    if ((f = fopen(manifest, "r")) == NULL)
+        return -1;
+    while (rc == 0 && fgets(line, sizeof(line), f)) {
+        char *path = strtok(line, " \t\r\n");
+        char *a    = strtok(NULL, " \t\r\n");
+        if (!path || *path == '#')
+            continue;
+        rc = add_job(b, capacity, path,
+                     a ? (uint32_t)strtoul(a, NULL, 0) : addr,
+                     out_dir, suffix);
+    }
+    fclose(f);
+    return rc;
+}
+
+
+static int cmp_out(const void *a, const void *b)
+{
+    return strcmp((*(const job *const *)a)->out, (*(const job *const *)b)->out);
+}
+
+
+/* Outputs are named after the base name of their dump, so dumps of the
+ * same name in different directories of a manifest would overwrite each
+ * other's core. Reports every such clash; returns -1 if there are any.
+ */
+static int check_outputs(const batch *b)
+{
+    job **sorted = malloc((b->num_jobs + 1) * sizeof(job *));
+    int   rc = 0, i;
+
+    if (!sorted) {
+        perror("convert");
+        return -1;
+    }
+    for (i = 0; i < b->num_jobs; i++)
+        sorted[i] = &b->jobs[i];
+    qsort(sorted, b->num_jobs, sizeof(job *), cmp_out);
+    for (i = 1; i < b->num_jobs; i++) {
+        if (strcmp(sorted[i - 1]->out, sorted[i]->out) == 0) {
+            fprintf(stderr, "%s and %s would both be written to %s\n",
+                    sorted[i - 1]->in, sorted[i]->in, sorted[i]->out);
+            rc = -1;
+        }
+    }
+    free(sorted);
+    return rc;
+}
+
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+static void summary(const batch *b, uint64_t wall_ns)
+{
+    uint64_t *lat = malloc((b->num_jobs + 1) * sizeof(uint64_t));
+    uint64_t  bytes = 0;
+    int       ok = 0, i;
+    double    secs = wall_ns / 1e9;
+
+    for (i = 0; i < b->num_jobs; i++) {
+        if (b->jobs[i].err)
+            continue;
+        bytes += b->jobs[i].bytes;
+        if (lat)
+            lat[ok] = b->jobs[i].ns;
+        ok++;
+    }
+    printf("converted %d of %d dumps in %.3f s\n", ok, b->num_jobs, secs);
+    if (ok && secs > 0)
+        printf("  %.1f dumps/s, %.1f MB/s\n", ok / secs, bytes / secs / 1e6);
+    if (ok && lat) {
+        qsort(lat, ok, sizeof(uint64_t), cmp_u64);
+        printf("  latency p50 %.3f ms, p99 %.3f ms\n",
+               lat[(ok - 1) / 2] / 1e6, lat[(ok - 1) * 99 / 100] / 1e6);
+    }
+    free(lat);
+}
+
+
+static void convert_usage(void)
+{
+    fprintf(stderr,
+            "usage: bare_core convert [-j threads] [-o dir] [-a address]\n"
+            "                         [-z gzip|zstd | -q depth] [-f firmware]\n"
+            "                         (dir | -m manifest)\n"
+            "\n"
+            "Converts every *.raw or *.dump file in dir, or every dump listed\n"
+            "in the manifest (\"path [address]\" per line), into a core file\n"
+            "in the output directory (default: the current directory). The\n"
+            "address applies to raw RAM images; *.dump streams carry their\n"
+            "own, and delta regions in them are rebuilt against the startup\n"
+            "RAM contents of the firmware ELF file (zeros without -f).\n"
+            "\n"
+            "With -q, each thread writes its cores through io_uring with up\n"
+            "to depth writes in flight.\n");
+}
+
+
+int convert_main(int argc, char *argv[])
+{
+    batch       b;
+    int         capacity = 0;
+    int         threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *out_dir = ".";
+    const char *manifest = NULL;
+    const char *suffix = ".core";
+    const char *firmware = NULL;
+    uint32_t    addr = DEFAULT_RAM_ADDR;
+    pthread_t  *pool;
+    uint64_t    start;
+    int         failed = 0;
+    int         opt, i;
+
+    memset(&b, 0, sizeof(b));
+    while ((opt = getopt(argc, argv, "j:o:a:m:z:q:f:")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'o':
+            out_dir = optarg;
+            break;
+        case 'a':
+            addr = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            manifest = optarg;
+            break;
+        case 'q':
+            b.depth = (unsigned)atoi(optarg);
+            break;
+        case 'f':
+            firmware = optarg;
+            break;
+        case 'z':
+            if (strcmp(optarg, "gzip") == 0) {
+                b.compress = CORE_COMPRESS_GZIP;
+                suffix     = ".core.gz";
+            } else if (strcmp(optarg, "zstd") == 0) {
+                b.compress = CORE_COMPRESS_ZSTD;
+                suffix     = ".core.zst";
+            } else {
+                convert_usage();
+                return 2;
+            }
+            break;
+        default:
+            convert_usage();
+            return 2;
+        }
+    }
+    if ((manifest == NULL) == (optind >= argc)) {
+        convert_usage();
+        return 2;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (b.depth && b.compress) {
+        fprintf(stderr, "-q cannot be combined with -z\n");
+        return 2;
+    }
+
+    if (firmware && (b.firmware = FirmwareOpen(firmware)) == NULL) {
+        perror(firmware);
+        return 1;
+    }
+    if (manifest ? read_manifest(&b, &capacity, manifest, addr, out_dir,
+                                 suffix)
+                 : scan_dir(&b, &capacity, argv[optind], addr, out_dir,
+                            suffix)) {
+        perror(manifest ? manifest : argv[optind]);
+        return 1;
+    }
+    if (check_outputs(&b))
+        return 1;
+
+    pthread_mutex_init(&b.lock, NULL);
+    if ((pool = malloc(threads * sizeof(pthread_t))) == NULL)
+        return 1;
+    start = now_ns();
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&pool[i], NULL, worker, &b)) {
+            threads = i;
+            break;
+        }
+    }
+    if (threads == 0)
+        worker(&b);
+    for (i = 0; i < threads; i++)
+        pthread_join(pool[i], NULL);
+    summary(&b, now_ns() - start);
+
+    for (i = 0; i < b.num_jobs; i++) {
+        failed |= b.jobs[i].err != 0;
+        free(b.jobs[i].in);
+        free(b.jobs[i].out);
+    }
+    free(b.jobs);
+    free(pool);
+    FirmwareClose(b.firmware);
+    pthread_mutex_destroy(&b.lock);
+    return failed;
+}
@@ -0,0 +1,230 @@
+/* Read access to the core files that bare_core writes.
+ *
+ * The core is mapped as it is, and target memory is returned as pointers
+ * into the mapping, so that scanning thousands of cores costs no copies.
+ * Holes in sparse cores read as the zeros they stand for. Only 32-bit
+ * little endian cores, the CORE_TARGET_ARM32_LE flavour, are supported.
+ */
+
+#include "corefile.h"
+#include "elfcore.h"
+
+#include <libelf/libelf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Where pr_reg is in a 32-bit ARM prstatus, see elfcore.c */
+#define PR_REG_OFFSET 72
+
+struct CoreFile {
+  const uint8_t    *image;
+  size_t            size;
+  const Elf32_Phdr *phdrs;
+  int               num_phdrs;
+  int               mapped;     /* image is mapped, not the caller's buffer */
+};
+
+
+/* Checks the headers of the "size" bytes of core at "image" and returns
+ * them as a CoreFile, which unmaps them when closed if "mapped" is set.
+ * Returns NULL with errno set on failure.
+ */
+static CoreFile *setup(const uint8_t *image, size_t size, int mapped) {
+  const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)image;
+  CoreFile         *cf;
+  int               i;
+
+  if (!(cf = calloc(1, sizeof(CoreFile)))) {
+    if (mapped)
+      munmap((void *)image, size);
+    return NULL;
+  }
+  cf->image  = image;
+  cf->size   = size;
+  cf->mapped = mapped;
+  if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+      ehdr->e_ident[EI_DATA] != ELFDATA2LSB || ehdr->e_type != ET_CORE ||
+      ehdr->e_phoff > cf->size ||
+      ehdr->e_phnum > (cf->size - ehdr->e_phoff) / sizeof(Elf32_Phdr))
+    goto bad;
+  cf->phdrs     = (const Elf32_Phdr *)(cf->image + ehdr->e_phoff);
+  cf->num_phdrs = ehdr->e_phnum;
+  for (i = 0; i < cf->num_phdrs; i++) {
+    if (cf->phdrs[i].p_offset > cf->size ||
+        cf->phdrs[i].p_filesz > cf->size - cf->phdrs[i].p_offset)
+      goto bad;
+  }
+  return cf;
+
+bad:
+  CoreFileClose(cf);
+  errno = ENOEXEC;
+  return NULL;
+}
+
+/* Maps the core file "fn". Returns NULL with errno set on failure,
+ * ENOEXEC if it is not a 32-bit little endian core or its program
+ * headers point outside the file.
+ */
+CoreFile *CoreFileOpen(const char *fn) {
+  struct stat st;
+  void       *image;
+  int         fd;
+
+  if ((fd = open(fn, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size < (off_t)sizeof(Elf32_Ehdr)) {
+    close(fd);
+    errno = ENOEXEC;
+    return NULL;
+  }
+  image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED)
+    return NULL;
+  return setup(image, st.st_size, 1);
+}
+
+/* Like CoreFileOpen(), but reads the core into "*buf", which holds
+ * "*capacity" bytes and is grown as needed, instead of mapping it. The
+ * buffer stays the caller's, for the next core, and the CoreFile is only
+ * valid until it is reused. Threads that go through many cores each with
+ * a buffer of their own avoid mapping and unmapping one per core, which
+ * all threads of the process contend for.
+ */
+CoreFile *CoreFileRead(const char *fn, uint8_t **buf, size_t *capacity) {
+  struct stat st;
+  size_t      done = 0;
+  int         fd;
+
+  if ((fd = open(fn, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0)
+    goto fail;
+  if (st.st_size < (off_t)sizeof(Elf32_Ehdr)) {
+    errno = ENOEXEC;
+    goto fail;
+  }
+  if ((size_t)st.st_size > *capacity) {
+    uint8_t *p = realloc(*buf, st.st_size);
+    if (!p)
+      goto fail;
+    *buf      = p;
+    *capacity = st.st_size;
+  }
+  while (done < (size_t)st.st_size) {
+    ssize_t n = read(fd, *buf + done, st.st_size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      errno = n ? errno : EIO;
+      goto fail;
+    }
+    done += n;
+  }
+  close(fd);
+  return setup(*buf, done, 0);
+
+fail:
+  close(fd);
+  return NULL;
+}
+
+void CoreFileClose(CoreFile *cf) {
+  if (!cf)
+    return;
+  if (cf->mapped)
+    munmap((void *)cf->image, cf->size);
+  free(cf);
+}
+
+/* Returns the "len" bytes of target memory at "addr", or NULL if they are
+ * not all in the file part of one PT_LOAD segment.
+ */
+const uint8_t *CoreFileMemory(const CoreFile *cf, uint64_t addr, size_t len) {
+  int i;
+
+  for (i = 0; i < cf->num_phdrs; i++) {
+    const Elf32_Phdr *p = &cf->phdrs[i];
+    if (p->p_type == PT_LOAD && addr >= p->p_vaddr &&
+        addr - p->p_vaddr <= p->p_filesz &&
+        len <= p->p_filesz - (addr - p->p_vaddr))
+      return cf->image + p->p_offset + (addr - p->p_vaddr);
+  }
+  return NULL;
+}
+
+/* Returns the descriptor of the first note of "type" owned by "name", and
+ * its size in "len", or NULL if the core has none. The owner may be given
+ * with or without its terminating NUL, as "CORE" is in elfcore.c.
+ */
+const void *CoreFileNote(const CoreFile *cf, const char *name, uint32_t type,
+                         size_t *len) {
+  size_t namesz = strlen(name);
+  int    i;
+
+  for (i = 0; i < cf->num_phdrs; i++) {
+    const Elf32_Phdr *p = &cf->phdrs[i];
+    const uint8_t    *notes = cf->image + p->p_offset;
+    size_t            off = 0;
+    if (p->p_type != PT_NOTE)
+      continue;
+    while (p->p_filesz - off >= sizeof(Elf32_Nhdr)) {
+      Elf32_Nhdr nhdr;
+      size_t     desc;
+      memcpy(&nhdr, notes + off, sizeof(nhdr));
+      desc = off + sizeof(nhdr) + ((nhdr.n_namesz + 3) & ~(size_t)3);
+      if (nhdr.n_namesz > p->p_filesz || nhdr.n_descsz > p->p_filesz ||
+          desc + nhdr.n_descsz > p->p_filesz)
+        break;
+      if (nhdr.n_type == type &&
+          (nhdr.n_namesz == namesz || nhdr.n_namesz == namesz + 1) &&
+          memcmp(notes + off + sizeof(nhdr), name, nhdr.n_namesz) == 0) {
+        *len = nhdr.n_descsz;
+        return notes + desc;
+      }
+      off = desc + ((nhdr.n_descsz + 3) & ~(size_t)3);
+    }
+  }
+  return NULL;
+}
+
+/* Copies r0-r15, cpsr and orig_r0 from the first NT_PRSTATUS note, the
+ * registers of the frame the dump was taken with, into "regs". Returns -1
+ * with errno set to ENOENT if the core has none.
+ */
+int CoreFileRegisters(const CoreFile *cf, uint32_t regs[18]) {
+  const uint8_t *prstatus;
+  size_t         len;
+  int            i;
+
+  prstatus = CoreFileNote(cf, "CORE", NT_PRSTATUS, &len);
+  if (!prstatus || len < PR_REG_OFFSET + 18 * 4) {
+    errno = ENOENT;
+    return -1;
+  }
+  for (i = 0; i < 18; i++) {
+    const uint8_t *b = prstatus + PR_REG_OFFSET + 4 * i;
+    regs[i] = b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+  }
+  return 0;
+}
+
+/* Returns the GNU build-id of the firmware that wrote the core and sets
+ * "len" to its length, or returns NULL if the core does not carry one.
+ */
+const uint8_t *CoreFileBuildId(const CoreFile *cf, size_t *len) {
+  const uint8_t *id = CoreFileNote(cf, "GNU", NT_GNU_BUILD_ID, len);
+
+  return id && *len ? id : NULL;
+}
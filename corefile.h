@@ -0,0 +1,27 @@
+/* Read access to the core files that bare_core writes.
+ */
+
+#ifndef _COREFILE_H
+#define _COREFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+  /* A core file mapped read-only, or read into a buffer; see corefile.c.
+   * It is never modified once opened, so any number of threads may share
+   * it.
+   */
+  typedef struct CoreFile CoreFile;
+
+
+CoreFile *CoreFileOpen(const char *fn);
+CoreFile *CoreFileRead(const char *fn, uint8_t **buf, size_t *capacity);
+void CoreFileClose(CoreFile *cf);
+const uint8_t *CoreFileMemory(const CoreFile *cf, uint64_t addr, size_t len);
+const void *CoreFileNote(const CoreFile *cf, const char *name, uint32_t type,
+                         size_t *len);
+int CoreFileRegisters(const CoreFile *cf, uint32_t regs[18]);
+const uint8_t *CoreFileBuildId(const CoreFile *cf, size_t *len);
+
+#endif /* _COREFILE_H */
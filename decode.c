@@ -0,0 +1,355 @@
+/*
+ * decode.c
+ *
+ *  bare_core decode: reads framed dump streams (arm/dumpframe.h) from a
+ *  serial port, or from a recording of one, and writes a core file for
+ *  every dump in them. With -s it reads a raw SWO capture instead and
+ *  takes the dumps from one ITM stimulus port (see arm/dumpswo.h).
+ *
+ *  Frames are checked and unpacked as the bytes arrive, and each dump is
+ *  decoded into memory as its frames come in, so a core is written as
+ *  soon as the last frame of its dump has been read. A dump that loses
+ *  frames is dropped, and decoding picks up again with the next dump.
+ */
+
+#include "bare_core.h"
+#include "bootnote.h"
+#include "dumpdecode.h"
+#include "elfcore.h"
+#include "firmware.h"
+#include "framedecode.h"
+#include "swodecode.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+typedef struct session {
+    DumpDecoder *dump;          /* Dump being received, or NULL             */
+    Firmware    *firmware;      /* Baseline of delta dumps, or NULL         */
+    const char  *out_dir;
+    const char  *prefix;
+    int          written;       /* Cores written                            */
+    int          failed;        /* Dumps dropped                            */
+    int          port;          /* SWO: stimulus port carrying the dumps    */
+    int          overflow;      /* SWO: data lost since the last payload    */
+    uint8_t      tail[DUMP_STREAM_START - 1]; /* Last bytes seen between   */
+    size_t       tail_len;      /* dumps, maybe the start of the next one   */
+} session;
+
+
+static void drop_dump(session *s, const char *why)
+{
+    fprintf(stderr, "dump %d: %s\n", s->written + s->failed + 1, why);
+    DumpDecoderDestroy(s->dump);
+    s->dump = NULL;
+    s->failed++;
+}
+
+
+static void write_core(session *s)
+{
+    CoreDump dump;
+    CoreNote notes[2];
+    uint8_t  boot[sizeof(BootTimes)];
+    char     path[4096];
+    int      i;
+
+    snprintf(path, sizeof(path), "%s/%s-%d.core", s->out_dir, s->prefix,
+             s->written + s->failed + 1);
+    DumpDecoderGetCore(s->dump, &dump);
+    if (FindBootTimes(&dump, s->firmware, boot) == 0) {
+        /* After the note of the fault, if the dump has one */
+        CoreNote *note = &notes[dump.num_notes];
+        for (i = 0; i < dump.num_notes; i++)
+            notes[i] = dump.notes[i];
+        note->name     = BOOT_NOTE_NAME;
+        note->type     = NT_BARE_BOOT_TIMES;
+        note->desc     = boot;
+        note->descsz   = sizeof(boot);
+        dump.notes     = notes;
+        dump.num_notes++;
+    }
+    if (CreateElfCoreDump(path, &dump, NULL)) {
+        drop_dump(s, strerror(errno));
+        return;
+    }
+    printf("%s: %d regions, pc 0x%08x\n", path, dump.num_regions,
+           dump.frame->arm.IP);
+    DumpDecoderDestroy(s->dump);
+    s->dump = NULL;
+    s->written++;
+}
+
+
+/* Remembers the last bytes of "buf", which is not part of any dump, in
+ * case they are the first part of the header of the next one.
+ */
+static void keep_tail(session *s, const uint8_t *buf, size_t len)
+{
+    size_t keep = sizeof(s->tail);
+
+    if (len >= keep) {
+        memcpy(s->tail, buf + len - keep, keep);
+        s->tail_len = keep;
+        return;
+    }
+    if (s->tail_len + len > keep) {
+        size_t drop = s->tail_len + len - keep;
+        memmove(s->tail, s->tail + drop, s->tail_len - drop);
+        s->tail_len -= drop;
+    }
+    memcpy(s->tail + s->tail_len, buf, len);
+    s->tail_len += len;
+}
+
+
+/* Looks for the start of a dump in the bytes kept from earlier payloads
+ * followed by "buf". If it begins in the kept bytes, they are moved to the
+ * front of s->tail and their number is returned. Otherwise returns 0.
+ */
+static size_t start_in_tail(session *s, const uint8_t *buf, size_t len)
+{
+    uint8_t        join[2 * sizeof(s->tail)];
+    size_t         head = len < sizeof(s->tail) ? len : sizeof(s->tail);
+    const uint8_t *start;
+    size_t         carried;
+
+    memcpy(join, s->tail, s->tail_len);
+    memcpy(join + s->tail_len, buf, head);
+    start = FindDumpStream(join, s->tail_len + head);
+    if (!start || start >= join + s->tail_len)
+        return 0;
+    carried = join + s->tail_len - start;
+    memmove(s->tail, start, carried);
+    return carried;
+}
+
+
+/* Feeds the payload of a frame to the dump being received, starting a new
+ * dump at the first record header if there is none. A header may be split
+ * across payloads, so the last few bytes outside a dump are kept for the
+ * next call. A malformed dump is dropped, and the search for the next one
+ * goes on from the byte after the point where it was fed.
+ */
+static int payload(void *arg, const uint8_t *buf, size_t len, int lost)
+{
+    session *s = (session *)arg;
+    ssize_t  n;
+
+    if (lost) {
+        if (s->dump)
+            drop_dump(s, "data lost");
+        s->tail_len = 0;
+    }
+    while (len) {
+        if (!s->dump) {
+            size_t carried = s->tail_len ? start_in_tail(s, buf, len) : 0;
+            if (!carried) {
+                const uint8_t *start = FindDumpStream(buf, len);
+                if (!start) {
+                    keep_tail(s, buf, len);
+                    return 0;
+                }
+                len -= start - buf;
+                buf  = start;
+            }
+            s->tail_len = 0;
+            if ((s->dump = DumpDecoderCreate()) == NULL)
+                return -1;
+            if (s->firmware)
+                DumpDecoderSetBaseline(s->dump, FirmwareBaseline, s->firmware);
+            if (carried && DumpDecoderFeed(s->dump, s->tail, carried) < 0) {
+                drop_dump(s, strerror(errno));
+                continue;
+            }
+        }
+        if ((n = DumpDecoderFeed(s->dump, buf, len)) < 0) {
+            drop_dump(s, strerror(errno));
+            n = 1;
+        } else if (DumpDecoderDone(s->dump))
+            write_core(s);
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+static int swo_port(void *arg, int port, const uint8_t *buf, size_t len)
+{
+    session *s = (session *)arg;
+    int      lost;
+
+    if (port == SWO_OVERFLOW)
+        s->overflow = 1;
+    if (port != s->port)
+        return 0;
+    lost = s->overflow;
+    s->overflow = 0;
+    return payload(s, buf, len, lost);
+}
+
+
+/* Puts a serial port into raw mode at "baud".
+ */
+static int setup_tty(int fd, speed_t baud)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio) < 0)
+        return -1;
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN]  = 1;
+    tio.c_cc[VTIME] = 0;
+    if (cfsetspeed(&tio, baud) < 0)
+        return -1;
+    return tcsetattr(fd, TCSANOW, &tio);
+}
+
+
+static speed_t baud_rate(int baud)
+{
+    switch (baud) {
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default:     return 0;
+    }
+}
+
+
+static void decode_usage(void)
+{
+    fprintf(stderr,
+            "usage: bare_core decode [-b baud | -s port] [-f firmware]\n"
+            "                        [-o dir] [-p prefix] (device | file | -)\n"
+            "\n"
+            "Reads framed dumps from a serial device (set to baud, default\n"
+            "115200), a recorded byte stream or standard input, and writes\n"
+            "dir/prefix-N.core (default: ./dump-N.core) for the Nth dump.\n"
+            "Delta regions are rebuilt against the firmware ELF file.\n"
+            "\n"
+            "With -s, the input is a raw SWO capture (ITM packets, TPIU\n"
+            "formatter off) and the dumps are read from stimulus port.\n");
+}
+
+
+int decode_main(int argc, char *argv[])
+{
+    session       s;
+    FrameDecoder *frames = NULL;
+    SwoDecoder   *swo = NULL;
+    const char   *firmware = NULL;
+    speed_t       speed = B115200;
+    uint8_t       buf[65536];
+    ssize_t       n;
+    int           fd, opt, rc = 0, err;
+
+    memset(&s, 0, sizeof(s));
+    s.out_dir = ".";
+    s.prefix  = "dump";
+    s.port    = -1;
+    while ((opt = getopt(argc, argv, "b:f:o:p:s:")) != -1) {
+        switch (opt) {
+        case 'b':
+            if ((speed = baud_rate(atoi(optarg))) == 0) {
+                fprintf(stderr, "unsupported baud rate %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'f':
+            firmware = optarg;
+            break;
+        case 'o':
+            s.out_dir = optarg;
+            break;
+        case 'p':
+            s.prefix = optarg;
+            break;
+        case 's':
+            s.port = atoi(optarg);
+            break;
+        default:
+            decode_usage();
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        decode_usage();
+        return 2;
+    }
+
+    if (firmware && (s.firmware = FirmwareOpen(firmware)) == NULL) {
+        perror(firmware);
+        return 1;
+    }
+    if (strcmp(argv[optind], "-") == 0)
+        fd = 0;
+    else if ((fd = open(argv[optind], O_RDONLY | O_NOCTTY)) < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (isatty(fd) && setup_tty(fd, speed) < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (s.port >= 0 ? (swo = SwoDecoderCreate(swo_port, &s)) == NULL
+                    : (frames = FrameDecoderCreate(payload, &s)) == NULL) {
+        perror("decode");
+        return 1;
+    }
+
+    for (;;) {
+        if ((n = read(fd, buf, sizeof(buf))) < 0 && errno == EINTR)
+            continue;
+        /* A pty reports EIO once the other side has closed */
+        if (n < 0 && errno != EIO) {
+            perror(argv[optind]);
+            rc = 1;
+        }
+        if (n <= 0)
+            break;
+        err = swo ? SwoDecoderFeed(swo, buf, n)
+                  : FrameDecoderFeed(frames, buf, n);
+        if (err) {
+            perror("decode");
+            rc = 1;
+            break;
+        }
+    }
+    if (s.dump)
+        drop_dump(&s, "incomplete");
+
+    printf("%d cores, %d dumps dropped; ", s.written, s.failed);
+    if (swo) {
+        const SwoStats *st = SwoDecoderStats(swo);
+        printf("%llu port packets, %llu overflows, %llu other packets\n",
+               (unsigned long long)st->packets,
+               (unsigned long long)st->overflows,
+               (unsigned long long)st->other);
+        SwoDecoderDestroy(swo);
+    } else {
+        const FrameStats *st = FrameDecoderStats(frames);
+        printf("%llu frames, %llu CRC errors, %llu lost, "
+               "%llu bytes skipped\n", (unsigned long long)st->frames,
+               (unsigned long long)st->crc_errors,
+               (unsigned long long)st->lost,
+               (unsigned long long)st->skipped);
+        FrameDecoderDestroy(frames);
+    }
+    FirmwareClose(s.firmware);
+    if (fd)
+        close(fd);
+    return rc || s.failed;
+}
@@ -0,0 +1,445 @@
+/* Decoder for the dump streams written by arm/dumpstream.c.
+ *
+ * The decoder is fed the stream in pieces of any size, as they arrive
+ * from a file, a serial port or a trace capture, and expands each region
+ * straight into the buffer that later becomes its CoreRegion. Only the
+ * record header or token that straddles two pieces is ever buffered, so
+ * decoding is a single pass over the input with no copies beyond the
+ * output itself.
+ *
+ * A delta region starts out as a copy of its baseline, obtained from the
+ * callback set with DumpDecoderSetBaseline() (zeros without one). The
+ * changed chunks are decoded into a separate buffer and then laid over
+ * it, and the result must match the CRC-32 sent by the target; if it
+ * does not, the baseline is not the firmware that ran on the target.
+ */
+
+#include "dumpdecode.h"
+#include "arm/dumpstream.h"
+
+#include <libelf/libelf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Refuse to allocate more than this for a single region of a stream that
+ * is corrupt or not a dump at all.
+ */
+#define DUMP_REGION_MAX (256u << 20)
+
+enum {
+  D_HEADER,                     /* Collecting a DumpRecord                  */
+  D_BUILD_ID,                   /* Collecting the build-id of the firmware  */
+  D_FAULT,                      /* Collecting a FaultRecord                 */
+  D_TOKEN,                      /* Collecting a token of a region           */
+  D_LITERAL,                    /* Copying the bytes of a literal           */
+  D_DELTA,                      /* Collecting the CRC and bitmap of a delta */
+  D_DONE,                       /* Seen DUMP_REC_END                        */
+  D_ERROR                       /* Stream is malformed                      */
+};
+
+_Static_assert(sizeof(FaultRecord) >= 4 + DUMP_DELTA_MAX_CHUNKS / 8,
+               "DumpDecoder.part is too small for a delta bitmap");
+_Static_assert(sizeof(FaultRecord) >= DUMP_BUILD_ID_MAX,
+               "DumpDecoder.part is too small for a build-id");
+
+struct DumpDecoder {
+  int             state;
+  uint8_t         part[sizeof(FaultRecord)]; /* Header, token, fault or  */
+                                             /* CRC and bitmap of a delta */
+  size_t          have, need;   /* Bytes in "part", bytes wanted there      */
+  uint32_t        literal;      /* Literal bytes still to copy              */
+  uint8_t        *out;          /* Region being decoded                     */
+  uint32_t        addr, size, pos;
+  uint8_t        *delta;        /* Delta region being rebuilt, or NULL      */
+  uint32_t        delta_size, crc;
+  uint8_t         changed[DUMP_DELTA_MAX_CHUNKS / 8];
+  DumpBaselineFn  baseline;
+  void           *baseline_arg;
+  CoreRegion     *regions;
+  int             num_regions, capacity;
+  Frame           frame;
+  uint8_t         fault[sizeof(FaultRecord) - sizeof(FaultRegs)];
+  CoreNote        fault_note;   /* Of "fault", once there is a FaultRecord  */
+  uint8_t         build_id[DUMP_BUILD_ID_MAX];
+  uint32_t        build_id_size;
+};
+
+
+static uint32_t get32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int malformed(void) {
+  errno = EINVAL;
+  return -1;
+}
+
+DumpDecoder *DumpDecoderCreate(void) {
+  DumpDecoder *d = calloc(1, sizeof(DumpDecoder));
+
+  if (d)
+    d->need = sizeof(DumpRecord);
+  return d;
+}
+
+/* Appends the region that has just been decoded to the list.
+ */
+static int add_region(DumpDecoder *d) {
+  CoreRegion *r;
+
+  if (d->num_regions == d->capacity) {
+    int capacity = d->capacity ? 2 * d->capacity : 4;
+    if (!(r = realloc(d->regions, capacity * sizeof(CoreRegion))))
+      return -1;
+    d->regions  = r;
+    d->capacity = capacity;
+  }
+  r = &d->regions[d->num_regions++];
+  memset(r, 0, sizeof(CoreRegion));
+  r->addr  = d->addr;
+  r->size  = d->size;
+  r->flags = PF_R|PF_W;
+  r->buf   = d->out;
+  r->fd    = -1;
+  d->out   = NULL;
+  return 0;
+}
+
+static int chunk_changed(const DumpDecoder *d, uint32_t i) {
+  return d->changed[i / 8] & 1 << (i % 8);
+}
+
+/* Lays the decoded chunks of a delta over its baseline and checks the
+ * result.
+ */
+static int finish_delta(DumpDecoder *d) {
+  uint32_t i, off, len, pos = 0;
+
+  for (i = 0, off = 0; off < d->delta_size; i++, off += len) {
+    len = d->delta_size - off < DUMP_CHUNK_SIZE ? d->delta_size - off
+                                                : DUMP_CHUNK_SIZE;
+    if (chunk_changed(d, i)) {
+      memcpy(d->delta + off, d->out + pos, len);
+      pos += len;
+    }
+  }
+  free(d->out);
+  d->out   = d->delta;
+  d->size  = d->delta_size;
+  d->delta = NULL;
+  if (crc32(crc32(0, NULL, 0), d->out, d->size) != d->crc) {
+    errno = EBADMSG;
+    return -1;
+  }
+  return 0;
+}
+
+/* Moves on to the next token of the current region, or to the next record
+ * once the region is complete.
+ */
+static int next_token(DumpDecoder *d) {
+  d->have = 0;
+  if (d->pos < d->size) {
+    d->state = D_TOKEN;
+    d->need  = 1;
+    return 0;
+  }
+  d->state = D_HEADER;
+  d->need  = sizeof(DumpRecord);
+  if (d->delta && finish_delta(d) < 0)
+    return -1;
+  return add_region(d);
+}
+
+static int header_done(DumpDecoder *d) {
+  const uint8_t *p = d->part;
+  uint32_t type = get32(p + 4);
+
+  if (get32(p) != DUMP_MAGIC)
+    return malformed();
+  d->addr = get32(p + 8);
+  d->size = get32(p + 12);
+  d->pos  = 0;
+  d->have = 0;
+  switch (type) {
+    case DUMP_REC_BEGIN:
+      if (d->size > DUMP_BUILD_ID_MAX)
+        return malformed();
+      if (d->size) {
+        d->state = D_BUILD_ID;
+        d->need  = d->size;
+      }
+      return 0;
+    case DUMP_REC_END:
+      d->state = D_DONE;
+      return 0;
+    case DUMP_REC_FAULT:
+      if (d->size != sizeof(FaultRecord))
+        return malformed();
+      d->state = D_FAULT;
+      d->need  = sizeof(FaultRecord);
+      return 0;
+    case DUMP_REC_REGION:
+      if (d->size > DUMP_REGION_MAX)
+        return malformed();
+      if (!(d->out = malloc(d->size ? d->size : 1)))
+        return -1;
+      return next_token(d);
+    case DUMP_REC_DELTA:
+      if (d->size > DUMP_DELTA_MAX_CHUNKS * DUMP_CHUNK_SIZE)
+        return malformed();
+      d->state = D_DELTA;
+      d->need  = 4 + (d->size + 8*DUMP_CHUNK_SIZE - 1) / (8*DUMP_CHUNK_SIZE);
+      return 0;
+    default:
+      return malformed();
+  }
+}
+
+static int build_id_done(DumpDecoder *d) {
+  memcpy(d->build_id, d->part, d->size);
+  d->build_id_size = d->size;
+  d->state = D_HEADER;
+  d->have  = 0;
+  d->need  = sizeof(DumpRecord);
+  return 0;
+}
+
+static int fault_done(DumpDecoder *d) {
+  int i;
+
+  memset(&d->frame, 0, sizeof(d->frame));
+  for (i = 0; i < 18; i++)
+    d->frame.arm.uregs[i] = get32(d->part + 4*i);
+  d->frame.tid = 1;
+  memcpy(d->fault, d->part + sizeof(FaultRegs), sizeof(d->fault));
+  d->fault_note.name   = FAULT_NOTE_NAME;
+  d->fault_note.type   = NT_BARE_FAULT;
+  d->fault_note.desc   = d->fault;
+  d->fault_note.descsz = sizeof(d->fault);
+  d->state = D_HEADER;
+  d->have  = 0;
+  d->need  = sizeof(DumpRecord);
+  return 0;
+}
+
+/* Sets up the region of a delta from its baseline, and a buffer for its
+ * changed chunks, which the tokens decode into.
+ */
+static int delta_done(DumpDecoder *d) {
+  uint32_t i, off, changed = 0;
+
+  d->crc = get32(d->part);
+  memset(d->changed, 0, sizeof(d->changed));
+  memcpy(d->changed, d->part + 4, d->need - 4);
+  for (i = 0, off = 0; off < d->size; i++, off += DUMP_CHUNK_SIZE) {
+    if (chunk_changed(d, i))
+      changed += d->size - off < DUMP_CHUNK_SIZE ? d->size - off
+                                                 : DUMP_CHUNK_SIZE;
+  }
+  if (!(d->delta = malloc(d->size ? d->size : 1)) ||
+      !(d->out = malloc(changed ? changed : 1)))
+    return -1;
+  if (!d->baseline)
+    memset(d->delta, 0, d->size);
+  else if (d->baseline(d->baseline_arg, d->addr, d->delta, d->size) < 0)
+    return -1;
+  d->delta_size = d->size;
+  d->size       = changed;
+  d->pos        = 0;
+  return next_token(d);
+}
+
+static int token_done(DumpDecoder *d) {
+  uint8_t  c = d->part[0];
+  uint32_t count, len, i;
+
+  if ((c & DUMP_TOK_KIND) < DUMP_TOK_BYTES) {
+    d->literal = c + 1;
+    if (d->literal > d->size - d->pos)
+      return malformed();
+    d->state = D_LITERAL;
+    return 0;
+  }
+  /* Run tokens carry a length byte and their pattern after "c".
+   */
+  len = (c & DUMP_TOK_KIND) == DUMP_TOK_WORDS ? 6 : 3;
+  if (d->have < len) {
+    d->need = len;
+    return 0;
+  }
+  count = ((c & 0x3f) << 8 | d->part[1]);
+  if (len == 3) {
+    count += DUMP_BYTES_MIN;
+    if (count > d->size - d->pos)
+      return malformed();
+    memset(d->out + d->pos, d->part[2], count);
+  } else {
+    count += DUMP_WORDS_MIN;
+    if (count > (d->size - d->pos) / 4)
+      return malformed();
+    for (i = 0; i < count; i++)
+      memcpy(d->out + d->pos + 4*i, d->part + 2, 4);
+    count *= 4;
+  }
+  d->pos += count;
+  return next_token(d);
+}
+
+/* Decodes up to "len" bytes of stream. Returns the number of bytes used,
+ * which is less than "len" only once the end of the dump has been seen,
+ * or -1 with errno set to EINVAL if the stream is malformed (and ENOMEM
+ * if a region cannot be allocated).
+ */
+ssize_t DumpDecoderFeed(DumpDecoder *d, const void *buf, size_t len) {
+  const uint8_t *p = (const uint8_t *)buf;
+  size_t         used = 0, n;
+  int            rc = 0;
+
+  while (used < len && rc == 0) {
+    switch (d->state) {
+      case D_DONE:
+        return used;
+      case D_ERROR:
+        errno = EINVAL;
+        return -1;
+      case D_LITERAL:
+        n = len - used < d->literal ? len - used : d->literal;
+        memcpy(d->out + d->pos, p + used, n);
+        d->pos     += n;
+        d->literal -= n;
+        used       += n;
+        if (d->literal == 0)
+          rc = next_token(d);
+        continue;
+      default:
+        break;
+    }
+
+    n = d->need - d->have;
+    if (n > len - used)
+      n = len - used;
+    memcpy(d->part + d->have, p + used, n);
+    d->have += n;
+    used    += n;
+    if (d->have < d->need)
+      continue;
+    switch (d->state) {
+      case D_HEADER:   rc = header_done(d);   break;
+      case D_BUILD_ID: rc = build_id_done(d); break;
+      case D_FAULT:    rc = fault_done(d);    break;
+      case D_TOKEN:    rc = token_done(d);    break;
+      case D_DELTA:    rc = delta_done(d);    break;
+    }
+  }
+  if (rc) {
+    d->state = D_ERROR;
+    return -1;
+  }
+  return used;
+}
+
+/* Makes "baseline" supply the contents that delta regions are relative
+ * to. It must fill "len" bytes at "buf" with the baseline of the region
+ * at "addr" and return 0, or -1 with errno set.
+ */
+void DumpDecoderSetBaseline(DumpDecoder *d, DumpBaselineFn baseline,
+                            void *arg) {
+  d->baseline     = baseline;
+  d->baseline_arg = arg;
+}
+
+/* Returns non-zero once the whole dump has been decoded.
+ */
+int DumpDecoderDone(const DumpDecoder *d) {
+  return d->state == D_DONE;
+}
+
+/* Describes the regions decoded so far, the registers of the fault record
+ * if there was one, with the rest of it as the one note, and the build-id
+ * of the firmware if the dump has it, in "dump". It stays valid until the
+ * decoder is destroyed.
+ */
+void DumpDecoderGetCore(DumpDecoder *d, CoreDump *dump) {
+  memset(dump, 0, sizeof(CoreDump));
+  dump->regions       = d->regions;
+  dump->num_regions   = d->num_regions;
+  dump->frame         = &d->frame;
+  dump->target        = CORE_TARGET_ARM32_LE;
+  if (d->fault_note.name) {
+    dump->notes         = &d->fault_note;
+    dump->num_notes     = 1;
+  }
+  dump->build_id      = d->build_id_size ? d->build_id : NULL;
+  dump->build_id_size = d->build_id_size;
+}
+
+void DumpDecoderDestroy(DumpDecoder *d) {
+  int i;
+
+  if (!d)
+    return;
+  for (i = 0; i < d->num_regions; i++)
+    free((void *)d->regions[i].buf);
+  free(d->regions);
+  free(d->out);
+  free(d->delta);
+  free(d);
+}
+
+/* Decodes the complete dump in "fn", with "baseline" for its deltas.
+ * Returns NULL with errno set on failure, including EINVAL for a dump
+ * that is cut short and EBADMSG for a delta that does not match its
+ * baseline.
+ */
+DumpDecoder *DumpDecodeFile(const char *fn, DumpBaselineFn baseline,
+                            void *arg) {
+  DumpDecoder *d;
+  uint8_t      buf[65536];
+  ssize_t      rc;
+  int          fd, err;
+
+  if ((fd = open(fn, O_RDONLY)) < 0)
+    return NULL;
+  if (!(d = DumpDecoderCreate())) {
+    close(fd);
+    return NULL;
+  }
+  DumpDecoderSetBaseline(d, baseline, arg);
+  while (!DumpDecoderDone(d)) {
+    if ((rc = read(fd, buf, sizeof(buf))) < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0) {
+      errno = rc ? errno : EINVAL;
+      break;
+    }
+    if (DumpDecoderFeed(d, buf, rc) < 0)
+      break;
+  }
+  err = errno;
+  close(fd);
+  if (!DumpDecoderDone(d)) {
+    DumpDecoderDestroy(d);
+    errno = err;
+    return NULL;
+  }
+  return d;
+}
+
+/* Returns the first byte in "buf" that starts a dump, that is the header
+ * of a DUMP_REC_BEGIN record, or NULL if there is none.
+ */
+const void *FindDumpStream(const void *buf, size_t len) {
+  const uint8_t *p = (const uint8_t *)buf, *end = p + len;
+
+  for (; (p = memchr(p, DUMP_MAGIC & 0xff, end - p)) != NULL; p++) {
+    if (end - p >= DUMP_STREAM_START && get32(p) == DUMP_MAGIC &&
+        get32(p + 4) == DUMP_REC_BEGIN)
+      return p;
+  }
+  return NULL;
+}
@@ -0,0 +1,40 @@
+/* Decoder for the dump streams written by arm/dumpstream.c.
+ */
+
+#ifndef _DUMPDECODE_H
+#define _DUMPDECODE_H
+
+#include "elfcore.h"
+
+
+  /* Turns a dump stream back into the regions and registers of a core.
+   * See dumpdecode.c.
+   */
+  typedef struct DumpDecoder DumpDecoder;
+
+  /* Supplies the baseline of a delta region; see DumpDecoderSetBaseline().
+   */
+  typedef int (*DumpBaselineFn)(void *arg, uint64_t addr, void *buf,
+                                size_t len);
+
+  /* Owner of the NT_BARE_FAULT note (arm/fault.h) of decoded cores */
+  #define FAULT_NOTE_NAME "BARE"
+
+  /* Bytes FindDumpStream() needs to see to recognise the start of a dump:
+   * the magic and type of a DUMP_REC_BEGIN header.
+   */
+  #define DUMP_STREAM_START 8
+
+
+DumpDecoder *DumpDecoderCreate(void);
+void DumpDecoderSetBaseline(DumpDecoder *d, DumpBaselineFn baseline,
+                            void *arg);
+ssize_t DumpDecoderFeed(DumpDecoder *d, const void *buf, size_t len);
+int DumpDecoderDone(const DumpDecoder *d);
+void DumpDecoderGetCore(DumpDecoder *d, CoreDump *dump);
+void DumpDecoderDestroy(DumpDecoder *d);
+DumpDecoder *DumpDecodeFile(const char *fn, DumpBaselineFn baseline,
+                            void *arg);
+const void *FindDumpStream(const void *buf, size_t len);
+
+#endif /* _DUMPDECODE_H */
@@ -31,6 +31,10 @@
  * Author: Markus Gutschke
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "elfcore.h"
 
 #include <libelf/libelf.h>
@@ -38,12 +42,13 @@
 #include <limits.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
-#include <sys/sysctl.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
@@ -52,40 +57,42 @@
 
 #include <assert.h>
 
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #ifndef CLONE_UNTRACED
 #define CLONE_UNTRACED 0x00800000
 #endif
 
-/* Data structures found in x86-32/64 and ARM core dumps on Linux; similar
- * data structures are defined in /usr/include/{linux,asm}/... but those
- * headers conflict with the rest of the libc headers. So we cannot
- * include them here.
- */
-
-  typedef struct fpxregs {      /* No extended FPU registers on ARM          */
-  } fpxregs;
-  typedef struct fpregs {       /* FPU registers                             */
-    struct fp_reg {
-      unsigned int sign1:1;
-      unsigned int unused:15;
-      unsigned int sign2:1;
-      unsigned int exponent:14;
-      unsigned int j:1;
-      unsigned int mantissa1:31;
-      unsigned int mantissa0:32;
-    } fpregs[8];
-    unsigned int   fpsr:32;
-    unsigned int   fpcr:32;
-    unsigned char  ftype[8];
-    unsigned int   init_flag;
-  } fpregs;
-  #define regs arm_regs         /* General purpose registers                 */
-
-typedef struct elf_timeval {    /* Time value with microsecond resolution    */
-  long tv_sec;                  /* Seconds                                   */
-  long tv_usec;                 /* Microseconds                              */
-} elf_timeval;
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#ifndef EM_AARCH64
+#define EM_AARCH64 183
+#endif
+
+/* Byte sex of the host, fixed at compile time.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_MSB 1
+#else
+#define HOST_MSB 0
+#endif
 
+/* Data structures found in ARM core dumps on Linux; similar data
+ * structures are defined in /usr/include/{linux,asm}/... but those
+ * headers conflict with the rest of the libc headers, and describe the
+ * host rather than the target. The structures whose layout depends on the
+ * target live in elfcore_target.h.
+ */
 
 typedef struct elf_siginfo {    /* Information about signal (unused)         */
   int32_t si_signo;             /* Signal number                             */
@@ -94,71 +101,6 @@ typedef struct elf_siginfo {    /* Information about signal (unused)         */
 } elf_siginfo;
 
 
-typedef struct prstatus {       /* Information about thread; includes CPU reg*/
-  elf_siginfo    pr_info;       /* Info associated with signal               */
-  uint16_t       pr_cursig;     /* Current signal                            */
-  unsigned long  pr_sigpend;    /* Set of pending signals                    */
-  unsigned long  pr_sighold;    /* Set of held signals                       */
-  pid_t          pr_pid;        /* Process ID                                */
-  pid_t          pr_ppid;       /* Parent's process ID                       */
-  pid_t          pr_pgrp;       /* Group ID                                  */
-  pid_t          pr_sid;        /* Session ID                                */
-  elf_timeval    pr_utime;      /* User time                                 */
-  elf_timeval    pr_stime;      /* System time                               */
-  elf_timeval    pr_cutime;     /* Cumulative user time                      */
-  elf_timeval    pr_cstime;     /* Cumulative system time                    */
-  regs           pr_reg;        /* CPU registers                             */
-  uint32_t       pr_fpvalid;    /* True if math co-processor being used      */
-} prstatus;
-
-
-typedef struct prpsinfo {       /* Information about process                 */
-  unsigned char  pr_state;      /* Numeric process state                     */
-  char           pr_sname;      /* Char for pr_state                         */
-  unsigned char  pr_zomb;       /* Zombie                                    */
-  signed char    pr_nice;       /* Nice val                                  */
-  unsigned long  pr_flag;       /* Flags                                     */
-  uint16_t       pr_uid;        /* User ID                                   */
-  uint16_t       pr_gid;        /* Group ID                                  */
-  pid_t          pr_pid;        /* Process ID                                */
-  pid_t          pr_ppid;       /* Parent's process ID                       */
-  pid_t          pr_pgrp;       /* Group ID                                  */
-  pid_t          pr_sid;        /* Session ID                                */
-  char           pr_fname[16];  /* Filename of executable                    */
-  char           pr_psargs[80]; /* Initial part of arg list                  */
-} prpsinfo;
-
-
-typedef struct user {           /* Ptrace returns this data for thread state */
-  regs           regs;          /* CPU registers                             */
-  unsigned long  fpvalid;       /* True if math co-processor being used      */
-  unsigned long  tsize;         /* Text segment size in pages                */
-  unsigned long  dsize;         /* Data segment size in pages                */
-  unsigned long  ssize;         /* Stack segment size in pages               */
-  unsigned long  start_code;    /* Starting virtual address of text          */
-  unsigned long  start_stack;   /* Starting virtual address of stack area    */
-  unsigned long  signal;        /* Signal that caused the core dump          */
-  unsigned long  reserved;      /* No longer used                            */
-  regs           *regs_ptr;     /* Used by gdb to help find the CPU registers*/
-  unsigned long  magic;         /* Magic for old A.OUT core files            */
-  char           comm[32];      /* User command that was responsible         */
-  unsigned long  debugreg[8];
-  fpregs         fpregs;        /* FPU registers                             */
-  fpregs         *fpregs_ptr;   /* Pointer to FPU registers                  */
-} user;
-
-
-
-  #define ELF_CLASS ELFCLASS32
-  #define Ehdr      Elf32_Ehdr
-  #define Phdr      Elf32_Phdr
-  #define Shdr      Elf32_Shdr
-  #define Nhdr      Elf32_Nhdr
-
-
-  #define ELF_ARCH  EM_ARM
-
-
 /* Re-runs fn until it doesn't cause EINTR
  */
 #define NO_INTR(fn)    do {} while ((fn) < 0 && errno == EINTR)
@@ -186,6 +128,41 @@ ssize_t c_write(int f, const void *void_buf, size_t bytes)
 }
 
 
+/* Wrapper for writev() which is guaranteed to never return EINTR nor
+ * short writes. The iovec array is used as scratch space and is modified
+ * as data gets written.
+ */
+ssize_t c_writev(int f, struct iovec *iov, int iovcnt)
+{
+    ssize_t total = 0;
+    while (iovcnt > 0) {
+      ssize_t rc;
+      NO_INTR(rc = writev(f, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt));
+      if (rc < 0) {
+        return rc;
+      } else if (rc == 0) {
+        break;
+      }
+      total += rc;
+      while (iovcnt > 0 && (size_t)rc >= iov->iov_len) {
+        rc -= iov->iov_len;
+        iov++;
+        iovcnt--;
+      }
+      if (rc > 0) {
+        iov->iov_base = (char *)iov->iov_base + rc;
+        iov->iov_len -= rc;
+      }
+    }
+    return total;
+}
+
+
+/* Plumbing for compressed cores: the ELF stream, at most "max_length"
+ * bytes of it, is written to "write_fd". The compressor thread reads it
+ * back from the other end of the pipe, "compressed_fd", and writes the
+ * compressed data to "out_fd".
+ */
 struct WriterFds {
   size_t max_length;
   int    write_fd;
@@ -193,187 +170,964 @@ struct WriterFds {
   int    out_fd;
 };
 
+/* The ELF header, the program header table and the note segment are
+ * assembled in "buf" and then handed to the kernel in a single writev()
+ * together with the memory segments. Cores with too many segments for
+ * "buf" get a heap allocated block instead; "start" points at whichever
+ * one is in use.
+ */
 struct io {
   int fd;
-  unsigned char *data, *end;
+  unsigned char *start, *data, *end;
   unsigned char buf[4096];
 };
 
 
-/* Dynamically determines the byte sex of the system. Returns non-zero
- * for big-endian machines.
+/* Appends "len" bytes to the header block. Returns non-zero if the block
+ * is too small to hold them.
  */
-static inline int sex() {
-  int probe = 1;
-  return !*(char *)&probe;
+static int io_put(struct io *io, const void *src, size_t len) {
+  if ((size_t)(io->end - io->data) < len)
+    return -1;
+  memcpy(io->data, src, len);
+  io->data += len;
+  return 0;
 }
 
 
-/* This function is invoked from a seperate process. It has access to a
- * copy-on-write copy of the parents address space, and all crucial
- * information about the parent has been computed by the caller.
+/* All memory segments in the core file are aligned to this many bytes.
  */
-int CreateElfCore(char *fn, uint32_t ram_addr, uint8_t *raw_buf, uint32_t ram_size, Frame *frame)
-{
-  /* Count the number of mappings in "/proc/self/maps". We are guaranteed
-   * that this number is not going to change while this function executes.
-   */
+#define CORE_PAGESIZE 4096
+
+
+/* A page of zeros for sinks that cannot skip over holes.
+ */
+static const unsigned char zero_page[CORE_PAGESIZE];
+
+
+static int fd_sink_write(CoreSink *sink, struct iovec *iov, int iovcnt) {
+  size_t len = 0;
+  int i;
+  for (i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+  return c_writev(sink->fd, iov, iovcnt) == (ssize_t)len ? 0 : -1;
+}
+
+
+static int fd_sink_skip(CoreSink *sink, uint64_t len) {
+  return lseek(sink->fd, len, SEEK_CUR) < 0 ? -1 : 0;
+}
+
+
+/* Copies "len" bytes at "offset" in "fd" to the current position of the
+ * sink. On Linux the data never passes through user space: whole blocks
+ * are reflinked where the file system supports it, and the rest goes
+ * through copy_file_range(). Anything else is bounced through a buffer.
+ */
+static int fd_sink_copy(CoreSink *sink, int fd, off_t offset, uint64_t len) {
+  int dst = sink->fd;
+  unsigned char scratch[4096];
+#ifdef __linux__
+  /* scope */ {
+    struct stat st;
+    off_t pos = lseek(dst, 0, SEEK_CUR);
+    if (pos >= 0 && fstat(dst, &st) == 0 && st.st_blksize > 0) {
+      uint64_t blocks = len - len % st.st_blksize;
+      if (blocks && offset % st.st_blksize == 0 &&
+          pos % st.st_blksize == 0) {
+        struct file_clone_range range;
+        range.src_fd      = fd;
+        range.src_offset  = offset;
+        range.src_length  = blocks;
+        range.dest_offset = pos;
+        if (ioctl(dst, FICLONERANGE, &range) == 0 &&
+            lseek(dst, pos + blocks, SEEK_SET) == pos + (off_t)blocks) {
+          offset += blocks;
+          len    -= blocks;
+        }
+      }
+    }
+  }
+  while (len > 0) {
+    ssize_t rc;
+    NO_INTR(rc = copy_file_range(fd, &offset, dst, NULL, len, 0));
+    if (rc < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                   errno == EOPNOTSUPP))
+      break;
+    if (rc <= 0)
+      return -1;
+    len -= rc;
+  }
+#endif
+  while (len > 0) {
+    ssize_t rc;
+    NO_INTR(rc = pread(fd, scratch,
+                       len < sizeof(scratch) ? len : sizeof(scratch), offset));
+    if (rc <= 0)
+      return -1;
+    if (c_write(dst, scratch, rc) != rc)
+      return -1;
+    offset += rc;
+    len    -= rc;
+  }
+  return 0;
+}
+
+
+/* Extends the file over any trailing hole.
+ */
+static int fd_sink_finish(CoreSink *sink, uint64_t size) {
+  return ftruncate(sink->fd, size);
+}
+
+
+/* Makes room for at least "len" more bytes in a memory sink.
+ */
+static int mem_sink_reserve(CoreSink *sink, uint64_t len) {
+  size_t   capacity = sink->capacity ? sink->capacity : CORE_PAGESIZE;
+  uint8_t *data;
+  if (sink->size + len <= sink->capacity)
+    return 0;
+  while (capacity < sink->size + len)
+    capacity *= 2;
+  if ((data = realloc(sink->data, capacity)) == NULL)
+    return -1;
+  sink->data     = data;
+  sink->capacity = capacity;
+  return 0;
+}
+
+
+static int mem_sink_write(CoreSink *sink, struct iovec *iov, int iovcnt) {
+  int i;
+  for (i = 0; i < iovcnt; i++) {
+    if (mem_sink_reserve(sink, iov[i].iov_len))
+      return -1;
+    memcpy(sink->data + sink->size, iov[i].iov_base, iov[i].iov_len);
+    sink->size += iov[i].iov_len;
+  }
+  return 0;
+}
+
+
+static int mem_sink_skip(CoreSink *sink, uint64_t len) {
+  if (mem_sink_reserve(sink, len))
+    return -1;
+  memset(sink->data + sink->size, 0, len);
+  sink->size += len;
+  return 0;
+}
+
+
+static int callback_sink_write(CoreSink *sink, struct iovec *iov, int iovcnt) {
+  int i;
+  for (i = 0; i < iovcnt; i++) {
+    if (sink->callback(sink->arg, iov[i].iov_base, iov[i].iov_len))
+      return -1;
+  }
+  return 0;
+}
+
+
+/* Sets up "sink" to write to the file descriptor "fd", which must be
+ * positioned at the start of the core. Holes are left with lseek(), and
+ * file-backed regions are copied by the kernel.
+ */
+void InitFdCoreSink(CoreSink *sink, int fd) {
+  memset(sink, 0, sizeof(*sink));
+  sink->write  = fd_sink_write;
+  sink->skip   = fd_sink_skip;
+  sink->copy   = fd_sink_copy;
+  sink->finish = fd_sink_finish;
+  sink->fd     = fd;
+}
+
+
+/* Sets up "sink" to collect the core in a growable heap buffer, starting
+ * out with room for "capacity" bytes (see ElfCoreSize()). The caller owns
+ * sink->data, which holds sink->size bytes, and must free() it.
+ */
+int InitMemCoreSink(CoreSink *sink, size_t capacity) {
+  memset(sink, 0, sizeof(*sink));
+  sink->write = mem_sink_write;
+  sink->skip  = mem_sink_skip;
+  sink->fd    = -1;
+  return mem_sink_reserve(sink, capacity);
+}
+
+
+/* Sets up "sink" to hand the core to "callback" in order, in pieces of
+ * arbitrary size. Holes are passed on as zeros. The callback returns
+ * non-zero to abort the core.
+ */
+void InitCallbackCoreSink(CoreSink *sink,
+                          int (*callback)(void *arg, const void *buf,
+                                          size_t len),
+                          void *arg) {
+  memset(sink, 0, sizeof(*sink));
+  sink->write    = callback_sink_write;
+  sink->callback = callback;
+  sink->arg      = arg;
+  sink->fd       = -1;
+}
+
+
+/* Program header fields, independent of the ELF class.
+ */
+struct phdr_fields {
+  uint32_t type, flags;
+  uint64_t offset, vaddr, filesz, memsz, align;
+};
+
+
+/* Sizes and serializers of the headers and notes for one flavour of core
+ * file. There is one instance per entry in the CORE_TARGET_* enumeration,
+ * generated from elfcore_target.h.
+ */
+struct elf_target {
+  size_t ehdr_size, phdr_size, nhdr_size, prpsinfo_size, prstatus_size;
+  int  (*put_ehdr)(struct io *io, int phnum);
+  int  (*put_phdr)(struct io *io, const struct phdr_fields *f);
+  int  (*put_nhdr)(struct io *io, const char *name, uint32_t namesz,
+                   uint32_t descsz, uint32_t type);
+  int  (*put_prpsinfo)(struct io *io, const Frame *frame);
+  int  (*put_prstatus)(struct io *io, const Frame *frame);
+};
+
+#define TARGET       arm32le
+#define TARGET_CLASS 32
+#define TARGET_MSB   0
+#define TARGET_MACH  EM_ARM
+#define TARGET_NREGS 18
+#define TARGET_UID   16
+#define TARGET_PRSTATUS_SIZE   148
+#define TARGET_PR_REG_OFFSET   72
+#define TARGET_PRPSINFO_SIZE   124
+#define TARGET_PR_FNAME_OFFSET 28
+#include "elfcore_target.h"
+
+#define TARGET       arm32be
+#define TARGET_CLASS 32
+#define TARGET_MSB   1
+#define TARGET_MACH  EM_ARM
+#define TARGET_NREGS 18
+#define TARGET_UID   16
+#define TARGET_PRSTATUS_SIZE   148
+#define TARGET_PR_REG_OFFSET   72
+#define TARGET_PRPSINFO_SIZE   124
+#define TARGET_PR_FNAME_OFFSET 28
+#include "elfcore_target.h"
+
+#define TARGET       aarch64le
+#define TARGET_CLASS 64
+#define TARGET_MSB   0
+#define TARGET_MACH  EM_AARCH64
+#define TARGET_NREGS 34
+#define TARGET_UID   32
+#define TARGET_PRSTATUS_SIZE   392
+#define TARGET_PR_REG_OFFSET   112
+#define TARGET_PRPSINFO_SIZE   136
+#define TARGET_PR_FNAME_OFFSET 40
+#include "elfcore_target.h"
+
+#define TARGET       aarch64be
+#define TARGET_CLASS 64
+#define TARGET_MSB   1
+#define TARGET_MACH  EM_AARCH64
+#define TARGET_NREGS 34
+#define TARGET_UID   32
+#define TARGET_PRSTATUS_SIZE   392
+#define TARGET_PR_REG_OFFSET   112
+#define TARGET_PRPSINFO_SIZE   136
+#define TARGET_PR_FNAME_OFFSET 40
+#include "elfcore_target.h"
+
+static const struct elf_target *const targets[] = {
+  &target_arm32le,              /* CORE_TARGET_ARM32_LE                      */
+  &target_arm32be,              /* CORE_TARGET_ARM32_BE                      */
+  &target_aarch64le,            /* CORE_TARGET_AARCH64_LE                    */
+  &target_aarch64be,            /* CORE_TARGET_AARCH64_BE                    */
+};
+
+
+/* Returns the serializers for the target of "dump", or NULL if it asks
+ * for one that does not exist.
+ */
+static const struct elf_target *elf_target(const CoreDump *dump) {
+  if (dump->target < 0 ||
+      dump->target >= (int)(sizeof(targets)/sizeof(targets[0])))
+    return NULL;
+  return targets[dump->target];
+}
+
+
+/* Returns non-zero if the contents of "region" go into the core file.
+ * Regions without a buffer or source file only get a program header.
+ */
+static inline int has_contents(const CoreRegion *region) {
+  return region->buf != NULL || region->fd >= 0;
+}
+
+
+/* Returns non-zero if all "len" bytes at "p" are zero. The bytes are
+ * folded into several independent accumulators a word at a time, which
+ * the compiler turns into vector code.
+ */
+static int is_zero(const uint8_t *p, size_t len) {
+  uint64_t acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+  for (; len >= 4*sizeof(uint64_t); len -= 4*sizeof(uint64_t)) {
+    uint64_t w[4];
+    memcpy(w, p, sizeof(w));
+    acc0 |= w[0];
+    acc1 |= w[1];
+    acc2 |= w[2];
+    acc3 |= w[3];
+    p    += sizeof(w);
+  }
+  while (len-- > 0)
+    acc0 |= *p++;
+  return (acc0 | acc1 | acc2 | acc3) == 0;
+}
+
+
+/* Collects the pieces of the core that can go out in one write to the
+ * sink, and tracks the position so that all-zero pages can be left as
+ * holes.
+ */
+struct gather {
+  CoreSink     *sink;
+  struct iovec *iov;
+  int           iovcnt, iovmax;
+  uint64_t      pos;          /* Position after the queued bytes         */
+  CoreStats     stats;
+};
+
+
+static int gather_flush(struct gather *g) {
+  int i;
+  if (g->iovcnt == 0)
+    return 0;
+  for (i = 0; i < g->iovcnt; i++)
+    g->stats.bytes_written += g->iov[i].iov_len;
+  if (g->sink->write(g->sink, g->iov, g->iovcnt))
+    return -1;
+  g->iovcnt = 0;
+  return 0;
+}
+
+
+static int gather_add(struct gather *g, const void *data, size_t len) {
+  struct iovec *last = g->iovcnt ? &g->iov[g->iovcnt - 1] : NULL;
+  if (last && (const char *)last->iov_base + last->iov_len == data) {
+    last->iov_len += len;
+  } else {
+    if (g->iovcnt == g->iovmax && gather_flush(g))
+      return -1;
+    g->iov[g->iovcnt].iov_base = (void *)data;
+    g->iov[g->iovcnt].iov_len  = len;
+    g->iovcnt++;
+  }
+  g->pos += len;
+  return 0;
+}
+
+
+/* Advances to "pos", leaving a hole if the sink supports them and
+ * writing zeros otherwise.
+ */
+static int gather_seek(struct gather *g, uint64_t pos) {
+  if (pos == g->pos)
+    return 0;
+  if (g->sink->skip) {
+    if (gather_flush(g) || g->sink->skip(g->sink, pos - g->pos))
+      return -1;
+    g->pos = pos;
+  }
+  while (g->pos < pos) {
+    uint64_t len = pos - g->pos;
+    if (gather_add(g, zero_page, len < CORE_PAGESIZE ? len : CORE_PAGESIZE))
+      return -1;
+  }
+  return 0;
+}
+
+
+/* Appends "len" bytes at "offset" in "fd", letting the sink copy them
+ * itself if it can and bouncing them through "scratch" otherwise.
+ */
+static int gather_copy(struct gather *g, int fd, off_t offset, uint64_t len,
+                       unsigned char *scratch, size_t scratch_len) {
+  if (gather_flush(g))
+    return -1;
+  if (g->sink->copy) {
+    if (g->sink->copy(g->sink, fd, offset, len))
+      return -1;
+    g->pos                 += len;
+    g->stats.bytes_written += len;
+    return 0;
+  }
+  while (len > 0) {
+    ssize_t rc;
+    NO_INTR(rc = pread(fd, scratch, len < scratch_len ? len : scratch_len,
+                       offset));
+    if (rc <= 0 || gather_add(g, scratch, rc) || gather_flush(g))
+      return -1;
+    offset += rc;
+    len    -= rc;
+  }
+  return 0;
+}
 
-  int handle;
-  prpsinfo      prpsinfo;
-  prstatus      prstatus;
 
+/* Placement of one memory segment in the core file.
+ */
+struct segment {
+  uint64_t offset;
+  uint64_t filesz;
+};
+
+
+/* Computes the size of the headers and notes, the padding that follows
+ * them, and the placement of each memory segment. Each segment starts at
+ * an offset that is congruent to its address modulo the page size, so that
+ * target pages and file system blocks line up. If "max_length" is
+ * non-zero, the contents of the lowest priority regions are cut short
+ * (from the end, a page at a time) until the core fits. "segs" may be NULL
+ * if "max_length" is zero; returns the size of the core file.
+ */
+static uint64_t core_layout(const struct elf_target *t, const CoreDump *dump,
+                            uint64_t max_length, size_t *header_size,
+                            size_t *note_size, size_t *note_align,
+                            struct segment *segs) {
+  const CoreRegion *regions = dump->regions;
   int num_threads = 1;
-  int rc = 0;
-  int num_mappings = 1;
+  uint64_t offset;
+  int i;
+
+  *note_size   = t->nhdr_size + 4 + t->prpsinfo_size +
+                 num_threads*(t->nhdr_size + 4 + t->prstatus_size);
+  if (dump->build_id)
+    *note_size += t->nhdr_size + 4 + ((dump->build_id_size + 3) & ~3);
+  for (i = 0; i < dump->num_notes; i++)
+    *note_size += t->nhdr_size + ((strlen(dump->notes[i].name) + 4) & ~3) +
+                  ((dump->notes[i].descsz + 3) & ~3);
+  *header_size = t->ehdr_size + (dump->num_regions + 1)*t->phdr_size +
+                 *note_size;
+  *note_align  = (CORE_PAGESIZE - *header_size % CORE_PAGESIZE) %
+                 CORE_PAGESIZE;
+  for (i = 0; segs && i < dump->num_regions; i++)
+    segs[i].filesz = has_contents(&regions[i]) ? regions[i].size : 0;
+  for (;;) {
+    uint64_t excess;
+    int      victim = -1;
+
+    offset = *header_size + *note_align;
+    for (i = 0; i < dump->num_regions; i++) {
+      offset += (regions[i].addr - offset) & (CORE_PAGESIZE - 1);
+      if (segs) {
+        segs[i].offset = offset;
+        offset += segs[i].filesz;
+      } else if (has_contents(&regions[i])) {
+        offset += regions[i].size;
+      }
+    }
+    if (!max_length || !segs || offset <= max_length)
+      return offset;
+
+    /* Trimming by whole pages leaves the padding of later segments alone */
+    for (i = 0; i < dump->num_regions; i++) {
+      if (segs[i].filesz &&
+          (victim < 0 || regions[i].priority <= regions[victim].priority))
+        victim = i;
+    }
+    if (victim < 0)
+      return offset;
+    excess = (offset - max_length + CORE_PAGESIZE - 1) &
+             ~(uint64_t)(CORE_PAGESIZE - 1);
+    segs[victim].filesz -= excess < segs[victim].filesz
+                           ? excess : segs[victim].filesz;
+  }
+}
+
+
+/* Returns the exact size of the core that WriteElfCore() produces for
+ * "dump", so that callers can preallocate.
+ */
+uint64_t ElfCoreSize(const CoreDump *dump) {
+  const struct elf_target *t = elf_target(dump);
+  size_t header_size, note_size, note_align;
+  if (!t)
+    return 0;
+  return core_layout(t, dump, 0, &header_size, &note_size, &note_align,
+                     NULL);
+}
+
+
+/* Writes a core of at most "max_length" bytes (zero for no limit) to
+ * "sink". See WriteElfCore().
+ */
+static int write_core(CoreSink *sink, const CoreDump *dump,
+                      uint64_t max_length, CoreStats *stats)
+{
+  const struct elf_target *t = elf_target(dump);
+  const CoreRegion *regions = dump->regions;
+  int num_regions = dump->num_regions;
+  int num_threads = 1;
+  int rc = -1;
   struct io io;
-  struct {
-      size_t start_address, end_address, offset;
-      int   flags;
-    } mappings[1] = {
-            { (size_t)ram_addr, (size_t)ram_addr + ram_size, 0, PF_W|PF_R }
-    };
-
-    size_t note_align;
-    int i;
-    size_t pagesize = 4096;
-
-  io.data = io.end = 0;
-
-  handle = open(fn, O_WRONLY | O_TRUNC | O_CREAT, 0644);
-        /* Write out the ELF header                                          */
-        /* scope */ {
-          Ehdr ehdr;
-          memset(&ehdr, 0, sizeof(Ehdr));
-          ehdr.e_ident[0] = ELFMAG0;
-          ehdr.e_ident[1] = ELFMAG1;
-          ehdr.e_ident[2] = ELFMAG2;
-          ehdr.e_ident[3] = ELFMAG3;
-          ehdr.e_ident[4] = ELF_CLASS;
-          ehdr.e_ident[5] = sex() ? ELFDATA2MSB : ELFDATA2LSB;
-          ehdr.e_ident[6] = EV_CURRENT;
-          ehdr.e_type     = ET_CORE;
-          ehdr.e_machine  = ELF_ARCH;
-          ehdr.e_version  = EV_CURRENT;
-          ehdr.e_phoff    = sizeof(Ehdr);
-          ehdr.e_ehsize   = sizeof(Ehdr);
-          ehdr.e_phentsize= sizeof(Phdr);
-          ehdr.e_phnum    = num_mappings + 1;
-          ehdr.e_shentsize= sizeof(Shdr);
-          if (c_write(handle, &ehdr, sizeof(Ehdr)) != sizeof(Ehdr)) {
-            assert(0);
-            goto done;
-          }
+  struct gather g;
+  struct segment *segs = NULL;
+  uint64_t size;
+  size_t note_align, note_size, header_size;
+  int i;
+
+  memset(&g, 0, sizeof(g));
+  g.sink   = sink;
+  io.fd    = sink->fd;
+  io.start = io.buf;
+
+  /* The layout is computed up front, so that the header block can be
+   * sized exactly once regardless of the number of regions.
+   */
+  if (!t ||
+      (segs = malloc((num_regions + 1)*sizeof(struct segment))) == NULL)
+    return -1;
+  size = core_layout(t, dump, max_length, &header_size, &note_size,
+                     &note_align, segs);
+  if (max_length && size > max_length)
+    goto done;
+  if (header_size + note_align > sizeof(io.buf) &&
+      (io.start = malloc(header_size + note_align)) == NULL)
+    goto done;
+  io.data  = io.start;
+  io.end   = io.start + header_size + note_align;
+  g.iovmax = IOV_MAX;
+  if ((g.iov = malloc(g.iovmax*sizeof(struct iovec))) == NULL)
+    goto done;
+
+        /* Assemble the ELF header                                           */
+        if (t->put_ehdr(&io, num_regions + 1)) {
+          assert(0);
+          goto done;
         }
 
-        /* Write program headers, starting with the PT_NOTE entry            */
+        /* Assemble program headers, starting with the PT_NOTE entry         */
         /* scope */
         {
-          Phdr   phdr;
-          size_t offset   = sizeof(Ehdr) + (num_mappings + 1)*sizeof(Phdr);
-          size_t filesz   = sizeof(Nhdr) + 4 + sizeof(struct prpsinfo) +
-                            num_threads*(
-                            + sizeof(Nhdr) + 4 + sizeof(struct prstatus)
-                            );
-
-          memset(&phdr, 0, sizeof(Phdr));
-          phdr.p_type     = PT_NOTE;
-          phdr.p_offset   = offset;
-          phdr.p_filesz   = filesz;
-          if (c_write(handle, &phdr, sizeof(Phdr)) != sizeof(Phdr)) {
+          struct phdr_fields phdr;
+
+          memset(&phdr, 0, sizeof(phdr));
+          phdr.type       = PT_NOTE;
+          phdr.offset     = t->ehdr_size + (num_regions + 1)*t->phdr_size;
+          phdr.filesz     = note_size;
+          if (t->put_phdr(&io, &phdr)) {
             assert(0);
             goto done;
           }
 
           /* Now follow with program headers for each of the memory segments */
-          phdr.p_type     = PT_LOAD;
-          phdr.p_align    = pagesize;
-          phdr.p_paddr    = 0;
-          note_align      = phdr.p_align - ((offset+filesz) % phdr.p_align);
-          if (note_align == phdr.p_align)
-            note_align    = 0;
-          offset         += note_align;
-          for (i = 0; i < num_mappings; i++) {
-            offset       += filesz;
-            filesz        = mappings[i].end_address -mappings[i].start_address;
-            phdr.p_offset = offset;
-            phdr.p_vaddr  = mappings[i].start_address;
-            phdr.p_memsz  = filesz;
-
-            /* Do not write contents for memory segments that are read-only  */
-            if ((mappings[i].flags & PF_W) == 0)
-              filesz      = 0;
-            phdr.p_filesz = filesz;
-            phdr.p_flags  = mappings[i].flags;
-            if (c_write(handle, &phdr, sizeof(Phdr)) != sizeof(Phdr)) {
+          phdr.type       = PT_LOAD;
+          phdr.align      = CORE_PAGESIZE;
+          for (i = 0; i < num_regions; i++) {
+            phdr.offset   = segs[i].offset;
+            phdr.vaddr    = regions[i].addr;
+            phdr.memsz    = regions[i].size;
+
+            /* Segments without data or cut short by "max_length" are shorter
+             * in the file than in memory.
+             */
+            phdr.filesz   = segs[i].filesz;
+            phdr.flags    = regions[i].flags;
+            if (t->put_phdr(&io, &phdr)) {
               assert(0);
               goto done;
             }
           }
         }
 
-        /* Write note section                                                */
-        /* scope */ {
-          Nhdr nhdr;
-          memset(&nhdr, 0, sizeof(Nhdr));
-          nhdr.n_namesz   = 4;
-          nhdr.n_descsz   = sizeof(struct prpsinfo);
-          nhdr.n_type     = NT_PRPSINFO;
-          if (c_write(handle, &nhdr, sizeof(Nhdr)) != sizeof(Nhdr) ||
-              c_write(handle, "CORE", 4) != 4 ||
-              c_write(handle, &prpsinfo, sizeof(struct prpsinfo)) !=
-              sizeof(struct prpsinfo)) {
-              assert(0);
+        /* Assemble note section                                             */
+        if (t->put_nhdr(&io, "CORE", 4, t->prpsinfo_size, NT_PRPSINFO) ||
+            t->put_prpsinfo(&io, dump->frame)) {
+          assert(0);
+          goto done;
+        }
+        for (i = num_threads; i-- > 0; ) {
+          /* Process status and integer registers                            */
+          if (t->put_nhdr(&io, "CORE", 4, t->prstatus_size, NT_PRSTATUS) ||
+              t->put_prstatus(&io, dump->frame)) {
+            assert(0);
             goto done;
           }
-
-          for (i = num_threads; i-- > 0; ) {
-            /* Process status and integer registers                          */
-            nhdr.n_descsz = sizeof(struct prstatus);
-            nhdr.n_type   = NT_PRSTATUS;
-            prstatus.pr_pid = 1;
-            //prstatus.pr_reg = regs[i];
-            if (c_write(handle, &nhdr, sizeof(Nhdr)) != sizeof(Nhdr) ||
-                c_write(handle, "CORE", 4) != 4 ||
-                c_write(handle, &prstatus, sizeof(struct prstatus)) !=
-                sizeof(struct prstatus)) {
-                assert(0);
-              goto done;
-            }
-          }
         }
-
-        /* Align all following segments to multiples of page size            */
-        if (note_align) {
-          char scratch[note_align];
-          memset(scratch, 0, note_align);
-          if (c_write(handle, scratch, sizeof(scratch)) != sizeof(scratch)) {
+        if (dump->build_id) {
+          /* Build-id of the firmware, as in its NT_GNU_BUILD_ID note        */
+          static const char pad[4];
+          if (t->put_nhdr(&io, "GNU", 4, dump->build_id_size,
+                          NT_GNU_BUILD_ID) ||
+              io_put(&io, dump->build_id, dump->build_id_size) ||
+              io_put(&io, pad, -dump->build_id_size & 3)) {
             assert(0);
             goto done;
           }
         }
-
-        /* Write all memory segments                                         */
-        for (i = 0; i < num_mappings; i++) {
-          if ((mappings[i].flags & PF_W) &&
-              c_write(handle, (void *)raw_buf,
-                     mappings[i].end_address - mappings[i].start_address) !=
-                     mappings[i].end_address - mappings[i].start_address) {
+        for (i = 0; i < dump->num_notes; i++) {
+          /* Caller supplied notes, such as the boot times of bare_core    */
+          const CoreNote *note = &dump->notes[i];
+          static const char pad[4];
+          if (t->put_nhdr(&io, note->name, strlen(note->name) + 1,
+                          note->descsz, note->type) ||
+              io_put(&io, note->desc, note->descsz) ||
+              io_put(&io, pad, -note->descsz & 3)) {
+            assert(0);
             goto done;
           }
         }
-        {
-          Phdr   phdr;
-          memset(&phdr, 0, sizeof(Phdr));
-          phdr.p_type     = PT_NULL;
-          phdr.p_paddr    = 0;
-            if (c_write(handle, &phdr, sizeof(Phdr)) != sizeof(Phdr)) {
-              assert(0);
-              goto done;
+
+        /* Align all following segments to multiples of page size            */
+        memset(io.data, 0, note_align);
+        io.data += note_align;
+        if (gather_add(&g, io.start, io.data - io.start))
+          goto done;
+
+        /* Queue the memory segments behind the header block, one page at a
+         * time. Pages that are all zeros are skipped, and segments that live
+         * in a file rather than a buffer force a flush of everything queued
+         * so far.
+         */
+        for (i = 0; i < num_regions; i++) {
+          if (regions[i].buf) {
+            const uint8_t *p   = regions[i].buf;
+            uint64_t       len = segs[i].filesz;
+            uint64_t       pos = segs[i].offset;
+            while (len > 0) {
+              size_t chunk = CORE_PAGESIZE - (pos & (CORE_PAGESIZE - 1));
+              if (chunk > len)
+                chunk = len;
+              if (chunk < CORE_PAGESIZE || !is_zero(p, chunk)) {
+                if (gather_seek(&g, pos) || gather_add(&g, p, chunk))
+                  goto done;
+              }
+              p   += chunk;
+              pos += chunk;
+              len -= chunk;
             }
+          } else if (regions[i].fd >= 0) {
+            if (gather_seek(&g, segs[i].offset) ||
+                gather_copy(&g, regions[i].fd, regions[i].offset,
+                            segs[i].filesz, io.buf, sizeof(io.buf)))
+              goto done;
+          }
+        }
+
+        /* Emit everything that is still queued, including any trailing
+         * hole.
+         */
+        g.stats.logical_size = size;
+        if (gather_seek(&g, size) == 0 && gather_flush(&g) == 0 &&
+            (!sink->finish || sink->finish(sink, size) == 0)) {
+          rc = 0;
+          if (stats)
+            *stats = g.stats;
         }
 done:
-    close(handle);
+    if (io.start != io.buf)
+      free(io.start);
+    free(g.iov);
+    free(segs);
     return rc;
 }
 
+
+/* Writes a core with one PT_LOAD segment per region of "dump" to "sink".
+ * The contents of each segment are taken straight from the caller's
+ * buffer, or read from the region's "fd" at "offset" if there is no
+ * buffer. Pages of zeros in the buffers are left as holes if the sink
+ * supports them. If "stats" is non-NULL, it receives the logical size of
+ * the core and the number of bytes actually written.
+ */
+int WriteElfCore(CoreSink *sink, const CoreDump *dump, CoreStats *stats)
+{
+  return write_core(sink, dump, 0, stats);
+}
+
+
+/* Writes "dump" to the core file "fn". See WriteElfCore().
+ */
+int CreateElfCoreDump(char *fn, const CoreDump *dump, CoreStats *stats)
+{
+  CoreSink sink;
+  int fd, rc;
+
+  if ((fd = open(fn, O_WRONLY | O_TRUNC | O_CREAT, 0644)) < 0)
+    return -1;
+  InitFdCoreSink(&sink, fd);
+  rc = WriteElfCore(&sink, dump, stats);
+  close(fd);
+  return rc;
+}
+
+
+/* Writes a core file with one PT_LOAD segment per entry in "regions".
+ * See WriteElfCore().
+ */
+int CreateElfCoreRegions(char *fn, const CoreRegion *regions, int num_regions,
+                         Frame *frame, CoreStats *stats)
+{
+  CoreDump dump;
+
+  memset(&dump, 0, sizeof(dump));
+  dump.regions     = regions;
+  dump.num_regions = num_regions;
+  dump.frame       = frame;
+  return CreateElfCoreDump(fn, &dump, stats);
+}
+
+
+/* Writes a core file for a single RAM region held in "raw_buf".
+ */
+int CreateElfCore(char *fn, uint32_t ram_addr, uint8_t *raw_buf, uint32_t ram_size, Frame *frame)
+{
+  CoreRegion region;
+
+  memset(&region, 0, sizeof(region));
+  region.addr  = ram_addr;
+  region.size  = ram_size;
+  region.flags = PF_W|PF_R;
+  region.buf   = raw_buf;
+  region.fd    = -1;
+  return CreateElfCoreRegions(fn, &region, 1, frame, NULL);
+}
+
+
+/* Converts the raw RAM image in "raw_fn", which starts at target address
+ * "ram_addr", into a core file. Only the headers and notes are written by
+ * us; the image itself is copied (or reflinked) by the kernel.
+ */
+int ConvertRawCore(char *fn, char *raw_fn, uint32_t ram_addr, Frame *frame)
+{
+  CoreRegion region;
+  struct stat st;
+  int rc;
+
+  memset(&region, 0, sizeof(region));
+  if ((region.fd = open(raw_fn, O_RDONLY)) < 0)
+    return -1;
+  if (fstat(region.fd, &st) < 0) {
+    close(region.fd);
+    return -1;
+  }
+  region.addr  = ram_addr;
+  region.size  = st.st_size;
+  region.flags = PF_W|PF_R;
+  rc = CreateElfCoreRegions(fn, &region, 1, frame, NULL);
+  close(region.fd);
+  return rc;
+}
+
+
+/* State of the compressor thread.
+ */
+struct compressor {
+  struct WriterFds *fds;
+  int               method;
+  int               rc;
+  uint64_t          out_bytes;
+};
+
+
+/* Compresses everything readable from fds->compressed_fd with zlib,
+ * producing a gzip stream.
+ */
+static int gzip_stream(struct compressor *c, unsigned char *in,
+                       unsigned char *out, size_t len) {
+  z_stream z;
+  int      flush = Z_NO_FLUSH;
+  int      rc = 0;
+
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+  while (flush != Z_FINISH) {
+    ssize_t got;
+    NO_INTR(got = read(c->fds->compressed_fd, in, len));
+    if (got < 0) {
+      rc = -1;
+      break;
+    }
+    flush       = got ? Z_NO_FLUSH : Z_FINISH;
+    z.next_in   = in;
+    z.avail_in  = got;
+    do {
+      size_t have;
+      z.next_out  = out;
+      z.avail_out = len;
+      deflate(&z, flush);
+      have = len - z.avail_out;
+      if (c_write(c->fds->out_fd, out, have) != (ssize_t)have) {
+        rc = -1;
+        break;
+      }
+      c->out_bytes += have;
+    } while (z.avail_out == 0);
+    if (rc)
+      break;
+  }
+  deflateEnd(&z);
+  return rc;
+}
+
+
+#ifdef HAVE_ZSTD
+/* Compresses everything readable from fds->compressed_fd into a zstd
+ * frame.
+ */
+static int zstd_stream(struct compressor *c, unsigned char *in,
+                       unsigned char *out, size_t len) {
+  ZSTD_CStream *z = ZSTD_createCStream();
+  int           done = 0;
+  int           rc = 0;
+
+  if (!z || ZSTD_isError(ZSTD_initCStream(z, 3))) {
+    ZSTD_freeCStream(z);
+    return -1;
+  }
+  while (!done && !rc) {
+    ZSTD_inBuffer input;
+    size_t        remaining;
+    ssize_t       got;
+    NO_INTR(got = read(c->fds->compressed_fd, in, len));
+    if (got < 0) {
+      rc = -1;
+      break;
+    }
+    done       = got == 0;
+    input.src  = in;
+    input.size = got;
+    input.pos  = 0;
+    do {
+      ZSTD_outBuffer output = { out, len, 0 };
+      remaining = done ? ZSTD_endStream(z, &output)
+                       : ZSTD_compressStream(z, &output, &input);
+      if (ZSTD_isError(remaining) ||
+          c_write(c->fds->out_fd, out, output.pos) != (ssize_t)output.pos) {
+        rc = -1;
+        break;
+      }
+      c->out_bytes += output.pos;
+    } while (done ? remaining != 0 : input.pos < input.size);
+  }
+  ZSTD_freeCStream(z);
+  return rc;
+}
+#endif
+
+
+static void *compressor_thread(void *arg) {
+  struct compressor *c = (struct compressor *)arg;
+  static const size_t len = 64*1024;
+  unsigned char *in  = malloc(len);
+  unsigned char *out = malloc(len);
+
+  c->rc = -1;
+  if (in && out) {
+    switch (c->method) {
+      case CORE_COMPRESS_GZIP:
+        c->rc = gzip_stream(c, in, out, len);
+        break;
+#ifdef HAVE_ZSTD
+      case CORE_COMPRESS_ZSTD:
+        c->rc = zstd_stream(c, in, out, len);
+        break;
+#endif
+    }
+  }
+
+  /* Keep draining the pipe, so that the writer never blocks on us        */
+  if (in) {
+    ssize_t got;
+    do {
+      NO_INTR(got = read(c->fds->compressed_fd, in, len));
+    } while (got > 0);
+  }
+  free(in);
+  free(out);
+  return NULL;
+}
+
+
+/* Writes a core compressed with "method" (CORE_COMPRESS_GZIP or, if built
+ * with HAVE_ZSTD, CORE_COMPRESS_ZSTD) to "out_fd". The compressor runs in
+ * a thread of its own, fed through a pipe. If "max_length" is non-zero,
+ * the uncompressed core is kept within that many bytes by cutting short
+ * the lowest priority regions; the headers are never truncated. If
+ * "stats" is non-NULL, it receives the uncompressed size and the number
+ * of compressed bytes written.
+ */
+int WriteCompressedElfCore(int out_fd, const CoreDump *dump, int method,
+                           size_t max_length, CoreStats *stats)
+{
+  struct WriterFds  fds;
+  struct compressor c;
+  CoreSink          sink;
+  CoreStats         core_stats;
+  pthread_t         thread;
+  int               pipe_fds[2];
+  int               rc;
+
+#ifndef HAVE_ZSTD
+  if (method == CORE_COMPRESS_ZSTD) {
+    errno = ENOSYS;
+    return -1;
+  }
+#endif
+  if (method != CORE_COMPRESS_GZIP && method != CORE_COMPRESS_ZSTD) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (pipe(pipe_fds) < 0)
+    return -1;
+  fds.max_length    = max_length;
+  fds.compressed_fd = pipe_fds[0];
+  fds.write_fd      = pipe_fds[1];
+  fds.out_fd        = out_fd;
+  memset(&c, 0, sizeof(c));
+  c.fds    = &fds;
+  c.method = method;
+  if (pthread_create(&thread, NULL, compressor_thread, &c)) {
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return -1;
+  }
+
+  /* A pipe can neither seek nor be the target of a reflink               */
+  InitFdCoreSink(&sink, fds.write_fd);
+  sink.skip   = NULL;
+  sink.finish = NULL;
+  rc = write_core(&sink, dump, fds.max_length, &core_stats);
+  close(fds.write_fd);
+  pthread_join(thread, NULL);
+  close(fds.compressed_fd);
+  if (rc || c.rc)
+    return -1;
+  if (stats) {
+    stats->logical_size  = core_stats.logical_size;
+    stats->bytes_written = c.out_bytes;
+  }
+  return 0;
+}
+
+
+/* Writes a compressed core file. See WriteCompressedElfCore().
+ */
+int CreateCompressedElfCore(char *fn, const CoreDump *dump, int method,
+                            size_t max_length, CoreStats *stats)
+{
+  int fd, rc;
+
+  if ((fd = open(fn, O_WRONLY | O_TRUNC | O_CREAT, 0644)) < 0)
+    return -1;
+  rc = WriteCompressedElfCore(fd, dump, method, max_length, stats);
+  close(fd);
+  return rc;
+}
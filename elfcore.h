@@ -37,6 +37,7 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 
 /* Define the DUMPER symbol to make sure that there is exactly one
@@ -50,7 +51,7 @@
     #define SP uregs[13]        /* Stack pointer                             */
     #define IP uregs[15]        /* Program counter                           */
     #define LR uregs[14]        /* Link register                             */
-    long uregs[18];
+    uint32_t uregs[18];         /* r0-r15, cpsr, orig_r0 as on the target    */
   } arm_regs;
 
   /* ARM calling conventions are a little more tricky. A little assembly
@@ -63,7 +64,126 @@
   } Frame;
 
 
+  /* A block of target memory that becomes one PT_LOAD segment in the core.
+   * The contents come from "buf" if it is set, otherwise they are read from
+   * "fd" at "offset". Regions without either (buf == NULL, fd == -1), such
+   * as peripheral windows, only get a program header.
+   */
+  typedef struct CoreRegion {
+    uint64_t        addr;       /* Target address of the first byte         */
+    uint64_t        size;       /* Size in bytes                            */
+    int             flags;      /* PF_R, PF_W and PF_X segment flags        */
+    const uint8_t  *buf;        /* Contents, or NULL                        */
+    int             fd;         /* Source file if buf is NULL, or -1        */
+    off_t           offset;     /* Offset of the contents in fd             */
+    int             priority;   /* Lowest gets cut first to meet max_length */
+  } CoreRegion;
+
+  /* Size accounting for a core file that may contain holes.
+   */
+  typedef struct CoreStats {
+    uint64_t        logical_size;   /* Size of the core including holes   */
+    uint64_t        bytes_written;  /* Bytes actually written             */
+  } CoreStats;
+
+  /* Flavours of core file: ELF class, byte order and machine.
+   */
+  enum {
+    CORE_TARGET_ARM32_LE   = 0, /* The default                              */
+    CORE_TARGET_ARM32_BE   = 1,
+    CORE_TARGET_AARCH64_LE = 2,
+    CORE_TARGET_AARCH64_BE = 3
+  };
+
+
+  /* A note added to the PT_NOTE segment after the standard ones. "desc"
+   * is copied as it is, so it must already be in the target byte order.
+   */
+  typedef struct CoreNote {
+    const char     *name;       /* Owner, e.g. "BARE"                       */
+    uint32_t        type;
+    const void     *desc;
+    uint32_t        descsz;
+  } CoreNote;
+
+
+  /* Type of the "GNU" note that holds the build-id of an executable */
+  #ifndef NT_GNU_BUILD_ID
+  #define NT_GNU_BUILD_ID 3
+  #endif
+
+
+  /* Everything that goes into a core.
+   */
+  typedef struct CoreDump {
+    const CoreRegion *regions;  /* One PT_LOAD segment each                 */
+    int             num_regions;
+    Frame          *frame;      /* Registers of the crashed thread          */
+    int             target;     /* CORE_TARGET_*                            */
+    const CoreNote *notes;      /* Extra notes, or NULL                     */
+    int             num_notes;
+    const uint8_t  *build_id;   /* GNU build-id of the firmware, or NULL    */
+    uint32_t        build_id_size;
+  } CoreDump;
+
+
+  /* Destination of a core. WriteElfCore() produces the core strictly in
+   * order through "write"; the other operations are optional. "skip"
+   * advances over "len" bytes of zeros, leaving a hole. "copy" appends
+   * "len" bytes at "offset" in "fd" without a user-space copy. "finish"
+   * is called with the final size of the core. Use one of the Init*CoreSink
+   * functions to set up a sink; the remaining fields are their state.
+   */
+  typedef struct CoreSink CoreSink;
+  struct CoreSink {
+    int           (*write)(CoreSink *sink, struct iovec *iov, int iovcnt);
+    int           (*skip)(CoreSink *sink, uint64_t len);
+    int           (*copy)(CoreSink *sink, int fd, off_t offset, uint64_t len);
+    int           (*finish)(CoreSink *sink, uint64_t size);
+    int             fd;         /* File descriptor sink                     */
+    uint8_t        *data;       /* Memory sink: the core so far             */
+    size_t          size, capacity;
+    int           (*callback)(void *arg, const void *buf, size_t len);
+    void           *arg;        /* Callback sink                            */
+  };
+
+
+  /* Compression methods for WriteCompressedElfCore().
+   */
+  enum {
+    CORE_COMPRESS_GZIP = 1,
+    CORE_COMPRESS_ZSTD = 2      /* Needs a build with HAVE_ZSTD             */
+  };
+
+
+  /* Writes many cores concurrently through io_uring; see elfcore_uring.c.
+   */
+  typedef struct CoreRing CoreRing;
+
+
 ssize_t c_write(int f, const void *void_buf, size_t bytes);
+ssize_t c_writev(int f, struct iovec *iov, int iovcnt);
 int CreateElfCore(char *fn, uint32_t ram_addr, uint8_t *raw_buf, uint32_t ram_size, Frame *frame);
+int CreateElfCoreRegions(char *fn, const CoreRegion *regions, int num_regions,
+                         Frame *frame, CoreStats *stats);
+int CreateElfCoreDump(char *fn, const CoreDump *dump, CoreStats *stats);
+void InitFdCoreSink(CoreSink *sink, int fd);
+int InitMemCoreSink(CoreSink *sink, size_t capacity);
+void InitCallbackCoreSink(CoreSink *sink,
+                          int (*callback)(void *arg, const void *buf,
+                                          size_t len),
+                          void *arg);
+uint64_t ElfCoreSize(const CoreDump *dump);
+int WriteElfCore(CoreSink *sink, const CoreDump *dump, CoreStats *stats);
+int WriteCompressedElfCore(int out_fd, const CoreDump *dump, int method,
+                           size_t max_length, CoreStats *stats);
+int CreateCompressedElfCore(char *fn, const CoreDump *dump, int method,
+                            size_t max_length, CoreStats *stats);
+CoreRing *CoreRingCreate(unsigned depth);
+int CoreRingIsAsync(const CoreRing *ring);
+int CoreRingSubmit(CoreRing *ring, char *fn, const CoreDump *dump, void *tag);
+int CoreRingReap(CoreRing *ring, void **tag, int *rc, int wait);
+void CoreRingDestroy(CoreRing *ring);
+int ConvertRawCore(char *fn, char *raw_fn, uint32_t ram_addr, Frame *frame);
 
 #endif /* _ELFCORE_H */
@@ -0,0 +1,251 @@
+/* Serializers for one target flavour of core file.
+ *
+ * This file is included by elfcore.c once per supported target, with the
+ * following macros describing it:
+ *
+ *   TARGET        Suffix for the names defined here, e.g. arm32le
+ *   TARGET_CLASS  32 or 64, the ELF class and the size of a C long
+ *   TARGET_MSB    1 for big-endian targets, 0 for little-endian ones
+ *   TARGET_MACH   e_machine of the core
+ *   TARGET_NREGS  Number of general purpose registers in prstatus
+ *   TARGET_UID    Width in bits of the uid/gid fields of prpsinfo
+ *   TARGET_PRSTATUS_SIZE, TARGET_PR_REG_OFFSET,
+ *   TARGET_PRPSINFO_SIZE, TARGET_PR_FNAME_OFFSET
+ *                 What the target's debugger expects for the note layouts;
+ *                 checked against the structures below at compile time
+ *
+ * Everything that depends on the target, the layout of the structures and
+ * whether their fields need byte-swapping, is settled here at compile
+ * time. The note structures are packed, with all padding spelled out, so
+ * that their layout does not depend on the host compiler's ABI. The
+ * functions below store each field exactly once, without checking the
+ * host or the target at run time. They are reached through the elf_target
+ * table "target_<TARGET>".
+ */
+
+#define T___(name, t) name##_##t
+#define T__(name, t)  T___(name, t)
+#define T_(name)      T__(name, TARGET)
+
+#if TARGET_MSB == HOST_MSB
+  #define S16(x)      ((uint16_t)(x))
+  #define S32(x)      ((uint32_t)(x))
+  #define S64(x)      ((uint64_t)(x))
+#else
+  #define S16(x)      __builtin_bswap16((uint16_t)(x))
+  #define S32(x)      __builtin_bswap32((uint32_t)(x))
+  #define S64(x)      __builtin_bswap64((uint64_t)(x))
+#endif
+
+#if TARGET_CLASS == 32
+  #define ELF_CLASS   ELFCLASS32
+  #define Ehdr        Elf32_Ehdr
+  #define Phdr        Elf32_Phdr
+  #define Shdr        Elf32_Shdr
+  #define Nhdr        Elf32_Nhdr
+  #define SL(x)       S32(x)
+  typedef uint32_t    T_(long);
+#else
+  #define ELF_CLASS   ELFCLASS64
+  #define Ehdr        Elf64_Ehdr
+  #define Phdr        Elf64_Phdr
+  #define Shdr        Elf64_Shdr
+  #define Nhdr        Elf64_Nhdr
+  #define SL(x)       S64(x)
+  typedef uint64_t    T_(long);
+#endif
+
+#if TARGET_UID == 16
+  #define SU(x)       S16(x)
+  typedef uint16_t    T_(uid);
+#else
+  #define SU(x)       S32(x)
+  typedef uint32_t    T_(uid);
+#endif
+
+
+typedef struct __attribute__((packed)) T_(timeval) {
+  T_(long)       tv_sec;        /* Seconds                                   */
+  T_(long)       tv_usec;       /* Microseconds                              */
+} T_(timeval);
+
+
+typedef struct __attribute__((packed)) T_(prstatus) {
+  elf_siginfo    pr_info;       /* Info associated with signal               */
+  uint16_t       pr_cursig;     /* Current signal                            */
+  uint16_t       pr_pad0;
+  T_(long)       pr_sigpend;    /* Set of pending signals                    */
+  T_(long)       pr_sighold;    /* Set of held signals                       */
+  int32_t        pr_pid;        /* Process ID                                */
+  int32_t        pr_ppid;       /* Parent's process ID                       */
+  int32_t        pr_pgrp;       /* Group ID                                  */
+  int32_t        pr_sid;        /* Session ID                                */
+  T_(timeval)    pr_utime;      /* User time                                 */
+  T_(timeval)    pr_stime;      /* System time                               */
+  T_(timeval)    pr_cutime;     /* Cumulative user time                      */
+  T_(timeval)    pr_cstime;     /* Cumulative system time                    */
+  T_(long)       pr_reg[TARGET_NREGS]; /* CPU registers                      */
+  uint32_t       pr_fpvalid;    /* True if math co-processor being used      */
+#if TARGET_CLASS == 64
+  uint32_t       pr_pad1;
+#endif
+} T_(prstatus);
+
+
+typedef struct __attribute__((packed)) T_(prpsinfo) {
+  unsigned char  pr_state;      /* Numeric process state                     */
+  char           pr_sname;      /* Char for pr_state                         */
+  unsigned char  pr_zomb;       /* Zombie                                    */
+  signed char    pr_nice;       /* Nice val                                  */
+#if TARGET_CLASS == 64
+  uint32_t       pr_pad0;
+#endif
+  T_(long)       pr_flag;       /* Flags                                     */
+  T_(uid)        pr_uid;        /* User ID                                   */
+  T_(uid)        pr_gid;        /* Group ID                                  */
+  int32_t        pr_pid;        /* Process ID                                */
+  int32_t        pr_ppid;       /* Parent's process ID                       */
+  int32_t        pr_pgrp;       /* Group ID                                  */
+  int32_t        pr_sid;        /* Session ID                                */
+  char           pr_fname[16];  /* Filename of executable                    */
+  char           pr_psargs[80]; /* Initial part of arg list                  */
+} T_(prpsinfo);
+
+
+_Static_assert(sizeof(T_(prstatus)) == TARGET_PRSTATUS_SIZE,
+               "prstatus does not match the target");
+_Static_assert(offsetof(T_(prstatus), pr_reg) == TARGET_PR_REG_OFFSET,
+               "prstatus registers are misplaced");
+_Static_assert(sizeof(T_(prpsinfo)) == TARGET_PRPSINFO_SIZE,
+               "prpsinfo does not match the target");
+_Static_assert(offsetof(T_(prpsinfo), pr_fname) == TARGET_PR_FNAME_OFFSET,
+               "prpsinfo file name is misplaced");
+
+
+static int T_(put_ehdr)(struct io *io, int phnum) {
+  Ehdr ehdr;
+  memset(&ehdr, 0, sizeof(Ehdr));
+  ehdr.e_ident[0] = ELFMAG0;
+  ehdr.e_ident[1] = ELFMAG1;
+  ehdr.e_ident[2] = ELFMAG2;
+  ehdr.e_ident[3] = ELFMAG3;
+  ehdr.e_ident[4] = ELF_CLASS;
+  ehdr.e_ident[5] = TARGET_MSB ? ELFDATA2MSB : ELFDATA2LSB;
+  ehdr.e_ident[6] = EV_CURRENT;
+  ehdr.e_type     = S16(ET_CORE);
+  ehdr.e_machine  = S16(TARGET_MACH);
+  ehdr.e_version  = S32(EV_CURRENT);
+  ehdr.e_phoff    = SL(sizeof(Ehdr));
+  ehdr.e_ehsize   = S16(sizeof(Ehdr));
+  ehdr.e_phentsize= S16(sizeof(Phdr));
+  ehdr.e_phnum    = S16(phnum);
+  ehdr.e_shentsize= S16(sizeof(Shdr));
+  return io_put(io, &ehdr, sizeof(Ehdr));
+}
+
+
+static int T_(put_phdr)(struct io *io, const struct phdr_fields *f) {
+  Phdr phdr;
+  memset(&phdr, 0, sizeof(Phdr));
+  phdr.p_type     = S32(f->type);
+  phdr.p_flags    = S32(f->flags);
+  phdr.p_offset   = SL(f->offset);
+  phdr.p_vaddr    = SL(f->vaddr);
+  phdr.p_filesz   = SL(f->filesz);
+  phdr.p_memsz    = SL(f->memsz);
+  phdr.p_align    = SL(f->align);
+  return io_put(io, &phdr, sizeof(Phdr));
+}
+
+
+/* Note header and the owner name, padded to a multiple of four bytes.
+ * "namesz" counts the terminating NUL if the name is to have one.
+ */
+static int T_(put_nhdr)(struct io *io, const char *name, uint32_t namesz,
+                        uint32_t descsz, uint32_t type) {
+  static const char pad[4];
+  Nhdr nhdr;
+  nhdr.n_namesz   = S32(namesz);
+  nhdr.n_descsz   = S32(descsz);
+  nhdr.n_type     = S32(type);
+  return io_put(io, &nhdr, sizeof(Nhdr)) || io_put(io, name, namesz) ||
+         io_put(io, pad, -namesz & 3);
+}
+
+
+static int T_(put_prpsinfo)(struct io *io, const Frame *frame) {
+  T_(prpsinfo) prpsinfo;
+  memset(&prpsinfo, 0, sizeof(prpsinfo));
+  prpsinfo.pr_sname = 'R';
+  prpsinfo.pr_pid   = S32(frame && frame->tid ? frame->tid : 1);
+  prpsinfo.pr_uid   = SU(0);
+  memcpy(prpsinfo.pr_fname, "firmware", sizeof("firmware"));
+  return io_put(io, &prpsinfo, sizeof(prpsinfo));
+}
+
+
+/* Process status and the registers from "frame", which holds the AArch32
+ * register file r0-r15 and cpsr.
+ */
+static int T_(put_prstatus)(struct io *io, const Frame *frame) {
+  T_(prstatus) prstatus;
+  memset(&prstatus, 0, sizeof(prstatus));
+  prstatus.pr_pid = S32(frame && frame->tid ? frame->tid : 1);
+  if (frame) {
+    const uint32_t *r = frame->arm.uregs;
+    int i;
+    prstatus.pr_info.si_errno = S32(frame->errno_);
+#if TARGET_CLASS == 32 && TARGET_MSB == HOST_MSB
+    /* Same layout as arm_regs: one block copy                               */
+    (void)i;
+    memcpy(prstatus.pr_reg, r, sizeof(prstatus.pr_reg));
+#elif TARGET_CLASS == 32
+    for (i = 0; i < TARGET_NREGS; i++)
+      prstatus.pr_reg[i] = S32(r[i]);
+#else
+    /* AArch32 state as seen from AArch64: x0-x12 are r0-r12, then sp, lr
+     * (x30), pc and pstate.
+     */
+    for (i = 0; i < 13; i++)
+      prstatus.pr_reg[i] = S64(r[i]);
+    prstatus.pr_reg[30] = S64(r[14]);
+    prstatus.pr_reg[31] = S64(r[13]);
+    prstatus.pr_reg[32] = S64(r[15]);
+    prstatus.pr_reg[33] = S64(r[16]);
+#endif
+  }
+  return io_put(io, &prstatus, sizeof(prstatus));
+}
+
+
+static const struct elf_target T_(target) = {
+  sizeof(Ehdr), sizeof(Phdr), sizeof(Nhdr),
+  sizeof(T_(prpsinfo)), sizeof(T_(prstatus)),
+  T_(put_ehdr), T_(put_phdr), T_(put_nhdr),
+  T_(put_prpsinfo), T_(put_prstatus)
+};
+
+
+#undef T___
+#undef T__
+#undef T_
+#undef S16
+#undef S32
+#undef S64
+#undef SL
+#undef SU
+#undef ELF_CLASS
+#undef Ehdr
+#undef Phdr
+#undef Shdr
+#undef Nhdr
+#undef TARGET
+#undef TARGET_CLASS
+#undef TARGET_MSB
+#undef TARGET_MACH
+#undef TARGET_NREGS
+#undef TARGET_UID
+#undef TARGET_PRSTATUS_SIZE
+#undef TARGET_PR_REG_OFFSET
+#undef TARGET_PRPSINFO_SIZE
+#undef TARGET_PR_FNAME_OFFSET
@@ -0,0 +1,480 @@
+/* io_uring backend for writing many cores at once.
+ *
+ * A CoreRing accepts cores with CoreRingSubmit() and hands them back with
+ * CoreRingReap() once all of their writes have completed. Each core is
+ * laid out by WriteElfCore() through a sink that turns every gathered
+ * write into an IORING_OP_WRITEV at an explicit file offset, so the
+ * header blocks and memory segments of up to "depth" writes (from any
+ * number of cores) are in flight at the same time. Region buffers are
+ * referenced in place; everything else (headers, notes, bounce buffers)
+ * is copied into memory owned by the core until it is reaped.
+ *
+ * The ring is set up with raw system calls, so liburing is not needed.
+ * Where io_uring is not available (non-Linux hosts, old kernels, seccomp
+ * sandboxes), CoreRingSubmit() writes the core synchronously with the
+ * regular file descriptor sink instead, and the core is ready to be
+ * reaped as soon as it returns.
+ */
+
+#include "elfcore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+
+/* Memory that has to stay valid until a core's writes have completed.
+ */
+struct arena {
+  struct arena  *next;
+  size_t         used, size;
+  unsigned char  data[];
+};
+
+/* One core in the ring.
+ */
+struct ring_core {
+  struct ring_core *next;       /* Completed cores waiting to be reaped     */
+  CoreRing         *ring;
+  const CoreDump   *dump;
+  int               fd;
+  int               pending;    /* Writes submitted but not completed      */
+  int               submitted;  /* All writes have been queued             */
+  int               rc;
+  uint64_t          pos;        /* File offset of the next write           */
+  void             *tag;
+  struct arena     *arena;
+};
+
+/* One write in the ring; its address is the SQE's user_data.
+ */
+struct ring_op {
+  struct ring_core *core;
+  struct iovec     *vec;        /* What is left to be written              */
+  int               iovcnt;
+  uint64_t          off;
+  size_t            len;
+};
+
+struct CoreRing {
+  int               ring_fd;    /* -1 if writing synchronously             */
+  unsigned          depth;
+  unsigned          queued;     /* SQEs filled in but not yet submitted     */
+  unsigned          inflight;   /* SQEs submitted but not yet completed     */
+  unsigned          cores;      /* Cores submitted but not yet reaped       */
+  struct ring_core *done_head, *done_tail;
+#ifdef HAVE_IO_URING
+  void             *sq_ptr, *cq_ptr;
+  size_t            sq_len, cq_len, sqes_len;
+  unsigned         *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned         *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+#endif
+};
+
+
+static void *arena_alloc(struct ring_core *core, size_t len) {
+  struct arena *a = core->arena;
+  len = (len + 15) & ~(size_t)15;
+  if (!a || a->size - a->used < len) {
+    size_t size = len > 16384 ? len : 16384;
+    if ((a = malloc(sizeof(struct arena) + size)) == NULL)
+      return NULL;
+    a->next     = core->arena;
+    a->used     = 0;
+    a->size     = size;
+    core->arena = a;
+  }
+  a->used += len;
+  return a->data + a->used - len;
+}
+
+
+static void core_free(struct ring_core *core) {
+  while (core->arena) {
+    struct arena *a = core->arena;
+    core->arena = a->next;
+    free(a);
+  }
+  free(core);
+}
+
+
+/* Moves a core whose writes have all completed to the list of cores that
+ * are ready to be reaped.
+ */
+static void core_done(struct ring_core *core) {
+  CoreRing *ring = core->ring;
+  if (core->fd >= 0 && close(core->fd) < 0)
+    core->rc = -1;
+  core->fd   = -1;
+  core->next = NULL;
+  if (ring->done_tail)
+    ring->done_tail->next = core;
+  else
+    ring->done_head = core;
+  ring->done_tail = core;
+}
+
+
+#ifdef HAVE_IO_URING
+static int ring_enter(CoreRing *ring, unsigned to_submit,
+                      unsigned min_complete) {
+  int rc;
+  do {
+    rc = syscall(__NR_io_uring_enter, ring->ring_fd, to_submit, min_complete,
+                 min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (rc < 0 && errno == EINTR);
+  return rc;
+}
+
+
+static struct io_uring_sqe *ring_get_sqe(CoreRing *ring);
+static void ring_push_sqe(CoreRing *ring);
+
+
+/* Fills in an SQE that writes what is left of "op".
+ */
+static void ring_prep_write(struct io_uring_sqe *sqe, const struct ring_op *op) {
+  sqe->opcode    = IORING_OP_WRITEV;
+  sqe->fd        = op->core->fd;
+  sqe->addr      = (uintptr_t)op->vec;
+  sqe->len       = op->iovcnt;
+  sqe->off       = op->off;
+  sqe->user_data = (uintptr_t)op;
+}
+
+
+/* Queues the rest of a write that completed short, the way write() would
+ * be called again. The completion just processed freed a slot, so this
+ * never has to wait. Returns -1 if the write made no progress at all.
+ */
+static int ring_resubmit(CoreRing *ring, struct ring_op *op, size_t done) {
+  struct io_uring_sqe *sqe;
+  if (done == 0)
+    return -1;
+  op->off += done;
+  op->len -= done;
+  while (done >= op->vec->iov_len) {
+    done -= op->vec->iov_len;
+    op->vec++;
+    op->iovcnt--;
+  }
+  op->vec->iov_base = (uint8_t *)op->vec->iov_base + done;
+  op->vec->iov_len -= done;
+  if ((sqe = ring_get_sqe(ring)) == NULL)
+    return -1;
+  ring_prep_write(sqe, op);
+  ring_push_sqe(ring);
+  return 0;
+}
+
+
+/* Processes all available completions.
+ */
+static void ring_complete(CoreRing *ring) {
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe  = &ring->cqes[head & *ring->cq_mask];
+    struct ring_op      *op   = (struct ring_op *)(uintptr_t)cqe->user_data;
+    struct ring_core    *core = op->core;
+    int                  res  = cqe->res;
+    head++;
+    ring->inflight--;
+    if (res >= 0 && (size_t)res < op->len &&
+        ring_resubmit(ring, op, res) == 0)
+      continue;
+    if (res < 0 || (size_t)res != op->len)
+      core->rc = -1;
+    if (--core->pending == 0 && core->submitted)
+      core_done(core);
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/* Hands all filled in SQEs to the kernel, and waits for at least
+ * "min_complete" completions.
+ */
+static int ring_submit(CoreRing *ring, unsigned min_complete) {
+  while (ring->queued || min_complete) {
+    int rc = ring_enter(ring, ring->queued, min_complete);
+    if (rc < 0 || (rc == 0 && !min_complete))
+      return -1;
+    ring->queued   -= rc;
+    ring->inflight += rc;
+    ring_complete(ring);
+    min_complete = 0;
+  }
+  return 0;
+}
+
+
+/* Returns a free SQE, waiting for completions if all "depth" slots are in
+ * use.
+ */
+static struct io_uring_sqe *ring_get_sqe(CoreRing *ring) {
+  unsigned tail;
+  struct io_uring_sqe *sqe;
+  if (ring->queued + ring->inflight >= ring->depth &&
+      ring_submit(ring, 1) < 0)
+    return NULL;
+  tail = *ring->sq_tail;
+  sqe  = &ring->sqes[tail & *ring->sq_mask];
+  ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+
+static void ring_push_sqe(CoreRing *ring) {
+  __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+}
+
+
+/* Returns non-zero if "p" points into one of the region buffers of the
+ * core, which the caller keeps alive until the core is reaped.
+ */
+static int in_region(const struct ring_core *core, const void *p,
+                     size_t len) {
+  int i;
+  for (i = 0; i < core->dump->num_regions; i++) {
+    const CoreRegion *r = &core->dump->regions[i];
+    if (r->buf && (const uint8_t *)p >= r->buf &&
+        (const uint8_t *)p + len <= r->buf + r->size)
+      return 1;
+  }
+  return 0;
+}
+
+
+static int ring_sink_write(CoreSink *sink, struct iovec *iov, int iovcnt) {
+  struct ring_core    *core = (struct ring_core *)sink->arg;
+  struct iovec        *vec  = arena_alloc(core, iovcnt*sizeof(struct iovec));
+  struct ring_op      *op   = arena_alloc(core, sizeof(struct ring_op));
+  struct io_uring_sqe *sqe;
+  int i;
+
+  if (!vec || !op)
+    return -1;
+  op->core   = core;
+  op->vec    = vec;
+  op->iovcnt = iovcnt;
+  op->off    = core->pos;
+  op->len    = 0;
+  for (i = 0; i < iovcnt; i++) {
+    vec[i] = iov[i];
+    if (!in_region(core, iov[i].iov_base, iov[i].iov_len)) {
+      if ((vec[i].iov_base = arena_alloc(core, iov[i].iov_len)) == NULL)
+        return -1;
+      memcpy(vec[i].iov_base, iov[i].iov_base, iov[i].iov_len);
+    }
+    op->len += iov[i].iov_len;
+  }
+  if ((sqe = ring_get_sqe(core->ring)) == NULL)
+    return -1;
+  ring_prep_write(sqe, op);
+  ring_push_sqe(core->ring);
+  core->pending++;
+  core->pos += op->len;
+  return 0;
+}
+
+
+static int ring_sink_skip(CoreSink *sink, uint64_t len) {
+  ((struct ring_core *)sink->arg)->pos += len;
+  return 0;
+}
+
+
+/* Sets the size of the file once all of its writes are queued, which
+ * also covers a trailing hole. The writes may still be in flight and land
+ * before or after; none of them ends past "size", so the file comes out
+ * the same either way.
+ */
+static int ring_sink_finish(CoreSink *sink, uint64_t size) {
+  return ftruncate(((struct ring_core *)sink->arg)->fd, size);
+}
+
+
+static int ring_setup(CoreRing *ring, unsigned depth) {
+  struct io_uring_params p;
+  int fd;
+
+  memset(&p, 0, sizeof(p));
+  if ((fd = syscall(__NR_io_uring_setup, depth, &p)) < 0)
+    return -1;
+  ring->ring_fd  = fd;
+  ring->depth    = p.sq_entries < depth ? p.sq_entries : depth;
+  ring->sq_len   = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  ring->cq_len   = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  ring->sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+  ring->sq_ptr   = mmap(NULL, ring->sq_len, PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  ring->cq_ptr   = mmap(NULL, ring->cq_len, PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  ring->sqes     = mmap(NULL, ring->sqes_len, PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED ||
+      ring->sqes == MAP_FAILED)
+    return -1;
+  ring->sq_head  = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+  ring->sq_tail  = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+  ring->sq_mask  = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+  ring->cq_head  = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+  ring->cq_tail  = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+  ring->cq_mask  = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+  ring->cqes     = (struct io_uring_cqe *)((char *)ring->cq_ptr +
+                                           p.cq_off.cqes);
+  return 0;
+}
+
+
+static void ring_teardown(CoreRing *ring) {
+  if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+    munmap(ring->sq_ptr, ring->sq_len);
+  if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED)
+    munmap(ring->cq_ptr, ring->cq_len);
+  if (ring->sqes && ring->sqes != MAP_FAILED)
+    munmap(ring->sqes, ring->sqes_len);
+  if (ring->ring_fd >= 0)
+    close(ring->ring_fd);
+  ring->ring_fd = -1;
+}
+#endif
+
+
+/* Creates a ring that keeps up to "depth" writes in flight. Returns NULL
+ * only if out of memory; without io_uring, the ring writes synchronously.
+ */
+CoreRing *CoreRingCreate(unsigned depth) {
+  CoreRing *ring = calloc(1, sizeof(CoreRing));
+  if (!ring)
+    return NULL;
+  ring->ring_fd = -1;
+  ring->depth   = depth ? depth : 1;
+#ifdef HAVE_IO_URING
+  if (ring_setup(ring, ring->depth) < 0)
+    ring_teardown(ring);
+#endif
+  return ring;
+}
+
+
+/* Returns non-zero if the ring is backed by io_uring rather than by
+ * synchronous writes.
+ */
+int CoreRingIsAsync(const CoreRing *ring) {
+  return ring->ring_fd >= 0;
+}
+
+
+/* Queues the writes for a core file "fn" holding "dump". The dump, its
+ * regions and their buffers must stay valid until the core is handed back
+ * by CoreRingReap() together with "tag". Returns -1 only if the core could
+ * not be started (its file cannot be created, or out of memory); it is not
+ * queued in that case. Once 0 is returned, any later failure, including
+ * one to submit the writes, is reported as the core's result by
+ * CoreRingReap().
+ */
+int CoreRingSubmit(CoreRing *ring, char *fn, const CoreDump *dump, void *tag) {
+  struct ring_core *core = calloc(1, sizeof(struct ring_core));
+  CoreSink sink;
+
+  if (!core)
+    return -1;
+  core->ring = ring;
+  core->dump = dump;
+  core->tag  = tag;
+  if ((core->fd = open(fn, O_WRONLY | O_TRUNC | O_CREAT, 0644)) < 0) {
+    free(core);
+    return -1;
+  }
+  ring->cores++;
+
+#ifdef HAVE_IO_URING
+  if (ring->ring_fd >= 0) {
+    memset(&sink, 0, sizeof(sink));
+    sink.write  = ring_sink_write;
+    sink.skip   = ring_sink_skip;
+    sink.finish = ring_sink_finish;
+    sink.fd     = -1;
+    sink.arg    = core;
+    if (WriteElfCore(&sink, dump, NULL) < 0)
+      core->rc = -1;
+    core->submitted = 1;
+    if (core->pending == 0)
+      core_done(core);
+    /* The core is queued now and goes back through CoreRingReap() whatever
+     * happens, so a failure to hand its writes to the kernel is its result
+     * and not ours. Whatever is left over is submitted by the next reap.
+     */
+    if (ring_submit(ring, 0) < 0)
+      core->rc = -1;
+    return 0;
+  }
+#endif
+
+  InitFdCoreSink(&sink, core->fd);
+  core->rc        = WriteElfCore(&sink, dump, NULL);
+  core->submitted = 1;
+  core_done(core);
+  return 0;
+}
+
+
+/* Hands back a core whose writes have completed, storing its tag and its
+ * result (0 or -1) in "tag" and "rc". If "wait" is set, blocks until a
+ * core completes. Returns 1 if a core was reaped and 0 if none is ready
+ * (or none is left).
+ */
+int CoreRingReap(CoreRing *ring, void **tag, int *rc, int wait) {
+  struct ring_core *core;
+
+#ifdef HAVE_IO_URING
+  if (ring->ring_fd >= 0) {
+    ring_complete(ring);
+    while (!ring->done_head && wait && ring->cores) {
+      if (ring_submit(ring, 1) < 0)
+        return 0;
+    }
+  }
+#endif
+  if ((core = ring->done_head) == NULL)
+    return 0;
+  if ((ring->done_head = core->next) == NULL)
+    ring->done_tail = NULL;
+  ring->cores--;
+  *tag = core->tag;
+  *rc  = core->rc;
+  core_free(core);
+  return 1;
+}
+
+
+/* Waits for all cores in flight and releases the ring. Cores that have
+ * not been reaped are discarded.
+ */
+void CoreRingDestroy(CoreRing *ring) {
+  void *tag;
+  int   rc;
+  while (ring->cores && CoreRingReap(ring, &tag, &rc, 1))
+    ;
+#ifdef HAVE_IO_URING
+  ring_teardown(ring);
+#endif
+  free(ring);
+}
@@ -0,0 +1,332 @@
+/* Access to the firmware ELF image that produced a dump.
+ *
+ * The image is mapped and its program headers, symbol table, build-id and
+ * RAM init table (__S_init, see arm/ROMCopy.c) are located once when it
+ * is opened.
+ * FirmwareRead() returns the contents of flash as programmed, that is by
+ * load address, and FirmwareBaseline() what startup code leaves in RAM
+ * before main(), which is what delta dumps are relative to.
+ */
+
+#include "firmware.h"
+#include "elfcore.h"
+
+#include <libelf/libelf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct Firmware {
+  const uint8_t    *image;
+  size_t            size;
+  const Elf32_Phdr *phdrs;
+  int               num_phdrs;
+  const Elf32_Sym  *syms;
+  int               num_syms;
+  const char       *strtab;
+  size_t            strtab_size;
+  FirmwareInit     *init;
+  int               num_init;
+  const uint8_t    *build_id;
+  size_t            build_id_size;
+};
+
+
+static uint32_t get32(const void *p) {
+  const uint8_t *b = (const uint8_t *)p;
+  return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+/* Returns non-zero if "count" items of "size" bytes at "off" lie within
+ * the image.
+ */
+static int in_image(const Firmware *fw, uint64_t off, uint64_t count,
+                    uint64_t size) {
+  return off <= fw->size && count * size <= fw->size - off;
+}
+
+static int find_symtab(Firmware *fw, const Elf32_Ehdr *ehdr) {
+  const Elf32_Shdr *shdrs = (const Elf32_Shdr *)(fw->image + ehdr->e_shoff);
+  int i;
+
+  if (!in_image(fw, ehdr->e_shoff, ehdr->e_shnum, sizeof(Elf32_Shdr)))
+    return -1;
+  for (i = 0; i < ehdr->e_shnum; i++) {
+    const Elf32_Shdr *str;
+    if (shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= ehdr->e_shnum)
+      continue;
+    str = &shdrs[shdrs[i].sh_link];
+    if (!in_image(fw, shdrs[i].sh_offset, 1, shdrs[i].sh_size) ||
+        !in_image(fw, str->sh_offset, 1, str->sh_size))
+      return -1;
+    fw->syms        = (const Elf32_Sym *)(fw->image + shdrs[i].sh_offset);
+    fw->num_syms    = shdrs[i].sh_size / sizeof(Elf32_Sym);
+    fw->strtab      = (const char *)(fw->image + str->sh_offset);
+    fw->strtab_size = str->sh_size;
+    return 0;
+  }
+  return 0;
+}
+
+/* Finds the NT_GNU_BUILD_ID note in the SHT_NOTE sections, if any.
+ */
+static void find_build_id(Firmware *fw, const Elf32_Ehdr *ehdr) {
+  const Elf32_Shdr *shdrs = (const Elf32_Shdr *)(fw->image + ehdr->e_shoff);
+  int i;
+
+  for (i = 0; i < ehdr->e_shnum; i++) {
+    const uint8_t *notes = fw->image + shdrs[i].sh_offset;
+    size_t         off = 0, size = shdrs[i].sh_size;
+    if (shdrs[i].sh_type != SHT_NOTE ||
+        !in_image(fw, shdrs[i].sh_offset, 1, size))
+      continue;
+    while (size - off >= 12) {
+      uint32_t namesz = get32(notes + off), descsz = get32(notes + off + 4);
+      size_t   desc = off + 12 + ((namesz + 3) & ~(size_t)3);
+      if (namesz > size || descsz > size || desc + descsz > size)
+        break;
+      if (get32(notes + off + 8) == NT_GNU_BUILD_ID && namesz == 4 &&
+          memcmp(notes + off + 12, "GNU", 4) == 0 && descsz) {
+        fw->build_id      = notes + desc;
+        fw->build_id_size = descsz;
+        return;
+      }
+      off = desc + ((descsz + 3) & ~(size_t)3);
+    }
+  }
+}
+
+/* Reads the RAM init table up to its INIT_END entry. Images from before
+ * the table have __S_romp instead: source, target and size of each copy,
+ * ending with all three zero.
+ */
+static int load_init(Firmware *fw) {
+  uint64_t addr;
+  uint8_t  entry[16];
+  int      legacy = 0;
+  size_t   len;
+
+  if (FirmwareSymbol(fw, "__S_init", &addr) < 0) {
+    if (FirmwareSymbol(fw, "__S_romp", &addr) < 0)
+      return 0;
+    legacy = 1;
+  }
+  len = legacy ? 12 : 16;
+  for (;; addr += len) {
+    FirmwareInit *p;
+    if (FirmwareRead(fw, addr, entry + 16 - len, len) < 0)
+      return -1;
+    if (legacy) {
+      if (!get32(entry + 4) && !get32(entry + 8) && !get32(entry + 12))
+        return 0;
+    } else if (get32(entry) == INIT_END)
+      return 0;
+    if (!(p = realloc(fw->init, (fw->num_init + 1) * sizeof(*p))))
+      return -1;
+    fw->init = p;
+    p += fw->num_init++;
+    p->kind   = legacy ? INIT_COPY : get32(entry);
+    p->source = get32(entry + 4);
+    p->target = get32(entry + 8);
+    p->size   = get32(entry + 12);
+  }
+}
+
+/* Maps the 32-bit little endian ARM executable "fn". Returns NULL with
+ * errno set on failure, ENOEXEC if the file is not such an executable.
+ */
+Firmware *FirmwareOpen(const char *fn) {
+  const Elf32_Ehdr *ehdr;
+  struct stat       st;
+  Firmware         *fw;
+  void             *image;
+  int               fd, err;
+
+  if ((fd = open(fn, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+  image = st.st_size >= (off_t)sizeof(Elf32_Ehdr)
+        ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  err = st.st_size >= (off_t)sizeof(Elf32_Ehdr) ? errno : ENOEXEC;
+  close(fd);
+  if (image == MAP_FAILED) {
+    errno = err;
+    return NULL;
+  }
+  if (!(fw = calloc(1, sizeof(Firmware)))) {
+    munmap(image, st.st_size);
+    return NULL;
+  }
+  fw->image = image;
+  fw->size  = st.st_size;
+  ehdr      = (const Elf32_Ehdr *)image;
+  if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+      ehdr->e_ident[EI_DATA] != ELFDATA2LSB || ehdr->e_machine != EM_ARM ||
+      !in_image(fw, ehdr->e_phoff, ehdr->e_phnum, sizeof(Elf32_Phdr)) ||
+      find_symtab(fw, ehdr) < 0) {
+    FirmwareClose(fw);
+    errno = ENOEXEC;
+    return NULL;
+  }
+  fw->phdrs     = (const Elf32_Phdr *)(fw->image + ehdr->e_phoff);
+  fw->num_phdrs = ehdr->e_phnum;
+  find_build_id(fw, ehdr);
+  if (load_init(fw) < 0) {
+    FirmwareClose(fw);
+    errno = ENOEXEC;
+    return NULL;
+  }
+  return fw;
+}
+
+void FirmwareClose(Firmware *fw) {
+  if (!fw)
+    return;
+  munmap((void *)fw->image, fw->size);
+  free(fw->init);
+  free(fw);
+}
+
+/* Looks up the value of the symbol "name". Returns -1 if there is none.
+ */
+int FirmwareSymbol(const Firmware *fw, const char *name, uint64_t *value) {
+  int i;
+
+  for (i = 0; i < fw->num_syms; i++) {
+    uint32_t off = fw->syms[i].st_name;
+    if (off < fw->strtab_size &&
+        strncmp(fw->strtab + off, name, fw->strtab_size - off) == 0) {
+      *value = fw->syms[i].st_value;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* Points "syms" at the symbol table, null first entry included, and
+ * "strtab" at the string table its names are offsets into, and returns
+ * the number of symbols. The image may not terminate the last name
+ * within "strtab_size" bytes.
+ */
+int FirmwareSymbols(const Firmware *fw, const Elf32_Sym **syms,
+                    const char **strtab, size_t *strtab_size) {
+  *syms        = fw->syms;
+  *strtab      = fw->strtab;
+  *strtab_size = fw->strtab_size;
+  return fw->num_syms;
+}
+
+/* Copies "len" bytes of flash at load address "addr" into "buf". Returns
+ * -1 with errno set to EFAULT if any of them is not in the image.
+ */
+int FirmwareRead(const Firmware *fw, uint64_t addr, void *buf, size_t len) {
+  uint8_t *out = (uint8_t *)buf;
+  int      i;
+
+  while (len) {
+    for (i = 0; i < fw->num_phdrs; i++) {
+      const Elf32_Phdr *ph = &fw->phdrs[i];
+      size_t n;
+      if (ph->p_type != PT_LOAD || addr < ph->p_paddr ||
+          addr - ph->p_paddr >= ph->p_filesz ||
+          !in_image(fw, ph->p_offset, 1, ph->p_filesz))
+        continue;
+      n = ph->p_paddr + ph->p_filesz - addr;
+      if (n > len)
+        n = len;
+      memcpy(out, fw->image + ph->p_offset + (addr - ph->p_paddr), n);
+      out  += n;
+      addr += n;
+      len  -= n;
+      break;
+    }
+    if (i == fw->num_phdrs) {
+      errno = EFAULT;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Fills "buf" with what startup code leaves in the "len" bytes of RAM at
+ * "addr", as __S_init sets them up: the flash contents for copies, the
+ * pattern for fills and zeros elsewhere. Has the signature of a
+ * DumpDecoder baseline, with "fw" as its argument.
+ */
+int FirmwareBaseline(void *arg, uint64_t addr, void *buf, size_t len) {
+  const Firmware *fw = (const Firmware *)arg;
+  uint8_t        *out = (uint8_t *)buf;
+
+  while (len) {
+    const FirmwareInit *hit = NULL;
+    uint64_t n = len, i;
+    for (i = 0; i < (uint64_t)fw->num_init; i++) {
+      const FirmwareInit *p = &fw->init[i];
+      if (addr >= p->target && addr - p->target < p->size) {
+        hit = p;
+        if (n > p->target + p->size - addr)
+          n = p->target + p->size - addr;
+        break;
+      }
+      if (p->target > addr && p->target - addr < n)
+        n = p->target - addr;
+    }
+    if (hit && hit->kind == INIT_COPY) {
+      if (FirmwareRead(fw, hit->source + (addr - hit->target), out, n) < 0)
+        return -1;
+    } else if (hit && (hit->kind == INIT_FILL || hit->kind == INIT_STACK)) {
+      for (i = 0; i < n; i++)
+        out[i] = hit->source >> ((addr + i) & 3) * 8;
+    } else {
+      memset(out, 0, n);
+    }
+    out  += n;
+    addr += n;
+    len  -= n;
+  }
+  return 0;
+}
+
+/* Points "init" at the entries of the RAM init table, without the
+ * terminator, and returns their number. Images from before the table
+ * give their ROM copies as INIT_COPY entries.
+ */
+int FirmwareInitTable(const Firmware *fw, const FirmwareInit **init) {
+  *init = fw->init;
+  return fw->num_init;
+}
+
+/* Returns the build-id of the image and its size in "len", or NULL if it
+ * was linked without one.
+ */
+const uint8_t *FirmwareBuildId(const Firmware *fw, size_t *len) {
+  *len = fw->build_id_size;
+  return fw->build_id;
+}
+
+/* Returns a hash of the whole image, which tells builds apart when they
+ * have no build-id.
+ */
+uint64_t FirmwareHash(const Firmware *fw) {
+  const uint8_t *b = fw->image;
+  uint64_t       h = 0xcbf29ce484222325ull;
+  size_t         len = fw->size;
+
+  for (; len >= 8; b += 8, len -= 8) {
+    uint64_t w;
+    memcpy(&w, b, 8);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 32;
+  }
+  while (len--)
+    h = (h ^ *b++) * 0x100000001b3ull;
+  return h;
+}
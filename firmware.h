@@ -0,0 +1,42 @@
+/* Access to the firmware ELF image that produced a dump.
+ */
+
+#ifndef _FIRMWARE_H
+#define _FIRMWARE_H
+
+#include <libelf/libelf.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+  /* A firmware image mapped read-only; see firmware.c. It is never
+   * modified after FirmwareOpen(), so any number of threads may share it.
+   */
+  typedef struct Firmware Firmware;
+
+  /* One entry of the RAM init table (__S_init), as InitInfo in
+   * arm/ROMCopy.h.
+   */
+  #define INIT_END   0
+  #define INIT_COPY  1
+  #define INIT_ZERO  2
+  #define INIT_FILL  3
+  #define INIT_STACK 4
+
+  typedef struct FirmwareInit {
+    uint32_t kind, source, target, size;
+  } FirmwareInit;
+
+
+Firmware *FirmwareOpen(const char *fn);
+void FirmwareClose(Firmware *fw);
+int FirmwareSymbol(const Firmware *fw, const char *name, uint64_t *value);
+int FirmwareSymbols(const Firmware *fw, const Elf32_Sym **syms,
+                    const char **strtab, size_t *strtab_size);
+int FirmwareRead(const Firmware *fw, uint64_t addr, void *buf, size_t len);
+int FirmwareBaseline(void *arg, uint64_t addr, void *buf, size_t len);
+int FirmwareInitTable(const Firmware *fw, const FirmwareInit **init);
+const uint8_t *FirmwareBuildId(const Firmware *fw, size_t *len);
+uint64_t FirmwareHash(const Firmware *fw);
+
+#endif /* _FIRMWARE_H */
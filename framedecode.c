@@ -0,0 +1,131 @@
+/* Decoder for the serial framing of arm/dumpframe.h.
+ *
+ * Input is consumed in pieces of any size. Bytes are only buffered while
+ * a frame is incomplete; whole frames in the input are checked and passed
+ * on where they lie. After a bad CRC or an impossible length the decoder
+ * drops a single byte and searches for the next sync pattern, so a glitch
+ * on the line costs the frames it hit and nothing more.
+ */
+
+#include "framedecode.h"
+#include "arm/dumpframe.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define FRAME_MAX (DUMP_FRAME_OVERHEAD + DUMP_FRAME_PAYLOAD_MAX)
+
+struct FrameDecoder {
+  FramePayloadFn  payload;
+  void           *arg;
+  FrameStats      stats;
+  int             have_seq;     /* A frame has been seen                    */
+  uint8_t         next_seq;
+  size_t          have;         /* Bytes of a partial frame in "buf"        */
+  uint8_t         buf[2 * FRAME_MAX];
+};
+
+
+FrameDecoder *FrameDecoderCreate(FramePayloadFn payload, void *arg) {
+  FrameDecoder *f = calloc(1, sizeof(FrameDecoder));
+
+  if (f) {
+    f->payload = payload;
+    f->arg     = arg;
+  }
+  return f;
+}
+
+/* Looks for a frame at the start of the "len" bytes at "p". Returns the
+ * number of bytes to drop (a complete frame, or garbage before one), or
+ * 0 if more input is needed to tell. Sets *rc if the payload callback
+ * asked to stop.
+ */
+static size_t scan(FrameDecoder *f, const uint8_t *p, size_t len, int *rc) {
+  const uint8_t *sync;
+  size_t         size;
+  uint32_t       crc;
+  int            lost;
+
+  if (len == 0)
+    return 0;
+  if (p[0] != DUMP_FRAME_SYNC0 || (len > 1 && p[1] != DUMP_FRAME_SYNC1)) {
+    sync = memchr(p + 1, DUMP_FRAME_SYNC0, len - 1);
+    size = sync ? (size_t)(sync - p) : len;
+    f->stats.skipped += size;
+    return size;
+  }
+  if (len < DUMP_FRAME_HEADER)
+    return 0;
+  if (p[3] == 0 || p[3] > DUMP_FRAME_PAYLOAD_MAX) {
+    f->stats.skipped++;
+    return 1;
+  }
+  size = DUMP_FRAME_OVERHEAD + p[3];
+  if (len < size)
+    return 0;
+  crc = crc32(crc32(0, NULL, 0), p + 2, 2 + p[3]);
+  if (memcmp(p + size - 4, (uint8_t[]){ crc, crc >> 8, crc >> 16, crc >> 24 },
+             4)) {
+    f->stats.crc_errors++;
+    f->stats.skipped++;
+    return 1;
+  }
+
+  lost = f->have_seq ? (uint8_t)(p[2] - f->next_seq) : 0;
+  f->have_seq  = 1;
+  f->next_seq  = p[2] + 1;
+  f->stats.frames++;
+  f->stats.lost += lost;
+  *rc = f->payload(f->arg, p + DUMP_FRAME_HEADER, p[3], lost);
+  return size;
+}
+
+/* Decodes "len" bytes of input. Returns 0, or the non-zero value of the
+ * payload callback that stopped it.
+ */
+int FrameDecoderFeed(FrameDecoder *f, const void *buf, size_t len) {
+  const uint8_t *p = (const uint8_t *)buf;
+  size_t         n, k;
+  int            rc = 0;
+
+  /* Complete a partial frame from earlier input first. Once it has been
+   * consumed, or shown to be garbage, carry on directly in "buf".
+   */
+  while (f->have && rc == 0) {
+    k = len < sizeof(f->buf) - f->have ? len : sizeof(f->buf) - f->have;
+    memcpy(f->buf + f->have, p, k);
+    if ((n = scan(f, f->buf, f->have + k, &rc)) == 0) {
+      f->have += k;
+      return 0;
+    }
+    if (n >= f->have) {
+      p   += n - f->have;
+      len -= n - f->have;
+      f->have = 0;
+      break;
+    }
+    memmove(f->buf, f->buf + n, f->have - n);
+    f->have -= n;
+  }
+
+  while (len && rc == 0) {
+    if ((n = scan(f, p, len, &rc)) == 0) {
+      memcpy(f->buf, p, len);
+      f->have = len;
+      return 0;
+    }
+    p   += n;
+    len -= n;
+  }
+  return rc;
+}
+
+const FrameStats *FrameDecoderStats(const FrameDecoder *f) {
+  return &f->stats;
+}
+
+void FrameDecoderDestroy(FrameDecoder *f) {
+  free(f);
+}
@@ -0,0 +1,36 @@
+/* Decoder for the serial framing of arm/dumpframe.h.
+ */
+
+#ifndef _FRAMEDECODE_H
+#define _FRAMEDECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+  /* Receives the payload of every good frame, in order. "lost" is the
+   * number of frames missing before this one, going by the sequence
+   * numbers. A non-zero return stops FrameDecoderFeed().
+   */
+  typedef int (*FramePayloadFn)(void *arg, const uint8_t *buf, size_t len,
+                                int lost);
+
+  /* Counters of a FrameDecoder.
+   */
+  typedef struct FrameStats {
+    uint64_t        frames;     /* Good frames                              */
+    uint64_t        crc_errors; /* Frames dropped for a bad CRC             */
+    uint64_t        lost;       /* Frames missing by sequence number        */
+    uint64_t        skipped;    /* Bytes discarded looking for a frame      */
+  } FrameStats;
+
+  typedef struct FrameDecoder FrameDecoder;
+
+
+FrameDecoder *FrameDecoderCreate(FramePayloadFn payload, void *arg);
+int FrameDecoderFeed(FrameDecoder *f, const void *buf, size_t len);
+const FrameStats *FrameDecoderStats(const FrameDecoder *f);
+void FrameDecoderDestroy(FrameDecoder *f);
+
+#endif /* _FRAMEDECODE_H */
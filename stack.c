@@ -0,0 +1,334 @@
+/*
+ * stack.c
+ *
+ *  bare_core stack: high-water marks of the painted RAM in a fleet of
+ *  cores.
+ *
+ *  Startup paints the heap, the stack and all free RAM with a pattern, as
+ *  listed in the firmware's RAM init table (INIT_FILL and INIT_STACK
+ *  entries, see arm/ROMCopy.h). Whatever no longer holds the pattern in
+ *  a core has been used since the reset. The stack grows down, so its
+ *  mark is measured from the top to the deepest word that changed; the
+ *  heap and free RAM are measured from the bottom to the highest one. The
+ *  guard words at _end_heap_magic and _end_stack_magic are checked as
+ *  well.
+ *
+ *  The search compares 32 bytes at a time with the pattern and only goes
+ *  word by word in the block where it changes, so a scan runs at memory
+ *  speed; the cores are mapped, not read.
+ */
+
+#include "bare_core.h"
+#include "corefile.h"
+#include "firmware.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BLOCK 32                /* Bytes compared at a time                 */
+
+static const char *const guard_names[] = { "_end_heap_magic",
+                                           "_end_stack_magic" };
+#define NUM_GUARDS  (int)(sizeof(guard_names)/sizeof(guard_names[0]))
+
+
+typedef struct painted {
+    const FirmwareInit *init;   /* INIT_FILL or INIT_STACK entry            */
+    uint64_t   *used;           /* High-water mark per core that has it     */
+    int         num_used;
+} painted;
+
+typedef struct analysis {
+    painted    *regions;
+    int         num_regions;
+    uint64_t    guard_addr[NUM_GUARDS];
+    int         guard_known[NUM_GUARDS];
+    int         guard_checked[NUM_GUARDS];
+    int         guard_broken[NUM_GUARDS];
+    uint32_t    guard_value;
+    int         cores, capacity, failed;
+    uint64_t    bytes;          /* Painted bytes scanned                    */
+    int         verbose;
+} analysis;
+
+
+/* Fills "pat" with the target bytes of "pattern" repeated.
+ */
+static void pattern_block(uint8_t pat[BLOCK], uint32_t pattern)
+{
+    int i;
+
+    for (i = 0; i < BLOCK; i++)
+        pat[i] = pattern >> (i & 3) * 8;
+}
+
+
+/* Returns non-zero if the BLOCK bytes at "p" differ from "pat". The words
+ * are folded into one accumulator, which the compiler turns into vector
+ * code.
+ */
+static int block_differs(const uint8_t *p, const uint8_t *pat)
+{
+    uint64_t w[BLOCK / 8], v[BLOCK / 8], acc = 0;
+    int      i;
+
+    memcpy(w, p, BLOCK);
+    memcpy(v, pat, BLOCK);
+    for (i = 0; i < BLOCK / 8; i++)
+        acc |= w[i] ^ v[i];
+    return acc != 0;
+}
+
+
+/* Returns the offset of the first word of the "len" bytes at "p" that is
+ * not the pattern, or "len" if there is none. "len" is a multiple of 4.
+ */
+static size_t first_unpainted(const uint8_t *p, size_t len, uint32_t pattern)
+{
+    uint8_t pat[BLOCK];
+    size_t  off = 0;
+
+    pattern_block(pat, pattern);
+    while (len - off >= BLOCK && !block_differs(p + off, pat))
+        off += BLOCK;
+    while (off < len && memcmp(p + off, pat, 4) == 0)
+        off += 4;
+    return off;
+}
+
+
+/* Returns the offset just past the last word of the "len" bytes at "p"
+ * that is not the pattern, or 0 if there is none. "len" is a multiple of
+ * 4.
+ */
+static size_t end_unpainted(const uint8_t *p, size_t len, uint32_t pattern)
+{
+    uint8_t pat[BLOCK];
+    size_t  end = len;
+
+    pattern_block(pat, pattern);
+    while (end >= BLOCK && !block_differs(p + end - BLOCK, pat))
+        end -= BLOCK;
+    while (end > 0 && memcmp(p + end - 4, pat, 4) == 0)
+        end -= 4;
+    return end;
+}
+
+
+static void add_core(analysis *a, const char *fn)
+{
+    CoreFile *cf;
+    int       i;
+
+    if ((cf = CoreFileOpen(fn)) == NULL) {
+        fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+        a->failed++;
+        return;
+    }
+    if (a->cores == a->capacity) {
+        a->capacity = a->capacity ? 2 * a->capacity : 256;
+        for (i = 0; i < a->num_regions; i++) {
+            uint64_t *used = realloc(a->regions[i].used,
+                                     a->capacity * sizeof(uint64_t));
+            if (used == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+            a->regions[i].used = used;
+        }
+    }
+    a->cores++;
+    if (a->verbose)
+        printf("%s:", fn);
+    for (i = 0; i < a->num_regions; i++) {
+        painted            *r = &a->regions[i];
+        const FirmwareInit *e = r->init;
+        size_t              len = e->size & ~3u;
+        const uint8_t      *mem = CoreFileMemory(cf, e->target, len);
+        uint64_t            used;
+
+        if (mem == NULL)
+            continue;
+        if (e->kind == INIT_STACK)
+            used = len - first_unpainted(mem, len, e->source);
+        else
+            used = end_unpainted(mem, len, e->source);
+        r->used[r->num_used++] = used;
+        a->bytes += len;
+        if (a->verbose)
+            printf(" 0x%08x %llu", e->target, (unsigned long long)used);
+    }
+    for (i = 0; i < NUM_GUARDS; i++) {
+        const uint8_t *mem;
+        uint32_t       value;
+        if (!a->guard_known[i] ||
+            (mem = CoreFileMemory(cf, a->guard_addr[i], 4)) == NULL)
+            continue;
+        value = mem[0] | mem[1] << 8 | mem[2] << 16 | (uint32_t)mem[3] << 24;
+        a->guard_checked[i]++;
+        if (value != a->guard_value) {
+            a->guard_broken[i]++;
+            if (a->verbose)
+                printf(" %s=0x%08x", guard_names[i], value);
+        }
+    }
+    if (a->verbose)
+        printf("\n");
+    CoreFileClose(cf);
+}
+
+
+/* Reads every *.core in "dir".
+ */
+static int add_dir(analysis *a, const char *dir)
+{
+    DIR           *d;
+    struct dirent *e;
+    char           path[4096];
+
+    if ((d = opendir(dir)) == NULL)
+        return -1;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len <= 5 || strcmp(e->d_name + len - 5, ".core") != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        add_core(a, path);
+    }
+    closedir(d);
+    return 0;
+}
+
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+static void summary(analysis *a, double secs)
+{
+    int i;
+
+    printf("%d cores, %d unreadable; %.1f MB of painted RAM scanned",
+           a->cores, a->failed, a->bytes / 1e6);
+    if (secs > 0)
+        printf(" at %.0f MB/s", a->bytes / secs / 1e6);
+    printf("\n%-6s %-10s %7s %6s %7s %7s %7s %7s %8s\n", "region", "address",
+           "size", "cores", "p50", "p90", "p99", "max", "headroom");
+    for (i = 0; i < a->num_regions; i++) {
+        painted            *r = &a->regions[i];
+        const FirmwareInit *e = r->init;
+        int                 n = r->num_used;
+
+        printf("%-6s 0x%08x %7u %6d", e->kind == INIT_STACK ? "stack" : "fill",
+               e->target, e->size, n);
+        if (n == 0) {
+            printf("  (not in any core)\n");
+            continue;
+        }
+        qsort(r->used, n, sizeof(uint64_t), cmp_u64);
+        printf(" %7llu %7llu %7llu %7llu %8lld\n",
+               (unsigned long long)r->used[(n - 1) / 2],
+               (unsigned long long)r->used[(n - 1) * 9 / 10],
+               (unsigned long long)r->used[(n - 1) * 99 / 100],
+               (unsigned long long)r->used[n - 1],
+               (long long)e->size - (long long)r->used[n - 1]);
+    }
+    for (i = 0; i < NUM_GUARDS; i++) {
+        if (a->guard_known[i])
+            printf("guard %-16s 0x%08llx broken in %d of %d cores\n",
+                   guard_names[i], (unsigned long long)a->guard_addr[i],
+                   a->guard_broken[i], a->guard_checked[i]);
+    }
+}
+
+
+static void stack_usage(void)
+{
+    fprintf(stderr,
+            "usage: bare_core stack -f firmware [-v] (core | dir)...\n"
+            "\n"
+            "Reports how much of the painted stack, heap and free RAM the\n"
+            "firmware's init table lists was used in each of the cores\n"
+            "given and every *.core in the directories given: percentiles\n"
+            "and maximum in bytes, and the headroom left at the maximum.\n"
+            "Also counts the cores whose guard words were overwritten.\n"
+            "-v adds a line per core.\n");
+}
+
+
+int stack_main(int argc, char *argv[])
+{
+    analysis            a;
+    Firmware           *fw;
+    const FirmwareInit *init;
+    const char         *firmware = NULL;
+    struct stat         st;
+    struct timespec     t0, t1;
+    uint64_t            value;
+    int                 opt, i, n;
+
+    memset(&a, 0, sizeof(a));
+    while ((opt = getopt(argc, argv, "f:v")) != -1) {
+        switch (opt) {
+        case 'f':
+            firmware = optarg;
+            break;
+        case 'v':
+            a.verbose = 1;
+            break;
+        default:
+            stack_usage();
+            return 2;
+        }
+    }
+    if (!firmware || optind >= argc) {
+        stack_usage();
+        return 2;
+    }
+    if ((fw = FirmwareOpen(firmware)) == NULL) {
+        perror(firmware);
+        return 1;
+    }
+    n = FirmwareInitTable(fw, &init);
+    if ((a.regions = calloc(n + 1, sizeof(painted))) == NULL)
+        return 1;
+    for (i = 0; i < n; i++) {
+        if (init[i].kind == INIT_FILL || init[i].kind == INIT_STACK)
+            a.regions[a.num_regions++].init = &init[i];
+    }
+    if (a.num_regions == 0)
+        fprintf(stderr, "%s: no painted RAM in the init table\n", firmware);
+    for (i = 0; i < NUM_GUARDS; i++)
+        a.guard_known[i] = FirmwareSymbol(fw, guard_names[i],
+                                          &a.guard_addr[i]) == 0;
+    if (FirmwareSymbol(fw, "_guard_magic", &value) == 0)
+        a.guard_value = (uint32_t)value;
+    else
+        memset(a.guard_known, 0, sizeof(a.guard_known));
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = optind; i < argc; i++) {
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (add_dir(&a, argv[i]) < 0)
+                perror(argv[i]);
+        } else {
+            add_core(&a, argv[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    summary(&a, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+
+    for (i = 0; i < a.num_regions; i++)
+        free(a.regions[i].used);
+    free(a.regions);
+    FirmwareClose(fw);
+    return a.cores ? 0 : 1;
+}
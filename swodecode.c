@@ -0,0 +1,123 @@
+/* Decoder for raw SWO captures of ITM packets.
+ *
+ * The capture must be the bare ITM packet stream, as the TPIU sends it
+ * over SWO with its formatter bypassed (see arm/dumpswo.c). Packets are
+ * parsed one byte at a time in a single pass, following the ITM protocol
+ * of the ARMv7-M Architecture Reference Manual: synchronization bytes,
+ * overflow, local and global timestamps and extension packets are
+ * skipped, and the payloads of stimulus port packets are collected per
+ * port. Consecutive packets for the same port are handed to the callback
+ * as one block, so the callback runs once per run of data rather than
+ * once per packet.
+ */
+
+#include "swodecode.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ITM_OVERFLOW    0x70
+#define ITM_SIZE_MASK   0x03    /* Payload size of a source packet          */
+#define ITM_HW_SOURCE   0x04    /* DWT rather than stimulus port            */
+#define ITM_CONTINUE    0x80    /* Another byte of the packet follows       */
+
+#define SWO_BLOCK       65536
+
+struct SwoDecoder {
+  SwoPortFn       port_fn;
+  void           *arg;
+  SwoStats        stats;
+  int             skip;         /* Payload bytes of a packet to discard     */
+  int             cont;         /* Skipping until a byte without bit 7      */
+  int             left;         /* Payload bytes of a port packet to come   */
+  int             port;         /* Port of "block"                          */
+  size_t          used;         /* Bytes in "block"                         */
+  uint8_t         block[SWO_BLOCK];
+};
+
+
+SwoDecoder *SwoDecoderCreate(SwoPortFn port, void *arg) {
+  SwoDecoder *s = calloc(1, sizeof(SwoDecoder));
+
+  if (s) {
+    s->port_fn = port;
+    s->arg     = arg;
+  }
+  return s;
+}
+
+static int flush(SwoDecoder *s) {
+  int rc = 0;
+
+  if (s->used)
+    rc = s->port_fn(s->arg, s->port, s->block, s->used);
+  s->used = 0;
+  return rc;
+}
+
+/* Decodes "len" bytes of capture. Returns 0, or the non-zero value of the
+ * callback that stopped it.
+ */
+int SwoDecoderFeed(SwoDecoder *s, const void *buf, size_t len) {
+  const uint8_t *p = (const uint8_t *)buf, *end = p + len;
+  int            rc = 0;
+
+  while (p < end && rc == 0) {
+    uint8_t c = *p++;
+
+    if (s->left) {
+      if (s->used == SWO_BLOCK && (rc = flush(s)) != 0)
+        break;
+      s->block[s->used++] = c;
+      s->left--;
+      continue;
+    }
+    if (s->skip) {
+      s->skip--;
+      continue;
+    }
+    if (s->cont) {
+      s->cont = c & ITM_CONTINUE;
+      continue;
+    }
+
+    if (c & ITM_SIZE_MASK) {
+      /* Source packet with 1, 2 or 4 bytes of payload */
+      int size = (c & ITM_SIZE_MASK) == 3 ? 4 : c & ITM_SIZE_MASK;
+      if (c & ITM_HW_SOURCE) {
+        s->stats.other++;
+        s->skip = size;
+        continue;
+      }
+      s->stats.packets++;
+      if (s->used && s->port != c >> 3 && (rc = flush(s)) != 0)
+        break;
+      s->port = c >> 3;
+      s->left = size;
+    } else if (c == 0) {
+      /* Part of a synchronization packet */
+    } else if (c == ITM_OVERFLOW) {
+      s->stats.overflows++;
+      if ((rc = flush(s)) == 0)
+        rc = s->port_fn(s->arg, SWO_OVERFLOW, NULL, 0);
+    } else {
+      /* Timestamps and extension packets; those with bit 7 set carry
+       * more bytes, up to one without it. 0x80 ends a synchronization
+       * packet.
+       */
+      s->stats.other++;
+      s->cont = c != 0x80 && (c & ITM_CONTINUE);
+    }
+  }
+  if (rc == 0)
+    rc = flush(s);
+  return rc;
+}
+
+const SwoStats *SwoDecoderStats(const SwoDecoder *s) {
+  return &s->stats;
+}
+
+void SwoDecoderDestroy(SwoDecoder *s) {
+  free(s);
+}
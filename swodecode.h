@@ -0,0 +1,37 @@
+/* Decoder for raw SWO captures of ITM packets.
+ */
+
+#ifndef _SWODECODE_H
+#define _SWODECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+  /* Receives the data written to stimulus "port", in order and in pieces
+   * of any size, or port SWO_OVERFLOW (with no data) where the ITM FIFO
+   * overflowed and packets were lost. A non-zero return stops
+   * SwoDecoderFeed().
+   */
+  typedef int (*SwoPortFn)(void *arg, int port, const uint8_t *buf,
+                           size_t len);
+
+  #define SWO_OVERFLOW  (-1)
+
+  /* Counters of a SwoDecoder.
+   */
+  typedef struct SwoStats {
+    uint64_t        packets;    /* Stimulus port packets                    */
+    uint64_t        overflows;  /* Overflow packets                         */
+    uint64_t        other;      /* Timestamp, extension and DWT packets     */
+  } SwoStats;
+
+  typedef struct SwoDecoder SwoDecoder;
+
+
+SwoDecoder *SwoDecoderCreate(SwoPortFn port, void *arg);
+int SwoDecoderFeed(SwoDecoder *s, const void *buf, size_t len);
+const SwoStats *SwoDecoderStats(const SwoDecoder *s);
+void SwoDecoderDestroy(SwoDecoder *s);
+
+#endif /* _SWODECODE_H */
@@ -0,0 +1,163 @@
+/*
+ * symbolize.c
+ *
+ *  bare_core symbolize: names of the functions and objects at target
+ *  addresses, like addr2line without the line numbers.
+ *
+ *  Addresses come from the command line or, one per line, from standard
+ *  input, are all looked up as one batch in the firmware's symbol index
+ *  (see symindex.c, which caches it between runs) and printed in the
+ *  order given. A cached index can be named by build-id alone.
+ */
+
+#include "bare_core.h"
+#include "cache.h"
+#include "firmware.h"
+#include "symindex.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static double since(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+
+/* Appends "addr" to the growing array "*addrs".
+ */
+static int add_addr(uint32_t **addrs, size_t *n, size_t *capacity,
+                    uint32_t addr)
+{
+    if (*n == *capacity) {
+        size_t    c = *capacity ? 2 * *capacity : 4096;
+        uint32_t *p = realloc(*addrs, c * sizeof(uint32_t));
+        if (p == NULL)
+            return -1;
+        *addrs    = p;
+        *capacity = c;
+    }
+    (*addrs)[(*n)++] = addr;
+    return 0;
+}
+
+
+static void symbolize_usage(void)
+{
+    fprintf(stderr,
+            "usage: bare_core symbolize (-f firmware | -b build-id) [-s]\n"
+            "                           [address...]\n"
+            "\n"
+            "Prints each address with the function or object of the\n"
+            "firmware it is in, as name+offset. Addresses are read one per\n"
+            "line from standard input if none are given; a Thumb code\n"
+            "address shows as offset +1. -s reports the time taken to\n"
+            "standard error. The symbol index is cached by the firmware's\n"
+            "GNU build-id in $BARE_CORE_CACHE, else $XDG_CACHE_HOME/bare_core\n"
+            "or ~/.cache/bare_core; -b uses only that, given the build-id\n"
+            "in hex.\n");
+}
+
+
+int symbolize_main(int argc, char *argv[])
+{
+    Firmware       *fw = NULL;
+    SymIndex       *idx;
+    const char     *firmware = NULL, *build_id = NULL;
+    struct timespec t0;
+    uint32_t       *addrs = NULL, *syms;
+    size_t          n = 0, capacity = 0, i;
+    double          open_secs, find_secs;
+    char            line[256], key[CACHE_KEY_MAX];
+    int             opt, stats = 0;
+
+    while ((opt = getopt(argc, argv, "f:b:s")) != -1) {
+        switch (opt) {
+        case 'f':
+            firmware = optarg;
+            break;
+        case 'b':
+            build_id = optarg;
+            break;
+        case 's':
+            stats = 1;
+            break;
+        default:
+            symbolize_usage();
+            return 2;
+        }
+    }
+    if (!firmware == !build_id) {
+        symbolize_usage();
+        return 2;
+    }
+    if (build_id) {
+        /* Keys are the build-id in lower case hex, see cache.c */
+        for (i = 0; build_id[i] && i < CACHE_KEY_MAX - 1; i++)
+            key[i] = tolower((unsigned char)build_id[i]);
+        key[i] = '\0';
+    }
+    for (i = optind; i < (size_t)argc; i++) {
+        if (add_addr(&addrs, &n, &capacity, strtoul(argv[i], NULL, 0)) < 0)
+            return 1;
+    }
+    if (optind == argc) {
+        while (fgets(line, sizeof(line), stdin) != NULL) {
+            if (add_addr(&addrs, &n, &capacity, strtoul(line, NULL, 0)) < 0)
+                return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (build_id) {
+        if ((idx = SymIndexOpenCached(key)) == NULL) {
+            fprintf(stderr, "%s: build is not cached; symbolize with -f "
+                    "and its firmware once\n", build_id);
+            free(addrs);
+            return 1;
+        }
+    } else if ((fw = FirmwareOpen(firmware)) == NULL ||
+               (idx = SymIndexOpen(fw)) == NULL) {
+        perror(firmware);
+        FirmwareClose(fw);
+        free(addrs);
+        return 1;
+    }
+    open_secs = since(&t0);
+    if ((syms = malloc((n + 1) * sizeof(uint32_t))) == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    SymIndexFindBatch(idx, addrs, n, syms);
+    find_secs = since(&t0);
+
+    for (i = 0; i < n; i++) {
+        if (syms[i] == SYMINDEX_NONE)
+            printf("0x%08x ??\n", addrs[i]);
+        else
+            printf("0x%08x %s+0x%x\n", addrs[i], SymIndexName(idx, syms[i]),
+                   addrs[i] - SymIndexStart(idx, syms[i]));
+    }
+    if (stats) {
+        fprintf(stderr, "index opened in %.3f ms; %zu addresses in %.3f ms",
+                open_secs * 1e3, n, find_secs * 1e3);
+        if (find_secs > 0)
+            fprintf(stderr, ", %.1f M/s", n / find_secs / 1e6);
+        fprintf(stderr, "\n");
+    }
+
+    free(syms);
+    free(addrs);
+    SymIndexClose(idx);
+    FirmwareClose(fw);
+    return 0;
+}
@@ -0,0 +1,343 @@
+/* Address to symbol lookup in a firmware image, with an on-disk cache.
+ *
+ * The functions and objects of .symtab become intervals sorted by start
+ * address. Their starts are searched in Eytzinger order (the
+ * implicit binary tree of a heap, root at 1), so that the first levels of
+ * every search share cache lines and the next ones can be prefetched;
+ * batch lookups interleave several searches to overlap their misses.
+ *
+ * The index is one block laid out as it is stored, a header and then
+ * arrays at 64 byte aligned offsets, so that a copy in the cache (see
+ * cache.c) is used by mapping it. It is in host byte order.
+ */
+
+#include "symindex.h"
+#include "cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGIC     "BCSYMIX2"
+#define KIND      "symidx"      /* Of its cache files */
+#define ALIGN     64
+#define BATCH     8             /* Searches interleaved by the batch lookup */
+
+typedef struct header {
+  char     magic[8];
+  char     key[CACHE_KEY_MAX];  /* Of the build, see cache.h */
+  uint32_t count;               /* Symbols */
+  uint32_t size;                /* Of the whole index, header included */
+  uint32_t keys;                /* Offsets of the arrays, see SymIndex */
+  uint32_t ranks;
+  uint32_t starts;
+  uint32_t ends;
+  uint32_t names;
+  uint32_t strings;
+  uint32_t strings_size;
+} header;
+
+struct SymIndex {
+  const uint8_t  *base;
+  size_t          size;
+  int             mapped;       /* base is a mapped cache file, not malloc'd */
+  uint32_t        count;
+  const uint32_t *keys;         /* Starts in Eytzinger order, from [1] */
+  const uint32_t *ranks;        /* Sorted position of each key, [0] = count */
+  const uint32_t *starts;       /* Sorted by address, as are ends and names */
+  const uint32_t *ends;
+  const uint32_t *names;        /* Offsets into strings */
+  const char     *strings;
+};
+
+typedef struct candidate {
+  uint32_t start, size, name;
+  int      rank;                /* Lower is preferred at equal starts */
+  int      order;               /* Then the first in .symtab */
+} candidate;
+
+
+static int cmp_candidate(const void *a, const void *b) {
+  const candidate *x = (const candidate *)a, *y = (const candidate *)b;
+
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  return x->rank != y->rank ? x->rank - y->rank : x->order - y->order;
+}
+
+/* Stores the sorted "starts" into "keys" in Eytzinger order, with their
+ * positions in "ranks". Returns the position after the subtree at "k".
+ */
+static uint32_t eytzinger(uint32_t *keys, uint32_t *ranks,
+                          const uint32_t *starts, uint32_t n, uint32_t i,
+                          uint32_t k) {
+  if (k <= n) {
+    i = eytzinger(keys, ranks, starts, n, i, 2 * k);
+    keys[k]  = starts[i];
+    ranks[k] = i++;
+    i = eytzinger(keys, ranks, starts, n, i, 2 * k + 1);
+  }
+  return i;
+}
+
+static uint32_t align(uint32_t off) {
+  return (off + ALIGN - 1) & ~(uint32_t)(ALIGN - 1);
+}
+
+/* Points the arrays of "idx" into its block as "h" lays them out */
+static void set_arrays(SymIndex *idx, const header *h) {
+  idx->count   = h->count;
+  idx->keys    = (const uint32_t *)(idx->base + h->keys);
+  idx->ranks   = (const uint32_t *)(idx->base + h->ranks);
+  idx->starts  = (const uint32_t *)(idx->base + h->starts);
+  idx->ends    = (const uint32_t *)(idx->base + h->ends);
+  idx->names   = (const uint32_t *)(idx->base + h->names);
+  idx->strings = (const char *)(idx->base + h->strings);
+}
+
+static SymIndex *build(const Firmware *fw, const char *key) {
+  const Elf32_Sym *syms;
+  const char      *strtab;
+  size_t           strtab_size, strings_size = 0;
+  candidate       *c;
+  SymIndex        *idx;
+  header           h;
+  uint32_t        *keys, *ranks, *starts, *ends, *names, n = 0, m, i;
+  uint8_t         *base;
+  char            *strings;
+  int              num_syms = FirmwareSymbols(fw, &syms, &strtab, &strtab_size);
+  int              j;
+
+  if (!(c = malloc((num_syms + 1) * sizeof(candidate))))
+    return NULL;
+  for (j = 0; j < num_syms; j++) {
+    const Elf32_Sym *s = &syms[j];
+    int type = ELF32_ST_TYPE(s->st_info);
+    if ((type != STT_FUNC && type != STT_OBJECT) || s->st_shndx == SHN_UNDEF ||
+        s->st_name >= strtab_size || !strtab[s->st_name] ||
+        strtab[s->st_name] == '$')
+      continue;
+    c[n].start = type == STT_FUNC ? s->st_value & ~1u : s->st_value;
+    c[n].size  = s->st_size;
+    c[n].name  = s->st_name;
+    c[n].rank  = (!s->st_size) << 2 |
+                 (ELF32_ST_BIND(s->st_info) != STB_GLOBAL) << 1 |
+                 (type != STT_FUNC);
+    c[n].order = j;
+    strings_size += strnlen(strtab + s->st_name, strtab_size - s->st_name) + 1;
+    n++;
+  }
+  qsort(c, n, sizeof(candidate), cmp_candidate);
+  /* One symbol per address, the preferred one */
+  for (i = m = 0; i < n; i++) {
+    if (m == 0 || c[i].start != c[m - 1].start)
+      c[m++] = c[i];
+  }
+  n = m;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, sizeof(h.magic));
+  snprintf(h.key, sizeof(h.key), "%s", key);
+  h.count        = n;
+  h.keys         = align(sizeof(header));
+  h.ranks        = align(h.keys + (n + 1) * 4);
+  h.starts       = align(h.ranks + (n + 1) * 4);
+  h.ends         = align(h.starts + n * 4);
+  h.names        = align(h.ends + n * 4);
+  h.strings      = align(h.names + n * 4);
+  h.strings_size = strings_size;
+  h.size         = align(h.strings + strings_size);
+  if (!(idx = calloc(1, sizeof(SymIndex))) ||
+      !(base = aligned_alloc(ALIGN, h.size))) {
+    free(idx);
+    free(c);
+    return NULL;
+  }
+  memset(base, 0, h.size);
+  memcpy(base, &h, sizeof(h));
+  keys    = (uint32_t *)(base + h.keys);
+  ranks   = (uint32_t *)(base + h.ranks);
+  starts  = (uint32_t *)(base + h.starts);
+  ends    = (uint32_t *)(base + h.ends);
+  names   = (uint32_t *)(base + h.names);
+  strings = (char *)(base + h.strings);
+  strings_size = 0;
+  for (i = 0; i < n; i++) {
+    size_t len = strnlen(strtab + c[i].name, strtab_size - c[i].name);
+    starts[i] = c[i].start;
+    /* Unsized symbols, like assembler labels, reach to the next one */
+    if (c[i].size)
+      ends[i] = c[i].start + c[i].size;
+    else
+      ends[i] = i + 1 < n ? c[i + 1].start : UINT32_MAX;
+    names[i] = strings_size;
+    memcpy(strings + strings_size, strtab + c[i].name, len);
+    strings_size += len + 1;
+  }
+  eytzinger(keys, ranks, starts, n, 0, 1);
+  ranks[0] = n;
+  free(c);
+
+  idx->base = base;
+  idx->size = h.size;
+  set_arrays(idx, &h);
+  return idx;
+}
+
+/* Builds the index of "fw" in memory. Returns NULL with errno set on
+ * failure.
+ */
+SymIndex *SymIndexBuild(const Firmware *fw) {
+  char key[CACHE_KEY_MAX];
+
+  CacheKey(fw, key);
+  return build(fw, key);
+}
+
+/* Returns non-zero if the "size" bytes at "base" are a well formed index
+ * of the build "key".
+ */
+static int valid(const uint8_t *base, size_t size, const char *key) {
+  const header   *h = (const header *)base;
+  const uint32_t *ranks, *names;
+  uint32_t        n, i;
+
+  if (size < sizeof(header) || memcmp(h->magic, MAGIC, sizeof(h->magic)) ||
+      strncmp(h->key, key, sizeof(h->key)) || h->size != size)
+    return 0;
+  /* n < size / 4 keeps (n + 1) * 4 <= size, so the bounds below cannot
+   * wrap around.
+   */
+  n = h->count;
+  if (n >= size / 4 || h->keys % 4 || h->ranks % 4 || h->starts % 4 ||
+      h->ends % 4 || h->names % 4 || h->keys > size - (n + 1) * 4 ||
+      h->ranks > size - (n + 1) * 4 || h->starts > size - n * 4 ||
+      h->ends > size - n * 4 || h->names > size - n * 4 ||
+      h->strings > size || h->strings_size > size - h->strings ||
+      (n && (!h->strings_size || base[h->strings + h->strings_size - 1])))
+    return 0;
+  ranks = (const uint32_t *)(base + h->ranks);
+  names = (const uint32_t *)(base + h->names);
+  for (i = 0; i <= n; i++) {
+    if (ranks[i] > n || (i < n && names[i] >= h->strings_size))
+      return 0;
+  }
+  return 1;
+}
+
+/* Returns the cached index of the build "key", or NULL with errno set to
+ * ENOENT if there is none.
+ */
+SymIndex *SymIndexOpenCached(const char *key) {
+  const void *base;
+  SymIndex   *idx;
+  size_t      size;
+
+  if (!(base = CacheMap(key, KIND, &size)))
+    return NULL;
+  if (!valid(base, size, key) || !(idx = calloc(1, sizeof(SymIndex)))) {
+    CacheUnmap(base, size);
+    errno = ENOENT;
+    return NULL;
+  }
+  idx->base   = base;
+  idx->size   = size;
+  idx->mapped = 1;
+  set_arrays(idx, (const header *)base);
+  return idx;
+}
+
+/* Returns the index of "fw" from the cache, or else builds it and stores
+ * it there. A cache that cannot be read or written only costs the build.
+ */
+SymIndex *SymIndexOpen(const Firmware *fw) {
+  char      key[CACHE_KEY_MAX];
+  SymIndex *idx;
+
+  CacheKey(fw, key);
+  if ((idx = SymIndexOpenCached(key)))
+    return idx;
+  if ((idx = build(fw, key)))
+    CacheStore(key, KIND, idx->base, idx->size);
+  return idx;
+}
+
+void SymIndexClose(SymIndex *idx) {
+  if (!idx)
+    return;
+  if (idx->mapped)
+    CacheUnmap(idx->base, idx->size);
+  else
+    free((void *)idx->base);
+  free(idx);
+}
+
+/* Returns the symbol "addr" is in, or SYMINDEX_NONE. The search walks
+ * down to a leaf and takes the key after the last one not above "addr",
+ * which the trailing set bits of the final position undo.
+ */
+uint32_t SymIndexFind(const SymIndex *idx, uint32_t addr) {
+  uint32_t k = 1, i;
+
+  while (k <= idx->count) {
+    __builtin_prefetch(idx->keys + 16 * k);
+    k = 2 * k + (idx->keys[k] <= addr);
+  }
+  k >>= __builtin_ffs(~k);
+  i = idx->ranks[k];            /* First symbol starting after addr */
+  return i && addr < idx->ends[i - 1] ? i - 1 : SYMINDEX_NONE;
+}
+
+/* Looks up the "n" addresses at "addrs" into "syms", as SymIndexFind()
+ * but BATCH at a time, level by level.
+ */
+void SymIndexFindBatch(const SymIndex *idx, const uint32_t *addrs, size_t n,
+                       uint32_t *syms) {
+  uint32_t count = idx->count;
+  int      depth = 32 - __builtin_clz(count | 1);
+  size_t   j;
+
+  for (j = 0; j + BATCH <= n; j += BATCH) {
+    uint32_t k[BATCH];
+    int      b, d;
+    for (b = 0; b < BATCH; b++)
+      k[b] = 1;
+    for (d = 0; d < depth; d++) {
+      for (b = 0; b < BATCH; b++) {
+        if (k[b] <= count) {
+          __builtin_prefetch(idx->keys + 16 * k[b]);
+          k[b] = 2 * k[b] + (idx->keys[k[b]] <= addrs[j + b]);
+        }
+      }
+    }
+    for (b = 0; b < BATCH; b++) {
+      uint32_t i = idx->ranks[k[b] >> __builtin_ffs(~k[b])];
+      syms[j + b] = i && addrs[j + b] < idx->ends[i - 1] ? i - 1
+                                                          : SYMINDEX_NONE;
+    }
+  }
+  for (; j < n; j++)
+    syms[j] = SymIndexFind(idx, addrs[j]);
+}
+
+const char *SymIndexName(const SymIndex *idx, uint32_t sym) {
+  return idx->strings + idx->names[sym];
+}
+
+uint32_t SymIndexStart(const SymIndex *idx, uint32_t sym) {
+  return idx->starts[sym];
+}
+
+/* Returns the name of the symbol "addr" is in and sets "offset" to where
+ * in it, or returns NULL if it is in none.
+ */
+const char *SymIndexLookup(const SymIndex *idx, uint32_t addr,
+                           uint32_t *offset) {
+  uint32_t sym = SymIndexFind(idx, addr);
+
+  if (sym == SYMINDEX_NONE)
+    return NULL;
+  *offset = addr - idx->starts[sym];
+  return SymIndexName(idx, sym);
+}
@@ -0,0 +1,35 @@
+/* Address to symbol lookup in a firmware image, with an on-disk cache.
+ */
+
+#ifndef _SYMINDEX_H
+#define _SYMINDEX_H
+
+#include "firmware.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+  /* The functions and objects of a firmware image by address; see
+   * symindex.c. It is never modified once opened, so any number of threads
+   * may look up in it at once.
+   */
+  typedef struct SymIndex SymIndex;
+
+  /* What a lookup found: the symbol's index, or SYMINDEX_NONE */
+  #define SYMINDEX_NONE UINT32_MAX
+
+
+SymIndex *SymIndexBuild(const Firmware *fw);
+SymIndex *SymIndexOpen(const Firmware *fw);
+SymIndex *SymIndexOpenCached(const char *key);
+void SymIndexClose(SymIndex *idx);
+uint32_t SymIndexFind(const SymIndex *idx, uint32_t addr);
+void SymIndexFindBatch(const SymIndex *idx, const uint32_t *addrs, size_t n,
+                       uint32_t *syms);
+const char *SymIndexName(const SymIndex *idx, uint32_t sym);
+uint32_t SymIndexStart(const SymIndex *idx, uint32_t sym);
+const char *SymIndexLookup(const SymIndex *idx, uint32_t addr,
+                           uint32_t *offset);
+
+#endif /* _SYMINDEX_H */
@@ -0,0 +1,514 @@
+/*
+ * test_decode.c
+ *
+ * Runs bare_core decode on two recordings, each once from the file and
+ * once through a pty that it is written to in pieces of 1 to 13 bytes, so
+ * that packets, frames and record headers are split across reads. Exits
+ * non-zero unless every run writes the two cores it should, with the
+ * right registers and memory, drops the other dumps and reports the
+ * expected counters.
+ *
+ * test_decode.rec is a byte stream as it comes off the UART. It holds, in
+ * order:
+ *
+ *   - boot messages and a false sync pattern, before any frame
+ *   - a frame of console text, not part of any dump
+ *   - dump 1, whose BEGIN header is split after 5 bytes across frames
+ *   - dump 2, with a byte flipped in one frame: the frame fails its CRC
+ *     and the dump is dropped for the lost data
+ *   - dump 3, whose FAULT record has the wrong size, followed in the same
+ *     frame by dump 4, whose BEGIN header runs into the next frame
+ *   - line noise after the last frame
+ *
+ * test_decode.swo is a raw SWO capture, read with -s 1. Between and in
+ * the middle of the dumps on stimulus port 1 it has printf traffic on
+ * port 0, synchronization packets, local and global timestamps, an
+ * extension packet and DWT event, PC sample and exception trace packets:
+ *
+ *   - dump 1, whose BEGIN header comes one byte per packet, each followed
+ *     by port 0 data and another packet, so the decoder sees it in 1 byte
+ *     pieces
+ *   - dump 2, with an overflow packet halfway through: it is dropped
+ *   - dump 3, in 2 byte packets
+ *
+ * The recordings are written by
+ * "./test_decode -w test_decode.rec test_decode.swo" if they have to
+ * change.
+ *
+ *   ./test_decode bare_core test_decode.rec test_decode.swo
+ */
+
+#define _GNU_SOURCE             /* memmem() */
+#include "arm/dumpframe.h"
+#include "arm/dumpstream.h"
+#include "arm/dumpswo.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define REGION1_ADDR    0x1fffc000u
+#define REGION1_SIZE    512
+#define REGION2_ADDR    0x20000000u
+#define REGION2_SIZE    256
+
+/* What one recording should decode to */
+typedef struct capture {
+    const char     *swo_port;   /* -s argument, or NULL for frames          */
+    uint8_t         data[8192];
+    size_t          len;
+    int             dumps;      /* In the recording                         */
+    int             core[2];    /* Those that become cores                  */
+    uint32_t        pc[2];      /* Their pc; the first has region 1, the    */
+                                /* second region 2                          */
+    const char     *stats;      /* Last line of output                      */
+} capture;
+
+static capture uart = {
+    NULL, { 0 }, 0, 4, { 1, 4 }, { 0x08001234, 0x08004444 },
+    "2 cores, 2 dumps dropped; 10 frames, 2 CRC errors, 1 lost, "
+    "137 bytes skipped\n"
+};
+
+static capture swo = {
+    "1", { 0 }, 0, 3, { 1, 3 }, { 0x08005555, 0x08006666 },
+    "2 cores, 1 dumps dropped; 309 port packets, 1 overflows, "
+    "29 other packets\n"
+};
+
+static uint8_t  pay[4096];      /* Dump stream, before framing or packets   */
+static size_t   pay_len;
+static uint8_t  seq;
+
+
+/* Contents of the two regions that make it into cores */
+
+static void region1(uint8_t *p)
+{
+    int i;
+
+    for (i = 0; i < 400; i += 4)
+        memcpy(p + i, "\xef\xbe\xad\xde", 4);
+    for (i = 400; i < REGION1_SIZE; i++)
+        p[i] = (uint8_t)(i * 3);
+}
+
+static void region2(uint8_t *p)
+{
+    int i;
+
+    memset(p, 0, 200);
+    for (i = 200; i < REGION2_SIZE; i++)
+        p[i] = (uint8_t)(i ^ 0x5a);
+}
+
+
+/* Writing the recordings */
+
+static void put(uint8_t *buf, size_t *len, const void *p, size_t n)
+{
+    memcpy(buf + *len, p, n);
+    *len += n;
+}
+
+static void put32(uint32_t v)
+{
+    uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+    put(pay, &pay_len, b, 4);
+}
+
+static void record(uint32_t type, uint32_t addr, uint32_t size)
+{
+    put32(DUMP_MAGIC);
+    put32(type);
+    put32(addr);
+    put32(size);
+}
+
+/* Appends a dump with a fault record whose pc is "pc" and region 1 or 2,
+ * as "region" says, to the dump stream. The fault record is "fault_size"
+ * bytes long.
+ */
+static void dump(uint32_t pc, int region, uint32_t fault_size)
+{
+    static const uint8_t tokens1[] = {
+        DUMP_TOK_WORDS, 100 - DUMP_WORDS_MIN, 0xef, 0xbe, 0xad, 0xde,
+        DUMP_TOK_LITERAL | (REGION1_SIZE - 400 - 1)
+    };
+    static const uint8_t tokens2[] = {
+        DUMP_TOK_BYTES, 200 - DUMP_BYTES_MIN, 0x00,
+        DUMP_TOK_LITERAL | (REGION2_SIZE - 200 - 1)
+    };
+    uint8_t  mem[REGION1_SIZE];
+    uint32_t i;
+
+    record(DUMP_REC_BEGIN, 0, 4);
+    put(pay, &pay_len, "\x01\x02\x03\x04", 4);
+    record(DUMP_REC_FAULT, 0, fault_size);
+    for (i = 0; i < fault_size / 4; i++)
+        put32(i == 15 ? pc : i == 16 ? 0x21000000 : 0x1000 + i);
+    if (region == 1) {
+        region1(mem);
+        record(DUMP_REC_REGION, REGION1_ADDR, REGION1_SIZE);
+        put(pay, &pay_len, tokens1, sizeof(tokens1));
+        put(pay, &pay_len, mem + 400, REGION1_SIZE - 400);
+    } else {
+        region2(mem);
+        record(DUMP_REC_REGION, REGION2_ADDR, REGION2_SIZE);
+        put(pay, &pay_len, tokens2, sizeof(tokens2));
+        put(pay, &pay_len, mem + 200, REGION2_SIZE - 200);
+    }
+    record(DUMP_REC_END, 0, 0);
+}
+
+/* Frames the next "len" bytes of the dump stream, starting at "*pos".
+ * If "flip" is set, a payload byte is flipped after the CRC is taken.
+ */
+static void frame(capture *c, size_t *pos, size_t len, int flip)
+{
+    uint8_t  hdr[4] = { DUMP_FRAME_SYNC0, DUMP_FRAME_SYNC1, seq++, len };
+    uint32_t crc = crc32(crc32(0, NULL, 0), hdr + 2, 2);
+    uint8_t  b[4];
+
+    crc = crc32(crc, pay + *pos, len);
+    b[0] = crc;
+    b[1] = crc >> 8;
+    b[2] = crc >> 16;
+    b[3] = crc >> 24;
+    put(c->data, &c->len, hdr, 4);
+    put(c->data, &c->len, pay + *pos, len);
+    if (flip)
+        c->data[c->len - len / 2] ^= 0x10;
+    put(c->data, &c->len, b, 4);
+    *pos += len;
+}
+
+/* Frames the dump stream from "*pos" up to "end" in frames of at most
+ * DUMP_FRAME_PAYLOAD_MAX bytes.
+ */
+static void frames(capture *c, size_t *pos, size_t end)
+{
+    while (*pos < end)
+        frame(c, pos, end - *pos < DUMP_FRAME_PAYLOAD_MAX
+                      ? end - *pos : DUMP_FRAME_PAYLOAD_MAX, 0);
+}
+
+static void write_uart(capture *c)
+{
+    size_t pos = 0, start3, start4;
+
+    pay_len = 0;
+    put(c->data, &c->len, "boot 1.2\r\n\xa5\x5a\x07\x03" "clock ok\r\n", 24);
+
+    put(pay, &pay_len, "console: hello\n", 15);
+    frame(c, &pos, 15, 0);
+
+    /* Dump 1, with its BEGIN header split */
+    dump(c->pc[0], 1, sizeof(FaultRecord));
+    frame(c, &pos, 5, 0);
+    frames(c, &pos, pay_len);
+
+    /* Dump 2, with a flipped byte in its second frame */
+    dump(0x08002222, 1, sizeof(FaultRecord));
+    frame(c, &pos, 100, 0);
+    frame(c, &pos, 100, 1);
+    frames(c, &pos, pay_len);
+
+    /* Dump 3, malformed, and dump 4 in the same frame, with dump 4's BEGIN
+     * header split 3 bytes in
+     */
+    start3 = pay_len;
+    record(DUMP_REC_BEGIN, 0, 0);
+    record(DUMP_REC_FAULT, 0, 12);
+    start4 = pay_len;
+    dump(c->pc[1], 2, sizeof(FaultRecord));
+    frame(c, &pos, start4 + 3 - start3, 0);
+    frames(c, &pos, pay_len);
+
+    put(c->data, &c->len, "\x00\xff\xa5\x13\x37", 5);
+}
+
+/* Appends a stimulus port packet with the "n" (1, 2 or 4) bytes at "p".
+ */
+static void itm(capture *c, int port, const void *p, int n)
+{
+    uint8_t hdr = port << 3 | (n == 4 ? 3 : n);
+
+    put(c->data, &c->len, &hdr, 1);
+    put(c->data, &c->len, p, n);
+}
+
+/* Sends "n" bytes of the dump stream from "*pos" to port DUMP_SWO_PORT in
+ * packets of "size" bytes, and of single bytes at the end. After every
+ * "every" packets come printf traffic and one of the other packets.
+ */
+static void itm_dump(capture *c, size_t *pos, size_t n, int size, int every)
+{
+    static const uint8_t other[][6] = {
+        { 1, 0x30 },                            /* Local timestamp        */
+        { 3, 0xc0, 0x85, 0x03 },                /* Local timestamp, long  */
+        { 5, 0x94, 0x81, 0x82, 0x83, 0x04 },    /* Global timestamp 1     */
+        { 3, 0xb4, 0x80, 0x01 },                /* Global timestamp 2     */
+        { 5, 0x17, 0x70, 0x80, 0x00, 0x08 },    /* DWT PC sample          */
+        { 2, 0x05, 0x70 },                      /* DWT event counter      */
+        { 3, 0x0e, 0x0b, 0x10 },                /* DWT exception trace    */
+        { 1, 0x08 },                            /* Extension              */
+    };
+    size_t end = *pos + n;
+    int    i = 0;
+
+    while (*pos < end) {
+        int k = end - *pos >= (size_t)size ? size : 1;
+        itm(c, DUMP_SWO_PORT, pay + *pos, k);
+        *pos += k;
+        if (++i % every == 0) {
+            const uint8_t *o = other[i / every % 8];
+            itm(c, 0, "tick", i & 1 ? 4 : 2);
+            put(c->data, &c->len, o + 1, o[0]);
+        }
+    }
+}
+
+static void write_swo(capture *c)
+{
+    static const uint8_t sync[] = { 0, 0, 0, 0, 0, 0x80 };
+    const char *hello = "hello, world\n";
+    size_t pos = 0, start, i;
+
+    pay_len = 0;
+    put(c->data, &c->len, sync, sizeof(sync));
+    for (i = 0; i < strlen(hello); i++)
+        itm(c, 0, hello + i, 1);
+
+    /* Dump 1, the BEGIN header one byte at a time */
+    dump(c->pc[0], 1, sizeof(FaultRecord));
+    itm_dump(c, &pos, sizeof(DumpRecord), 1, 1);
+    itm_dump(c, &pos, pay_len - pos, 4, 16);
+    put(c->data, &c->len, sync, sizeof(sync));
+
+    /* Dump 2, with an overflow halfway */
+    start = pay_len;
+    dump(0x08007777, 1, sizeof(FaultRecord));
+    itm_dump(c, &pos, (pay_len - start) / 2, 4, 32);
+    put(c->data, &c->len, "\x70", 1);
+    itm_dump(c, &pos, pay_len - pos, 4, 32);
+
+    /* Dump 3 */
+    dump(c->pc[1], 2, sizeof(FaultRecord));
+    itm_dump(c, &pos, pay_len - pos, 2, 24);
+    put(c->data, &c->len, sync, sizeof(sync));
+}
+
+static int write_file(const char *fn, const capture *c)
+{
+    FILE *f;
+
+    if ((f = fopen(fn, "wb")) == NULL ||
+        fwrite(c->data, c->len, 1, f) != 1 || fclose(f) != 0) {
+        perror(fn);
+        return 1;
+    }
+    return 0;
+}
+
+
+/* Checking the output */
+
+/* Returns non-zero unless the core "fn" holds the "size" bytes of "mem",
+ * which are a whole PT_LOAD segment, and the register value "pc".
+ */
+static int check_core(const char *fn, const uint8_t *mem, size_t size,
+                      uint32_t pc)
+{
+    uint8_t     buf[65536], b[4] = { pc, pc >> 8, pc >> 16, pc >> 24 };
+    ssize_t     n;
+    int         fd;
+
+    if ((fd = open(fn, O_RDONLY)) < 0) {
+        printf("%s: %s\n", fn, strerror(errno));
+        return 1;
+    }
+    n = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (n < 0 || !memmem(buf, n, mem, size) || !memmem(buf, n, b, 4)) {
+        printf("%s: region or pc missing\n", fn);
+        return 1;
+    }
+    return 0;
+}
+
+/* Checks what bare_core decode wrote into "dir" and printed as "out", and
+ * empties "dir".
+ */
+static int check_run(const capture *c, const char *what, const char *dir,
+                     const char *out)
+{
+    uint8_t     r1[REGION1_SIZE], r2[REGION2_SIZE];
+    const char *stats = strstr(out, "2 cores");
+    char        fn[4096];
+    struct stat st;
+    int         failed = 0, i;
+
+    region1(r1);
+    region2(r2);
+    if (!stats || strcmp(stats, c->stats) != 0) {
+        printf("%s: output was\n%s", what, out);
+        failed++;
+    }
+    snprintf(fn, sizeof(fn), "%s/dump-%d.core", dir, c->core[0]);
+    failed += check_core(fn, r1, sizeof(r1), c->pc[0]);
+    snprintf(fn, sizeof(fn), "%s/dump-%d.core", dir, c->core[1]);
+    failed += check_core(fn, r2, sizeof(r2), c->pc[1]);
+    for (i = 1; i <= c->dumps; i++) {
+        snprintf(fn, sizeof(fn), "%s/dump-%d.core", dir, i);
+        if (i != c->core[0] && i != c->core[1] && stat(fn, &st) == 0) {
+            printf("%s: dump-%d.core written\n", what, i);
+            failed++;
+        }
+        unlink(fn);
+    }
+    return failed;
+}
+
+/* Reads what the child writes to "fd" until it exits.
+ */
+static void read_all(int fd, char *out, size_t size)
+{
+    size_t  len = 0;
+    ssize_t n;
+
+    while (len < size - 1 && ((n = read(fd, out + len, size - 1 - len)) > 0 ||
+                              (n < 0 && errno == EINTR)))
+        len += n > 0 ? n : 0;
+    out[len] = 0;
+}
+
+/* Runs bare_core decode on the recording "c" in the file "input", with
+ * its stdout into "out". If "input" is NULL, the recording is written to
+ * a pty whose other side is the input instead.
+ */
+static int run(const char *bare_core, const capture *c, const char *input,
+               const char *dir, char *out, size_t size)
+{
+    int   pipefd[2], master = -1, slave = -1, status;
+    char  name[256];
+    pid_t pid;
+
+    if (!input) {
+        struct termios tio;
+        if (openpty(&master, &slave, name, NULL, NULL) < 0 ||
+            tcgetattr(slave, &tio) < 0)
+            return -1;
+        /* Raw before the first byte, or the line discipline gets them */
+        cfmakeraw(&tio);
+        if (tcsetattr(slave, TCSANOW, &tio) < 0)
+            return -1;
+        input = name;
+    }
+    if (pipe(pipefd) < 0 || (pid = fork()) < 0)
+        return -1;
+    if (pid == 0) {
+        dup2(pipefd[1], 1);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        if (master >= 0)
+            close(master);
+        if (c->swo_port)
+            execl(bare_core, bare_core, "decode", "-s", c->swo_port,
+                  "-o", dir, input, (char *)NULL);
+        else
+            execl(bare_core, bare_core, "decode", "-o", dir, input,
+                  (char *)NULL);
+        _exit(127);
+    }
+    close(pipefd[1]);
+    if (master >= 0) {
+        size_t pos = 0, n;
+        int    left;
+        for (n = 1; pos < c->len; pos += n, n = n % 13 + 1) {
+            if (n > c->len - pos)
+                n = c->len - pos;
+            if (write(master, c->data + pos, n) != (ssize_t)n)
+                return -1;
+        }
+        /* Closing the master discards what the decoder has not read */
+        while (ioctl(slave, FIONREAD, &left) == 0 && left > 0)
+            usleep(1000);
+        usleep(10000);
+        close(master);
+        close(slave);
+    }
+    read_all(pipefd[0], out, size);
+    close(pipefd[0]);
+    if (waitpid(pid, &status, 0) < 0)
+        return -1;
+    /* decode exits non-zero when it drops dumps */
+    return WIFEXITED(status) && WEXITSTATUS(status) == 1 ? 0 : -1;
+}
+
+/* Decodes the recording in "fn" from the file and through a pty.
+ */
+static int check(const char *bare_core, capture *c, const char *fn,
+                 const char *dir)
+{
+    char  out[8192], what[256];
+    FILE *f;
+    int   failed = 0;
+
+    if ((f = fopen(fn, "rb")) == NULL ||
+        (c->len = fread(c->data, 1, sizeof(c->data), f)) == 0) {
+        perror(fn);
+        return 1;
+    }
+    fclose(f);
+
+    snprintf(what, sizeof(what), "%s from the file", fn);
+    if (run(bare_core, c, fn, dir, out, sizeof(out)) < 0) {
+        printf("%s: decode failed\n%s", what, out);
+        failed++;
+    } else
+        failed += check_run(c, what, dir, out);
+
+    snprintf(what, sizeof(what), "%s through a pty", fn);
+    if (run(bare_core, c, NULL, dir, out, sizeof(out)) < 0) {
+        printf("%s: decode failed\n%s", what, out);
+        failed++;
+    } else
+        failed += check_run(c, what, dir, out);
+    return failed;
+}
+
+
+int main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/test_decode.XXXXXX";
+    int  failed = 0;
+
+    if (argc == 4 && strcmp(argv[1], "-w") == 0) {
+        write_uart(&uart);
+        write_swo(&swo);
+        return write_file(argv[2], &uart) || write_file(argv[3], &swo);
+    }
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s bare_core uart-recording swo-recording\n"
+                        "       %s -w uart-recording swo-recording\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    if (mkdtemp(dir) == NULL) {
+        perror(dir);
+        return 1;
+    }
+    failed += check(argv[1], &uart, argv[2], dir);
+    failed += check(argv[1], &swo, argv[3], dir);
+    rmdir(dir);
+    return failed != 0;
+}
@@ -0,0 +1,551 @@
+/*
+ * test_dumpstream.c
+ *
+ * Round trips dumps through the writer in arm/dumpstream.c and the
+ * decoder in dumpdecode.c on the host: runs of zeros, of the guard fill
+ * and of single bytes, literals of every length around the token limits,
+ * runs too long for one token and regions at odd addresses, with the
+ * stream fed to the decoder whole and in pieces of 1, 3, 7 and 4096
+ * bytes. Exits non-zero if any region, register or build-id comes back
+ * different, or if the compressor grows a region by more than it may.
+ *
+ * Delta regions are decoded against a small firmware image that the test
+ * writes out, with the init table and ROM contents that __S_init gives
+ * the writer, so that FirmwareBaseline() rebuilds what the writer
+ * compared against. They are sent with no, one and many chunks changed,
+ * and must fail with EBADMSG against an image with other ROM contents.
+ *
+ * The writer takes target addresses as uint32_t, so the program is built
+ * without PIE, which keeps its data below 4 GB. Its cycle counts read
+ * DWT_CYCCNT, so a page is mapped where the DWT is on the target; the
+ * CRC module is stood in for by zlib, whose CRC-32 it matches.
+ */
+
+#include "dumpdecode.h"
+#include "firmware.h"
+#include "arm/crc.h"
+#include "arm/dumpstream.h"
+#include "arm/ROMCopy.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define DWT_PAGE    0xe0001000u
+#define RAM_SIZE    (160*1024)      /* Holds a run too long for one token */
+
+/* RAM as startup leaves it for the delta tests, like ex1's m_ram1 */
+#define DATA_SIZE   2048            /* Copied from rom[]                  */
+#define BSS_SIZE    4096            /* Cleared                            */
+#define FILL_SIZE   10240           /* Painted with FILL_PATTERN          */
+#define FILL_PATTERN 0xdeadbeefu
+#define INIT_TABLE  0x400           /* Flash address of the table         */
+
+/* Stand-ins for the symbols that the linker defines on the target: an
+ * init table with nothing in it and a GNU build-id note.
+ */
+InitInfo __S_init[8] = { { INIT_END, 0, 0, 0 } };
+
+__asm__(".section .rodata\n"
+        ".balign 4\n"
+        ".globl __build_id_start\n"
+        ".globl __build_id_end\n"
+        "__build_id_start:\n"
+        ".long 4, 20, 3\n"
+        ".asciz \"GNU\"\n"
+        ".byte 0x8b, 0x1d, 0x3e, 0x02, 0x44, 0x9a, 0xc1, 0x57, 0x60, 0x0f\n"
+        ".byte 0x2b, 0x93, 0x7e, 0xd4, 0x15, 0xa8, 0x36, 0xcc, 0x01, 0xf2\n"
+        "__build_id_end:\n"
+        ".text\n");
+
+extern const uint8_t __build_id_start[], __build_id_end[];
+
+static uint32_t ram[RAM_SIZE / 4];
+static uint8_t  rom[DATA_SIZE];
+
+static uint8_t *stream;
+static size_t   stream_len, stream_cap;
+
+
+/* CRC module */
+
+static uint32_t crc;
+
+void crc_init(void)
+{
+}
+
+void crc_start(void)
+{
+    crc = crc32(0, NULL, 0);
+}
+
+void crc_feed(const void *buf, uint32_t len)
+{
+    crc = crc32(crc, buf, len);
+}
+
+void crc_feed_fill(uint32_t pattern, uint32_t len)
+{
+    uint8_t b[4] = { pattern, pattern >> 8, pattern >> 16, pattern >> 24 };
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+        crc = crc32(crc, &b[i & 3], 1);
+}
+
+uint32_t crc_result(void)
+{
+    return crc;
+}
+
+
+/* Collects the stream, as the UART or SWO transport would send it.
+ */
+static void collect(const void *buf, uint32_t len)
+{
+    if (stream_len + len > stream_cap) {
+        stream_cap = 2 * (stream_len + len);
+        if ((stream = realloc(stream, stream_cap)) == NULL) {
+            perror("test_dumpstream");
+            exit(1);
+        }
+    }
+    memcpy(stream + stream_len, buf, len);
+    stream_len += len;
+}
+
+
+/* Fills ram with everything the compressor has a token for, in pieces
+ * whose edges fall at every alignment.
+ */
+static void fill_ram(void)
+{
+    uint8_t *p = (uint8_t *)ram;
+    uint32_t seed = 12345, i, n;
+
+    memset(ram, 0, sizeof(ram));
+    for (i = 0; i < 16*1024; i += 4)            /* Guard fill */
+        memcpy(p + i, "\xef\xbe\xad\xde", 4);
+    for (i = 16*1024 + 1, n = 1; n <= 300; i += n + 1, n++) {
+        if (n % 3 == 0)                         /* Byte runs */
+            memset(p + i, n, n);
+        else {                                  /* Literals */
+            uint32_t j;
+            for (j = 0; j < n; j++) {
+                seed = seed * 1103515245 + 12345;
+                p[i + j] = seed >> 16;
+            }
+        }
+    }
+    /* What is left, over 64 KB, stays zero: a word run of more than
+     * DUMP_RUN_MAX words.
+     */
+}
+
+
+/* Makes a dump with the fault record "rec" and the given regions of ram,
+ * "n" pairs of offset and size, as deltas if "delta" is set, and returns
+ * its size.
+ */
+static size_t encode(const FaultRecord *rec, const uint32_t *regions, int n,
+                     int delta, DumpStats *stats)
+{
+    int i;
+
+    stream_len = 0;
+    memset(stats, 0, sizeof(*stats));
+    dump_begin(collect, stats);
+    dump_fault(rec);
+    for (i = 0; i < n; i++) {
+        uint32_t addr = (uint32_t)(uintptr_t)ram + regions[2*i];
+        if (delta)
+            dump_region_delta(addr, regions[2*i + 1]);
+        else
+            dump_region(addr, regions[2*i + 1]);
+    }
+    dump_end();
+    return stream_len;
+}
+
+
+/* Decodes the stream fed in pieces of "piece" bytes, with deltas against
+ * "fw" if it is set, and compares the result with what was dumped.
+ */
+static int decode(const char *what, size_t piece, const FaultRecord *rec,
+                  const uint32_t *regions, int n, Firmware *fw)
+{
+    DumpDecoder *d = DumpDecoderCreate();
+    CoreDump     dump;
+    size_t       pos, len;
+    int          failed = 0, i;
+
+    if (!d) {
+        perror("test_dumpstream");
+        exit(1);
+    }
+    if (fw)
+        DumpDecoderSetBaseline(d, FirmwareBaseline, fw);
+    for (pos = 0; pos < stream_len; pos += len) {
+        len = stream_len - pos < piece ? stream_len - pos : piece;
+        if (DumpDecoderFeed(d, stream + pos, len) != (ssize_t)len) {
+            printf("%s, %zu byte pieces: rejected at %zu\n", what, piece, pos);
+            DumpDecoderDestroy(d);
+            return 1;
+        }
+    }
+    if (!DumpDecoderDone(d)) {
+        printf("%s, %zu byte pieces: not done\n", what, piece);
+        DumpDecoderDestroy(d);
+        return 1;
+    }
+    DumpDecoderGetCore(d, &dump);
+    if (dump.num_regions != n) {
+        printf("%s, %zu byte pieces: %d regions, expected %d\n",
+               what, piece, dump.num_regions, n);
+        failed++;
+    }
+    for (i = 0; i < n && i < dump.num_regions; i++) {
+        const CoreRegion *r = &dump.regions[i];
+        const uint8_t    *p = (const uint8_t *)ram + regions[2*i];
+        if (r->addr != (uintptr_t)p || r->size != regions[2*i + 1] ||
+            memcmp(r->buf, p, r->size) != 0) {
+            printf("%s, %zu byte pieces: region %d differs\n", what, piece, i);
+            failed++;
+        }
+    }
+    if (memcmp(dump.frame->arm.uregs, rec->regs.uregs,
+               sizeof(rec->regs.uregs)) != 0 || dump.num_notes != 1 ||
+        memcmp(dump.notes[0].desc, &rec->exc_return,
+               dump.notes[0].descsz) != 0) {
+        printf("%s, %zu byte pieces: fault record differs\n", what, piece);
+        failed++;
+    }
+    if (dump.build_id_size != 20 ||
+        memcmp(dump.build_id, __build_id_start + 16, 20) != 0) {
+        printf("%s, %zu byte pieces: build-id differs\n", what, piece);
+        failed++;
+    }
+    DumpDecoderDestroy(d);
+    return failed;
+}
+
+
+static int round_trip(const char *what, const FaultRecord *rec,
+                      const uint32_t *regions, int n, Firmware *fw)
+{
+    static const size_t pieces[] = { 1, 3, 7, 4096, (size_t)-1 };
+    DumpStats stats;
+    uint32_t  in = 0;
+    size_t    len = encode(rec, regions, n, fw != NULL, &stats);
+    unsigned  i;
+    int       failed = 0;
+
+    for (i = 0; i < (unsigned)n; i++)
+        in += regions[2*i + 1];
+    if (stats.in != in || stats.out != len) {
+        printf("%s: stats say %u in, %u out, expected %u and %zu\n",
+               what, stats.in, stats.out, in, len);
+        failed++;
+    }
+    for (i = 0; i < sizeof(pieces)/sizeof(*pieces); i++)
+        failed += decode(what, pieces[i], rec, regions, n, fw);
+    return failed;
+}
+
+
+/* Random bytes only ever become literals, which may cost one byte in
+ * DUMP_LITERAL_MAX.
+ */
+static int check_bound(void)
+{
+    uint32_t    regions[2] = { 0, 64*1024 }, seed = 99, i;
+    uint8_t    *p = (uint8_t *)ram;
+    FaultRecord rec;
+    DumpStats   stats;
+    size_t      overhead = 4 * sizeof(DumpRecord) + 20 + sizeof(rec);
+
+    memset(&rec, 0, sizeof(rec));
+    for (i = 0; i < regions[1]; i++) {
+        seed = seed * 1103515245 + 12345;
+        p[i] = seed >> 16;
+    }
+    encode(&rec, regions, 1, 0, &stats);
+    if (stats.out > overhead + regions[1] + regions[1] / DUMP_LITERAL_MAX) {
+        printf("random region: %u bytes became %u\n", regions[1], stats.out);
+        return 1;
+    }
+    return round_trip("random region", &rec, regions, 1, NULL);
+}
+
+
+/* A stream that stops short is never done, and one with a bad magic is
+ * rejected.
+ */
+static int check_truncated(void)
+{
+    uint32_t    regions[2] = { 0, 4096 };
+    FaultRecord rec;
+    DumpStats   stats;
+    DumpDecoder *d;
+    int         failed = 0;
+
+    memset(&rec, 0, sizeof(rec));
+    encode(&rec, regions, 1, 0, &stats);
+    d = DumpDecoderCreate();
+    if (DumpDecoderFeed(d, stream, stream_len - 1) < 0 || DumpDecoderDone(d)) {
+        printf("truncated stream: decoded\n");
+        failed++;
+    }
+    DumpDecoderDestroy(d);
+
+    stream[sizeof(DumpRecord) + 20] ^= 0xff;
+    d = DumpDecoderCreate();
+    if (DumpDecoderFeed(d, stream, stream_len) >= 0) {
+        printf("bad magic: accepted\n");
+        failed++;
+    }
+    DumpDecoderDestroy(d);
+    return failed;
+}
+
+
+/* Writes a firmware image to "fn" as the linker would have for the init
+ * table in __S_init: rom[] as flash at its own address, the table at
+ * INIT_TABLE, and a symbol table with __S_init. "rom_xor" is applied to
+ * the copy of rom[] in the image, to make one that does not match.
+ */
+static int write_firmware(const char *fn, uint8_t rom_xor)
+{
+    struct {
+        Elf32_Ehdr ehdr;
+        Elf32_Phdr phdr[2];
+        Elf32_Shdr shdr[3];
+        uint32_t   init[4 * 4];
+        Elf32_Sym  sym[2];
+        char       str[16];
+        uint8_t    rom[DATA_SIZE];
+    } image;
+    FILE *f;
+    int   i;
+
+    memset(&image, 0, sizeof(image));
+    memcpy(image.ehdr.e_ident, ELFMAG, SELFMAG);
+    image.ehdr.e_ident[EI_CLASS]   = ELFCLASS32;
+    image.ehdr.e_ident[EI_DATA]    = ELFDATA2LSB;
+    image.ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    image.ehdr.e_type      = ET_EXEC;
+    image.ehdr.e_machine   = EM_ARM;
+    image.ehdr.e_version   = EV_CURRENT;
+    image.ehdr.e_phoff     = offsetof(typeof(image), phdr);
+    image.ehdr.e_shoff     = offsetof(typeof(image), shdr);
+    image.ehdr.e_ehsize    = sizeof(Elf32_Ehdr);
+    image.ehdr.e_phentsize = sizeof(Elf32_Phdr);
+    image.ehdr.e_phnum     = 2;
+    image.ehdr.e_shentsize = sizeof(Elf32_Shdr);
+    image.ehdr.e_shnum     = 3;
+
+    image.phdr[0].p_type   = PT_LOAD;
+    image.phdr[0].p_offset = offsetof(typeof(image), init);
+    image.phdr[0].p_vaddr  = INIT_TABLE;
+    image.phdr[0].p_paddr  = INIT_TABLE;
+    image.phdr[0].p_filesz = sizeof(image.init);
+    image.phdr[0].p_memsz  = sizeof(image.init);
+    image.phdr[0].p_flags  = PF_R;
+    image.phdr[1].p_type   = PT_LOAD;
+    image.phdr[1].p_offset = offsetof(typeof(image), rom);
+    image.phdr[1].p_vaddr  = (uint32_t)(uintptr_t)rom;
+    image.phdr[1].p_paddr  = (uint32_t)(uintptr_t)rom;
+    image.phdr[1].p_filesz = sizeof(image.rom);
+    image.phdr[1].p_memsz  = sizeof(image.rom);
+    image.phdr[1].p_flags  = PF_R;
+
+    image.shdr[1].sh_type    = SHT_SYMTAB;
+    image.shdr[1].sh_offset  = offsetof(typeof(image), sym);
+    image.shdr[1].sh_size    = sizeof(image.sym);
+    image.shdr[1].sh_link    = 2;
+    image.shdr[1].sh_entsize = sizeof(Elf32_Sym);
+    image.shdr[2].sh_type    = SHT_STRTAB;
+    image.shdr[2].sh_offset  = offsetof(typeof(image), str);
+    image.shdr[2].sh_size    = sizeof(image.str);
+    strcpy(image.str + 1, "__S_init");
+    image.sym[1].st_name     = 1;
+    image.sym[1].st_value    = INIT_TABLE;
+
+    for (i = 0; __S_init[i].Kind != INIT_END; i++) {
+        image.init[4*i]     = __S_init[i].Kind;
+        image.init[4*i + 1] = __S_init[i].Source;
+        image.init[4*i + 2] = __S_init[i].Target;
+        image.init[4*i + 3] = __S_init[i].Size;
+    }
+    for (i = 0; i < DATA_SIZE; i++)
+        image.rom[i] = rom[i] ^ rom_xor;
+
+    if ((f = fopen(fn, "wb")) == NULL ||
+        fwrite(&image, sizeof(image), 1, f) != 1 || fclose(f) != 0)
+        return -1;
+    return 0;
+}
+
+
+static void set_entry(int i, unsigned long kind, unsigned long source,
+                      unsigned long offset, unsigned long size)
+{
+    __S_init[i].Kind   = kind;
+    __S_init[i].Source = source;
+    __S_init[i].Target = (uintptr_t)ram + offset;
+    __S_init[i].Size   = size;
+}
+
+
+/* Sets up the init table and RAM as startup would leave them: rom[] copied
+ * to the start of ram, then cleared and painted ranges, zeros after.
+ */
+static void startup_ram(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < DATA_SIZE; i++)
+        rom[i] = (uint8_t)(i * 13 + 7);
+    set_entry(0, INIT_COPY, (uintptr_t)rom, 0, DATA_SIZE);
+    set_entry(1, INIT_ZERO, 0, DATA_SIZE, BSS_SIZE);
+    set_entry(2, INIT_FILL, FILL_PATTERN, DATA_SIZE + BSS_SIZE, FILL_SIZE);
+    set_entry(3, INIT_END, 0, 0, 0);
+
+    memset(ram, 0, sizeof(ram));
+    memcpy(ram, rom, DATA_SIZE);
+    for (i = 0; i < FILL_SIZE / 4; i++)
+        ram[(DATA_SIZE + BSS_SIZE) / 4 + i] = FILL_PATTERN;
+}
+
+
+/* Returns the type of the third record of the stream, the first region.
+ */
+static uint32_t first_region_type(void)
+{
+    size_t pos = sizeof(DumpRecord) + 20 + sizeof(DumpRecord) +
+                 sizeof(FaultRecord);
+    uint32_t type;
+
+    memcpy(&type, stream + pos + 4, 4);
+    return type;
+}
+
+
+/* Delta regions over every kind of init table entry, starting and ending
+ * at odd addresses and in ranges with no entry, with no, one and many
+ * chunks changed since startup.
+ */
+static int check_delta(const FaultRecord *rec)
+{
+    static const uint32_t regions[] = {
+        0, DATA_SIZE + BSS_SIZE + FILL_SIZE + 1000,
+        DATA_SIZE - 5, 3*DUMP_CHUNK_SIZE + 11,
+        DATA_SIZE + BSS_SIZE + 2, FILL_SIZE - 1
+    };
+    static const uint32_t large[] = {
+        0, DUMP_DELTA_MAX_CHUNKS * DUMP_CHUNK_SIZE + 1
+    };
+    int         n = sizeof(regions) / sizeof(*regions) / 2;
+    char        fn[] = "/tmp/test_dumpstream.XXXXXX";
+    uint8_t    *p = (uint8_t *)ram;
+    Firmware   *fw;
+    DumpDecoder *d;
+    DumpStats   stats;
+    size_t      empty;
+    int         failed = 0, fd, i;
+
+    startup_ram();
+    if ((fd = mkstemp(fn)) < 0 || close(fd) < 0 ||
+        write_firmware(fn, 0) < 0 || (fw = FirmwareOpen(fn)) == NULL) {
+        perror("test_dumpstream: firmware");
+        return 1;
+    }
+
+    /* Nothing changed: only the CRC and bitmap of each region are sent */
+    empty = encode(rec, regions, n, 1, &stats);
+    failed += round_trip("delta, unchanged", rec, regions, n, fw);
+    for (i = 0; i < n; i++)
+        empty -= sizeof(DumpRecord) + 4 +
+                 (regions[2*i + 1] + 8*DUMP_CHUNK_SIZE - 1) /
+                 (8*DUMP_CHUNK_SIZE);
+    if (empty != 3 * sizeof(DumpRecord) + 20 + sizeof(FaultRecord)) {
+        printf("delta, unchanged: sent chunks\n");
+        failed++;
+    }
+
+    p[DATA_SIZE + 100] ^= 0x40;
+    failed += round_trip("delta, one chunk", rec, regions, n, fw);
+
+    for (i = 0; i < DATA_SIZE + BSS_SIZE + FILL_SIZE + 1000;
+         i += 2*DUMP_CHUNK_SIZE + 3)
+        p[i] += 1 + i;
+    failed += round_trip("delta, many chunks", rec, regions, n, fw);
+
+    /* Too many chunks for a bitmap, so sent whole */
+    encode(rec, large, 1, 1, &stats);
+    if (first_region_type() != DUMP_REC_REGION) {
+        printf("delta, large: not sent whole\n");
+        failed++;
+    }
+    failed += round_trip("delta, large", rec, large, 1, fw);
+    FirmwareClose(fw);
+
+    /* Other ROM contents: the CRC of the first region does not match */
+    encode(rec, regions, n, 1, &stats);
+    if (write_firmware(fn, 0x01) < 0 || (fw = FirmwareOpen(fn)) == NULL) {
+        perror("test_dumpstream: firmware");
+        unlink(fn);
+        return failed + 1;
+    }
+    d = DumpDecoderCreate();
+    DumpDecoderSetBaseline(d, FirmwareBaseline, fw);
+    errno = 0;
+    if (DumpDecoderFeed(d, stream, stream_len) >= 0 || errno != EBADMSG) {
+        printf("delta, wrong firmware: %s\n", strerror(errno));
+        failed++;
+    }
+    DumpDecoderDestroy(d);
+    FirmwareClose(fw);
+    unlink(fn);
+    return failed;
+}
+
+
+int main(void)
+{
+    static const uint32_t whole[] = { 0, RAM_SIZE };
+    static const uint32_t odd[] = {
+        1, 0,  3, 1,  5, 7,  16*1024 - 3, 9,  16*1024 + 1, 2 + 3 + 4 + 5,
+        16*1024 - 129, 131 + 129,  1, 16*1024 + 301*150 - 2
+    };
+    FaultRecord rec;
+    int failed = 0, i;
+
+    if (mmap((void *)(uintptr_t)DWT_PAGE, 4096, PROT_READ|PROT_WRITE,
+             MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0) ==
+        MAP_FAILED) {
+        perror("test_dumpstream: DWT page");
+        return 1;
+    }
+    for (i = 0; i < 18; i++)
+        rec.regs.uregs[i] = 0x10000000u * (i & 7) + i;
+    rec.exc_return = 0xfffffff9;
+    rec.cfsr       = 0x00020000;
+    rec.hfsr       = 0x40000000;
+    rec.mmfar      = 0xe000edf4;
+    rec.bfar       = 0xe000edf8;
+    rec.cycles     = 1234;
+
+    fill_ram();
+    failed += round_trip("whole RAM", &rec, whole, 1, NULL);
+    failed += round_trip("odd regions", &rec, odd,
+                         sizeof(odd) / sizeof(*odd) / 2, NULL);
+    failed += check_bound();
+    failed += check_truncated();
+    failed += check_delta(&rec);
+    return failed != 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * test_fault.c
+ *
+ * Runs fault_extract() from arm/faultextract.c on synthetic exception
+ * frames: basic and with floating point state, each aligned and padded to
+ * 8 bytes, from the main and the process stack. Exits non-zero if any
+ * register comes out wrong.
+ */
+
+#include "fault.h"
+#include <stdio.h>
+#include <string.h>
+
+#define EXC_RETURN_MSP_BASIC    0xfffffff9u
+#define EXC_RETURN_PSP_BASIC    0xfffffffdu
+#define EXC_RETURN_MSP_FP       0xffffffe9u
+#define EXC_RETURN_PSP_FP       0xffffffedu
+#define XPSR_STACK_ALIGN        0x200u
+
+/* Room for the largest frame, s0-s15, fpscr and the reserved word
+ * included, and the padding word.
+ */
+static uint32_t stack[8 + 18 + 1];
+
+static int check(const char *what, uint32_t exc_return, uint32_t xpsr,
+                 uint32_t frame_words)
+{
+    static const uint32_t callee[8] = {
+        0x44444444, 0x55555555, 0x66666666, 0x77777777,
+        0x88888888, 0x99999999, 0xaaaaaaaa, 0xbbbbbbbb
+    };
+    uint32_t expected[18];
+    FaultRecord rec;
+    int failed = 0, i;
+
+    stack[0] = 0x10101010;      /* r0 */
+    stack[1] = 0x11111111;      /* r1 */
+    stack[2] = 0x22222222;      /* r2 */
+    stack[3] = 0x33333333;      /* r3 */
+    stack[4] = 0xcccccccc;      /* r12 */
+    stack[5] = 0x0800abcd;      /* lr */
+    stack[6] = 0x08001234;      /* pc */
+    stack[7] = 0x21000000 | xpsr;
+
+    for (i = 0; i < 4; i++)
+        expected[i] = stack[i];
+    for (i = 0; i < 8; i++)
+        expected[4 + i] = callee[i];
+    expected[12] = stack[4];
+    expected[13] = (uint32_t)(uintptr_t)stack + 4 * frame_words +
+                   (xpsr & XPSR_STACK_ALIGN ? 4 : 0);
+    expected[14] = stack[5];
+    expected[15] = stack[6];
+    expected[16] = stack[7];
+    expected[17] = stack[0];
+
+    memset(&rec, 0xee, sizeof(rec));
+    fault_extract(&rec, stack, exc_return, callee);
+    for (i = 0; i < 18; i++) {
+        if (rec.regs.uregs[i] != expected[i]) {
+            printf("%s: r%d is %08x, expected %08x\n",
+                   what, i, rec.regs.uregs[i], expected[i]);
+            failed++;
+        }
+    }
+    if (rec.exc_return != exc_return) {
+        printf("%s: exc_return is %08x, expected %08x\n",
+               what, rec.exc_return, exc_return);
+        failed++;
+    }
+    return failed;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    failed += check("basic",            EXC_RETURN_MSP_BASIC, 0, 8);
+    failed += check("basic, padded",    EXC_RETURN_MSP_BASIC,
+                    XPSR_STACK_ALIGN, 8);
+    failed += check("basic psp",        EXC_RETURN_PSP_BASIC, 0, 8);
+    failed += check("fp",               EXC_RETURN_MSP_FP, 0, 8 + 18);
+    failed += check("fp, padded",       EXC_RETURN_MSP_FP,
+                    XPSR_STACK_ALIGN, 8 + 18);
+    failed += check("fp psp, padded",   EXC_RETURN_PSP_FP,
+                    XPSR_STACK_ALIGN, 8 + 18);
+    return failed != 0;
+}
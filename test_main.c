@@ -6,9 +6,14 @@
  */
 
 #include "elfcore.h"
+#include <libelf/libelf.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 void test_elfcore(void);
+void test_elfcore_regions(void);
+int test_arm32_notes(void);
 
 
 uint32_t core_buf[32 * 1024 / 4];
@@ -21,7 +26,130 @@ void test_elfcore()
     CreateElfCore("core", 0x1fffc000, (uint8_t *)core_buf, 32*1024, &core_frame);
 }
 
+/* m_ram1 and m_ram2 from MK12DX256_app.ld, each taken from its own half of
+ * core_buf.
+ */
+void test_elfcore_regions()
+{
+    CoreRegion regions[2] = {
+        { .addr = 0x1fffc000, .size = 16*1024,         .flags = PF_R|PF_W|PF_X,
+          .buf = (uint8_t *)core_buf,           .fd = -1, .offset = 0,
+          .priority = 0 },
+        { .addr = 0x20000000, .size = 16*1024 - 0x100, .flags = PF_R|PF_W|PF_X,
+          .buf = (uint8_t *)core_buf + 16*1024, .fd = -1, .offset = 0,
+          .priority = 0 },
+    };
+
+    memset(core_buf, 0xde, sizeof(core_buf));
+    CreateElfCoreRegions("core_regions", regions, 2, &core_frame, NULL);
+}
+
+/* The NT_PRPSINFO and NT_PRSTATUS notes of an ARM32 core, spelled out byte
+ * by byte in the layouts that gdb and BFD read (elf32-arm.c, grok_psinfo
+ * and grok_prstatus): prpsinfo is 124 bytes with pr_pid at 12 and pr_fname
+ * at 28, prstatus is 148 bytes with pr_cursig at 12, pr_pid at 24 and the
+ * 18 registers at 72. Each note has a 12 byte header and the owner "CORE"
+ * without a NUL.
+ */
+#define B32(le, x) \
+    (le) ? (x) & 0xff : (x) >> 24,        (le) ? ((x) >> 8) & 0xff : ((x) >> 16) & 0xff, \
+    (le) ? ((x) >> 16) & 0xff : ((x) >> 8) & 0xff, (le) ? (x) >> 24 : (x) & 0xff
+#define Z4      0, 0, 0, 0
+#define Z16     Z4, Z4, Z4, Z4
+#define REG(le, i) B32(le, 0xa0b0c000u + (i))
+#define ARM32_NOTES(le) {                                                   \
+    /* NT_PRPSINFO                                                       */ \
+    B32(le, 4), B32(le, 124), B32(le, NT_PRPSINFO), 'C', 'O', 'R', 'E',     \
+    0, 'R', 0, 0,                   /* pr_state, pr_sname, pr_zomb, nice */ \
+    Z4,                             /* pr_flag                           */ \
+    Z4,                             /* pr_uid, pr_gid                    */ \
+    B32(le, 0x1234),                /* pr_pid                            */ \
+    Z4, Z4, Z4,                     /* pr_ppid, pr_pgrp, pr_sid          */ \
+    'f', 'i', 'r', 'm', 'w', 'a', 'r', 'e', 0, 0, 0, 0, Z4, /* pr_fname  */ \
+    Z16, Z16, Z16, Z16, Z16,        /* pr_psargs                         */ \
+    /* NT_PRSTATUS                                                       */ \
+    B32(le, 4), B32(le, 148), B32(le, NT_PRSTATUS), 'C', 'O', 'R', 'E',     \
+    Z4, Z4, B32(le, 0x55),          /* si_signo, si_code, si_errno       */ \
+    Z4,                             /* pr_cursig, pad                    */ \
+    Z4, Z4,                         /* pr_sigpend, pr_sighold            */ \
+    B32(le, 0x1234),                /* pr_pid                            */ \
+    Z4, Z4, Z4,                     /* pr_ppid, pr_pgrp, pr_sid          */ \
+    Z16, Z16,                       /* pr_utime ... pr_cstime            */ \
+    REG(le, 0),  REG(le, 1),  REG(le, 2),  REG(le, 3),  REG(le, 4),         \
+    REG(le, 5),  REG(le, 6),  REG(le, 7),  REG(le, 8),  REG(le, 9),         \
+    REG(le, 10), REG(le, 11), REG(le, 12), REG(le, 13), REG(le, 14),        \
+    REG(le, 15), REG(le, 16), REG(le, 17),                                  \
+    Z4                              /* pr_fpvalid                        */ \
+}
+
+static const uint8_t arm32le_notes[] = ARM32_NOTES(1);
+static const uint8_t arm32be_notes[] = ARM32_NOTES(0);
+
+/* Writes a one region core for each ARM32 flavour and compares its notes,
+ * which follow the ELF header and two program headers, with the fixtures
+ * above. Returns the number of mismatches.
+ */
+int test_arm32_notes()
+{
+    static const struct {
+        const char    *name;
+        int            target;
+        const uint8_t *notes;
+    } targets[] = {
+        { "arm32le", CORE_TARGET_ARM32_LE, arm32le_notes },
+        { "arm32be", CORE_TARGET_ARM32_BE, arm32be_notes },
+    };
+    static const uint8_t ram[256] = { 1 };
+    CoreRegion region = {
+        .addr = 0x1fffc000, .size = sizeof(ram), .flags = PF_R|PF_W,
+        .buf = ram, .fd = -1, .offset = 0, .priority = 0
+    };
+    size_t notes = sizeof(Elf32_Ehdr) + 2*sizeof(Elf32_Phdr);
+    Frame frame;
+    int failed = 0;
+    unsigned i, j;
+
+    _Static_assert(sizeof(arm32le_notes) == 2*16 + 124 + 148,
+                   "note fixture has the wrong size");
+    memset(&frame, 0, sizeof(frame));
+    for (i = 0; i < 18; i++)
+        frame.arm.uregs[i] = 0xa0b0c000u + i;
+    frame.errno_ = 0x55;
+    frame.tid    = 0x1234;
+
+    for (i = 0; i < sizeof(targets)/sizeof(*targets); i++) {
+        CoreDump dump = {
+            .regions = &region, .num_regions = 1, .frame = &frame,
+            .target = targets[i].target
+        };
+        CoreSink sink;
+
+        if (InitMemCoreSink(&sink, 0) < 0 ||
+            WriteElfCore(&sink, &dump, NULL) < 0 ||
+            sink.size < notes + sizeof(arm32le_notes)) {
+            printf("%s: cannot write the core\n", targets[i].name);
+            failed++;
+        } else {
+            for (j = 0; j < sizeof(arm32le_notes); j++) {
+                if (sink.data[notes + j] != targets[i].notes[j]) {
+                    printf("%s: note byte %u is %02x, expected %02x\n",
+                           targets[i].name, j, sink.data[notes + j],
+                           targets[i].notes[j]);
+                    failed++;
+                    break;
+                }
+            }
+        }
+        free(sink.data);
+    }
+    return failed;
+}
+
 int main(int argc, char *argv[])
 {
+    (void)argc;
+    (void)argv;
     test_elfcore();
+    test_elfcore_regions();
+    return test_arm32_notes() != 0;
 }
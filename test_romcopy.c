@@ -0,0 +1,283 @@
+/*
+ * test_romcopy.c
+ *
+ * Checks __copy_rom_section() and __fill_ram_section() from arm/ROMCopy.c
+ * on the host: every source and destination alignment, every length up to
+ * a few bursts, against memcpy() and the pattern as it lies in memory, and
+ * that no byte outside the section is touched. With -b it then times the
+ * copy, aligned and through the shifting path, against the
+ * byte/halfword/word loop it replaced, and the fill, and a whole RAM
+ * setup through __init_ram_sections() against the startup sequence
+ * before the init table.
+ *
+ * Built at -O0 like the target objects, so the old loop runs as it did
+ * there and the new routines as BOOT_FAST makes them.
+ *
+ *   ./test_romcopy [-b]     -b also runs the throughput comparison
+ */
+
+#include "ROMCopy.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_LEN     300
+#define GUARD       8
+#define BENCH_SIZE  (64*1024)
+#define BENCH_BYTES (256*1024*1024)
+
+/* RAM set up at boot, roughly as much as ex1 has */
+#define BOOT_DATA   1536        /* .data and .data2, copied from ROM       */
+#define BOOT_BSS    8192        /* .bss and .bss2, cleared                 */
+#define BOOT_PAINT  12288       /* Heap, stack and free RAM, painted       */
+#define BOOT_RUNS   20000
+
+/* Walked by __init_ram_sections(); bench_boot() fills it in */
+InitInfo __S_init[6] = { { INIT_END, 0, 0, 0 } };
+
+
+/* __copy_rom_section() before the word bursts, for comparison.
+ */
+static void old_copy_rom_section(unsigned long dst, unsigned long src,
+                                 unsigned long size)
+{
+    unsigned long len = size;
+
+    if (dst == src || size == 0)
+        return;
+    while (len > 0) {
+        if (!(src & 3) && !(dst & 3) && len >= 4) {
+            *((int *)dst) = *((int *)src);
+            dst += 4;
+            src += 4;
+            len -= 4;
+        } else if (!(src & 1) && !(dst & 1) && len >= 2) {
+            *((short *)dst) = *((short *)src);
+            dst += 2;
+            src += 2;
+            len -= 2;
+        } else {
+            *((char *)dst) = *((char *)src);
+            dst += 1;
+            src += 1;
+            len -= 1;
+        }
+    }
+}
+
+
+static uint32_t src_buf[(MAX_LEN + 2*GUARD) / 4 + 1];
+static uint32_t dst_buf[(MAX_LEN + 2*GUARD) / 4 + 1];
+
+/* Returns the number of bytes in dst_buf outside [lo, hi) that are not
+ * 0x5a any more.
+ */
+static int guards_hit(const uint8_t *lo, const uint8_t *hi)
+{
+    const uint8_t *p = (const uint8_t *)dst_buf;
+    const uint8_t *end = p + sizeof(dst_buf);
+    int hit = 0;
+
+    for (; p < end; p++)
+        hit += (p < lo || p >= hi) && *p != 0x5a;
+    return hit;
+}
+
+
+static int check_copy(void)
+{
+    uint8_t *sb = (uint8_t *)src_buf, *db = (uint8_t *)dst_buf;
+    int failed = 0, sa, da, len;
+    unsigned i;
+
+    for (i = 0; i < sizeof(src_buf); i++)
+        sb[i] = (uint8_t)(i * 7 + 1);
+    for (sa = 0; sa < 4; sa++) {
+        for (da = 0; da < 4; da++) {
+            for (len = 0; len <= MAX_LEN; len++) {
+                uint8_t *s = sb + GUARD + sa, *d = db + GUARD + da;
+                memset(db, 0x5a, sizeof(dst_buf));
+                __copy_rom_section((unsigned long)d, (unsigned long)s, len);
+                if (memcmp(d, s, len) != 0 || guards_hit(d, d + len)) {
+                    printf("copy: src +%d, dst +%d, %d bytes: wrong\n",
+                           sa, da, len);
+                    failed++;
+                }
+            }
+        }
+    }
+    return failed;
+}
+
+
+static int check_fill(void)
+{
+    static const uint32_t patterns[] = { 0, 0xa5a5a5a5, 0x11223344 };
+    uint8_t *db = (uint8_t *)dst_buf;
+    int failed = 0, da, len, i;
+    unsigned p;
+
+    for (p = 0; p < sizeof(patterns)/sizeof(*patterns); p++) {
+        for (da = 0; da < 4; da++) {
+            for (len = 0; len <= MAX_LEN; len++) {
+                uint8_t *d = db + GUARD + da;
+                int bad = 0;
+                memset(db, 0x5a, sizeof(dst_buf));
+                __fill_ram_section((unsigned long)d, patterns[p], len);
+                for (i = 0; i < len; i++)
+                    bad |= d[i] != (uint8_t)(patterns[p] >>
+                                             ((uintptr_t)(d + i) & 3) * 8);
+                if (bad || guards_hit(d, d + len)) {
+                    printf("fill %08x: dst +%d, %d bytes: wrong\n",
+                           patterns[p], da, len);
+                    failed++;
+                }
+            }
+        }
+    }
+    return failed;
+}
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void bench_copy(const char *what,
+                       void (*copy)(unsigned long, unsigned long,
+                                    unsigned long),
+                       uint8_t *dst, const uint8_t *src)
+{
+    double start = now(), secs;
+    int i;
+
+    for (i = 0; i < BENCH_BYTES / BENCH_SIZE; i++)
+        copy((unsigned long)dst, (unsigned long)src, BENCH_SIZE);
+    secs = now() - start;
+    printf("  %-24s %8.1f MB/s\n", what, BENCH_BYTES / secs / 1e6);
+}
+
+
+static void bench(void)
+{
+    uint32_t *src = malloc(BENCH_SIZE + 8), *dst = malloc(BENCH_SIZE + 8);
+    uint8_t  *s = (uint8_t *)src, *d = (uint8_t *)dst;
+    double    start, secs;
+    int       i;
+
+    if (!src || !dst) {
+        perror("test_romcopy");
+        exit(1);
+    }
+    memset(s, 0x3c, BENCH_SIZE + 8);
+    printf("%d KB sections:\n", BENCH_SIZE / 1024);
+    bench_copy("old copy, aligned", old_copy_rom_section, d, s);
+    bench_copy("new copy, aligned", __copy_rom_section, d, s);
+    bench_copy("old copy, src +1", old_copy_rom_section, d, s + 1);
+    bench_copy("new copy, src +1", __copy_rom_section, d, s + 1);
+    bench_copy("old copy, src +2, dst +1", old_copy_rom_section, d + 1, s + 2);
+    bench_copy("new copy, src +2, dst +1", __copy_rom_section, d + 1, s + 2);
+
+    start = now();
+    for (i = 0; i < BENCH_BYTES / BENCH_SIZE; i++)
+        __fill_ram_section((unsigned long)d, 0xa5a5a5a5, BENCH_SIZE);
+    secs = now() - start;
+    printf("  %-24s %8.1f MB/s\n", "fill", BENCH_BYTES / secs / 1e6);
+    free(src);
+    free(dst);
+}
+
+
+/* What startup did before the init table: memset() of .bss and .bss2,
+ * then the old copy loop over the __S_romp entries for .data and .data2.
+ * The host memset() is likely faster than the one on the target.
+ */
+static void old_boot(uint8_t *ram, const uint8_t *rom)
+{
+    memset(ram + BOOT_DATA, 0, BOOT_BSS / 2);
+    memset(ram + BOOT_DATA + BOOT_BSS / 2, 0, BOOT_BSS / 2);
+    old_copy_rom_section((unsigned long)ram, (unsigned long)rom,
+                         BOOT_DATA / 2);
+    old_copy_rom_section((unsigned long)ram + BOOT_DATA / 2,
+                         (unsigned long)rom + BOOT_DATA / 2, BOOT_DATA / 2);
+}
+
+
+static void set_entry(int i, unsigned long kind, unsigned long source,
+                      const uint8_t *target, unsigned long size)
+{
+    __S_init[i].Kind   = kind;
+    __S_init[i].Source = source;
+    __S_init[i].Target = (unsigned long)target;
+    __S_init[i].Size   = size;
+}
+
+
+static int bench_boot(void)
+{
+    uint8_t *rom = malloc(BOOT_DATA);
+    uint8_t *ram = malloc(BOOT_DATA + BOOT_BSS + BOOT_PAINT);
+    double   start, secs;
+    int      failed = 0, i;
+
+    if (!rom || !ram) {
+        perror("test_romcopy");
+        exit(1);
+    }
+    memset(rom, 0x3c, BOOT_DATA);
+    printf("RAM setup, %d bytes copied, %d cleared:\n", BOOT_DATA, BOOT_BSS);
+
+    start = now();
+    for (i = 0; i < BOOT_RUNS; i++)
+        old_boot(ram, rom);
+    secs = now() - start;
+    printf("  %-24s %8.2f us\n", "old sequence", secs / BOOT_RUNS * 1e6);
+
+    set_entry(0, INIT_COPY, (unsigned long)rom, ram, BOOT_DATA / 2);
+    set_entry(1, INIT_COPY, (unsigned long)rom + BOOT_DATA / 2,
+              ram + BOOT_DATA / 2, BOOT_DATA / 2);
+    set_entry(2, INIT_ZERO, 0, ram + BOOT_DATA, BOOT_BSS / 2);
+    set_entry(3, INIT_ZERO, 0, ram + BOOT_DATA + BOOT_BSS / 2, BOOT_BSS / 2);
+    set_entry(4, INIT_END, 0, NULL, 0);
+    start = now();
+    for (i = 0; i < BOOT_RUNS; i++)
+        __init_ram_sections();
+    secs = now() - start;
+    printf("  %-24s %8.2f us\n", "init table", secs / BOOT_RUNS * 1e6);
+
+    set_entry(4, INIT_FILL, 0xa5a5a5a5, ram + BOOT_DATA + BOOT_BSS,
+              BOOT_PAINT);
+    set_entry(5, INIT_END, 0, NULL, 0);
+    start = now();
+    for (i = 0; i < BOOT_RUNS; i++)
+        __init_ram_sections();
+    secs = now() - start;
+    printf("  %-24s %8.2f us\n", "init table, with paint",
+           secs / BOOT_RUNS * 1e6);
+    if (memcmp(ram, rom, BOOT_DATA) != 0 || ram[BOOT_DATA + BOOT_BSS - 1] ||
+        ram[BOOT_DATA + BOOT_BSS + BOOT_PAINT - 1] != 0xa5) {
+        printf("  init table set up RAM wrongly\n");
+        failed++;
+    }
+    free(rom);
+    free(ram);
+    return failed;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int failed = check_copy() + check_fill();
+
+    if (!failed && argc > 1 && strcmp(argv[1], "-b") == 0) {
+        bench();
+        failed += bench_boot();
+    }
+    return failed != 0;
+}
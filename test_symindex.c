@@ -0,0 +1,480 @@
+/*
+ * test_symindex.c
+ *
+ * Checks SymIndexFind() and SymIndexFindBatch() from symindex.c against a
+ * linear scan of the symbol table, on firmware images that the test
+ * writes out with 0, 1 and 2^k - 1 and 2^k symbols for k up to 10, so
+ * that the Eytzinger tree is empty, a single node, full and one past full.
+ * The symbols are sized and unsized, some overlap the next one, some leave
+ * gaps, and some share their start with others that the index must not
+ * prefer; mapping symbols and ones of other types must be skipped.
+ * Every symbol is looked up just before, at and just after its start and
+ * end, along with addresses at random.
+ *
+ * Then it opens an index through the cache, in a directory of its own,
+ * and checks that the cached copy answers the same, and that truncated or
+ * corrupted copies of it are not used. Exits non-zero on any difference.
+ */
+
+#include "cache.h"
+#include "firmware.h"
+#include "symindex.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_SYMS    4096
+
+/* Offsets of the fields of a cached index, as symindex.c lays it out */
+#define H_KEY           8
+#define H_COUNT         ((8 + CACHE_KEY_MAX + 3) & ~3)
+#define H_SIZE          (H_COUNT + 4)
+#define H_KEYS          (H_COUNT + 8)
+#define H_RANKS         (H_COUNT + 12)
+#define H_NAMES         (H_COUNT + 24)
+#define H_STRINGS       (H_COUNT + 28)
+#define H_STRINGS_SIZE  (H_COUNT + 32)
+
+typedef struct sym {
+    uint32_t value, size;
+    uint8_t  type, bind;
+    uint16_t shndx;
+    char     name[16];
+} sym;
+
+static sym      syms[MAX_SYMS];
+static int      num_syms;
+static uint32_t seed = 12345;
+
+
+static uint32_t rnd(uint32_t n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % n;
+}
+
+
+static void add(uint32_t value, uint32_t size, int type, int bind, int shndx,
+                const char *name)
+{
+    sym *s = &syms[num_syms++];
+
+    s->value = value;
+    s->size  = size;
+    s->type  = type;
+    s->bind  = bind;
+    s->shndx = shndx;
+    snprintf(s->name, sizeof(s->name), "%s", name);
+}
+
+
+/* Fills syms with "count" symbols at distinct starts, and others that the
+ * index drops: ones at the same starts that it must not prefer, mapping
+ * symbols, undefined ones and ones that are neither functions nor
+ * objects.
+ */
+static void make_syms(int count)
+{
+    uint32_t addr = 0x100;
+    char     name[16];
+    int      i;
+
+    num_syms = 0;
+    for (i = 0; i < count; i++) {
+        uint32_t size, r = rnd(8);
+        int      func = rnd(2);
+        if (r < 2)
+            size = 0;                           /* Reaches to the next one */
+        else if (r < 4)
+            size = 0x100;                       /* Overlaps the next one */
+        else
+            size = 1 + rnd(24);                 /* Mostly leaves a gap */
+        snprintf(name, sizeof(name), "s%d", i);
+        add(addr | func, size, func ? STT_FUNC : STT_OBJECT,
+            rnd(4) ? STB_GLOBAL : STB_LOCAL, 1, name);
+        if (rnd(8) == 0) {
+            /* Unsized, or a local object: never preferred over a sized
+             * global function at the same start
+             */
+            snprintf(name, sizeof(name), "d%d", i);
+            add(addr, rnd(2) ? 0 : 4, STT_OBJECT, STB_LOCAL, 1, name);
+        }
+        if (rnd(16) == 0) {
+            add(addr + 1, 0, STT_OBJECT, STB_GLOBAL, 1, "$d");
+            add(addr + 1, 2, STT_NOTYPE, STB_GLOBAL, 1, "label");
+            add(addr + 2, 2, STT_FUNC, STB_GLOBAL, SHN_UNDEF, "undef");
+            add(addr + 3, 2, STT_FUNC, STB_GLOBAL, 1, "");
+        }
+        addr += 2 + 2 * rnd(32);
+    }
+    /* An unsized last symbol near the top reaches to the end */
+    if (count > 8) {
+        syms[num_syms - 1].value = 0xffffff00;
+        syms[num_syms - 1].size  = 0;
+    }
+}
+
+
+/* Writes syms out as the .symtab of an image with no segments.
+ */
+static int write_firmware(const char *fn)
+{
+    Elf32_Ehdr ehdr;
+    Elf32_Shdr shdr[3];
+    Elf32_Sym  elf_syms[MAX_SYMS + 1];
+    char       str[MAX_SYMS * 16];
+    size_t     str_size = 1;
+    FILE      *f;
+    int        i, ok;
+
+    memset(&ehdr, 0, sizeof(ehdr));
+    memset(shdr, 0, sizeof(shdr));
+    memset(elf_syms, 0, sizeof(elf_syms));
+    str[0] = 0;
+    for (i = 0; i < num_syms; i++) {
+        Elf32_Sym *s = &elf_syms[i + 1];
+        s->st_name  = str_size;
+        s->st_value = syms[i].value;
+        s->st_size  = syms[i].size;
+        s->st_info  = ELF32_ST_INFO(syms[i].bind, syms[i].type);
+        s->st_shndx = syms[i].shndx;
+        strcpy(str + str_size, syms[i].name);
+        str_size += strlen(syms[i].name) + 1;
+    }
+
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS]   = ELFCLASS32;
+    ehdr.e_ident[EI_DATA]    = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type      = ET_EXEC;
+    ehdr.e_machine   = EM_ARM;
+    ehdr.e_version   = EV_CURRENT;
+    ehdr.e_shoff     = sizeof(ehdr);
+    ehdr.e_ehsize    = sizeof(Elf32_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf32_Shdr);
+    ehdr.e_shnum     = 3;
+
+    shdr[1].sh_type    = SHT_SYMTAB;
+    shdr[1].sh_offset  = sizeof(ehdr) + sizeof(shdr);
+    shdr[1].sh_size    = (num_syms + 1) * sizeof(Elf32_Sym);
+    shdr[1].sh_link    = 2;
+    shdr[1].sh_entsize = sizeof(Elf32_Sym);
+    shdr[2].sh_type    = SHT_STRTAB;
+    shdr[2].sh_offset  = shdr[1].sh_offset + shdr[1].sh_size;
+    shdr[2].sh_size    = str_size;
+
+    if ((f = fopen(fn, "wb")) == NULL)
+        return -1;
+    ok = fwrite(&ehdr, sizeof(ehdr), 1, f) == 1 &&
+         fwrite(shdr, sizeof(shdr), 1, f) == 1 &&
+         fwrite(elf_syms, shdr[1].sh_size, 1, f) == 1 &&
+         fwrite(str, str_size, 1, f) == 1;
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+
+/* Returns non-zero if syms[i] is one the index keeps.
+ */
+static int indexed(int i)
+{
+    return (syms[i].type == STT_FUNC || syms[i].type == STT_OBJECT) &&
+           syms[i].shndx != SHN_UNDEF && syms[i].name[0] &&
+           syms[i].name[0] != '$';
+}
+
+
+static uint32_t start_of(int i)
+{
+    return syms[i].type == STT_FUNC ? syms[i].value & ~1u : syms[i].value;
+}
+
+
+/* Returns non-zero if syms[i] is preferred to syms[j] at the same start:
+ * sized, then global, then a function, then the first in the table.
+ */
+static int preferred(int i, int j)
+{
+    if (!syms[i].size != !syms[j].size)
+        return syms[i].size != 0;
+    if ((syms[i].bind == STB_GLOBAL) != (syms[j].bind == STB_GLOBAL))
+        return syms[i].bind == STB_GLOBAL;
+    if (syms[i].type != syms[j].type)
+        return syms[i].type == STT_FUNC;
+    return i < j;
+}
+
+
+/* Returns the symbol "addr" is in, by looking at all of them, or -1.
+ */
+static int linear_find(uint32_t addr)
+{
+    uint32_t end = UINT32_MAX;
+    int      best = -1, i;
+
+    for (i = 0; i < num_syms; i++) {
+        if (!indexed(i) || start_of(i) > addr)
+            continue;
+        if (best < 0 || start_of(i) > start_of(best) ||
+            (start_of(i) == start_of(best) && preferred(i, best)))
+            best = i;
+    }
+    if (best < 0)
+        return -1;
+    if (syms[best].size)
+        end = start_of(best) + syms[best].size;
+    else {
+        for (i = 0; i < num_syms; i++) {
+            if (indexed(i) && start_of(i) > start_of(best) &&
+                start_of(i) < end)
+                end = start_of(i);
+        }
+    }
+    return addr < end ? best : -1;
+}
+
+
+/* Returns non-zero, and says so, if "found" is not the symbol "want" of
+ * syms or, for -1, none.
+ */
+static int compare(const char *what, const SymIndex *idx, uint32_t addr,
+                   uint32_t found, int want)
+{
+    if (want < 0 && found == SYMINDEX_NONE)
+        return 0;
+    if (want >= 0 && found != SYMINDEX_NONE &&
+        strcmp(SymIndexName(idx, found), syms[want].name) == 0 &&
+        SymIndexStart(idx, found) == start_of(want))
+        return 0;
+    printf("%s: 0x%08x is in %s, expected %s\n", what, addr,
+           found == SYMINDEX_NONE ? "none" : SymIndexName(idx, found),
+           want < 0 ? "none" : syms[want].name);
+    return 1;
+}
+
+
+/* Looks up every symbol's edges and random addresses in "idx", one at a
+ * time and in batches, and compares them with the linear scan.
+ */
+static int check_index(const char *what, const SymIndex *idx)
+{
+    static uint32_t addrs[MAX_SYMS * 6 + 256], found[MAX_SYMS * 6 + 256];
+    static int      want[MAX_SYMS * 6 + 256];
+    size_t          n = 0, i, len;
+    int             failed = 0;
+
+    addrs[n++] = 0;
+    addrs[n++] = UINT32_MAX;
+    for (i = 0; i < (size_t)num_syms; i++) {
+        uint32_t start = start_of(i), end = start + syms[i].size;
+        addrs[n++] = start - 1;
+        addrs[n++] = start;
+        addrs[n++] = start + 1;
+        addrs[n++] = end - 1;
+        addrs[n++] = end;
+        addrs[n++] = end + 1;
+    }
+    for (i = 0; i < 254; i++)
+        addrs[n++] = i < 127 ? 0x100 + rnd(0x8000) : rnd(UINT32_MAX);
+
+    for (i = 0; i < n; i++)
+        want[i] = linear_find(addrs[i]);
+
+    for (i = 0; i < n && failed < 10; i++)
+        failed += compare(what, idx, addrs[i], SymIndexFind(idx, addrs[i]),
+                          want[i]);
+
+    /* Whole batches, and every length of the last partial one */
+    for (len = n; len + 8 > n && !failed; len--) {
+        memset(found, 0xa5, sizeof(found));
+        SymIndexFindBatch(idx, addrs, len, found);
+        for (i = 0; i < len && failed < 10; i++)
+            failed += compare(what, idx, addrs[i], found[i], want[i]);
+        if (found[len] != 0xa5a5a5a5) {
+            printf("%s: batch of %zu wrote past its end\n", what, len);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+
+static int check_counts(void)
+{
+    char fn[] = "/tmp/test_symindex.XXXXXX";
+    int  failed = 0, fd, k;
+
+    if ((fd = mkstemp(fn)) < 0 || close(fd) < 0) {
+        perror("test_symindex");
+        return 1;
+    }
+    for (k = 0; k <= 10; k++) {
+        int counts[2] = { (1 << k) - 1, 1 << k }, c;
+        for (c = 0; c < 2; c++) {
+            Firmware *fw;
+            SymIndex *idx;
+            char      what[32];
+            snprintf(what, sizeof(what), "%d symbols", counts[c]);
+            make_syms(counts[c]);
+            if (write_firmware(fn) < 0 || (fw = FirmwareOpen(fn)) == NULL ||
+                (idx = SymIndexBuild(fw)) == NULL) {
+                perror(what);
+                failed++;
+                continue;
+            }
+            failed += check_index(what, idx);
+            SymIndexClose(idx);
+            FirmwareClose(fw);
+        }
+    }
+    unlink(fn);
+    return failed;
+}
+
+
+static uint32_t get32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+
+static void set32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, 4);
+}
+
+
+static int write_file(const char *fn, const uint8_t *buf, size_t len)
+{
+    FILE *f = fopen(fn, "wb");
+    int   ok;
+
+    if (f == NULL)
+        return -1;
+    ok = len == 0 || fwrite(buf, len, 1, f) == 1;
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+
+/* Writes "buf" as the cached index of "key" and returns non-zero if
+ * SymIndexOpenCached() takes it.
+ */
+static int accepted(const char *path, const char *key, const uint8_t *buf,
+                    size_t len)
+{
+    SymIndex *idx;
+
+    if (write_file(path, buf, len) < 0) {
+        perror(path);
+        return 1;
+    }
+    if ((idx = SymIndexOpenCached(key)) == NULL)
+        return 0;
+    SymIndexClose(idx);
+    return 1;
+}
+
+
+static int check_cache(void)
+{
+    char      dir[] = "/tmp/test_symindex.cache.XXXXXX";
+    char      fn[] = "/tmp/test_symindex.XXXXXX";
+    char      key[CACHE_KEY_MAX], path[4096 + 64];
+    uint8_t  *good, *bad;
+    SymIndex *idx;
+    Firmware *fw;
+    FILE     *f;
+    long      size;
+    uint32_t  count, ranks, names, strings, strings_size;
+    int       failed = 0, fd;
+
+    if (mkdtemp(dir) == NULL || (fd = mkstemp(fn)) < 0 || close(fd) < 0 ||
+        setenv("BARE_CORE_CACHE", dir, 1) < 0) {
+        perror("test_symindex");
+        return 1;
+    }
+    make_syms(100);
+    if (write_firmware(fn) < 0 || (fw = FirmwareOpen(fn)) == NULL ||
+        (idx = SymIndexOpen(fw)) == NULL) {
+        perror("test_symindex: cache");
+        return 1;
+    }
+    SymIndexClose(idx);
+    CacheKey(fw, key);
+    snprintf(path, sizeof(path), "%s/%s.symidx", dir, key);
+    if ((idx = SymIndexOpenCached(key)) == NULL) {
+        printf("cache: index not cached as %s\n", path);
+        return 1;
+    }
+    failed += check_index("cached", idx);
+    SymIndexClose(idx);
+
+    if ((f = fopen(path, "rb")) == NULL || fseek(f, 0, SEEK_END) < 0 ||
+        (size = ftell(f)) < H_STRINGS_SIZE + 4 || fseek(f, 0, SEEK_SET) < 0 ||
+        (good = malloc(size)) == NULL || (bad = malloc(size + 4)) == NULL ||
+        fread(good, size, 1, f) != 1) {
+        perror(path);
+        return 1;
+    }
+    fclose(f);
+    count        = get32(good + H_COUNT);
+    ranks        = get32(good + H_RANKS);
+    names        = get32(good + H_NAMES);
+    strings      = get32(good + H_STRINGS);
+    strings_size = get32(good + H_STRINGS_SIZE);
+
+#define CORRUPT(what, len, change) do {                                 \
+        memcpy(bad, good, size);                                        \
+        change;                                                         \
+        if (accepted(path, key, bad, len)) {                            \
+            printf("cache: %s copy was used\n", what);                  \
+            failed++;                                                   \
+        }                                                               \
+    } while (0)
+
+    CORRUPT("empty", 0, (void)0);
+    CORRUPT("truncated header", H_STRINGS_SIZE, (void)0);
+    CORRUPT("truncated by a byte", size - 1, (void)0);
+    CORRUPT("truncated by 64 bytes", size - 64, (void)0);
+    CORRUPT("extended", size + 4, set32(bad + size, 0));
+    CORRUPT("bad magic", size, bad[0] ^= 1);
+    CORRUPT("other build's", size, bad[H_KEY] ^= 1);
+    CORRUPT("wrong size", size, set32(bad + H_SIZE, size + 64));
+    CORRUPT("huge count", size, set32(bad + H_COUNT, 0x40000000));
+    CORRUPT("count past the arrays", size, set32(bad + H_COUNT, size / 4 - 1));
+    CORRUPT("misaligned keys", size, set32(bad + H_KEYS, get32(bad + H_KEYS) + 2));
+    CORRUPT("keys past the end", size, set32(bad + H_KEYS, size - 4));
+    CORRUPT("strings past the end", size, set32(bad + H_STRINGS, size + 4));
+    CORRUPT("strings overrun", size,
+            set32(bad + H_STRINGS_SIZE, size - strings + 1));
+    CORRUPT("unterminated strings", size,
+            bad[strings + strings_size - 1] = 'x');
+    CORRUPT("rank out of range", size,
+            set32(bad + ranks + 4 * (count / 2), count + 1));
+    CORRUPT("name out of range", size,
+            set32(bad + names + 4 * (count - 1), strings_size));
+
+    if (!accepted(path, key, good, size)) {
+        printf("cache: intact copy was not used\n");
+        failed++;
+    }
+    unlink(path);
+    rmdir(dir);
+    unlink(fn);
+    FirmwareClose(fw);
+    free(good);
+    free(bad);
+    return failed;
+}
+
+
+int main(void)
+{
+    int failed = check_counts();
+
+    failed += check_cache();
+    return failed != 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * test_unwind.c
+ *
+ * Unwinds synthetic cores with unwind.c against a small firmware image
+ * that the test writes out. Its exception index table has inline
+ * (personality 0) entries, .ARM.extab entries with personality 1 and with
+ * a generic personality, both with extra opcode words, an EXIDX_CANTUNWIND
+ * entry for the outermost function and entries that cannot be followed.
+ *
+ * The stack of the first core chains through every opcode the unwinder
+ * knows: vsp adjustments both ways, 0xb2 with a two byte uleb, the 0x80
+ * masks with and without pc, 0xb1, vsp from a register and the VFP skips,
+ * and through a basic exception frame padded by bit 9 of the stacked xpsr
+ * and an unpadded one with floating point state. Another pops sp with a
+ * 0x80 mask; the rest end in each UnwindStop reason. Exits non-zero if the pc, sp or flags of a frame, the
+ * number of frames or the stop reason come out wrong.
+ */
+
+#include "corefile.h"
+#include "elfcore.h"
+#include "firmware.h"
+#include "unwind.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FLASH       0x1000u         /* Exception index table              */
+#define EXTAB       0x1200u         /* Entries it points to               */
+#define FLASH_SIZE  0x400u
+#define RAM         0x20000000u
+#define RAM_SIZE    0x2000u
+
+/* Function starts; each runs up to the next one */
+#define F_RESET     0x2000u         /* Outermost, EXIDX_CANTUNWIND        */
+#define F_IRQ_FP    0x2100u         /* Returns to a floating point frame  */
+#define F_IRQ       0x2200u         /* Returns to a basic frame           */
+#define F_GENERIC   0x2300u         /* extab, generic personality         */
+#define F_PR1       0x2400u         /* extab, personality 1               */
+#define F_LEAF      0x2500u         /* Inline: add, pop r4 and lr         */
+#define F_FINISH    0x2600u         /* Inline: finish only                */
+#define F_PR3       0x2700u         /* Inline personality 3, not known    */
+#define F_REFUSE    0x2800u         /* 0x80 0x00                          */
+#define F_BAD_B1    0x2900u         /* 0xb1 with a mask above r3          */
+#define F_VSP_SP    0x2a00u         /* 0x9d: vsp = sp                     */
+#define F_SPARE     0x2b00u         /* 0xb4, spare                        */
+#define F_ULEB      0x2c00u         /* 0xb2 with its uleb cut off         */
+#define F_DOWN      0x2d00u         /* vsp -= 8                           */
+#define F_PSP       0x2e00u         /* Returns to the process stack       */
+#define F_POP_SP    0x2f00u         /* pop {sp, lr}                       */
+
+#define PERSONALITY 0x3ff0u         /* Of F_GENERIC's extab entry         */
+
+#define EXC_RETURN_MSP_BASIC    0xfffffff9u
+#define EXC_RETURN_PSP_BASIC    0xfffffffdu
+#define EXC_RETURN_MSP_FP       0xffffffe9u
+#define XPSR_STACK_ALIGN        0x200u
+
+static uint32_t flash[FLASH_SIZE / 4];
+static uint32_t ram[RAM_SIZE / 4];
+static int      num_exidx;
+
+
+/* Sets the word at target address "addr" in flash or RAM.
+ */
+static void put(uint32_t addr, uint32_t value)
+{
+    if (addr >= RAM)
+        ram[(addr - RAM) / 4] = value;
+    else
+        flash[(addr - FLASH) / 4] = value;
+}
+
+
+static uint32_t prel31(uint32_t target, uint32_t place)
+{
+    return (target - place) & 0x7fffffff;
+}
+
+
+/* Adds an index entry for the function at "fn"; "data" is the second
+ * word, EXIDX_CANTUNWIND, an inline entry or, with "extab" set, the
+ * address of an .ARM.extab entry.
+ */
+static void exidx(uint32_t fn, uint32_t data, int extab)
+{
+    uint32_t place = FLASH + 8 * num_exidx++;
+
+    put(place, prel31(fn, place));
+    put(place + 4, extab ? prel31(data, place + 4) : data);
+}
+
+
+/* Writes the image: flash as one segment, and the symbols that bound the
+ * index table.
+ */
+static int write_firmware(const char *fn)
+{
+    struct {
+        Elf32_Ehdr ehdr;
+        Elf32_Phdr phdr;
+        Elf32_Shdr shdr[3];
+        Elf32_Sym  sym[3];
+        char       str[32];
+        uint32_t   flash[FLASH_SIZE / 4];
+    } image;
+    FILE *f;
+
+    memset(&image, 0, sizeof(image));
+    memcpy(image.ehdr.e_ident, ELFMAG, SELFMAG);
+    image.ehdr.e_ident[EI_CLASS]   = ELFCLASS32;
+    image.ehdr.e_ident[EI_DATA]    = ELFDATA2LSB;
+    image.ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    image.ehdr.e_type      = ET_EXEC;
+    image.ehdr.e_machine   = EM_ARM;
+    image.ehdr.e_version   = EV_CURRENT;
+    image.ehdr.e_phoff     = offsetof(typeof(image), phdr);
+    image.ehdr.e_shoff     = offsetof(typeof(image), shdr);
+    image.ehdr.e_ehsize    = sizeof(Elf32_Ehdr);
+    image.ehdr.e_phentsize = sizeof(Elf32_Phdr);
+    image.ehdr.e_phnum     = 1;
+    image.ehdr.e_shentsize = sizeof(Elf32_Shdr);
+    image.ehdr.e_shnum     = 3;
+
+    image.phdr.p_type   = PT_LOAD;
+    image.phdr.p_offset = offsetof(typeof(image), flash);
+    image.phdr.p_vaddr  = FLASH;
+    image.phdr.p_paddr  = FLASH;
+    image.phdr.p_filesz = FLASH_SIZE;
+    image.phdr.p_memsz  = FLASH_SIZE;
+    image.phdr.p_flags  = PF_R;
+
+    image.shdr[1].sh_type    = SHT_SYMTAB;
+    image.shdr[1].sh_offset  = offsetof(typeof(image), sym);
+    image.shdr[1].sh_size    = sizeof(image.sym);
+    image.shdr[1].sh_link    = 2;
+    image.shdr[1].sh_entsize = sizeof(Elf32_Sym);
+    image.shdr[2].sh_type    = SHT_STRTAB;
+    image.shdr[2].sh_offset  = offsetof(typeof(image), str);
+    image.shdr[2].sh_size    = sizeof(image.str);
+    strcpy(image.str + 1, "__exidx_start");
+    strcpy(image.str + 15, "__exidx_end");
+    image.sym[1].st_name     = 1;
+    image.sym[1].st_value    = FLASH;
+    image.sym[2].st_name     = 15;
+    image.sym[2].st_value    = FLASH + 8 * num_exidx;
+    memcpy(image.flash, flash, sizeof(flash));
+
+    if ((f = fopen(fn, "wb")) == NULL ||
+        fwrite(&image, sizeof(image), 1, f) != 1 || fclose(f) != 0)
+        return -1;
+    return 0;
+}
+
+
+/* Writes the index table. Entries are added out of order; the linker
+ * sorts them, but the unwinder must not rely on it.
+ */
+static void build_tables(void)
+{
+    exidx(F_LEAF,    0x8002a8b0, 0);    /* vsp += 12, pop {r4, lr}     */
+    exidx(F_RESET,   1, 0);             /* EXIDX_CANTUNWIND            */
+    exidx(F_IRQ_FP,  0x80a8b0b0, 0);    /* pop {r4, lr}                */
+    exidx(F_IRQ,     0x80a8b0b0, 0);
+    exidx(F_PSP,     0x80a8b0b0, 0);
+    exidx(F_GENERIC, EXTAB, 1);
+    exidx(F_PR1,     EXTAB + 12, 1);
+    exidx(F_FINISH,  0x80b0b0b0, 0);
+    exidx(F_PR3,     0x83b0b0b0, 0);
+    exidx(F_REFUSE,  0x808000b0, 0);
+    exidx(F_BAD_B1,  0x80b110b0, 0);
+    exidx(F_VSP_SP,  0x809db0b0, 0);
+    exidx(F_SPARE,   0x80b4b0b0, 0);
+    exidx(F_ULEB,    0x80b28080, 0);
+    exidx(F_DOWN,    0x8041b0b0, 0);
+    exidx(F_POP_SP,  0x808600b0, 0);
+
+    /* Generic personality, one extra word: vsp = r7, pop {r0-r3},
+     * pop {r4, pc}
+     */
+    put(EXTAB,      prel31(PERSONALITY, EXTAB));
+    put(EXTAB + 4,  0x0197b10f);
+    put(EXTAB + 8,  0x8801b0b0);
+
+    /* Personality 1, three extra words: vsp += 0x204 + (129 << 2), skip
+     * d0-d3 (0xc9), d0-d1 and the FSTMFDX word (0xb3), d8-d9 and the
+     * word (0xb9), d8-d9 (0xd1), vsp -= 4, pop {r7, lr}
+     */
+    put(EXTAB + 12, 0x8103b281);
+    put(EXTAB + 16, 0x01c903b3);
+    put(EXTAB + 20, 0x01b9d140);
+    put(EXTAB + 24, 0x8408b0b0);
+}
+
+
+typedef struct expect {
+    uint32_t pc, sp, flags;
+} expect;
+
+/* Where each frame of the chain starts, and what it leaves on the stack */
+#define S0      (RAM + 0x100)
+#define S1      (S0 + 20)               /* F_LEAF: 12, r4, lr */
+#define S2      (S1 + 0x464)            /* F_PR1 */
+#define S3      (S2 + 32)               /* F_GENERIC: from r7 = S2 + 8 */
+#define S4      (S3 + 8 + 36)           /* F_IRQ: r4, lr, padded frame */
+#define S5      (S4 + 8 + 32 + 18*4)    /* F_IRQ_FP: r4, lr, FP frame */
+
+/* Fills the stack that the chain from F_LEAF unwinds through.
+ */
+static void build_stack(void)
+{
+    int i;
+
+    memset(ram, 0xee, sizeof(ram));
+    put(S0 + 12, 0x44);                         /* F_LEAF: r4 */
+    put(S0 + 16, F_LEAF | 1);                   /* lr: the call ends F_PR1 */
+
+    put(S1 + 0x45c, S2 + 8);                    /* F_PR1: r7 */
+    put(S1 + 0x460, (F_GENERIC + 0x40) | 1);    /* lr */
+
+    for (i = 0; i < 4; i++)                     /* F_GENERIC: r0-r3 */
+        put(S2 + 8 + 4*i, i);
+    put(S2 + 24, 0x44);                         /* r4 */
+    put(S2 + 28, (F_IRQ + 0x20) | 1);           /* pc */
+
+    put(S3, 0x44);                              /* F_IRQ: r4 */
+    put(S3 + 4, EXC_RETURN_MSP_BASIC);          /* lr */
+    put(S3 + 8 + 20, 0xdead0001);               /* Stacked lr */
+    put(S3 + 8 + 24, F_IRQ_FP + 0x30);          /* Stacked pc */
+    put(S3 + 8 + 28, 0x01000000 | XPSR_STACK_ALIGN);
+
+    put(S4, 0x44);                              /* F_IRQ_FP: r4 */
+    put(S4 + 4, EXC_RETURN_MSP_FP);             /* lr */
+    put(S4 + 8 + 20, (F_RESET + 0x40) | 1);     /* Stacked lr */
+    put(S4 + 8 + 24, F_FINISH + 0x10);          /* Stacked pc */
+    put(S4 + 8 + 28, 0x01000000);
+
+    put(S0 + 0x40, S0 + 0x200);                 /* F_POP_SP: sp */
+    put(S0 + 0x44, (F_RESET + 0x40) | 1);       /* lr */
+}
+
+
+static int write_core(const char *fn)
+{
+    CoreRegion region = {
+        .addr = RAM, .size = RAM_SIZE, .flags = PF_R|PF_W,
+        .buf = (const uint8_t *)ram, .fd = -1, .offset = 0, .priority = 0
+    };
+    Frame    frame;
+    CoreDump dump = { .regions = &region, .num_regions = 1, .frame = &frame };
+
+    memset(&frame, 0, sizeof(frame));
+    return CreateElfCoreDump((char *)fn, &dump, NULL);
+}
+
+
+/* Unwinds from "pc", "sp" and "lr" into at most "max" frames, and
+ * compares the frames and the stop reason with "want".
+ */
+static int check(const char *what, const Unwinder *uw, const CoreFile *cf,
+                 uint32_t pc, uint32_t sp, uint32_t lr, int max,
+                 const expect *want, int num_want, UnwindStop want_stop)
+{
+    UnwindFrame frames[16];
+    UnwindStop  stop;
+    uint32_t    regs[18];
+    int         failed = 0, n, i;
+
+    for (i = 0; i < 18; i++)
+        regs[i] = 0x11111111 * i;
+    regs[13] = sp;
+    regs[14] = lr;
+    regs[15] = pc;
+    n = Unwind(uw, cf, regs, frames, max, &stop);
+    if (n != num_want || stop != want_stop) {
+        printf("%s: %d frames, %s; expected %d, %s\n", what, n,
+               UnwindStopName(stop), num_want, UnwindStopName(want_stop));
+        failed++;
+    }
+    for (i = 0; i < n && i < num_want; i++) {
+        if (frames[i].pc != want[i].pc || frames[i].sp != want[i].sp ||
+            frames[i].flags != want[i].flags) {
+            printf("%s: frame %d is pc %08x sp %08x flags %x, expected "
+                   "pc %08x sp %08x flags %x\n", what, i, frames[i].pc,
+                   frames[i].sp, frames[i].flags, want[i].pc, want[i].sp,
+                   want[i].flags);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+
+/* Entries whose opcodes the unwinder must refuse */
+static const struct {
+    const char *what;
+    uint32_t    fn;
+} bad_entries[] = {
+    { "personality 3",    F_PR3 },
+    { "refuse to unwind", F_REFUSE },
+    { "0xb1 above r3",    F_BAD_B1 },
+    { "vsp from sp",      F_VSP_SP },
+    { "spare opcode",     F_SPARE },
+    { "uleb cut off",     F_ULEB },
+};
+
+
+static int run(const Unwinder *uw, const CoreFile *cf)
+{
+    static const expect chain[] = {
+        { F_LEAF + 0x11,         S0, 0 },
+        { F_LEAF | 1,            S1, 0 },
+        { (F_GENERIC + 0x40) | 1, S2, 0 },
+        { (F_IRQ + 0x20) | 1,    S3, 0 },
+        { F_IRQ_FP + 0x30,       S4, UNWIND_EXCEPTION },
+        { F_FINISH + 0x10,       S5, UNWIND_EXCEPTION },
+        { (F_RESET + 0x40) | 1,  S5, 0 },
+    };
+    static const expect pop_sp[] = {
+        { F_POP_SP | 1,          S0 + 0x40, 0 },
+        { (F_RESET + 0x40) | 1,  S0 + 0x200, 0 },
+    };
+    char      fn[] = "/tmp/test_unwind.psp.XXXXXX";
+    CoreFile *psp;
+    expect    bad = { 0, S0, 0 };
+    int       failed = 0, fd;
+    unsigned  i;
+
+    failed += check("chain", uw, cf, F_LEAF + 0x11, S0, 0, 16, chain, 7,
+                    UNWIND_END);
+    failed += check("depth", uw, cf, F_LEAF + 0x11, S0, 0, 3, chain, 3,
+                    UNWIND_DEPTH);
+    failed += check("pc zero", uw, cf, 0, S0, 0, 16, NULL, 0, UNWIND_END);
+    failed += check("sp popped", uw, cf, F_POP_SP | 1, S0 + 0x40, 0, 16,
+                    pop_sp, 2, UNWIND_END);
+
+    bad.pc = 0x1801;
+    failed += check("no entry", uw, cf, bad.pc, S0, 0, 16, &bad, 1,
+                    UNWIND_NO_ENTRY);
+    bad.pc = F_LEAF + 0x11;
+    bad.sp = RAM + RAM_SIZE - 16;
+    failed += check("stack past the core", uw, cf, bad.pc, bad.sp, 0, 16,
+                    &bad, 1, UNWIND_MEMORY);
+    bad.sp = S0;
+
+    for (i = 0; i < sizeof(bad_entries)/sizeof(*bad_entries); i++) {
+        bad.pc = bad_entries[i].fn | 1;
+        failed += check(bad_entries[i].what, uw, cf, bad.pc, S0, 0, 16,
+                        &bad, 1, UNWIND_BAD_ENTRY);
+    }
+
+    bad.pc = F_DOWN | 1;
+    failed += check("vsp goes down", uw, cf, bad.pc, S0, 0, 16, &bad, 1,
+                    UNWIND_LOOP);
+    bad.pc = (F_FINISH + 0x10) | 1;
+    failed += check("returns to itself", uw, cf, bad.pc, S0, bad.pc, 16,
+                    &bad, 1, UNWIND_LOOP);
+
+    /* A core in which the pop in F_PSP leaves EXC_RETURN_PSP_BASIC in lr */
+    put(S0 + 4, EXC_RETURN_PSP_BASIC);
+    if ((fd = mkstemp(fn)) < 0 || close(fd) < 0 || write_core(fn) < 0 ||
+        (psp = CoreFileOpen(fn)) == NULL) {
+        perror("test_unwind: core");
+        return failed + 1;
+    }
+    bad.pc = F_PSP | 1;
+    failed += check("process stack", uw, psp, bad.pc, S0, 0, 16, &bad, 1,
+                    UNWIND_MEMORY);
+    CoreFileClose(psp);
+    unlink(fn);
+    return failed;
+}
+
+
+int main(void)
+{
+    char      fw_fn[] = "/tmp/test_unwind.fw.XXXXXX";
+    char      core_fn[] = "/tmp/test_unwind.core.XXXXXX";
+    Firmware *fw;
+    Unwinder *uw;
+    CoreFile *cf;
+    int       failed, fd;
+
+    build_tables();
+    build_stack();
+    if ((fd = mkstemp(fw_fn)) < 0 || close(fd) < 0 ||
+        write_firmware(fw_fn) < 0 || (fw = FirmwareOpen(fw_fn)) == NULL ||
+        (uw = UnwinderCreate(fw)) == NULL) {
+        perror("test_unwind: firmware");
+        return 1;
+    }
+    if ((fd = mkstemp(core_fn)) < 0 || close(fd) < 0 ||
+        write_core(core_fn) < 0 || (cf = CoreFileOpen(core_fn)) == NULL) {
+        perror("test_unwind: core");
+        return 1;
+    }
+    failed = run(uw, cf);
+
+    CoreFileClose(cf);
+    UnwinderDestroy(uw);
+    FirmwareClose(fw);
+    unlink(core_fn);
+    unlink(fw_fn);
+    return failed != 0;
+}
@@ -0,0 +1,492 @@
+/* Stack unwinding of cores by the firmware's ARM exception index tables.
+ *
+ * The firmware is built with -funwind-tables, so every function has an
+ * entry in .ARM.exidx (between __exidx_start and __exidx_end) whose
+ * opcodes, inline or in .ARM.extab, undo its prologue; see the Exception
+ * Handling ABI for the ARM Architecture (EHABI), section 10. The entries
+ * are decoded once, when the Unwinder is created, into a sorted array of
+ * function starts and a pool of opcode bytes, so that unwinding a core
+ * only searches that array and reads the core's stack. An exception
+ * return value in lr continues the unwind through the frame the Cortex-M
+ * pushed on exception entry.
+ *
+ * The decoded tables are stored in the cache (see cache.c) as one block, a
+ * header, the entries and the pool, in host byte order, and later used by
+ * mapping it; a core then needs only its build-id to be unwound.
+ */
+
+#include "unwind.h"
+#include "cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXIDX_CANTUNWIND 1
+
+#define MAGIC "BCUNWND1"
+#define KIND  "unwind"          /* Of its cache files */
+
+/* Entries without opcodes: the outermost frame, and formats not known */
+#define CANT_UNWIND UINT32_MAX
+#define UNKNOWN     (UINT32_MAX - 1)
+
+typedef struct entry {
+  uint32_t fn;                  /* Function start, Thumb bit clear */
+  uint32_t ops;                 /* Offset of its opcodes in the pool */
+  uint32_t num_ops;
+} entry;
+
+struct Unwinder {
+  entry      *entries;
+  int         num_entries;
+  uint8_t    *pool;
+  size_t      pool_size;
+  const void *mapped;           /* Cache file holding both, if not malloc'd */
+  size_t      mapped_size;
+};
+
+/* A cached Unwinder: this, the entries, then the pool */
+typedef struct header {
+  char     magic[8];
+  char     key[CACHE_KEY_MAX];  /* Of the build, see cache.h */
+  uint32_t num_entries;
+  uint64_t pool_size;
+} header;
+
+#define ENTRIES_OFFSET ((sizeof(header) + 7) & ~(size_t)7)
+
+
+static uint32_t get32(const uint8_t *b) {
+  return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static int read32(const Firmware *fw, uint32_t addr, uint32_t *word) {
+  uint8_t b[4];
+
+  if (FirmwareRead(fw, addr, b, 4) < 0)
+    return -1;
+  *word = get32(b);
+  return 0;
+}
+
+/* Address of the target of the 31-bit place-relative offset at "place" */
+static uint32_t prel31(uint32_t place, uint32_t word) {
+  return place + (uint32_t)((int32_t)(word << 1) >> 1);
+}
+
+static int pool_add(Unwinder *uw, const uint8_t *ops, size_t n) {
+  uint8_t *pool = realloc(uw->pool, uw->pool_size + n);
+
+  if (!pool)
+    return -1;
+  memcpy(pool + uw->pool_size, ops, n);
+  uw->pool = pool;
+  uw->pool_size += n;
+  return 0;
+}
+
+/* Appends the opcodes of the .ARM.extab entry at "addr" to the pool. Only
+ * the compact personalities, and generic ones whose data starts like
+ * theirs (as GCC's __gxx_personality_v0 does), are understood; -1 means
+ * the entry is in another format.
+ */
+static int decode_extab(Unwinder *uw, const Firmware *fw, uint32_t addr) {
+  uint8_t  ops[3 + 4 * 255];
+  uint32_t word;
+  int      n, words, i;
+
+  if (read32(fw, addr, &word) < 0)
+    return -1;
+  if (!(word & 0x80000000)) {
+    addr += 4;
+    if (read32(fw, addr, &word) < 0)
+      return -1;
+    words = word >> 24;
+    n = 3;
+  } else if ((word >> 24 & 0x7f) == 0) {
+    words = 0;
+    n = 3;
+  } else if ((word >> 24 & 0x7f) <= 2) {
+    words = word >> 16 & 0xff;
+    n = 2;
+  } else {
+    return -1;
+  }
+  for (i = 0; i < n; i++)
+    ops[i] = word >> (n - 1 - i) * 8;
+  for (i = 0; i < words; i++) {
+    addr += 4;
+    if (read32(fw, addr, &word) < 0)
+      return -1;
+    ops[n++] = word >> 24;
+    ops[n++] = word >> 16;
+    ops[n++] = word >> 8;
+    ops[n++] = word;
+  }
+  return pool_add(uw, ops, n) < 0 ? -1 : n;
+}
+
+static int cmp_entry(const void *a, const void *b) {
+  uint32_t x = ((const entry *)a)->fn, y = ((const entry *)b)->fn;
+  return x < y ? -1 : x > y;
+}
+
+/* Decodes the exception index table of "fw". Returns NULL with errno set
+ * on failure, ENOENT if the image has no table.
+ */
+Unwinder *UnwinderCreate(const Firmware *fw) {
+  uint64_t  start, end;
+  Unwinder *uw;
+  uint32_t  addr;
+
+  if (FirmwareSymbol(fw, "__exidx_start", &start) < 0 ||
+      FirmwareSymbol(fw, "__exidx_end", &end) < 0 || end <= start) {
+    errno = ENOENT;
+    return NULL;
+  }
+  if (!(uw = calloc(1, sizeof(Unwinder))) ||
+      !(uw->entries = malloc((end - start) / 8 * sizeof(entry)))) {
+    free(uw);
+    errno = ENOMEM;
+    return NULL;
+  }
+  for (addr = start; addr + 8 <= end; addr += 8) {
+    entry   *e = &uw->entries[uw->num_entries];
+    uint8_t  ops[3];
+    uint32_t fn, data;
+    int      n;
+    if (read32(fw, addr, &fn) < 0 || read32(fw, addr + 4, &data) < 0)
+      goto bad;
+    e->fn  = prel31(addr, fn) & ~1u;
+    e->ops = uw->pool_size;
+    if (data == EXIDX_CANTUNWIND) {
+      e->ops = CANT_UNWIND;
+      n = 0;
+    } else if (data & 0x80000000) {
+      ops[0] = data >> 16;
+      ops[1] = data >> 8;
+      ops[2] = data;
+      n = (data >> 24 & 0x7f) == 0 && pool_add(uw, ops, 3) == 0 ? 3 : -1;
+    } else {
+      n = decode_extab(uw, fw, prel31(addr + 4, data));
+    }
+    if (n < 0) {
+      e->ops = UNKNOWN;
+      n = 0;
+    }
+    e->num_ops = n;
+    uw->num_entries++;
+  }
+  /* The linker sorts the table; objects linked without it may not be */
+  qsort(uw->entries, uw->num_entries, sizeof(entry), cmp_entry);
+  return uw;
+
+bad:
+  UnwinderDestroy(uw);
+  errno = ENOEXEC;
+  return NULL;
+}
+
+/* Stores "uw" in the cache as the tables of the build "key" */
+static int store(const Unwinder *uw, const char *key) {
+  size_t   entries_size = uw->num_entries * sizeof(entry);
+  size_t   size = ENTRIES_OFFSET + entries_size + uw->pool_size;
+  uint8_t *block;
+  header   h;
+  int      ret;
+
+  if (!(block = calloc(1, size)))
+    return -1;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, sizeof(h.magic));
+  snprintf(h.key, sizeof(h.key), "%s", key);
+  h.num_entries = uw->num_entries;
+  h.pool_size   = uw->pool_size;
+  memcpy(block, &h, sizeof(h));
+  memcpy(block + ENTRIES_OFFSET, uw->entries, entries_size);
+  memcpy(block + ENTRIES_OFFSET + entries_size, uw->pool, uw->pool_size);
+  ret = CacheStore(key, KIND, block, size);
+  free(block);
+  return ret;
+}
+
+/* Returns non-zero if the "size" bytes at "base" are well formed tables of
+ * the build "key", whose opcodes are all in the pool.
+ */
+static int valid(const uint8_t *base, size_t size, const char *key) {
+  const header *h = (const header *)base;
+  const entry  *e = (const entry *)(base + ENTRIES_OFFSET);
+  uint32_t      i;
+
+  if (size < ENTRIES_OFFSET || memcmp(h->magic, MAGIC, sizeof(h->magic)) ||
+      strncmp(h->key, key, sizeof(h->key)) ||
+      h->num_entries > (size - ENTRIES_OFFSET) / sizeof(entry) ||
+      ENTRIES_OFFSET + h->num_entries * sizeof(entry) + h->pool_size != size)
+    return 0;
+  for (i = 0; i < h->num_entries; i++) {
+    if (e[i].ops != CANT_UNWIND && e[i].ops != UNKNOWN &&
+        (e[i].ops > h->pool_size || e[i].num_ops > h->pool_size - e[i].ops))
+      return 0;
+    if (i && e[i].fn < e[i - 1].fn)
+      return 0;
+  }
+  return 1;
+}
+
+/* Returns the cached tables of the build "key", or NULL with errno set to
+ * ENOENT if they are not cached.
+ */
+Unwinder *UnwinderOpenCached(const char *key) {
+  const uint8_t *base;
+  Unwinder      *uw;
+  size_t         size;
+
+  if (!(base = CacheMap(key, KIND, &size)))
+    return NULL;
+  if (!valid(base, size, key) || !(uw = calloc(1, sizeof(Unwinder)))) {
+    CacheUnmap(base, size);
+    errno = ENOENT;
+    return NULL;
+  }
+  uw->mapped      = base;
+  uw->mapped_size = size;
+  uw->num_entries = ((const header *)base)->num_entries;
+  uw->pool_size   = ((const header *)base)->pool_size;
+  uw->entries     = (entry *)(base + ENTRIES_OFFSET);
+  uw->pool        = (uint8_t *)(base + ENTRIES_OFFSET +
+                                uw->num_entries * sizeof(entry));
+  return uw;
+}
+
+/* Returns the tables of "fw" from the cache, or else decodes them and
+ * stores them there. A cache that cannot be read or written only costs
+ * the decoding.
+ */
+Unwinder *UnwinderOpen(const Firmware *fw) {
+  char      key[CACHE_KEY_MAX];
+  Unwinder *uw;
+
+  CacheKey(fw, key);
+  if ((uw = UnwinderOpenCached(key)))
+    return uw;
+  if ((uw = UnwinderCreate(fw)))
+    store(uw, key);
+  return uw;
+}
+
+void UnwinderDestroy(Unwinder *uw) {
+  if (!uw)
+    return;
+  if (uw->mapped) {
+    CacheUnmap(uw->mapped, uw->mapped_size);
+  } else {
+    free(uw->entries);
+    free(uw->pool);
+  }
+  free(uw);
+}
+
+/* Returns the entry of the function "addr" is in, or NULL if it is
+ * before the first one. Entries cover up to the next function.
+ */
+static const entry *find_entry(const Unwinder *uw, uint32_t addr) {
+  int lo = 0, hi = uw->num_entries;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (uw->entries[mid].fn <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo ? &uw->entries[lo - 1] : NULL;
+}
+
+/* Pops the registers set in "mask" from the stack at "*vsp", lowest
+ * first.
+ */
+static int pop(const CoreFile *cf, uint32_t *r, uint32_t *vsp, unsigned mask) {
+  const uint8_t *mem;
+  int            i, n = __builtin_popcount(mask);
+
+  if (!(mem = CoreFileMemory(cf, *vsp, 4 * n)))
+    return -1;
+  for (i = 0; i < 16; i++) {
+    if (mask & 1u << i) {
+      r[i] = get32(mem);
+      mem += 4;
+    }
+  }
+  *vsp = mask & 1u << 13 ? r[13] : *vsp + 4 * n;
+  return 0;
+}
+
+/* Runs the unwind opcodes of "e" on "r". Returns 0, or UNWIND_MEMORY or
+ * UNWIND_BAD_ENTRY. r15 is set from r14 unless the opcodes pop it.
+ */
+static int execute(const Unwinder *uw, const entry *e, const CoreFile *cf,
+                   uint32_t *r) {
+  const uint8_t *op = uw->pool + e->ops, *end = op + e->num_ops;
+  uint32_t       vsp = r[13];
+  int            pc_set = 0;
+
+  if (e->ops == UNKNOWN)
+    return UNWIND_BAD_ENTRY;
+  while (op < end) {
+    uint8_t  b = *op++;
+    unsigned mask;
+    if ((b & 0xc0) == 0x00) {
+      vsp += ((b & 0x3f) << 2) + 4;
+    } else if ((b & 0xc0) == 0x40) {
+      vsp -= ((b & 0x3f) << 2) + 4;
+    } else if ((b & 0xf0) == 0x80) {
+      if (op == end)
+        return UNWIND_BAD_ENTRY;
+      mask = ((b & 0x0f) << 8 | *op++) << 4;
+      if (!mask)
+        return UNWIND_BAD_ENTRY;        /* Refuse to unwind */
+      if (pop(cf, r, &vsp, mask) < 0)
+        return UNWIND_MEMORY;
+      pc_set |= mask & 1u << 15;
+    } else if ((b & 0xf0) == 0x90) {
+      if ((b & 0x0f) == 13 || (b & 0x0f) == 15)
+        return UNWIND_BAD_ENTRY;
+      vsp = r[b & 0x0f];
+    } else if ((b & 0xf0) == 0xa0) {
+      mask = ((2u << (b & 7)) - 1) << 4;
+      if (b & 0x08)
+        mask |= 1u << 14;
+      if (pop(cf, r, &vsp, mask) < 0)
+        return UNWIND_MEMORY;
+    } else if (b == 0xb0) {
+      break;
+    } else if (b == 0xb1) {
+      if (op == end || !*op || *op & 0xf0)
+        return UNWIND_BAD_ENTRY;
+      if (pop(cf, r, &vsp, *op++) < 0)
+        return UNWIND_MEMORY;
+    } else if (b == 0xb2) {
+      uint32_t uleb = 0;
+      int      shift = 0;
+      do {
+        if (op == end || shift > 28)
+          return UNWIND_BAD_ENTRY;
+        uleb |= (uint32_t)(*op & 0x7f) << shift;
+        shift += 7;
+      } while (*op++ & 0x80);
+      vsp += 0x204 + (uleb << 2);
+    } else if (b == 0xb3 || b == 0xc8 || b == 0xc9) {
+      /* VFP registers: skip them, FSTMFDX adds a format word */
+      if (op == end)
+        return UNWIND_BAD_ENTRY;
+      vsp += ((*op++ & 0x0f) + 1) * 8 + (b == 0xb3 ? 4 : 0);
+    } else if ((b & 0xf8) == 0xb8 || (b & 0xf8) == 0xd0) {
+      vsp += ((b & 7) + 1) * 8 + ((b & 0xf8) == 0xb8 ? 4 : 0);
+    } else {
+      return UNWIND_BAD_ENTRY;          /* iWMMXt or spare */
+    }
+  }
+  r[13] = vsp;
+  if (!pc_set)
+    r[15] = r[14];
+  return 0;
+}
+
+/* Replaces "r" by the registers the Cortex-M stacked on the exception
+ * entry that "exc_return" returns from: r0-r3, r12, lr, pc and xpsr, the
+ * FP context unless bit 4 is set, and a padding word if bit 9 of the
+ * stacked xpsr says the stack was aligned. Frames stacked on the process
+ * stack (bit 2) cannot be found, as the core has only the main sp.
+ */
+static int exception_frame(const CoreFile *cf, uint32_t *r,
+                           uint32_t exc_return) {
+  const uint8_t *mem;
+  uint32_t       sp = r[13], size;
+
+  if (exc_return & 4 || !(mem = CoreFileMemory(cf, sp, 32)))
+    return -1;
+  r[0]  = get32(mem);
+  r[1]  = get32(mem + 4);
+  r[2]  = get32(mem + 8);
+  r[3]  = get32(mem + 12);
+  r[12] = get32(mem + 16);
+  r[14] = get32(mem + 20);
+  r[15] = get32(mem + 24);
+  r[16] = get32(mem + 28);
+  size  = exc_return & 0x10 ? 32 : 32 + 18 * 4;
+  if (r[16] & 0x200)
+    size += 4;
+  r[13] = sp + size;
+  return 0;
+}
+
+/* Unwinds the stack of "cf" from the registers "regs" (r0-r15, cpsr, as
+ * in a prstatus) into up to "max_frames" frames, innermost first, and
+ * returns how many. "stop" is set to why there are no more.
+ */
+int Unwind(const Unwinder *uw, const CoreFile *cf, const uint32_t regs[18],
+           UnwindFrame *frames, int max_frames, UnwindStop *stop) {
+  uint32_t r[18], flags = 0;
+  int      n = 0, exact = 1;
+
+  memcpy(r, regs, sizeof(r));
+  *stop = UNWIND_DEPTH;
+  while (n < max_frames) {
+    const entry *e;
+    uint32_t     addr = r[15] & ~1u, sp = r[13];
+    int          err;
+    if (!addr) {
+      *stop = UNWIND_END;
+      break;
+    }
+    frames[n].pc    = r[15];
+    frames[n].sp    = sp;
+    frames[n].flags = flags;
+    n++;
+    /* A return address is just past the call, which may end the function */
+    if (!exact)
+      addr -= 2;
+    if (!(e = find_entry(uw, addr))) {
+      *stop = UNWIND_NO_ENTRY;
+      break;
+    }
+    if (e->ops == CANT_UNWIND) {
+      *stop = UNWIND_END;
+      break;
+    }
+    if ((err = execute(uw, e, cf, r))) {
+      *stop = err;
+      break;
+    }
+    exact = 0;
+    flags = 0;
+    if ((r[15] & 0xffffff00) == 0xffffff00) {
+      if (exception_frame(cf, r, r[15]) < 0) {
+        *stop = UNWIND_MEMORY;
+        break;
+      }
+      exact = 1;
+      flags = UNWIND_EXCEPTION;
+    }
+    if (r[13] < sp ||
+        (r[13] == sp && (r[15] & ~1u) == (frames[n - 1].pc & ~1u))) {
+      *stop = UNWIND_LOOP;
+      break;
+    }
+  }
+  return n;
+}
+
+const char *UnwindStopName(UnwindStop stop) {
+  switch (stop) {
+  case UNWIND_END:       return "end of stack";
+  case UNWIND_NO_ENTRY:  return "no unwind entry";
+  case UNWIND_MEMORY:    return "stack not in core";
+  case UNWIND_BAD_ENTRY: return "unwind entry not understood";
+  case UNWIND_LOOP:      return "stack does not grow";
+  case UNWIND_DEPTH:     return "too deep";
+  }
+  return "?";
+}
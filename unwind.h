@@ -0,0 +1,49 @@
+/* Stack unwinding of cores by the firmware's ARM exception index tables.
+ */
+
+#ifndef _UNWIND_H
+#define _UNWIND_H
+
+#include "corefile.h"
+#include "firmware.h"
+
+#include <stdint.h>
+
+
+  /* The unwind tables of one firmware image, decoded; see unwind.c. It is
+   * never modified once created or opened, so any number of threads may
+   * unwind with it at once.
+   */
+  typedef struct Unwinder Unwinder;
+
+  /* One frame of a backtrace. "pc" is where the frame's function was
+   * when the dump was taken, a return address for all but the innermost
+   * frame and those interrupted by an exception.
+   */
+  #define UNWIND_EXCEPTION 1    /* Frame was interrupted by an exception     */
+
+  typedef struct UnwindFrame {
+    uint32_t pc, sp;
+    uint32_t flags;
+  } UnwindFrame;
+
+  /* Why a backtrace ends */
+  typedef enum UnwindStop {
+    UNWIND_END,                 /* Outermost frame, or pc zero               */
+    UNWIND_NO_ENTRY,            /* pc is not in any function with an entry   */
+    UNWIND_MEMORY,              /* Stack the unwind needs is not in the core */
+    UNWIND_BAD_ENTRY,           /* Entry has opcodes that cannot be followed */
+    UNWIND_LOOP,                /* Caller frame is not above its callee      */
+    UNWIND_DEPTH,               /* No room for more frames                   */
+  } UnwindStop;
+
+
+Unwinder *UnwinderCreate(const Firmware *fw);
+Unwinder *UnwinderOpen(const Firmware *fw);
+Unwinder *UnwinderOpenCached(const char *key);
+void UnwinderDestroy(Unwinder *uw);
+int Unwind(const Unwinder *uw, const CoreFile *cf, const uint32_t regs[18],
+           UnwindFrame *frames, int max_frames, UnwindStop *stop);
+const char *UnwindStopName(UnwindStop stop);
+
+#endif /* _UNWIND_H */